@@ -0,0 +1,246 @@
+/*
+   Batch scenario runner for MSP430 emulator
+   Copyright (c) 2014 Chris Eagle
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation; either version 2 of the License, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+   more details.
+
+   You should have received a copy of the GNU General Public License along with
+   this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+   Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/*
+ * Workers claim scenarios one at a time from a shared counter, so a long
+ * run doesn't hold up the short ones queued behind it. Every scenario gets
+ * a fresh Machine over the worker's own 64K of flat memory, and images are
+ * shared through the loader's cache, so scenarios never see each other's
+ * state and each result depends only on its scenario.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+
+#include "cpu.h"
+#include "loader.h"
+#include "hooks.h"
+#include "replay.h"
+#include "runner.h"
+#include "batch.h"
+
+struct BatchShared {
+   const BatchScenario *scenarios;
+   BatchResult *results;
+   unsigned int count;
+   std::atomic<unsigned int> next;
+};
+
+static const char *statusNames[] = {
+   "ok",
+   "can't load image",
+   "can't load session",
+   "bad hook",
+   "out of memory"
+};
+
+const char *batchStatusName(int status) {
+   if (status < 0 || status > BATCH_NO_MEMORY) {
+      return "unknown";
+   }
+   return statusNames[status];
+}
+
+void initBatchScenario(BatchScenario *s) {
+   memset(s, 0, sizeof(BatchScenario));
+   s->format = IMAGE_DETECT;
+   s->bugMode = -1;
+   s->budget = 100000000;
+}
+
+void freeBatchScenario(BatchScenario *s) {
+   free(s->id);
+   free(s->image);
+   free(s->session);
+   free(s->hooks);
+   free(s->inputs);
+   initBatchScenario(s);
+}
+
+bool addBatchInput(BatchScenario *s, const void *data, unsigned int len) {
+   if (len > 0xffff) {
+      return false;
+   }
+   unsigned char *buf = (unsigned char*)realloc(s->inputs, s->inputsLen + len + 2);
+   if (buf == NULL) {
+      return false;
+   }
+   s->inputs = buf;
+   buf += s->inputsLen;
+   buf[0] = len & 0xff;
+   buf[1] = len >> 8;
+   memcpy(buf + 2, data, len);
+   s->inputsLen += len + 2;
+   s->numInputs++;
+   return true;
+}
+
+void freeBatchResult(BatchResult *r) {
+   free(r->console);
+   r->console = NULL;
+   r->consoleLen = 0;
+}
+
+static bool isStop(const BatchScenario *s, unsigned short addr) {
+   for (unsigned int i = 0; i < s->numStops; i++) {
+      if (s->stops[i] == addr) {
+         return true;
+      }
+   }
+   return false;
+}
+
+//put m in the scenario's starting state over mem
+static int startScenario(const BatchScenario *s, Machine *m, unsigned char *mem) {
+   if (s->session) {
+      ReplayLog *log;
+      if (loadReplay(s->session, &log) != REPLAY_OK) {
+         return BATCH_BAD_SESSION;
+      }
+      memcpy(mem, log->initial.mem, MEM_SIZE);
+      m->setFlatMemory(mem);
+      memcpy(&m->cpu, &log->initial.regs, sizeof(Registers));
+      memcpy(&m->aux, &log->initial.aux, sizeof(AuxState));
+      m->bugMode = log->bugMode;
+      for (unsigned int i = 0; i < log->numHooks; i++) {
+         addNativeHook(m, log->hooks[i].addr, log->hooks[i].name, log->hooks[i].flags);
+      }
+      freeReplay(log);
+   }
+   else {
+      const Image *img;
+      if (s->image == NULL || loadImage(s->image, s->format, s->base, &img) != LOAD_OK) {
+         return BATCH_NO_IMAGE;
+      }
+      memcpy(mem, img->mem, MEM_SIZE);
+      unsigned int entry = img->entry;
+      releaseImage(img);
+      m->setFlatMemory(mem);
+      m->resetCpu();
+      if (entry != IMAGE_NO_ENTRY) {
+         m->initProgram(entry & 0xffff);
+      }
+   }
+   for (unsigned int i = 0; i < 16; i++) {
+      if (s->regMask & (1 << i)) {
+         m->cpu.general[i] = s->regs[i];
+      }
+   }
+   if (s->regMask & (1 << PC)) {
+      m->cpu.initial_pc = s->regs[PC];
+   }
+   if (s->bugMode >= 0) {
+      m->bugMode = s->bugMode != 0;
+   }
+   if (s->hooks && !addNativeHooks(m, s->hooks)) {
+      return BATCH_BAD_HOOK;
+   }
+   unsigned int off = 0;
+   while (off + 2 <= s->inputsLen) {
+      unsigned int len = s->inputs[off] | (s->inputs[off + 1] << 8);
+      if (!m->queueInput(s->inputs + off + 2, len)) {
+         return BATCH_NO_MEMORY;
+      }
+      off += len + 2;
+   }
+   return BATCH_OK;
+}
+
+static void runScenario(const BatchScenario *s, BatchResult *r, unsigned char *mem) {
+   memset(r, 0, sizeof(BatchResult));
+   Machine *m = new Machine();
+   m->quietMode = true;
+   r->status = startScenario(s, m, mem);
+   if (r->status != BATCH_OK) {
+      delete m;
+      return;
+   }
+   m->stopReason = STOP_NONE;
+
+   //a loop run in bulk could step over a stop address
+   m->loopIdioms = s->numStops == 0;
+   m->insnLimit = s->budget;
+   r->reason = STOP_BUDGET;
+   while (m->insnCount < s->budget) {
+      m->executeInstruction();
+      if (m->stopReason != STOP_NONE) {
+         r->reason = m->stopReason;
+         break;
+      }
+      if (s->numStops && isStop(s, m->cpu.general[PC])) {
+         r->reason = STOP_TARGET;
+         break;
+      }
+   }
+   r->addr = r->reason == STOP_TARGET ? m->cpu.general[PC] : m->cpu.initial_pc;
+   r->insns = m->insnCount;
+   r->inputsUsed = s->numInputs - m->input.count;
+   for (unsigned int i = 0; i < 16; i++) {
+      r->regs[i] = (unsigned short)m->cpu.general[i];
+   }
+
+   qstring text;
+   m->consoleText(&text);
+   if (text.length()) {
+      r->console = (char*)malloc(text.length());
+      if (r->console == NULL) {
+         r->status = BATCH_NO_MEMORY;
+      }
+      else {
+         memcpy(r->console, text.c_str(), text.length());
+         r->consoleLen = (unsigned int)text.length();
+      }
+   }
+   delete m;
+}
+
+static void batchWorker(void *arg, unsigned int /*slot*/) {
+   BatchShared *sh = (BatchShared*)arg;
+   unsigned char *mem = (unsigned char*)malloc(MEM_SIZE);
+   while (true) {
+      unsigned int i = sh->next.fetch_add(1);
+      if (i >= sh->count) {
+         break;
+      }
+      if (mem == NULL) {
+         memset(&sh->results[i], 0, sizeof(BatchResult));
+         sh->results[i].status = BATCH_NO_MEMORY;
+         continue;
+      }
+      runScenario(&sh->scenarios[i], &sh->results[i], mem);
+   }
+   free(mem);
+}
+
+unsigned int runBatch(const BatchScenario *scenarios, BatchResult *results, unsigned int count,
+                      unsigned int threads) {
+   BatchShared sh;
+   sh.scenarios = scenarios;
+   sh.results = results;
+   sh.count = count;
+   sh.next.store(0);
+
+   unsigned int numWorkers = threads ? threads : hardwareThreads();
+   if (numWorkers > count) {
+      numWorkers = count ? count : 1;
+   }
+   runWorkers(batchWorker, &sh, numWorkers);
+   return numWorkers;
+}
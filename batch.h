@@ -0,0 +1,80 @@
+/*
+   Headers for MSP430 emulator batch runs
+   Copyright (c) 2014 Chris Eagle
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation; either version 2 of the License, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+   more details.
+
+   You should have received a copy of the GNU General Public License along with
+   this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+   Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef __BATCH_H
+#define __BATCH_H
+
+#include "msp430defs.h"
+
+#define BATCH_MAX_STOPS 16
+
+//one independent run: a starting state, its input and when to stop
+struct BatchScenario {
+   char *id;                  //echoed with the result, may be NULL
+   char *image;               //firmware reset through its vector or entry point
+   unsigned int format;       //IMAGE_DETECT and friends
+   unsigned int base;         //load address of a raw image
+   char *session;             //session log whose starting state is used instead, may be NULL
+   unsigned int regMask;      //bit n set when regs[n] replaces the starting value
+   unsigned short regs[16];
+   int bugMode;               //0 or 1, -1 for the global setting
+   char *hooks;               //name@addr list, may be NULL
+   unsigned char *inputs;     //queue entries back to back, each a 2 byte length then its bytes
+   unsigned int inputsLen;
+   unsigned int numInputs;
+   uint64 budget;
+   unsigned int numStops;
+   unsigned short stops[BATCH_MAX_STOPS];
+};
+
+//status codes for a scenario
+enum {
+   BATCH_OK,
+   BATCH_NO_IMAGE,      //image missing, unreadable or malformed
+   BATCH_BAD_SESSION,   //session log missing, unreadable or malformed
+   BATCH_BAD_HOOK,      //unknown function or bad address in hooks
+   BATCH_NO_MEMORY
+};
+
+struct BatchResult {
+   int status;
+   unsigned int reason;       //STOP_BUDGET when out of instructions, STOP_TARGET at a stop address
+   unsigned short addr;       //of the instruction that stopped the run, or the stop address reached
+   uint64 insns;
+   unsigned int inputsUsed;
+   unsigned short regs[16];
+   char *console;             //retained console output, consoleLen bytes
+   unsigned int consoleLen;
+};
+
+void initBatchScenario(BatchScenario *s);
+void freeBatchScenario(BatchScenario *s);
+//append one input entry, false when too long for a getsn call or out of memory
+bool addBatchInput(BatchScenario *s, const void *data, unsigned int len);
+
+const char *batchStatusName(int status);
+
+//run count scenarios on threads workers (0 for one per hardware thread),
+//each on its own flat memory machine. results[i] answers scenarios[i].
+//returns the number of workers used
+unsigned int runBatch(const BatchScenario *scenarios, BatchResult *results, unsigned int count,
+                      unsigned int threads);
+void freeBatchResult(BatchResult *r);
+
+#endif
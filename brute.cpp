@@ -0,0 +1,220 @@
+/*
+   Parallel input brute forcer for MSP430 emulator
+   Copyright (c) 2014 Chris Eagle
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation; either version 2 of the License, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+   more details.
+
+   You should have received a copy of the GNU General Public License along with
+   this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+   Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/*
+ * Candidates are numbered shortest first and workers claim blocks of
+ * numbers from a shared counter. Each candidate is run on the worker's
+ * own Runner from the snapshot at the input syscall, so a try costs the
+ * instructions of the check routine plus the pages it dirtied. The lowest
+ * numbered unlocking candidate is reported.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <atomic>
+
+#include "cpu.h"
+#include "snapshot.h"
+#include "runner.h"
+#include "brute.h"
+
+//candidates claimed by a worker at a time
+#define BRUTE_BLOCK 1024
+
+struct BruteShared {
+   const BruteOptions *opts;
+   const Snapshot *base;
+   unsigned char charset[256];
+   unsigned int numChars;
+   unsigned int prefixLen;
+   unsigned int suffixLen;
+   uint64 lenStart[BRUTE_MAX_INPUT + 2];   //first candidate number of each length
+   uint64 space;
+   time_t start;
+   std::atomic<uint64> next;
+   std::atomic<uint64> found;      //lowest unlocking candidate, space if none
+   std::atomic<uint64> tried;
+};
+
+struct BruteWorker {
+   BruteShared *shared;
+   Runner runner;
+   unsigned char buf[BRUTE_MAX_INPUT];
+};
+
+unsigned int expandCharset(const char *spec, unsigned char *out) {
+   bool seen[256];
+   unsigned int n = 0;
+   memset(seen, 0, sizeof(seen));
+   for (const unsigned char *p = (const unsigned char*)spec; *p; p++) {
+      unsigned int lo = *p;
+      unsigned int hi = lo;
+      if (p[1] == '-' && p[2]) {
+         hi = p[2];
+         p += 2;
+      }
+      for (unsigned int c = lo; c <= hi; c++) {
+         if (!seen[c]) {
+            seen[c] = true;
+            out[n++] = c;
+         }
+      }
+   }
+   return n;
+}
+
+//write candidate number idx into buf, returns its length
+static unsigned int makeCandidate(BruteShared *sh, uint64 idx, unsigned char *buf) {
+   unsigned int len = sh->opts->minLen;
+   while (idx >= sh->lenStart[len + 1]) {
+      len++;
+   }
+   idx -= sh->lenStart[len];
+   if (sh->prefixLen) {
+      memcpy(buf, sh->opts->prefix, sh->prefixLen);
+   }
+   unsigned char *body = buf + sh->prefixLen;
+   for (unsigned int i = len; i > 0; i--) {
+      body[i - 1] = sh->charset[idx % sh->numChars];
+      idx /= sh->numChars;
+   }
+   if (sh->suffixLen) {
+      memcpy(body + len, sh->opts->suffix, sh->suffixLen);
+   }
+   return sh->prefixLen + len + sh->suffixLen;
+}
+
+static void bruteWorker(void *arg, unsigned int slot) {
+   BruteWorker *w = (BruteWorker*)arg + slot;
+   BruteShared *sh = w->shared;
+   const BruteOptions *opts = sh->opts;
+   while (true) {
+      uint64 first = sh->next.fetch_add(BRUTE_BLOCK, std::memory_order_relaxed);
+      if (first >= sh->space || first >= sh->found.load(std::memory_order_relaxed)) {
+         break;
+      }
+      if (opts->seconds && (unsigned int)(time(NULL) - sh->start) >= opts->seconds) {
+         break;
+      }
+      uint64 last = first + BRUTE_BLOCK < sh->space ? first + BRUTE_BLOCK : sh->space;
+      uint64 n;
+      for (n = first; n < last; n++) {
+         unsigned int len = makeCandidate(sh, n, w->buf);
+         if (runInput(&w->runner, w->buf, len, opts->instBudget) == STOP_UNLOCK) {
+            uint64 best = sh->found.load(std::memory_order_relaxed);
+            while (n < best && !sh->found.compare_exchange_weak(best, n, std::memory_order_relaxed)) {
+            }
+            n++;
+            break;
+         }
+      }
+      sh->tried.fetch_add(n - first, std::memory_order_relaxed);
+   }
+}
+
+void initBruteOptions(BruteOptions *opts) {
+   opts->charset = "0-9";
+   opts->minLen = 1;
+   opts->maxLen = 4;
+   opts->prefix = NULL;
+   opts->suffix = NULL;
+   opts->instBudget = 100000;
+   opts->seconds = 0;
+   opts->threads = 0;
+}
+
+int bruteForce(const BruteOptions *opts, BruteStats *stats) {
+   memset(stats, 0, sizeof(BruteStats));
+   BruteShared sh;
+   sh.opts = opts;
+   sh.numChars = expandCharset(opts->charset ? opts->charset : "", sh.charset);
+   sh.prefixLen = opts->prefix ? strlen(opts->prefix) : 0;
+   sh.suffixLen = opts->suffix ? strlen(opts->suffix) : 0;
+   if (sh.numChars == 0 || opts->minLen > opts->maxLen ||
+       sh.prefixLen + opts->maxLen + sh.suffixLen > BRUTE_MAX_INPUT) {
+      return BRUTE_BAD_OPTIONS;
+   }
+
+   //number every candidate, giving up if the space won't fit in 64 bits
+   uint64 total = 0;
+   uint64 count = 1;    //numChars to the power len
+   for (unsigned int len = 0; len <= opts->maxLen; len++) {
+      if (len >= opts->minLen) {
+         sh.lenStart[len] = total;
+         if (total + count < total) {
+            return BRUTE_BAD_OPTIONS;
+         }
+         total += count;
+      }
+      if (len < opts->maxLen) {
+         if (count > ~(uint64)0 / sh.numChars) {
+            return BRUTE_BAD_OPTIONS;
+         }
+         count *= sh.numChars;
+      }
+   }
+   sh.lenStart[opts->maxLen + 1] = total;
+   sh.space = total;
+   stats->space = total;
+
+   Snapshot *base = snapshotAtInput(RUNNER_BOOT_BUDGET);
+   if (base == NULL) {
+      return BRUTE_NO_INPUT;
+   }
+   if (sh.prefixLen + opts->maxLen + sh.suffixLen > inputLimit(base)) {
+      free(base);
+      return BRUTE_BAD_OPTIONS;
+   }
+   sh.base = base;
+   sh.start = time(NULL);
+   sh.next.store(0);
+   sh.found.store(sh.space);
+   sh.tried.store(0);
+
+   unsigned int numWorkers = opts->threads ? opts->threads : hardwareThreads();
+   BruteWorker *workers = new BruteWorker[numWorkers];
+   int result = BRUTE_OK;
+   for (unsigned int i = 0; i < numWorkers; i++) {
+      workers[i].shared = &sh;
+      if (!initRunner(&workers[i].runner, base)) {
+         result = BRUTE_NO_MEMORY;
+      }
+   }
+
+   if (result == BRUTE_OK) {
+      runWorkers(bruteWorker, workers, numWorkers);
+
+      uint64 found = sh.found.load();
+      if (found < sh.space) {
+         stats->found = true;
+         stats->len = makeCandidate(&sh, found, stats->input);
+      }
+      stats->tried = sh.tried.load();
+      stats->seconds = (unsigned int)(time(NULL) - sh.start);
+      stats->threads = numWorkers;
+   }
+
+   for (unsigned int i = 0; i < numWorkers; i++) {
+      freeRunner(&workers[i].runner);
+   }
+   delete [] workers;
+   free(base);
+   return result;
+}
@@ -0,0 +1,64 @@
+/*
+   Headers for MSP430 emulator input brute forcer
+   Copyright (c) 2014 Chris Eagle
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation; either version 2 of the License, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+   more details.
+
+   You should have received a copy of the GNU General Public License along with
+   this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+   Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef __BRUTE_H
+#define __BRUTE_H
+
+#include "msp430defs.h"
+
+//longest candidate, prefix and suffix included
+#define BRUTE_MAX_INPUT 256
+
+struct BruteOptions {
+   const char *charset;       //characters to enumerate, a-z style ranges allowed
+   unsigned int minLen;       //length range of the enumerated part
+   unsigned int maxLen;
+   const char *prefix;        //fixed text around the enumerated part, may be NULL
+   const char *suffix;
+   unsigned int instBudget;   //per candidate instruction limit
+   unsigned int seconds;      //wall clock budget, 0 for none
+   unsigned int threads;      //worker count, 0 for one per hardware thread
+};
+
+struct BruteStats {
+   uint64 tried;
+   uint64 space;              //candidates in the whole search
+   unsigned int seconds;
+   unsigned int threads;
+   bool found;
+   unsigned int len;
+   unsigned char input[BRUTE_MAX_INPUT];   //the unlocking input when found
+};
+
+//status codes returned by bruteForce
+enum {
+   BRUTE_OK,
+   BRUTE_NO_INPUT,      //never reached an input syscall
+   BRUTE_NO_MEMORY,
+   BRUTE_BAD_OPTIONS    //empty charset, bad length range or candidates too long
+};
+
+//expand a-z style ranges into out (256 bytes), a '-' at either end is
+//literal. returns the number of distinct characters
+unsigned int expandCharset(const char *spec, unsigned char *out);
+
+void initBruteOptions(BruteOptions *opts);
+int bruteForce(const BruteOptions *opts, BruteStats *stats);
+
+#endif
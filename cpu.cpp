@@ -17,10 +17,15 @@
    Place, Suite 330, Boston, MA 02111-1307 USA
 */
 
+#include <ctype.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "buffer.h"
 #include "cpu.h"
+#include "snapshot.h"
+#include "replay.h"
 #include "msp430emu_ui.h"
 
 //masks to clear out bytes appropriate to the sizes above
@@ -43,29 +48,53 @@ unsigned int CARRY_BITS[] = {0x00010000, 0x00000100};
 #define COND(x) (((x) >> 10) & 7)
 #define OFFSET(x) (((x) & 0x3ff) * 2)
 
-//The cpu
-Registers cpu;
-
-static qstring console;
 bool breakMode = false;
 
-static unsigned int instStart;
-static unsigned short opcode;   //opcode, first or second byte (if first == 0x0F)
-static unsigned short sreg;
-static unsigned short dreg;
-static unsigned short a_s;
-static unsigned short a_d;
-static unsigned short b_w;
-static unsigned int sourceOp;
-static unsigned int destOp;
+#ifdef __IDP__
+bytevec_t lastInput;
+#endif
 
-void getDest(unsigned short mode, unsigned short reg);
-void getSource(unsigned short mode, unsigned short reg);
-void putDest(unsigned short mode, unsigned short reg, unsigned short val);
+//The cpu
+Machine emu;
+Registers &cpu = emu.cpu;
+
+Machine::Machine() {
+   memset(&cpu, 0, sizeof(cpu));
+   memset(&aux, 0, sizeof(aux));
+   shouldBreak = 1;
+   stopReason = STOP_NONE;
+   quietMode = false;
+   bugMode = ::bugMode;
+   coverageMap = NULL;
+   getsnHook = NULL;
+   cmpLog = NULL;
+   power = NULL;
+   taint = NULL;
+   forkHook = NULL;
+   replay = NULL;
+   user = NULL;
+   memset(&input, 0, sizeof(input));
+   insnCount = 0;
+   loopIdioms = false;
+   insnLimit = ~(uint64)0;
+   clearConsole();
+   offMessage = false;
+   flatMem = NULL;
+   memset(pageDirty, 0, sizeof(pageDirty));
+   numDirty = 0;
+   prevLoc = 0;
+   hashing = false;
+   memHash = 0;
+   memset(hookMap, 0, sizeof(hookMap));
+   numHooks = 0;
+   otherHooks = false;
+   profile = NULL;
+   setSyscallProfile(&microcorruptionProfile);
+}
 
-//flag to tell CPU users that they should probably break because something
-//strange has happened
-unsigned int shouldBreak = 1;
+Machine::~Machine() {
+   free(input.buf);
+}
 
 void setBreakMode(bool newMode) {
    breakMode = newMode;
@@ -145,37 +174,303 @@ int loadState(netnode &f) {
 
 #endif
 
-static bool offMessage = false;
-
-void resetCpu() {
+void Machine::resetCpu() {
    memset(cpu.general, 0, sizeof(cpu.general));
+   memset(&aux, 0, sizeof(aux));
+   if (taint) {
+      clearTaint();
+   }
    pc = readWord(0xfffe);
    //enable interrupts by default per Kris Kaspersky
    sr = 0;
    offMessage = false;
 }
 
-void initProgram(unsigned int entry) {
+void Machine::initProgram(unsigned int entry) {
    pc = entry;
 }
 
 //sign extension functions
 //byte->unsigned short
-unsigned short sebw(unsigned short val) {
+static unsigned short sebw(unsigned short val) {
    short result = (char)val;
    return (unsigned short) result;
 }
 
+void Machine::setFlatMemory(unsigned char *mem) {
+   flatMem = mem;
+   clearDirtyPages();
+   if (hashing) {
+      enableStateHash(true);
+   }
+}
+
+//the contribution of byte val at addr to the memory hash
+static inline uint64 byteKey(unsigned int addr, unsigned int val) {
+   uint64 z = (uint64)((addr << 8) | val) * 0x9E3779B97F4A7C15ULL;
+   z = (z ^ (z >> 29)) * 0xBF58476D1CE4E5B9ULL;
+   return z ^ (z >> 32);
+}
+
+void Machine::enableStateHash(bool on) {
+   hashing = on;
+   memHash = 0;
+   if (on) {
+      for (unsigned int addr = 0; addr < MEM_SIZE; addr++) {
+         memHash ^= byteKey(addr, readByte(addr));
+      }
+   }
+}
+
+uint64 Machine::stateHash() {
+   uint64 h = memHash;
+   for (unsigned int i = 0; i < 16; i++) {
+      h = (h ^ cpu.general[i]) * 0x100000001b3ULL;
+   }
+   return h;
+}
+
+//fold a page about to be overwritten with data into the memory hash
+static void rehashPage(uint64 *hash, unsigned int offset, const unsigned char *cur, const unsigned char *data) {
+   for (unsigned int i = 0; i < MEM_PAGE_SIZE; i++) {
+      if (cur[i] != data[i]) {
+         *hash ^= byteKey(offset + i, cur[i]) ^ byteKey(offset + i, data[i]);
+      }
+   }
+}
+
+void Machine::clearDirtyPages() {
+   for (unsigned int i = 0; i < numDirty; i++) {
+      pageDirty[dirtyList[i]] = 0;
+   }
+   numDirty = 0;
+}
+
+//copy every page written since the last clear back from image
+void Machine::restoreDirtyPages(const unsigned char *image) {
+   for (unsigned int i = 0; i < numDirty; i++) {
+      unsigned int offset = dirtyList[i] << MEM_PAGE_SHIFT;
+      if (hashing) {
+         rehashPage(&memHash, offset, flatMem + offset, image + offset);
+      }
+      memcpy(flatMem + offset, image + offset, MEM_PAGE_SIZE);
+      pageDirty[dirtyList[i]] = 0;
+   }
+   numDirty = 0;
+}
+
+//copy a whole page into flat memory, marking it dirty
+void Machine::loadPage(unsigned int page, const unsigned char *data) {
+   if (!pageDirty[page]) {
+      pageDirty[page] = 1;
+      dirtyList[numDirty++] = page;
+   }
+   if (hashing) {
+      rehashPage(&memHash, page << MEM_PAGE_SHIFT, flatMem + (page << MEM_PAGE_SHIFT), data);
+   }
+   memcpy(flatMem + (page << MEM_PAGE_SHIFT), data, MEM_PAGE_SIZE);
+}
+
+void Machine::resetCoverage() {
+   if (coverageMap) {
+      memset(coverageMap, 0, COVERAGE_MAP_SIZE);
+   }
+   prevLoc = 0;
+}
+
+//record the edge leading to the current pc, indexed by hash of branch
+//target xor hash of previous target
+void Machine::coverEdge() {
+   unsigned int cur = ((pc * 0x9E3779B1) >> 16) & (COVERAGE_MAP_SIZE - 1);
+   coverageMap[cur ^ prevLoc]++;
+   prevLoc = cur >> 1;
+}
+
+//log the operands of the cmp or sub being executed
+void Machine::logCmp() {
+   if (destOp == sourceOp || (cmpLog->sites && !CMPLOG_IS_SITE(cmpLog->sites, instStart))) {
+      return;
+   }
+   if (cmpLog->count) {
+      CmpLogEntry *last = &cmpLog->entries[(cmpLog->count - 1) % CMPLOG_ENTRIES];
+      if (last->site == instStart && last->op1 == destOp && last->op2 == sourceOp) {
+         return;
+      }
+   }
+   if (cmpLog->count < CMPLOG_ENTRIES) {
+      CmpLogEntry *e = &cmpLog->entries[cmpLog->count];
+      e->site = instStart;
+      e->kind = b_w ? CMPLOG_BYTE : CMPLOG_WORD;
+      e->op1 = destOp;
+      e->op2 = sourceOp;
+   }
+   cmpLog->count++;
+}
+
+void Machine::clearTaint() {
+   if (flatMem) {
+      //only written bytes are ever labeled
+      for (unsigned int i = 0; i < numDirty; i++) {
+         memset(taint->mem + (dirtyList[i] << MEM_PAGE_SHIFT), 0, MEM_PAGE_SIZE * sizeof(TaintMask));
+      }
+   }
+   else {
+      memset(taint->mem, 0, sizeof(taint->mem));
+   }
+   memset(taint->regs, 0, sizeof(taint->regs));
+   taint->src = taint->dst = taint->read = taint->write = 0;
+   taint->labeling = false;
+   taint->count = 0;
+}
+
+void Machine::logTaint(unsigned int kind, unsigned short value, unsigned short value2, TaintMask mask) {
+   //once events is full the previous event was never stored, so count them all
+   if (taint->count && taint->count <= TAINT_EVENTS) {
+      TaintEvent *last = &taint->events[taint->count - 1];
+      if (last->site == instStart && last->kind == kind && last->value == value &&
+          last->value2 == value2) {
+         //the same event again, a word written a byte at a time for one
+         last->mask |= mask;
+         return;
+      }
+   }
+   if (taint->count < TAINT_EVENTS) {
+      TaintEvent *e = &taint->events[taint->count];
+      e->site = instStart;
+      e->kind = kind;
+      e->value = value;
+      e->value2 = value2;
+      e->mask = mask;
+   }
+   taint->count++;
+   if (!quietMode) {
+      char offsets[128];
+      formatTaint(mask, offsets, sizeof(offsets));
+      switch (kind) {
+         case TAINT_PC:
+            msg("Input bytes %s control pc (0x%04x) at 0x%04x\n", offsets, value, instStart);
+            break;
+         case TAINT_RET:
+            msg("Input bytes %s overwrite the return address at 0x%04x (0x%04x) at 0x%04x\n",
+                offsets, value, value2, instStart);
+            break;
+         case TAINT_CMP:
+            msg("Input bytes %s reach the comparison of 0x%04x with 0x%04x at 0x%04x\n",
+                offsets, value, value2, instStart);
+            break;
+      }
+   }
+}
+
+//label a byte being written, input bytes during getsn and the labels of
+//the value being stored otherwise
+void Machine::taintWrite(unsigned short addr) {
+   TaintMask label = taint->write;
+   if (taint->labeling) {
+      label = TAINT_BIT((unsigned short)(addr - taint->inputAddr));
+   }
+   taint->mem[addr] = label;
+   if (label) {
+      unsigned int depth = aux.callDepth < CALL_STACK_DEPTH ? aux.callDepth : CALL_STACK_DEPTH;
+      for (unsigned int i = 0; i < depth; i++) {
+         if ((addr & ~1) == aux.callSlots[i]) {
+            logTaint(TAINT_RET, aux.callSlots[i], aux.callStack[i], label);
+            break;
+         }
+      }
+   }
+}
+
+static unsigned int hammingWeight(unsigned int v) {
+   v = v - ((v >> 1) & 0x5555);
+   v = (v & 0x3333) + ((v >> 2) & 0x3333);
+   v = (v + (v >> 4)) & 0x0f0f;
+   return (v + (v >> 8)) & 0x1f;
+}
+
+//add the power drawn moving val over bus to the current instruction
+void Machine::leakValue(unsigned int bus, unsigned short val) {
+   if (power->model == POWER_HD) {
+      leakage += hammingWeight(power->bus[bus] ^ val);
+      power->bus[bus] = val;
+   }
+   else {
+      leakage += hammingWeight(val);
+   }
+}
+
+void Machine::logHsm(const char *str) {
+   if (cmpLog->count < CMPLOG_ENTRIES) {
+      CmpLogEntry *e = &cmpLog->entries[cmpLog->count];
+      unsigned int len = strlen(str);
+      e->site = SYSCALL_ADDR;
+      e->kind = CMPLOG_HSM;
+      e->op1 = len;
+      e->op2 = 0;
+      memcpy(e->str, str, len < CMPLOG_STRING ? len : CMPLOG_STRING);
+   }
+   cmpLog->count++;
+}
+
+void Machine::pushCall(unsigned short ret) {
+   if (aux.callDepth < CALL_STACK_DEPTH) {
+      aux.callStack[aux.callDepth] = ret;
+      //call has already pushed ret
+      aux.callSlots[aux.callDepth] = sp;
+   }
+   aux.callDepth++;
+}
+
+//unwind to the frame returning to target. A return to anywhere else
+//(a smashed return address) leaves the shadow stack alone so that the
+//crash which follows is attributed to the frame it happened in
+void Machine::popCall(unsigned short target) {
+   unsigned int depth = aux.callDepth;
+   if (depth > CALL_STACK_DEPTH) {
+      //too deep to check
+      aux.callDepth--;
+      return;
+   }
+   while (depth) {
+      depth--;
+      if (aux.callStack[depth] == target) {
+         aux.callDepth = depth;
+         return;
+      }
+   }
+}
+
+unsigned int Machine::callStackHash(unsigned int frames) {
+   unsigned int h = 0x811c9dc5;
+   unsigned int depth = aux.callDepth < CALL_STACK_DEPTH ? aux.callDepth : CALL_STACK_DEPTH;
+   for (unsigned int i = 0; i < frames && i < depth; i++) {
+      unsigned short ret = aux.callStack[depth - 1 - i];
+      h = (h ^ (ret & 0xff)) * 0x01000193;
+      h = (h ^ (ret >> 8)) * 0x01000193;
+   }
+   return h;
+}
+
 //return a byte
-unsigned char readByte(unsigned short addr) {
+unsigned char Machine::readByte(unsigned short addr) {
+   if (flatMem) {
+      return flatMem[addr];
+   }
+#ifdef __IDP__
    return get_byte(addr);
+#else
+   return 0;
+#endif
 }
 
 //don't interface to IDA's get_word/long routines so
 //that we can detect stack usage in readByte
-unsigned short readWord(unsigned short addr) {
+unsigned short Machine::readWord(unsigned short addr) {
    if (addr & 1) {
-      msg("Misaligned read from address 0x%04x\n", addr);
+      stopReason = STOP_MISALIGNED_READ;
+      if (!quietMode) {
+         msg("Misaligned read from address 0x%04x\n", addr);
+      }
       return 0;
    }
    else {
@@ -186,20 +481,26 @@ unsigned short readWord(unsigned short addr) {
 }
 
 //all reads from memory should be through this function
-unsigned short readMem(unsigned short addr, unsigned short size) {
+unsigned short Machine::readMem(unsigned short addr, unsigned short size) {
    unsigned short result = 0;
    switch (size) {
       case SIZE_BYTE:
          result = readByte(addr);
+         if (taint) {
+            taint->read = taint->mem[addr];
+         }
          break;
       case SIZE_WORD:
          result = readWord(addr);
+         if (taint) {
+            taint->read = taint->mem[addr] | taint->mem[(unsigned short)(addr + 1)];
+         }
          break;
    }
    return result;
 }
 
-unsigned int readBuffer(unsigned short addr, void *buf, unsigned int nbytes) {
+unsigned int Machine::readBuffer(unsigned short addr, void *buf, unsigned int nbytes) {
 //   int result = 0;
    for (unsigned int i = 0; i < nbytes; i++) {
       ((unsigned char*)buf)[i] = readByte(addr + i);
@@ -208,15 +509,36 @@ unsigned int readBuffer(unsigned short addr, void *buf, unsigned int nbytes) {
 }
 
 //store a byte
-void writeByte(unsigned short addr, unsigned short val) {
-   patch_byte(addr, val);
+void Machine::writeByte(unsigned short addr, unsigned short val) {
+   if (taint) {
+      taintWrite(addr);
+   }
+   if (hashing) {
+      memHash ^= byteKey(addr, readByte(addr)) ^ byteKey(addr, val & 0xff);
+   }
+   unsigned int page = addr >> MEM_PAGE_SHIFT;
+   if (!pageDirty[page]) {
+      pageDirty[page] = 1;
+      dirtyList[numDirty++] = page;
+   }
+   if (flatMem) {
+      flatMem[addr] = (unsigned char)val;
+   }
+#ifdef __IDP__
+   else {
+      patch_byte(addr, val);
+   }
+#endif
 }
 
 //don't interface to IDA's put_word/long routines so
 //that we can detect stack usage in writeByte
-void writeWord(unsigned short addr, unsigned short val) {
+void Machine::writeWord(unsigned short addr, unsigned short val) {
    if (addr & 1) {
-      msg("Misaligned write to address 0x%04x\n", addr);
+      stopReason = STOP_MISALIGNED_WRITE;
+      if (!quietMode) {
+         msg("Misaligned write to address 0x%04x\n", addr);
+      }
    }
    else {
       writeByte(addr, val);
@@ -225,7 +547,10 @@ void writeWord(unsigned short addr, unsigned short val) {
 }
 
 //all writes to memory should be through this function
-void writeMem(unsigned short addr, unsigned short val, unsigned short size) {
+void Machine::writeMem(unsigned short addr, unsigned short val, unsigned short size) {
+   if (power) {
+      leakValue(POWER_BUS_WRITE, val);
+   }
    switch (size) {
       case SIZE_BYTE:
          writeByte(addr, val);
@@ -236,7 +561,7 @@ void writeMem(unsigned short addr, unsigned short val, unsigned short size) {
    }
 }
 
-unsigned int writeBuffer(unsigned short addr, void *buf, unsigned int nbytes) {
+unsigned int Machine::writeBuffer(unsigned short addr, void *buf, unsigned int nbytes) {
 //   int result = 0;
    for (unsigned int i = 0; i < nbytes; i++) {
       writeByte(addr + i, ((unsigned char*)buf)[i]);
@@ -244,19 +569,19 @@ unsigned int writeBuffer(unsigned short addr, void *buf, unsigned int nbytes) {
    return nbytes;
 }
 
-void push(unsigned short val) {
+void Machine::push(unsigned short val) {
    sp -= 2;
    writeMem(sp, val, SIZE_WORD);
 }
 
-unsigned short pop() {
+unsigned short Machine::pop() {
    unsigned short res = readMem(sp, SIZE_WORD);
    sp += 2;
    return res;
 }
 
 //read according to specified n from eip location
-unsigned short fetch() {
+unsigned short Machine::fetch() {
    unsigned short op = readWord(pc);
    pc += 2;
 //   msg(" 0x%04x", op);
@@ -264,7 +589,10 @@ unsigned short fetch() {
 }
 
 //deal with sign, zero, and parity flags
-void setSR(unsigned int val) {
+void Machine::setSR(unsigned int val) {
+   if (taint) {
+      taint->regs[SR] = taint->src | taint->dst;
+   }
    val &= SIZE_MASKS[b_w]; //mask off upper bytes
    if (val) CLEAR(xZF);
    else SET(xZF);
@@ -273,20 +601,20 @@ void setSR(unsigned int val) {
    sr &= 0x1F;
 }
 
-void checkAddOverflow(unsigned int op1, unsigned int op2, unsigned int sum) {
+void Machine::checkAddOverflow(unsigned int op1, unsigned int op2, unsigned int sum) {
    unsigned int mask = SIGN_BITS[b_w];
    if ((op1 & op2 & ~sum & mask) || (~op1 & ~op2 & sum & mask)) SET(xVF);
    else CLEAR(xVF);
 }
 
-void checkSubOverflow(unsigned int op1, unsigned int op2, unsigned int diff) {
+void Machine::checkSubOverflow(unsigned int op1, unsigned int op2, unsigned int diff) {
    unsigned int mask = SIGN_BITS[b_w];
    if ((op1 & ~op2 & ~diff & mask) || (~op1 & op2 & diff & mask)) SET(xVF);
    else CLEAR(xVF);
 }
 
 //handle instructions that begin w/ 0x1n
-int doOne() {
+int Machine::doOne() {
    switch ((opcode >> 6) & 0xf) {
       case 0: case 1: { //rrc rrc.b
          getDest(a_s, dreg);
@@ -349,16 +677,27 @@ int doOne() {
          break;
       case 8: case 9:  //push push.b
          getSource(a_s, dreg);
+         if (taint) {
+            taint->write = taint->src;
+         }
          push(sourceOp);
          break;
       case 10:   //call
          getSource(a_s, dreg);
          push(pc);
+         pushCall(pc);
          pc = sourceOp;
+         if (taint) {
+            taint->regs[PC] = taint->src;
+         }
          break;
       case 12:
          sr = pop();
          pc = pop();
+         popCall(pc);
+         if (taint) {
+            taint->regs[PC] = taint->read;
+         }
          break;
       default:
          return 0;
@@ -367,7 +706,7 @@ int doOne() {
 }
 
 //handle instructions that begin w/ 0x2n
-int doJump(unsigned int cond, unsigned int offset) {
+int Machine::doJump(unsigned int cond, unsigned int offset) {
    unsigned short delta = 0;
    switch (cond) {
       case 0:  // jne/jnz
@@ -399,18 +738,314 @@ int doJump(unsigned int cond, unsigned int offset) {
          delta = offset;
          break;
    }
+   unsigned short next = pc;
    pc += delta;
+   if (forkHook && cond != 7 && offset != 0 && taint && taint->regs[SR]) {
+      forkHook(this, delta ? next : next + offset);
+   }
+   if (loopIdioms && cond == 0 && (delta & 0x8000)) {
+      loopIdiom(pc, instStart);
+   }
    return 1;
 }
 
+/*
+ * Loop idioms. When the jnz closing a loop is taken, the loop body from
+ * its target up to the jnz is matched against a few byte loop shapes:
+ *
+ *    copy      mov.b @rs+, rt / mov.b rt, X(rd) / inc rd / tst.b rt
+ *              mov.b @rs+, X(rd) / inc rd / tst.b X-1(rd)
+ *    strlen    inc rp / tst.b X(rp)
+ *              mov.b @rp+, rt / tst.b rt
+ *    compare   mov.b @ra+, rt / cmp.b @rb+, rt / jnz out / tst.b rt
+ *    fill/copy mov.b src, X(rd) / inc rd / then dec rc, add #-1 rc (either
+ *              optionally followed by tst rc), or cmp re, rd
+ *
+ * where src is a register, a constant or @rs+ and all registers are r4-r15.
+ * Every iteration but the last is done at once on flat memory, leaving pc
+ * at the loop head, and the interpreter runs the last. Each shape's flags
+ * are all rewritten by every iteration from that iteration's data alone
+ * (none of add, cmp and sub differ in bug mode), so the last iteration
+ * leaves exactly the flags the whole loop would have. Loops whose writes
+ * reach their own code, that run off the end of memory, or whose source and
+ * destination overlap in a way a forward byte copy doesn't preserve are
+ * left to the interpreter, as are hooked loops.
+ */
+
+//longest loop body looked at, in words
+#define IDIOM_MAX_WORDS 6
+//loops with fewer iterations to go are not worth it
+#define IDIOM_MIN_ITERS 2
+
+static inline bool idiomReg(unsigned int r) {
+   return r >= 4;
+}
+
+//store n bytes copied from src, or of val when src is NULL, as n writeByte
+//calls would. False without writing when they would reach the loop's code
+bool Machine::idiomStore(unsigned int addr, const unsigned char *src, unsigned int val, unsigned int n,
+                         unsigned short head, unsigned short jump) {
+   if (addr + n > MEM_SIZE || (addr < (unsigned int)jump + 2 && addr + n > head)) {
+      return false;
+   }
+   if (hashing) {
+      for (unsigned int i = 0; i < n; i++) {
+         memHash ^= byteKey(addr + i, flatMem[addr + i]) ^ byteKey(addr + i, src ? src[i] : val & 0xff);
+      }
+   }
+   for (unsigned int page = addr >> MEM_PAGE_SHIFT; n && page <= (addr + n - 1) >> MEM_PAGE_SHIFT; page++) {
+      if (!pageDirty[page]) {
+         pageDirty[page] = 1;
+         dirtyList[numDirty++] = page;
+      }
+   }
+   if (src) {
+      //callers only pass overlapping ranges that a forward copy handles
+      memmove(flatMem + addr, src, n);
+   }
+   else {
+      memset(flatMem + addr, val, n);
+   }
+   return true;
+}
+
+//pc is at head having just taken the jnz at jump. Returns true when the
+//loop's remaining iterations but one have been done
+bool Machine::loopIdiom(unsigned short head, unsigned short jump) {
+   if (flatMem == NULL || coverageMap || power || taint || cmpLog ||
+       head >= jump || jump - head > 2 * IDIOM_MAX_WORDS) {
+      return false;
+   }
+   for (unsigned int a = head; a <= jump; a += 2) {
+      if (hookMap[a >> 3] & (1 << (a & 7))) {
+         return false;
+      }
+   }
+   unsigned short w[IDIOM_MAX_WORDS];
+   unsigned int n = (jump - head) / 2;
+   for (unsigned int i = 0; i < n; i++) {
+      w[i] = flatMem[head + 2 * i] | (flatMem[head + 2 * i + 1] << 8);
+   }
+   unsigned int *r = cpu.general;
+   unsigned int iters = 0;      //iterations done in bulk
+   unsigned int insns = 0;      //instructions per iteration, the jnz included
+
+   if (n == 5 && (w[0] & 0xf0f0) == 0x4070 && (w[1] & 0xf0f0) == 0x40c0 &&
+       ((w[1] >> 8) & 0xf) == (w[0] & 0xf) && w[3] == (0x5310 | (w[1] & 0xf)) &&
+       w[4] == (0x9340 | (w[0] & 0xf))) {
+      //copy through rt
+      unsigned int rs = (w[0] >> 8) & 0xf;
+      unsigned int rt = w[0] & 0xf;
+      unsigned int rd = w[1] & 0xf;
+      if (!idiomReg(rs) || !idiomReg(rt) || !idiomReg(rd) || rs == rt || rs == rd || rt == rd) {
+         return false;
+      }
+      unsigned int s = r[rs] & 0xffff;
+      unsigned int d = (r[rd] + w[2]) & 0xffff;
+      const unsigned char *z = (const unsigned char*)memchr(flatMem + s, 0, MEM_SIZE - s);
+      iters = z ? (unsigned int)(z - (flatMem + s)) : 0;
+      insns = 5;
+      if (iters < IDIOM_MIN_ITERS || insnCount + (uint64)iters * insns > insnLimit ||
+          (d > s && d <= s + iters)) {
+         return false;
+      }
+      unsigned int last = flatMem[s + iters - 1];
+      if (!idiomStore(d, flatMem + s, 0, iters, head, jump)) {
+         return false;
+      }
+      r[rs] = (s + iters) & 0xffff;
+      r[rd] = (r[rd] + iters) & 0xffff;
+      r[rt] = last;
+   }
+   else if (n == 5 && (w[0] & 0xf0f0) == 0x40f0 && w[2] == (0x5310 | (w[0] & 0xf)) &&
+            w[3] == (0x93c0 | (w[0] & 0xf)) && w[4] == ((w[1] - 1) & 0xffff)) {
+      //copy testing the byte stored
+      unsigned int rs = (w[0] >> 8) & 0xf;
+      unsigned int rd = w[0] & 0xf;
+      if (!idiomReg(rs) || !idiomReg(rd) || rs == rd) {
+         return false;
+      }
+      unsigned int s = r[rs] & 0xffff;
+      unsigned int d = (r[rd] + w[1]) & 0xffff;
+      const unsigned char *z = (const unsigned char*)memchr(flatMem + s, 0, MEM_SIZE - s);
+      iters = z ? (unsigned int)(z - (flatMem + s)) : 0;
+      insns = 4;
+      if (iters < IDIOM_MIN_ITERS || insnCount + (uint64)iters * insns > insnLimit ||
+          (d > s && d <= s + iters) || !idiomStore(d, flatMem + s, 0, iters, head, jump)) {
+         return false;
+      }
+      r[rs] = (s + iters) & 0xffff;
+      r[rd] = (r[rd] + iters) & 0xffff;
+   }
+   else if (n == 3 && (w[0] & 0xfff0) == 0x5310 && w[1] == (0x93c0 | (w[0] & 0xf))) {
+      //strlen by index
+      unsigned int rp = w[0] & 0xf;
+      if (!idiomReg(rp)) {
+         return false;
+      }
+      unsigned int a = (r[rp] + w[2] + 1) & 0xffff;
+      const unsigned char *z = (const unsigned char*)memchr(flatMem + a, 0, MEM_SIZE - a);
+      //the iteration finding the zero is the last
+      iters = z ? (unsigned int)(z - (flatMem + a)) : 0;
+      insns = 3;
+      if (iters < IDIOM_MIN_ITERS || insnCount + (uint64)iters * insns > insnLimit) {
+         return false;
+      }
+      r[rp] = (r[rp] + iters) & 0xffff;
+   }
+   else if (n == 2 && (w[0] & 0xf0f0) == 0x4070 && w[1] == (0x9340 | (w[0] & 0xf))) {
+      //strlen by pointer
+      unsigned int rp = (w[0] >> 8) & 0xf;
+      unsigned int rt = w[0] & 0xf;
+      if (!idiomReg(rp) || !idiomReg(rt) || rp == rt) {
+         return false;
+      }
+      unsigned int p = r[rp] & 0xffff;
+      const unsigned char *z = (const unsigned char*)memchr(flatMem + p, 0, MEM_SIZE - p);
+      iters = z ? (unsigned int)(z - (flatMem + p)) : 0;
+      insns = 3;
+      if (iters < IDIOM_MIN_ITERS || insnCount + (uint64)iters * insns > insnLimit) {
+         return false;
+      }
+      r[rt] = flatMem[p + iters - 1];
+      r[rp] = (p + iters) & 0xffff;
+   }
+   else if (n == 4 && (w[0] & 0xf0f0) == 0x4070 && (w[1] & 0xf0f0) == 0x9070 &&
+            (w[1] & 0xf) == (w[0] & 0xf) && (w[2] & 0xfe00) == 0x2000 &&
+            w[3] == (0x9340 | (w[0] & 0xf))) {
+      //compare
+      unsigned int ra = (w[0] >> 8) & 0xf;
+      unsigned int rb = (w[1] >> 8) & 0xf;
+      unsigned int rt = w[0] & 0xf;
+      //the exit must leave the loop forwards
+      if (!idiomReg(ra) || !idiomReg(rb) || !idiomReg(rt) || ra == rb || ra == rt || rb == rt ||
+          head + 6 + OFFSET(w[2]) <= jump) {
+         return false;
+      }
+      unsigned int a = r[ra] & 0xffff;
+      unsigned int b = r[rb] & 0xffff;
+      unsigned int limit = MEM_SIZE - (a > b ? a : b);
+      unsigned int i = 0;
+      while (i < limit && flatMem[a + i] == flatMem[b + i] && flatMem[a + i] != 0) {
+         i++;
+      }
+      iters = i < limit ? i : 0;
+      insns = 5;
+      if (iters < IDIOM_MIN_ITERS || insnCount + (uint64)iters * insns > insnLimit) {
+         return false;
+      }
+      r[rt] = flatMem[a + iters - 1];
+      r[ra] = (a + iters) & 0xffff;
+      r[rb] = (b + iters) & 0xffff;
+   }
+   else if (n >= 4 && (w[0] & 0xf0c0) == 0x40c0) {
+      //fill or counted copy, the store first
+      unsigned int rd = w[0] & 0xf;
+      unsigned int sreg = (w[0] >> 8) & 0xf;
+      unsigned int as = (w[0] >> 4) & 3;
+      unsigned int i = 1;
+      int rs = -1;
+      int rv = -1;
+      unsigned int val = 0;
+      if (sreg == 3) {
+         static const unsigned int cg3[4] = {0, 1, 2, 0xffff};
+         val = cg3[as];
+      }
+      else if (sreg == 2 && as >= 2) {
+         val = as == 2 ? 4 : 8;
+      }
+      else if (sreg == 0 && as == 3) {
+         val = w[i++];
+      }
+      else if (idiomReg(sreg) && as == 0) {
+         rv = sreg;
+      }
+      else if (idiomReg(sreg) && as == 3) {
+         rs = sreg;
+      }
+      else {
+         return false;
+      }
+      unsigned short x = w[i++];
+      if (!idiomReg(rd) || i + 2 > n || w[i++] != (0x5310 | rd)) {
+         return false;
+      }
+      //the step that ends the loop
+      unsigned int rem;
+      int rc = -1;
+      int re = -1;
+      if (i + 1 == n && (w[i] & 0xf0ff) == (0x9000 | rd)) {
+         re = (w[i] >> 8) & 0xf;
+      }
+      else if (i + 1 == n && (w[i] & 0xfff0) == (0x9000 | (rd << 8))) {
+         re = w[i] & 0xf;
+      }
+      else if ((w[i] & 0xfff0) == 0x8310 || (w[i] & 0xfff0) == 0x5330) {
+         rc = w[i] & 0xf;
+         if (i + 1 != n && (i + 2 != n || w[i + 1] != (0x9300 | rc))) {
+            return false;
+         }
+      }
+      else {
+         return false;
+      }
+      if (re >= 0) {
+         if (!idiomReg(re) || re == (int)rd || re == rs) {
+            return false;
+         }
+         rem = (r[re] - r[rd]) & 0xffff;
+      }
+      else {
+         if (!idiomReg(rc) || rc == (int)rd || rc == rs || rc == rv) {
+            return false;
+         }
+         rem = r[rc] & 0xffff;
+      }
+      if (rv == (int)rd || rs == (int)rd) {
+         return false;
+      }
+      //the store, inc, the one word step instructions and the jnz
+      insns = n - i + 3;
+      iters = rem ? rem - 1 : 0;
+      if (iters < IDIOM_MIN_ITERS || insnCount + (uint64)iters * insns > insnLimit) {
+         return false;
+      }
+      unsigned int d = (r[rd] + x) & 0xffff;
+      if (rs >= 0) {
+         unsigned int s = r[rs] & 0xffff;
+         if (s + iters > MEM_SIZE || (d > s && d < s + iters) ||
+             !idiomStore(d, flatMem + s, 0, iters, head, jump)) {
+            return false;
+         }
+         r[rs] = (s + iters) & 0xffff;
+      }
+      else if (!idiomStore(d, NULL, rv >= 0 ? r[rv] : val, iters, head, jump)) {
+         return false;
+      }
+      r[rd] = (r[rd] + iters) & 0xffff;
+      if (rc >= 0) {
+         r[rc] = (r[rc] - iters) & 0xffff;
+      }
+   }
+   else {
+      return false;
+   }
+   insnCount += (uint64)iters * insns;
+   return true;
+}
+
 //handle instructions that begin w/ 0x4n
-int doMove() {  //MOV.B, MOV
+int Machine::doMove() {  //MOV.B, MOV
    putDest(a_d, dreg, sourceOp);
+   if (dreg == PC && sreg == SP && a_s == 3) {
+      //ret
+      popCall(pc);
+   }
    return 1;
 }
 
 //handle instructions that begin w/ 0x6n
-int doAdd(unsigned short carryIn) {  //ADD.B ADD ADDC.B ADDC
+int Machine::doAdd(unsigned short carryIn) {  //ADD.B ADD ADDC.B ADDC
    getDest(a_d, dreg);
    unsigned int res = destOp + sourceOp + carryIn;
    if (res & CARRY_BITS[b_w]) SET(xCF);
@@ -422,8 +1057,14 @@ int doAdd(unsigned short carryIn) {  //ADD.B ADD ADDC.B ADDC
 }
 
 //handle instructions that begin w/ 0x7n
-int doSub(unsigned short carryIn) {   //SUB.B SUB SUBC.B SUBC 
+int Machine::doSub(unsigned short carryIn) {   //SUB.B SUB SUBC.B SUBC 
    getDest(a_d, dreg);
+   if (cmpLog) {
+      logCmp();
+   }
+   if (taint && (taint->src | taint->dst)) {
+      logTaint(TAINT_CMP, destOp, sourceOp, taint->src | taint->dst);
+   }
    unsigned int res = destOp + (0xffff & ~sourceOp) + carryIn;
    if (res & CARRY_BITS[b_w]) SET(xCF);
    else CLEAR(xCF);
@@ -434,8 +1075,14 @@ int doSub(unsigned short carryIn) {   //SUB.B SUB SUBC.B SUBC
 }
 
 //handle instructions that begin w/ 0x9n
-int doCmp() {     //CMP  CMP.B
+int Machine::doCmp() {     //CMP  CMP.B
    getDest(a_d, dreg);
+   if (cmpLog) {
+      logCmp();
+   }
+   if (taint && (taint->src | taint->dst)) {
+      logTaint(TAINT_CMP, destOp, sourceOp, taint->src | taint->dst);
+   }
    unsigned int res = destOp + (0xffff & ~sourceOp) + 1;
    if (res & CARRY_BITS[b_w]) SET(xCF);
    else CLEAR(xCF);
@@ -445,7 +1092,7 @@ int doCmp() {     //CMP  CMP.B
 }
 
 //add low nibble of a and b in MSP430 BCD manner
-unsigned int bcdAddDigit(unsigned int a, unsigned int b, unsigned int c = 0) {
+static unsigned int bcdAddDigit(unsigned int a, unsigned int b, unsigned int c = 0) {
    unsigned int res = (a & 0xf) + (b & 0xf) + (c & 1);  //c is carry
    c = 0;
    if (res > 9) {
@@ -456,7 +1103,7 @@ unsigned int bcdAddDigit(unsigned int a, unsigned int b, unsigned int c = 0) {
 }
 
 //handle instructions that begin w/ 0xAn
-int doDadd() {          //DADD,  DADD.B
+int Machine::doDadd() {          //DADD,  DADD.B
    unsigned int res;
    getDest(a_d, dreg);
    
@@ -491,7 +1138,7 @@ int doDadd() {          //DADD,  DADD.B
 }
 
 //handle instructions that begin w/ 0xBn
-int doBit() {     //BIT.B  BIT
+int Machine::doBit() {     //BIT.B  BIT
    getDest(a_d, dreg);
    unsigned int res = destOp & sourceOp;
    CLEAR(xVF);
@@ -501,7 +1148,7 @@ int doBit() {     //BIT.B  BIT
 }
 
 //handle instructions that begin w/ 0xCn
-int doBic() {    //BIC.B  BIC
+int Machine::doBic() {    //BIC.B  BIC
    getDest(a_d, dreg);
    unsigned int res = destOp & ~sourceOp;
    putDest(a_d, dreg, res);
@@ -509,7 +1156,7 @@ int doBic() {    //BIC.B  BIC
 }
 
 //handle instructions that begin w/ 0xDn
-int doBis() {     //BIS.B   BIS
+int Machine::doBis() {     //BIS.B   BIS
    getDest(a_d, dreg);
    unsigned int res = destOp | sourceOp;
    putDest(a_d, dreg, res);
@@ -517,7 +1164,7 @@ int doBis() {     //BIS.B   BIS
 }
 
 //handle instructions that begin w/ 0xEn
-int doXor() {   // XOR.B   XOR
+int Machine::doXor() {   // XOR.B   XOR
    getDest(a_d, dreg);
    unsigned int res = destOp ^ sourceOp;
    (destOp & sourceOp & SIGN_BITS[b_w]) ? SET(xVF) : CLEAR(xVF);
@@ -528,7 +1175,7 @@ int doXor() {   // XOR.B   XOR
 }
 
 //handle instructions that begin w/ 0xFn
-int doAnd() {    //AND    AND.B
+int Machine::doAnd() {    //AND    AND.B
    getDest(a_d, dreg);
    unsigned int res = destOp & sourceOp;
    CLEAR(xVF);
@@ -543,13 +1190,13 @@ int doAnd() {    //AND    AND.B
  * until a NULL is encountered.  Returned value must be free'd
  */
 
-char *getString(unsigned short addr) {
+char *Machine::getString(unsigned short addr) {
    int size = 16;
    int i = 0;
    unsigned char *str = NULL, ch;
    str = (unsigned char*) malloc(size);
    if (addr) {
-      while ((ch = get_byte(addr++)) != 0) {
+      while ((ch = readByte(addr++)) != 0) {
          if (i == size) {
             str = (unsigned char*)realloc(str, size + 16);
             size += 16;
@@ -565,85 +1212,529 @@ char *getString(unsigned short addr) {
    return (char*)str;
 }
 
-void syscall() {
-   unsigned short syscallNum = (sr >> 8) & 0x7f;
-   //args at sp+6
-   switch (syscallNum) {
-      case 0: {
-         unsigned short ch = readWord(sp + 8);
-         console += (char)ch;
-         msg("%c", ch);
+bool Machine::queueInput(const void *data, unsigned int len) {
+   if (len > 0xffff) {
+      return false;
+   }
+   if (input.head == input.size) {
+      //everything was consumed, start over at the front
+      input.head = input.size = input.taken = 0;
+   }
+   if (input.size + len + 2 > input.cap) {
+      unsigned int cap = (input.size + len + 2) * 2;
+      unsigned char *buf = (unsigned char*)realloc(input.buf, cap);
+      if (buf == NULL) {
+         return false;
+      }
+      input.buf = buf;
+      input.cap = cap;
+   }
+   input.buf[input.size] = len & 0xff;
+   input.buf[input.size + 1] = len >> 8;
+   memcpy(input.buf + input.size + 2, data, len);
+   input.size += len + 2;
+   input.count++;
+   return true;
+}
+
+bool Machine::queueHexInput(const char *hex) {
+   unsigned char *buf = (unsigned char*)malloc(strlen(hex) / 2 + 1);
+   if (buf == NULL) {
+      return false;
+   }
+   unsigned int len = 0;
+   int hi = -1;
+   for (const char *p = hex; *p; p++) {
+      int v;
+      if (isspace((unsigned char)*p)) {
+         continue;
+      }
+      else if (*p >= '0' && *p <= '9') {
+         v = *p - '0';
+      }
+      else if (*p >= 'a' && *p <= 'f') {
+         v = *p - 'a' + 10;
+      }
+      else if (*p >= 'A' && *p <= 'F') {
+         v = *p - 'A' + 10;
+      }
+      else {
+         free(buf);
+         return false;
+      }
+      if (hi < 0) {
+         hi = v;
+      }
+      else {
+         buf[len++] = (hi << 4) | v;
+         hi = -1;
+      }
+   }
+   bool ok = hi < 0 && queueInput(buf, len);
+   free(buf);
+   return ok;
+}
+
+void Machine::clearInput() {
+   input.head = input.size = input.taken = input.count = 0;
+}
+
+//answer a getsn from the queue, the rest of an entry getchar started on
+//counts as a whole entry
+bool Machine::getsnQueued(unsigned short addr, unsigned short len) {
+   if (input.count == 0) {
+      return false;
+   }
+   unsigned char *entry = input.buf + input.head;
+   unsigned int n = (entry[0] | (entry[1] << 8)) - input.taken;
+   writeBuffer(addr, entry + 2 + input.taken, n < len ? n : len);
+#ifdef __IDP__
+   lastInput.clear();
+   lastInput.append(entry + 2 + input.taken, n < len ? n : len);
+#endif
+   input.head += (entry[0] | (entry[1] << 8)) + 2;
+   input.taken = 0;
+   input.count--;
+   return true;
+}
+
+//answer a getchar with the next queued byte in r15
+bool Machine::getcharQueued() {
+   while (input.count) {
+      unsigned char *entry = input.buf + input.head;
+      unsigned int n = entry[0] | (entry[1] << 8);
+      if (input.taken < n) {
+         r15 = entry[2 + input.taken++];
+         if (input.taken == n) {
+            input.head += n + 2;
+            input.taken = 0;
+            input.count--;
+         }
+         return true;
+      }
+      //an empty entry has nothing for getchar
+      input.head += n + 2;
+      input.taken = 0;
+      input.count--;
+   }
+   return false;
+}
+
+bool Machine::addHook(unsigned short addr, NativeHook fn, void *arg, unsigned int flags, const char *name) {
+   HookEntry *h = (HookEntry*)findHook(addr);
+   if (h == NULL) {
+      if (numHooks == MAX_HOOKS) {
+         return false;
+      }
+      h = &hooks[numHooks++];
+      hookMap[addr >> 3] |= 1 << (addr & 7);
+      otherHooks |= addr != SYSCALL_ADDR;
+   }
+   h->addr = addr;
+   h->flags = flags;
+   h->fn = fn;
+   h->arg = arg;
+   h->name = name;
+   h->calls = 0;
+   return true;
+}
+
+bool Machine::removeHook(unsigned short addr) {
+   HookEntry *h = (HookEntry*)findHook(addr);
+   if (h == NULL) {
+      return false;
+   }
+   *h = hooks[--numHooks];
+   hookMap[addr >> 3] &= ~(1 << (addr & 7));
+   otherHooks = numHooks > 1 || (numHooks == 1 && hooks[0].addr != SYSCALL_ADDR);
+   return true;
+}
+
+static unsigned int syscallHook(Machine *m, unsigned short addr, void *arg);
+
+void Machine::clearHooks() {
+   unsigned int i = 0;
+   while (i < numHooks) {
+      if (hooks[i].fn == syscallHook) {
+         i++;
+      }
+      else {
+         removeHook(hooks[i].addr);
+      }
+   }
+}
+
+const HookEntry *Machine::findHook(unsigned short addr) {
+   for (unsigned int i = 0; i < numHooks; i++) {
+      if (hooks[i].addr == addr) {
+         return &hooks[i];
+      }
+   }
+   return NULL;
+}
+
+//run the hook at pc, false when it asks for the instruction there to
+//execute instead
+bool Machine::runHook() {
+   HookEntry *h = (HookEntry*)findHook(pc);
+   //the hook may add or remove hooks
+   unsigned int flags = h->flags;
+   h->calls++;
+   if ((flags & HOOK_LOG) && !quietMode) {
+      msg("%s hook at 0x%04x, r15 0x%04x r14 0x%04x r13 0x%04x\n", h->name ? h->name : "native",
+          pc, r15, r14, r13);
+   }
+   unsigned int res = h->fn(this, pc, h->arg);
+   if (res == HOOK_EXECUTE) {
+      return false;
+   }
+   if (res == HOOK_RETURN) {
+      pc = pop();
+      popCall(pc);
+   }
+   if (flags & HOOK_BREAK) {
+      shouldBreak = 1;
+   }
+   return true;
+}
+
+void Machine::clearConsole() {
+   console.total = console.flushed = console.numChunks = 0;
+   console.open = false;
+}
+
+void Machine::consoleWrite(char ch) {
+   if (!console.open) {
+      ConsoleChunk *c = &console.chunks[console.numChunks++ % CONSOLE_CHUNKS];
+      c->insn = insnCount;
+      c->start = console.total;
+      console.open = true;
+   }
+   console.buf[console.total++ % CONSOLE_SIZE] = ch;
+   if (ch == '\n') {
+      flushConsole();
+   }
+}
+
+//append stream bytes from..to still held in the ring to text
+void Machine::consoleRange(uint64 from, uint64 to, qstring *text) {
+   if (to - from > CONSOLE_SIZE) {
+      from = to - CONSOLE_SIZE;
+   }
+   while (from < to) {
+      unsigned int offset = (unsigned int)(from % CONSOLE_SIZE);
+      unsigned int n = CONSOLE_SIZE - offset;
+      if (n > to - from) {
+         n = (unsigned int)(to - from);
+      }
+      text->append(console.buf + offset, n);
+      from += n;
+   }
+}
+
+void Machine::flushConsole() {
+   if (!quietMode && console.flushed != console.total) {
+      qstring text;
+      consoleRange(console.flushed, console.total, &text);
+      msg("%s", text.c_str());
+   }
+   console.flushed = console.total;
+   console.open = false;
+}
+
+void Machine::consoleText(qstring *text) {
+   text->clear();
+   consoleRange(console.total > CONSOLE_SIZE ? console.total - CONSOLE_SIZE : 0, console.total, text);
+}
+
+//chunks whose bytes have all been overwritten are no longer available
+unsigned int Machine::consoleChunks() {
+   uint64 first = console.numChunks > CONSOLE_CHUNKS ? console.numChunks - CONSOLE_CHUNKS : 0;
+   while (first < console.numChunks) {
+      uint64 end = first + 1 < console.numChunks ? console.chunks[(first + 1) % CONSOLE_CHUNKS].start : console.total;
+      if (console.total - end < CONSOLE_SIZE) {
          break;
       }
-      case 1:
+      first++;
+   }
+   return (unsigned int)(console.numChunks - first);
+}
+
+bool Machine::consoleChunk(unsigned int n, uint64 *insn, qstring *text) {
+   unsigned int count = consoleChunks();
+   if (n >= count) {
+      return false;
+   }
+   uint64 index = console.numChunks - count + n;
+   ConsoleChunk *c = &console.chunks[index % CONSOLE_CHUNKS];
+   uint64 end = index + 1 < console.numChunks ? console.chunks[(index + 1) % CONSOLE_CHUNKS].start : console.total;
+   *insn = c->insn;
+   text->clear();
+   consoleRange(c->start, end, text);
+   return true;
+}
+
+//the microcorruption system calls. Arguments follow the INT wrapper's
+//return address and the call number on the stack
+
+static unsigned int sysPutchar(Machine *m, unsigned int /*num*/) {
+   m->consoleWrite((char)m->syscallArg(0));
+   return SYSCALL_RESUME;
+}
+
+static unsigned int sysGetchar(Machine *m, unsigned int /*num*/) {
+   if (m->replay) {
+      const ReplayEvent *e = replayTake(m, REPLAY_CHAR);
+      if (e) {
+         m->cpu.general[R15] = e->value;
+         return SYSCALL_RESUME;
+      }
+   }
+   if (m->getcharQueued()) {
+      recordValue(m, REPLAY_CHAR, m->cpu.general[R15]);
+      return SYSCALL_RESUME;
+   }
+#ifdef __IDP__
+   if (m->getsnHook == NULL) {
+      if (!m->quietMode) {
          //open some kind of input dialog
          msg("getchar invoked, please set R15\n");
-         break;
-      case 2: {
-         bytevec_t bv;
-         //always break following send or wait
-         shouldBreak = 1;
-         unsigned short addr = readWord(sp + 8);
-         unsigned short len = readWord(sp + 10);
-//         msg("gets(0x%x, %d)\n", addr, len);
-         if (do_getsn(bv, len, console.c_str())) {
-            for (bytevec_t::iterator i = bv.begin(); i != bv.end(); i++) {
-               patch_byte(addr++, *i);
-            }
-         }
-         else {
-            //return without poping ret so that the syscall gets rerun
-            return;
-         }
-         break;
       }
-      case 0x10:
-         msg("DEP is on\n");
-         break;
-      case 0x11:
-         if (readWord(sp + 10)) {
-            msg("Marking page 0x%x writable\n", readWord(sp + 8));
-         }
-         else {
-            msg("Marking page 0x%x executable\n", readWord(sp + 8));
-         }
-         break;
-      case 0x20:
-//         msg("rand\n");
-         r15 = 0x1234;
-         break;
-      case 0x7d: {
-         unsigned short addr = readWord(sp + 10);
-         unsigned short pw = readWord(sp + 8);
-         char *str = getString(pw);
-//         msg("hsm1, %s/0x%x\n", str, addr);
-         free(str);
-         break;
+      return SYSCALL_RESUME;
+   }
+#endif
+   //out of input with no one to ask, leave the syscall pending as getsn does
+   m->stopReason = STOP_INPUT;
+   m->shouldBreak = 1;
+   return SYSCALL_RETRY;
+}
+
+//answer a getsn from the queue, the getsn hook or the dialog
+static unsigned int getsnInput(Machine *m, unsigned short addr, unsigned short len) {
+   //always break following send or wait
+   if (m->getsnQueued(addr, len)) {
+      return SYSCALL_BREAK;
+   }
+   if (m->getsnHook) {
+      if (!m->getsnHook(m, addr, len)) {
+         //out of input, leave the syscall pending
+         m->stopReason = STOP_INPUT;
+         m->shouldBreak = 1;
+         return SYSCALL_RETRY;
       }
-      case 0x7e: {
-         unsigned short pw = readWord(sp + 8);
-         char *str = getString(pw);
-//         msg("hsm2, %s\n", str);
-         free(str);
-         break;
+      return SYSCALL_BREAK;
+   }
+#ifdef __IDP__
+   bytevec_t bv;
+   qstring text;
+   m->flushConsole();
+   m->consoleText(&text);
+   if (!do_getsn(bv, len, text.c_str())) {
+      //rerun the syscall
+      m->shouldBreak = 1;
+      return SYSCALL_RETRY;
+   }
+   lastInput = bv;
+   for (bytevec_t::iterator i = bv.begin(); i != bv.end(); i++) {
+      m->writeByte(addr++, *i);
+   }
+   return SYSCALL_BREAK;
+#else
+   //no dialog in headless builds
+   m->stopReason = STOP_INPUT;
+   m->shouldBreak = 1;
+   return SYSCALL_RETRY;
+#endif
+}
+
+static unsigned int sysGetsn(Machine *m, unsigned int /*num*/) {
+   unsigned short addr = m->syscallArg(0);
+   unsigned short len = m->syscallArg(1);
+//   msg("gets(0x%x, %d)\n", addr, len);
+   if (m->taint) {
+      m->taint->labeling = true;
+      m->taint->inputAddr = addr;
+   }
+   if (m->replay == NULL) {
+      return getsnInput(m, addr, len);
+   }
+   if (m->replay->replaying) {
+      const ReplayEvent *e = replayTake(m, REPLAY_INPUT);
+      if (e == NULL) {
+         //the session had no answer yet, as if the dialog were cancelled
+         m->shouldBreak = 1;
+         return SYSCALL_RETRY;
       }
-      case 0x7f:
-         restoreCursor();
-         warning("The lock is now open!\n");
-         msg("The lock is now open!\n");
-         showWaitCursor();
-        //always break after lock gets opened
-         shouldBreak = 1;
-         break;
+      m->writeBuffer(e->addr, (void*)replayData(m->replay, e), e->len);
+      return SYSCALL_BREAK;
+   }
+   //log the span of the buffer the input actually changed
+   unsigned char *before = (unsigned char*)malloc(2 * (unsigned int)len + 1);
+   if (before) {
+      m->readBuffer(addr, before, len);
+   }
+   unsigned int res = getsnInput(m, addr, len);
+   if (before && res != SYSCALL_RETRY) {
+      unsigned char *after = before + len;
+      m->readBuffer(addr, after, len);
+      unsigned int first = 0;
+      unsigned int last = len;
+      while (first < len && before[first] == after[first]) {
+         first++;
+      }
+      while (last > first && before[last - 1] == after[last - 1]) {
+         last--;
+      }
+      recordBytes(m, REPLAY_INPUT, addr + first, after + first, last - first);
+   }
+   free(before);
+   return res;
+}
+
+static unsigned int sysDepOn(Machine *m, unsigned int /*num*/) {
+   m->aux.depEnabled = 1;
+   if (!m->quietMode) {
+      msg("DEP is on\n");
+   }
+   return SYSCALL_RESUME;
+}
+
+static unsigned int sysDepPage(Machine *m, unsigned int /*num*/) {
+   unsigned short page = m->syscallArg(0) & (MEM_PAGES - 1);
+   m->aux.noExec[page] = m->syscallArg(1) ? 1 : 0;
+   if (!m->quietMode) {
+      msg("Marking page 0x%x %s\n", page, m->aux.noExec[page] ? "writable" : "executable");
+   }
+   return SYSCALL_RESUME;
+}
+
+static unsigned int sysRand(Machine *m, unsigned int /*num*/) {
+//   msg("rand\n");
+   const ReplayEvent *e = m->replay ? replayTake(m, REPLAY_RAND) : NULL;
+   m->cpu.general[R15] = e ? e->value : 0x1234;
+   recordValue(m, REPLAY_RAND, m->cpu.general[R15]);
+   return SYSCALL_RESUME;
+}
+
+//hsm1 also takes the address of a flag in its second argument
+static unsigned int sysHsm(Machine *m, unsigned int /*num*/) {
+   if (m->cmpLog) {
+      char *str = m->syscallString(0);
+      m->logHsm(str);
+      free(str);
+   }
+   return SYSCALL_RESUME;
+}
+
+static unsigned int sysUnlock(Machine *m, unsigned int /*num*/) {
+   if (!m->quietMode) {
+#ifdef __IDP__
+      restoreCursor();
+      warning("The lock is now open!\n");
+      showWaitCursor();
+#endif
+      msg("The lock is now open!\n");
    }
-   if (breakMode) {
+   //always break after lock gets opened
+   m->stopReason = STOP_UNLOCK;
+   return SYSCALL_BREAK;
+}
+
+static unsigned int microcorruptionNumber(Machine *m) {
+   return SYSCALL_NUMBER(m->cpu.general[SR]);
+}
+
+static const SyscallDef microcorruptionSyscalls[] = {
+   {SYS_PUTCHAR, "putchar", sysPutchar},
+   {SYS_GETCHAR, "getchar", sysGetchar},
+   {SYS_GETSN, "getsn", sysGetsn},
+   {SYS_DEP_ON, "dep_on", sysDepOn},
+   {SYS_DEP_PAGE, "dep_page", sysDepPage},
+   {SYS_RAND, "rand", sysRand},
+   {SYS_HSM1, "hsm1", sysHsm},
+   {SYS_HSM2, "hsm2", sysHsm},
+   {SYS_UNLOCK, "unlock", sysUnlock}
+};
+
+const SyscallProfile microcorruptionProfile = {
+   "microcorruption",
+   SYSCALL_ADDR,
+   8,
+   microcorruptionNumber,
+   sizeof(microcorruptionSyscalls) / sizeof(microcorruptionSyscalls[0]),
+   microcorruptionSyscalls
+};
+
+//the system call entry, hooked at the profile's entry address
+static unsigned int syscallHook(Machine *m, unsigned short /*addr*/, void * /*arg*/) {
+   //pops the return address itself unless the call is to be retried
+   m->syscall();
+   return HOOK_JUMPED;
+}
+
+void Machine::setSyscallProfile(const SyscallProfile *p) {
+   if (profile) {
+      const HookEntry *h = findHook(profile->entry);
+      if (h && h->fn == syscallHook) {
+         removeHook(profile->entry);
+      }
+   }
+   profile = p;
+   memset(syscallHandlers, 0, sizeof(syscallHandlers));
+   memset(syscallCalls, 0, sizeof(syscallCalls));
+   for (unsigned int i = 0; i < p->numDefs; i++) {
+      syscallHandlers[p->defs[i].num & (SYSCALL_NUMBERS - 1)] = p->defs[i].fn;
+   }
+   addHook(p->entry, syscallHook, NULL, 0, "syscall");
+}
+
+void Machine::setSyscallHandler(unsigned int num, SyscallHandler fn) {
+   syscallHandlers[num & (SYSCALL_NUMBERS - 1)] = fn;
+}
+
+const char *Machine::syscallName(unsigned int num) {
+   for (unsigned int i = 0; i < profile->numDefs; i++) {
+      if (profile->defs[i].num == num) {
+         return profile->defs[i].name;
+      }
+   }
+   return NULL;
+}
+
+unsigned short Machine::syscallArg(unsigned int n) {
+   return readWord(sp + profile->argOffset + 2 * n);
+}
+
+char *Machine::syscallString(unsigned int n) {
+   return getString(syscallArg(n));
+}
+
+bool Machine::atSyscall(unsigned int num) {
+   return pc == profile->entry && profile->number(this) == num;
+}
+
+void Machine::syscall() {
+   unsigned int num = profile->number(this) & (SYSCALL_NUMBERS - 1);
+   SyscallHandler fn = syscallHandlers[num];
+   syscallCalls[num]++;
+   //calls without a handler do nothing
+   unsigned int res = fn ? fn(this, num) : (unsigned int)SYSCALL_RESUME;
+   if (res == SYSCALL_RETRY) {
+      //leave the return address so that the call runs again
+      return;
+   }
+   if (res == SYSCALL_BREAK || breakMode) {
       shouldBreak = 1;
    }
    pc = pop();
+   popCall(pc);
 }
 
-void getDest(unsigned short mode, unsigned short reg) {
+void Machine::getDest(unsigned short mode, unsigned short reg) {
 //   msg("getDest: mode - %d, reg - %d\n", mode, reg);
+   if (taint) {
+      taint->read = 0;
+   }
    switch (mode) {
       case 0:  //register mode
          destOp = b_w ? cpu.general[reg] & 0xff : cpu.general[reg];
@@ -673,11 +1764,20 @@ void getDest(unsigned short mode, unsigned short reg) {
          //invalid destination mode
          break;
    }
+   if (power) {
+      leakValue(POWER_BUS_DEST, destOp);
+   }
+   if (taint) {
+      taint->dst = mode == 0 ? taint->regs[reg] : taint->read;
+   }
 }
 
-void getSource(unsigned short mode, unsigned short reg) {
+void Machine::getSource(unsigned short mode, unsigned short reg) {
 //   msg("getSource: sreg %d, dreg, %d, b/w: %d, As: %d, Ad: %d\n", sreg, dreg, b_w, a_s, a_d);
 //   msg("getSource: mode %d, reg, %d\n", mode, reg);
+   if (taint) {
+      taint->read = 0;
+   }
    switch (mode) {
       case 0:  //register mode
          if (reg == R3) {
@@ -744,16 +1844,33 @@ void getSource(unsigned short mode, unsigned short reg) {
          }
          break;
    }
+   if (power) {
+      leakValue(POWER_BUS_SOURCE, sourceOp);
+   }
+   if (taint) {
+      //constant generators and immediates never read memory
+      taint->src = mode == 0 ? (reg == R3 ? 0 : taint->regs[reg]) : taint->read;
+   }
 }
 
-void putDest(unsigned short mode, unsigned short reg, unsigned short val) {
+void Machine::putDest(unsigned short mode, unsigned short reg, unsigned short val) {
 //   msg("putDest: mode %d, reg, %d, b/w: %d\n", mode, reg, b_w);
    if (b_w) {
       val = val & 0xff;
    }
+   if (taint) {
+      //mov copies its source, everything else combines both operands
+      taint->write = (opcode >> 12) == 4 ? taint->src : taint->src | taint->dst;
+      if (mode == 0) {
+         taint->regs[reg] = taint->write;
+      }
+   }
    switch (mode) {
       case 0:  //register mode
          cpu.general[reg] = val;
+         if (power) {
+            leakValue(POWER_BUS_WRITE, val);
+         }
          break;
       case 1:  //
          switch (reg) {
@@ -782,16 +1899,33 @@ void putDest(unsigned short mode, unsigned short reg, unsigned short val) {
    }
 }
 
-int executeInstruction() {
+int Machine::executeInstruction() {
    pc = pc & 0xffff;
    instStart = pc;
    cpu.initial_pc = pc;
+   leakage = 0;
+   insnCount++;
+   //owners may leave these set, so only a change is a new stop
+   unsigned int prevReason = stopReason;
+   unsigned int prevBreak = shouldBreak;
+   if (taint) {
+      taint->src = taint->dst = taint->write = 0;
+      taint->labeling = false;
+   }
+
+   if (warmBootArmed && this == &emu) {
+      warmBootCheck();
+   }
  
-   if (sr & 0x10) {
+   if (sr & xCPUOFF) {
       //the cpu is off
-      if (!offMessage) {
+      stopReason = STOP_CPUOFF;
+      flushConsole();
+      if (!offMessage && !quietMode) {
          offMessage = true;
+#ifdef __IDP__
          warning("The cpu has been powered off.");
+#endif
          msg("The cpu has been powered off.\n");
       }
       return 0;
@@ -801,10 +1935,22 @@ int executeInstruction() {
    
 //msg("msp430emu: begin instruction, pc: 0x%x\n", pc);
    if (pc & 1) {
-      msg("Misaligned instruction 0x%04x\n", pc);
+      stopReason = STOP_MISALIGNED_PC;
+      if (!quietMode) {
+         msg("Misaligned instruction 0x%04x\n", pc);
+      }
    }
-   else if (pc == 0x10) {
-      syscall();
+   else if ((pc == SYSCALL_ADDR || otherHooks) && (hookMap[pc >> 3] & (1 << (pc & 7))) && runHook()) {
+      //hooks transfer control much like a call or return
+      if (coverageMap) {
+         coverEdge();
+      }
+   }
+   else if (aux.depEnabled && aux.noExec[pc >> MEM_PAGE_SHIFT]) {
+      stopReason = STOP_EXEC_NX;
+      if (!quietMode) {
+         msg("Execution in non executable page at 0x%04x\n", pc);
+      }
    }
    else {
       unsigned int res = 0;
@@ -871,11 +2017,150 @@ int executeInstruction() {
             break;
       }
       if (res == 0) {
-         msg("Invalid instruction 0x%04x, at address 0x%04x\n", opcode, instStart);
-      }      
+         stopReason = STOP_INVALID;
+         if (!quietMode) {
+            msg("Invalid instruction 0x%04x, at address 0x%04x\n", opcode, instStart);
+         }
+      }
+      else if (coverageMap) {
+         //jumps, call/reti and anything with pc as its destination
+         if (op == 2 || op == 3 || (op == 1 && ((opcode >> 6) & 0xf) >= 10) ||
+             (op >= 4 && dreg == PC && a_d == 0)) {
+            coverEdge();
+         }
+      }
    }
 //msg("msp430emu: end instruction, eip: 0x%x\n", eip);
    pc = pc & 0xffff;
+   if (taint && taint->regs[PC]) {
+      logTaint(TAINT_PC, pc, 0, taint->regs[PC]);
+      taint->regs[PC] = 0;
+   }
+   if (power) {
+      if (power->count < power->capacity) {
+         power->samples[power->count] = leakage < 0xff ? leakage : 0xff;
+      }
+      power->count++;
+   }
+   if (console.open && (stopReason != prevReason || shouldBreak != prevBreak)) {
+      flushConsole();
+   }
    return 0;
 }
 
+//size in bytes of the instruction at addr, decoded without side effects
+unsigned int Machine::instructionLength(unsigned short addr) {
+   unsigned short op = readWord(addr & ~1);
+   unsigned int len = 2;
+   unsigned short as = AS(op);
+   if ((op >> 12) >= 4) {
+      //format 1, the source then the destination extension words
+      unsigned short s = SREG(op);
+      if ((as == 1 && s != R3) || (as == 3 && s == PC)) {
+         len += 2;
+      }
+      if (AD(op)) {
+         len += 2;
+      }
+   }
+   else if ((op >> 12) == 1) {
+      unsigned short d = DREG(op);
+      if ((as == 1 && d != R3) || (as == 3 && d == PC)) {
+         len += 2;
+      }
+   }
+   return len;
+}
+
+const char *stopReasonName(unsigned int reason) {
+   static const char *names[STOP_REASONS] = {
+      "none", "unlock", "input", "invalid", "misaligned_pc", "cpuoff", "budget",
+      "misaligned_read", "misaligned_write", "exec_nx", "target", "loop"
+   };
+   return reason < STOP_REASONS ? names[reason] : "unknown";
+}
+
+void initProgram(unsigned int entry) {
+   emu.initProgram(entry);
+}
+
+bool setTaintTracking(bool on) {
+   if (on && emu.taint == NULL) {
+      emu.taint = (Taint*)calloc(1, sizeof(Taint));
+   }
+   else if (!on && emu.taint) {
+      free(emu.taint);
+      emu.taint = NULL;
+   }
+   return emu.taint != NULL;
+}
+
+bool getTaintTracking() {
+   return emu.taint != NULL;
+}
+
+void formatTaint(TaintMask mask, char *buf, unsigned int size) {
+   unsigned int used = 0;
+   buf[0] = 0;
+   for (unsigned int i = 0; i < TAINT_OFFSETS && used < size; i++) {
+      if ((mask & ((TaintMask)1 << i)) == 0) {
+         continue;
+      }
+      unsigned int j = i;
+      while (j + 1 < TAINT_OFFSETS && (mask & ((TaintMask)1 << (j + 1)))) {
+         j++;
+      }
+      const char *more = j == TAINT_OFFSETS - 1 ? "+" : "";
+      if (j == i) {
+         used += ::qsnprintf(buf + used, size - used, "%s%u%s", used ? "," : "", i, more);
+      }
+      else {
+         used += ::qsnprintf(buf + used, size - used, "%s%u-%u%s", used ? "," : "", i, j, more);
+      }
+      i = j;
+   }
+}
+
+void resetCpu() {
+   emu.resetCpu();
+}
+
+void push(unsigned short val) {
+   emu.push(val);
+}
+
+unsigned char readByte(unsigned short addr) {
+   return emu.readByte(addr);
+}
+
+void writeByte(unsigned short addr, unsigned short val) {
+   emu.writeByte(addr, val);
+}
+
+unsigned short readWord(unsigned short addr) {
+   return emu.readWord(addr);
+}
+
+void writeWord(unsigned short addr, unsigned short val) {
+   emu.writeWord(addr, val);
+}
+
+void writeMem(unsigned short addr, unsigned short val, unsigned short size) {
+   emu.writeMem(addr, val, size);
+}
+
+unsigned short readMem(unsigned short addr, unsigned short size) {
+   return emu.readMem(addr, size);
+}
+
+unsigned int readBuffer(unsigned short addr, void *buf, unsigned int nbytes) {
+   return emu.readBuffer(addr, buf, nbytes);
+}
+
+unsigned int writeBuffer(unsigned short addr, void *buf, unsigned int nbytes) {
+   return emu.writeBuffer(addr, buf, nbytes);
+}
+
+int executeInstruction() {
+   return emu.executeInstruction();
+}
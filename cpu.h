@@ -24,13 +24,21 @@
 
 #define CPU_VERSION VERSION(1)
 
+#define MEM_SIZE 0x10000
+
+//dirty page tracking granularity for the flat memory image
+#define MEM_PAGE_SHIFT 8
+#define MEM_PAGE_SIZE (1 << MEM_PAGE_SHIFT)
+#define MEM_PAGES (MEM_SIZE >> MEM_PAGE_SHIFT)
+
+//size of the edge coverage map, must be a power of two
+#define COVERAGE_MAP_SIZE 0x10000
+
 struct Registers {
    unsigned int general[16];
    unsigned int initial_pc;
 };
 
-extern Registers cpu;
-
 //masks to clear out bytes appropriate to the sizes above
 extern unsigned int SIZE_MASKS[5];
 
@@ -42,7 +50,150 @@ extern unsigned int CARRY_BITS[5];
 
 extern unsigned short BITS[5];
 
-extern unsigned int shouldBreak;
+//address that traps into the microcorruption system call handler and
+//the system call number carried in the high byte of sr
+#define SYSCALL_ADDR 0x10
+#define SYSCALL_NUMBER(x) (((x) >> 8) & 0x7f)
+
+//size of a machine's system call table
+#define SYSCALL_NUMBERS 256
+
+//the microcorruption system calls
+#define SYS_PUTCHAR 0
+#define SYS_GETCHAR 1
+#define SYS_GETSN 2
+#define SYS_DEP_ON 0x10
+#define SYS_DEP_PAGE 0x11
+#define SYS_RAND 0x20
+#define SYS_HSM1 0x7d
+#define SYS_HSM2 0x7e
+#define SYS_UNLOCK 0x7f
+
+//reasons that the cpu asks to stop, recorded in stopReason
+enum {
+   STOP_NONE,
+   STOP_UNLOCK,          // syscall 0x7f, the door is open
+   STOP_INPUT,           // input requested and no input available
+   STOP_INVALID,         // invalid instruction
+   STOP_MISALIGNED_PC,   // attempt to execute at an odd address
+   STOP_CPUOFF,          // CPUOFF set in sr
+   STOP_BUDGET,          // instruction budget exhausted
+   STOP_MISALIGNED_READ, // word read from an odd address
+   STOP_MISALIGNED_WRITE,// word write to an odd address
+   STOP_EXEC_NX,         // execution in a page that DEP marked non executable
+   STOP_TARGET,          // reached the address a runner was asked to stop at
+   STOP_LOOP,            // a runner saw the whole machine state repeat
+   STOP_REASONS
+};
+
+//depth of the shadow call stack, deeper calls are counted but not recorded
+#define CALL_STACK_DEPTH 64
+
+//machine state that is neither registers nor memory. Snapshots carry it
+//along with the registers
+struct AuxState {
+   unsigned int depEnabled;            //syscall 0x10 turned DEP on
+   unsigned char noExec[MEM_PAGES];    //pages marked writable by syscall 0x11
+   unsigned int callDepth;
+   unsigned short callStack[CALL_STACK_DEPTH];   //return addresses
+   unsigned short callSlots[CALL_STACK_DEPTH];   //where each was pushed
+};
+
+//comparison logging, see CmpLog
+#define CMPLOG_ENTRIES 256
+#define CMPLOG_STRING 16
+
+//bitmap of instruction addresses whose comparisons should be logged
+#define CMPLOG_SITE_BYTES (MEM_SIZE / 8)
+#define CMPLOG_SET_SITE(s, a) ((s)[(a) >> 3] |= 1 << ((a) & 7))
+#define CMPLOG_IS_SITE(s, a) ((s)[(a) >> 3] & (1 << ((a) & 7)))
+
+enum {
+   CMPLOG_WORD,      // cmp/sub
+   CMPLOG_BYTE,      // cmp.b/sub.b
+   CMPLOG_HSM        // password handed to the HSM (syscall 0x7d/0x7e)
+};
+
+struct CmpLogEntry {
+   unsigned short site;    //address of the instruction, SYSCALL_ADDR for hsm
+   unsigned short kind;
+   unsigned short op1;     //destination operand, string length for hsm
+   unsigned short op2;     //source operand
+   unsigned char str[CMPLOG_STRING];   //leading bytes of the hsm password
+};
+
+//comparisons made during one run. Only comparisons whose operands differ
+//are logged and a repeat of the previous entry is dropped. count keeps
+//going once entries is full.
+struct CmpLog {
+   const unsigned char *sites;   //CMPLOG_SITE_BYTES bitmap, NULL for all
+   unsigned int count;
+   CmpLogEntry entries[CMPLOG_ENTRIES];
+};
+
+//simulated power consumption, see PowerTrace
+enum {
+   POWER_HW,         // hamming weight of each value
+   POWER_HD          // hamming distance from the previous value on the same bus
+};
+
+enum {
+   POWER_BUS_SOURCE, // source operands
+   POWER_BUS_DEST,   // destination operands
+   POWER_BUS_WRITE,  // results written to registers or memory
+   POWER_BUSES
+};
+
+//one leakage sample per executed instruction, the sum over its source
+//operand, destination operand and every result it writes of the hamming
+//weight (or distance) of the value. count keeps going once samples is full.
+struct PowerTrace {
+   unsigned int model;
+   unsigned int capacity;
+   unsigned char *samples;
+   unsigned int count;
+   unsigned short bus[POWER_BUSES];    //last value seen on each bus
+};
+
+//input taint tracking, see Taint. Each bit of a mask is one input offset,
+//the last bit stands for every offset from TAINT_OFFSETS - 1 on
+typedef uint64 TaintMask;
+#define TAINT_OFFSETS 64
+#define TAINT_BIT(off) ((TaintMask)1 << ((off) < TAINT_OFFSETS - 1 ? (off) : TAINT_OFFSETS - 1))
+#define TAINT_EVENTS 256
+
+enum {
+   TAINT_PC,         // pc loaded from input derived data, value is the new pc
+   TAINT_RET,        // input derived data written over the return address at value
+   TAINT_CMP         // cmp/sub operand derived from input, values are the operands
+};
+
+struct TaintEvent {
+   unsigned short site;    //address of the instruction
+   unsigned short kind;
+   unsigned short value;
+   unsigned short value2;
+   TaintMask mask;         //input offsets that flowed into it
+};
+
+//shadow state for taint tracking. Bytes written by the getsn system call
+//are labeled with their offset in the input, and labels follow data through
+//registers (one label per register) and memory (one per byte). Results
+//carry the union of their operands' labels, mov carries its source's.
+//Addresses used to reach data do not taint it and neither do branches.
+//count keeps going once events is full.
+struct Taint {
+   TaintMask mem[MEM_SIZE];
+   TaintMask regs[16];
+   TaintMask src;          //labels of the current instruction's operands
+   TaintMask dst;
+   TaintMask read;         //labels of the last memory read
+   TaintMask write;        //labels given to memory writes
+   bool labeling;          //getsn is writing input at inputAddr
+   unsigned short inputAddr;
+   unsigned int count;
+   TaintEvent events[TAINT_EVENTS];
+};
 
 // Status codes returned by the database blob reading routine
 enum {
@@ -55,28 +206,368 @@ enum {
    MSP430EMUSAVE_FAILED                // state save failed (buffer problems)
 };
 
+class Machine;
+struct ReplayLog;
+
+//input fed to the getchar and getsn system calls ahead of any prompt. Each
+//entry answers one getsn call, getchar takes entries a byte at a time
+struct InputQueue {
+   unsigned char *buf;     //entries back to back, each a 2 byte length then its bytes
+   unsigned int size;      //bytes of buf in use
+   unsigned int cap;
+   unsigned int head;      //offset of the next entry
+   unsigned int taken;     //bytes of the head entry already read by getchar
+   unsigned int count;     //entries not yet consumed
+};
+
+//console output kept per machine, older output is dropped
+#define CONSOLE_SIZE 0x4000
+#define CONSOLE_CHUNKS 512
+
+//a run of console output ended by a newline or a flush
+struct ConsoleChunk {
+   uint64 insn;            //instruction count when its first byte was written
+   uint64 start;           //stream offset of its first byte
+};
+
+//console output written by putchar. Byte n of the stream is kept at
+//buf[n % CONSOLE_SIZE] until it is overwritten
+struct Console {
+   char buf[CONSOLE_SIZE];
+   uint64 total;           //bytes written
+   uint64 flushed;         //bytes echoed to the output window
+   ConsoleChunk chunks[CONSOLE_CHUNKS];
+   uint64 numChunks;       //chunks started, the last CONSOLE_CHUNKS are kept
+   bool open;              //the last chunk is still being written
+};
+
+//native handler run in place of the code at a hooked address. It works
+//on the machine directly and returns how execution continues
+typedef unsigned int (*NativeHook)(Machine *m, unsigned short addr, void *arg);
+
+//native hook results
+enum {
+   HOOK_RETURN,      //pop the return address into pc, the hook emulated a whole function
+   HOOK_JUMPED,      //the hook has set pc itself
+   HOOK_EXECUTE      //execute the instruction at the address as if there were no hook
+};
+
+//a system call handler, num is the call being made. Arguments are read
+//with Machine::syscallArg. Returns how the call completes
+typedef unsigned int (*SyscallHandler)(Machine *m, unsigned int num);
+
+//system call handler results
+enum {
+   SYSCALL_RESUME,   //return to the caller
+   SYSCALL_BREAK,    //return to the caller and ask the cpu user to break
+   SYSCALL_RETRY     //leave the call pending, it runs again on the next step
+};
+
+struct SyscallDef {
+   unsigned int num;
+   const char *name;
+   SyscallHandler fn;
+};
+
+//a platform's system call convention and its calls. A call to entry traps
+//into the handler that number picks, with the first argument argOffset
+//bytes above sp
+struct SyscallProfile {
+   const char *name;
+   unsigned short entry;
+   unsigned short argOffset;
+   unsigned int (*number)(Machine *m);
+   unsigned int numDefs;
+   const SyscallDef *defs;
+};
+
+extern const SyscallProfile microcorruptionProfile;
+
+//native hook flags. Hooks are otherwise invisible, a hooked function runs
+//as one step and breakpoints inside it are never reached
+#define HOOK_BREAK 1    //ask the cpu user to break after the hook runs
+#define HOOK_LOG 2      //report each call unless quiet
+
+#define MAX_HOOKS 64
+
+struct HookEntry {
+   unsigned short addr;
+   unsigned short flags;
+   NativeHook fn;
+   void *arg;
+   const char *name;       //for display, may be NULL
+   unsigned int calls;
+};
+
+//optional replacement for the getsn dialog. Writes at most len bytes
+//to addr and returns true, or returns false when no input is available
+typedef bool (*GetsnHook)(Machine *m, unsigned short addr, unsigned short len);
+
+//called at a conditional jump whose flags derive from input (taint must be
+//on) with the address the jump did not go to
+typedef void (*ForkHook)(Machine *m, unsigned short otherPc);
+
+//one independent instance of the cpu. Machines running from flat memory
+//share nothing and may run concurrently on separate threads. A machine
+//without flat memory reads and writes the ida database.
+class Machine {
+public:
+   Machine();
+   ~Machine();
+
+   Registers cpu;
+   AuxState aux;
+
+   //flag to tell CPU users that they should probably break because something
+   //strange has happened
+   unsigned int shouldBreak;
+
+   //why the cpu last asked to stop, cleared by cpu users
+   unsigned int stopReason;
+
+   //suppress console echo, fault messages and dialogs (batch runs)
+   bool quietMode;
+
+   //emulate the microcorruption simulator's flag bugs, new machines start
+   //with the global bugMode setting
+   bool bugMode;
+
+   //edge coverage map updated at each control transfer when non-NULL
+   unsigned char *coverageMap;
+
+   GetsnHook getsnHook;
+
+   //comparison log filled by cmp, sub and hsm syscalls when non-NULL
+   CmpLog *cmpLog;
+
+   //power trace sampled at each instruction when non-NULL
+   PowerTrace *power;
+
+   //input taint tracked when non-NULL
+   Taint *taint;
+
+   ForkHook forkHook;
+
+   //session log the input system calls record to or replay from when non-NULL
+   ReplayLog *replay;
+
+   //owner supplied context for hooks
+   void *user;
+
+   //consumed by the input system calls before getsnHook or the dialog
+   InputQueue input;
+
+   //instructions executed since the machine was created or the count
+   //was last cleared by its owner
+   uint64 insnCount;
+
+   Console console;
+
+   //run recognized copy, fill, strlen and compare loops as one bulk
+   //operation when the backward jump closing them is taken. insnCount and
+   //all register, flag and memory effects stay exact, but a single
+   //executeInstruction may then run many instructions, stepping over
+   //breakpoints inside the loop. Flat memory only, and never while coverage,
+   //power, taint or comparison logging is on
+   bool loopIdioms;
+   //a bulk loop never takes insnCount past this
+   uint64 insnLimit;
+
+   void initProgram(unsigned int entry);
+   void resetCpu();
+
+   void push(unsigned short val);
+   unsigned short pop();
+   unsigned char readByte(unsigned short addr);
+   void writeByte(unsigned short addr, unsigned short val);
+   unsigned short readWord(unsigned short addr);
+   void writeWord(unsigned short addr, unsigned short val);
+   void writeMem(unsigned short addr, unsigned short val, unsigned short size);
+   unsigned short readMem(unsigned short addr, unsigned short size);
+   unsigned int readBuffer(unsigned short addr, void *buf, unsigned int nbytes);
+   unsigned int writeBuffer(unsigned short addr, void *buf, unsigned int nbytes);
+
+   void setFlatMemory(unsigned char *mem);
+   unsigned char *getFlatMemory() {return flatMem;};
+   void clearDirtyPages();
+   void restoreDirtyPages(const unsigned char *image);
+   const unsigned short *getDirtyPages(unsigned int *count) {*count = numDirty; return dirtyList;};
+   void loadPage(unsigned int page, const unsigned char *data);
+
+   //keep a hash of all of memory up to date as it is written. Turning it
+   //on hashes the whole address space once. Writes that bypass the machine
+   //(the database patched directly) go unseen, turn it on again after them
+   void enableStateHash(bool on);
+   bool stateHashEnabled() {return hashing;};
+   //hash of memory and registers, equal states hash equal. O(1)
+   uint64 stateHash();
+   void resetCoverage();
+
+   //append one entry to the input queue, false when out of memory or
+   //longer than a getsn call could ask for
+   bool queueInput(const void *data, unsigned int len);
+   //same for hex encoded bytes, white space ignored. false when hex is malformed
+   bool queueHexInput(const char *hex);
+   void clearInput();
+
+   //run fn whenever pc reaches addr, replacing any hook already there.
+   //The system call profile's entry is hooked too
+   bool addHook(unsigned short addr, NativeHook fn, void *arg, unsigned int flags, const char *name);
+   bool removeHook(unsigned short addr);
+   //remove every hook except the system call entry
+   void clearHooks();
+
+   //install a profile's calls in place of the current table, new machines
+   //use microcorruptionProfile
+   void setSyscallProfile(const SyscallProfile *p);
+   const SyscallProfile *getSyscallProfile() {return profile;};
+   //replace or, with NULL, remove the handler for one call
+   void setSyscallHandler(unsigned int num, SyscallHandler fn);
+   const char *syscallName(unsigned int num);
+   //times each call has been made since the profile was installed
+   unsigned int syscallCount(unsigned int num) {return syscallCalls[num & (SYSCALL_NUMBERS - 1)];};
+   //argument n of the call being made, as a word or a string to free
+   unsigned short syscallArg(unsigned int n);
+   char *syscallString(unsigned int n);
+   //true when pc is about to make call num
+   bool atSyscall(unsigned int num);
+   const HookEntry *findHook(unsigned short addr);
+   const HookEntry *getHooks(unsigned int *count) {*count = numHooks; return hooks;};
+
+   //append a character to the console as putchar does
+   void consoleWrite(char ch);
+   //take queued input for a getsn or getchar call, false when there is none
+   bool getsnQueued(unsigned short addr, unsigned short len);
+   bool getcharQueued();
+   void logHsm(const char *str);
+   //echo console output not yet shown (unless quiet) and end the current
+   //chunk. Done on newline and whenever the cpu asks to stop
+   void flushConsole();
+   void clearConsole();
+   //retained console text, whole or a chunk at a time, chunk 0 the oldest
+   void consoleText(qstring *text);
+   unsigned int consoleChunks();
+   bool consoleChunk(unsigned int n, uint64 *insn, qstring *text);
+
+   int executeInstruction();
+   unsigned int instructionLength(unsigned short addr);
+   void syscall();
+   char *getString(unsigned short addr);
+
+   //forget all taint labels and events. Only pages written since the last
+   //clearDirtyPages are cleared in flat memory, so call this first
+   void clearTaint();
+
+   //hash of the innermost frames return addresses on the shadow call stack
+   unsigned int callStackHash(unsigned int frames);
+
+private:
+   Machine(const Machine & /*m*/) {};
+   Machine &operator=(const Machine & /*m*/) {return *this;};
+   unsigned short fetch();
+   void setSR(unsigned int val);
+   void checkAddOverflow(unsigned int op1, unsigned int op2, unsigned int sum);
+   void checkSubOverflow(unsigned int op1, unsigned int op2, unsigned int diff);
+   void coverEdge();
+   void logCmp();
+   void leakValue(unsigned int bus, unsigned short val);
+   void taintWrite(unsigned short addr);
+   bool runHook();
+   bool loopIdiom(unsigned short head, unsigned short jump);
+   bool idiomStore(unsigned int addr, const unsigned char *src, unsigned int val, unsigned int n,
+                   unsigned short head, unsigned short jump);
+   void consoleRange(uint64 from, uint64 to, qstring *text);
+   void logTaint(unsigned int kind, unsigned short value, unsigned short value2, TaintMask mask);
+   void pushCall(unsigned short ret);
+   void popCall(unsigned short target);
+   void getDest(unsigned short mode, unsigned short reg);
+   void getSource(unsigned short mode, unsigned short reg);
+   void putDest(unsigned short mode, unsigned short reg, unsigned short val);
+   int doOne();
+   int doJump(unsigned int cond, unsigned int offset);
+   int doMove();
+   int doAdd(unsigned short carryIn);
+   int doSub(unsigned short carryIn);
+   int doCmp();
+   int doDadd();
+   int doBit();
+   int doBic();
+   int doBis();
+   int doXor();
+   int doAnd();
+
+   bool offMessage;
+
+   unsigned int instStart;
+   unsigned short opcode;   //opcode, first or second byte (if first == 0x0F)
+   unsigned short sreg;
+   unsigned short dreg;
+   unsigned short a_s;
+   unsigned short a_d;
+   unsigned short b_w;
+   unsigned int sourceOp;
+   unsigned int destOp;
+   unsigned int leakage;    //power drawn by the current instruction
+
+   //flat copy of the address space used in place of the database when non-NULL
+   unsigned char *flatMem;
+
+   //pages written since the last clearDirtyPages, in flatMem or the database
+   unsigned char pageDirty[MEM_PAGES];
+   unsigned short dirtyList[MEM_PAGES];
+   unsigned int numDirty;
+
+   unsigned int prevLoc;
+
+   bool hashing;
+   uint64 memHash;   //xor of a key for each address and the byte it holds
+
+   unsigned char hookMap[MEM_SIZE / 8];   //bit per hooked address
+   HookEntry hooks[MAX_HOOKS];
+   unsigned int numHooks;
+   bool otherHooks;     //any hook away from SYSCALL_ADDR, saves a map lookup per instruction
+
+   const SyscallProfile *profile;
+   SyscallHandler syscallHandlers[SYSCALL_NUMBERS];
+   unsigned int syscallCalls[SYSCALL_NUMBERS];
+};
+
+//the machine driven by the user interface and scripts
+extern Machine emu;
+extern Registers &cpu;
+
+//the functions below operate on emu
 void initProgram(unsigned int entry);
 
 void resetCpu();
 
 void push(unsigned short val);
-unsigned short pop(unsigned short size);
 unsigned char readByte(unsigned short addr);
 void writeByte(unsigned short addr, unsigned short val);
 unsigned short readWord(unsigned short addr);
 void writeWord(unsigned short addr, unsigned short val);
 void writeMem(unsigned short addr, unsigned short val, unsigned short size);
 unsigned short readMem(unsigned short addr, unsigned short size);
+unsigned int readBuffer(unsigned short addr, void *buf, unsigned int nbytes);
+unsigned int writeBuffer(unsigned short addr, void *buf, unsigned int nbytes);
 
 int executeInstruction();
-void doInterruptReturn();
 
-void syscall();
+//allocate or drop emu's taint state
+bool setTaintTracking(bool on);
+bool getTaintTracking();
+
+//list the input offsets in mask as ranges ("0-3,16") into buf
+void formatTaint(TaintMask mask, char *buf, unsigned int size);
 
-char *getString(unsigned short addr);
+//short name for a stop reason, used in file names and reports
+const char *stopReasonName(unsigned int reason);
 
 #ifdef __IDP__
 
+//the most recent input typed into the getsn dialog
+extern bytevec_t lastInput;
+
 int saveState(netnode &f);
 int loadState(netnode &f);
 
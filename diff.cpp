@@ -0,0 +1,139 @@
+/*
+   Bug mode differential runs for MSP430 emulator
+   Copyright (c) 2014 Chris Eagle
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation; either version 2 of the License, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+   more details.
+
+   You should have received a copy of the GNU General Public License along with
+   this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+   Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/*
+ * Two private machines start from the current state, one emulating the
+ * microcorruption simulator's flag bugs and one not, and are stepped one
+ * instruction at a time. Both keep an incremental state hash, so after
+ * each instruction the whole machines (registers and memory) are compared
+ * with a single test and only a divergence pays for a full comparison.
+ * The machines are stepped on one thread: handing every instruction or
+ * block to another core would cost far more than interpreting it.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "snapshot.h"
+#include "runner.h"
+#include "diff.h"
+
+void initDiffOptions(DiffOptions *opts) {
+   opts->input = NULL;
+   opts->inputLen = 0;
+   opts->maxInsns = 10000000;
+}
+
+static void addByte(DiffStats *stats, unsigned int addr, unsigned char accurate, unsigned char quirk) {
+   if (stats->numBytes < DIFF_MAX_BYTES) {
+      DiffByte *d = &stats->bytes[stats->numBytes++];
+      d->addr = addr;
+      d->accurate = accurate;
+      d->quirk = quirk;
+   }
+   stats->totalBytes++;
+}
+
+//compare the pages either machine has written, the rest still match
+//the snapshot they both started from
+static void compareMemory(Machine *a, Machine *b, DiffStats *stats) {
+   const unsigned char *memA = a->getFlatMemory();
+   const unsigned char *memB = b->getFlatMemory();
+   unsigned char checked[MEM_SIZE >> MEM_PAGE_SHIFT];
+   memset(checked, 0, sizeof(checked));
+   Machine *both[2] = {a, b};
+   for (unsigned int m = 0; m < 2; m++) {
+      unsigned int numPages;
+      const unsigned short *dirty = both[m]->getDirtyPages(&numPages);
+      for (unsigned int i = 0; i < numPages; i++) {
+         if (checked[dirty[i]]) {
+            continue;
+         }
+         checked[dirty[i]] = 1;
+         unsigned int offset = dirty[i] << MEM_PAGE_SHIFT;
+         for (unsigned int j = offset; j < offset + MEM_PAGE_SIZE; j++) {
+            if (memA[j] != memB[j]) {
+               addByte(stats, j, memA[j], memB[j]);
+            }
+         }
+      }
+   }
+}
+
+int diffRun(const DiffOptions *opts, DiffStats *stats) {
+   memset(stats, 0, sizeof(DiffStats));
+   Snapshot *base = takeSnapshot();
+   if (base == NULL) {
+      return DIFF_NO_MEMORY;
+   }
+   Runner accurate;
+   Runner quirk;
+   bool okA = initRunner(&accurate, base);
+   bool okB = initRunner(&quirk, base);
+   if (!okA || !okB) {
+      if (okA) {
+         freeRunner(&accurate);
+      }
+      if (okB) {
+         freeRunner(&quirk);
+      }
+      free(base);
+      return DIFF_NO_MEMORY;
+   }
+   Machine *a = accurate.m;
+   Machine *b = quirk.m;
+   a->bugMode = false;
+   b->bugMode = true;
+   a->enableStateHash(true);
+   b->enableStateHash(true);
+   restoreRunner(&accurate, opts->input, opts->inputLen);
+   restoreRunner(&quirk, opts->input, opts->inputLen);
+
+   while (stats->insns < opts->maxInsns) {
+      unsigned short site = a->cpu.general[PC];
+      unsigned short opcode = a->readWord(site);
+      a->executeInstruction();
+      b->executeInstruction();
+      stats->insns++;
+      if (a->stopReason != b->stopReason || a->stateHash() != b->stateHash()) {
+         stats->diverged = true;
+         stats->site = site;
+         stats->opcode = opcode;
+         for (unsigned int i = 0; i < 16; i++) {
+            stats->accurate[i] = a->cpu.general[i];
+            stats->quirk[i] = b->cpu.general[i];
+            if (stats->accurate[i] != stats->quirk[i]) {
+               stats->regMask |= 1 << i;
+            }
+         }
+         compareMemory(a, b, stats);
+         break;
+      }
+      if (a->stopReason != STOP_NONE) {
+         break;
+      }
+   }
+   stats->reason = a->stopReason;
+   stats->quirkReason = b->stopReason;
+   freeRunner(&accurate);
+   freeRunner(&quirk);
+   free(base);
+   return DIFF_OK;
+}
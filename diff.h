@@ -0,0 +1,67 @@
+/*
+   Headers for MSP430 emulator bug mode differential runs
+   Copyright (c) 2014 Chris Eagle
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation; either version 2 of the License, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+   more details.
+
+   You should have received a copy of the GNU General Public License along with
+   this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+   Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef __DIFF_H
+#define __DIFF_H
+
+#include "msp430defs.h"
+
+//differing memory bytes reported
+#define DIFF_MAX_BYTES 16
+
+struct DiffOptions {
+   const unsigned char *input;   //delivered to the first getsn, may be NULL
+   unsigned int inputLen;
+   unsigned int maxInsns;
+};
+
+struct DiffByte {
+   unsigned short addr;
+   unsigned char accurate;
+   unsigned char quirk;
+};
+
+struct DiffStats {
+   bool diverged;
+   unsigned int insns;           //instructions run, including the diverging one
+   unsigned short site;          //address of the diverging instruction
+   unsigned short opcode;
+   unsigned int reason;          //how the accurate machine stopped, STOP_NONE if it didn't
+   unsigned int quirkReason;     //same for the bug mode machine
+   unsigned int regMask;         //bit n set when rn differs
+   unsigned short accurate[16];  //registers after the diverging instruction
+   unsigned short quirk[16];
+   unsigned int totalBytes;      //memory bytes that differ
+   unsigned int numBytes;        //entries in bytes
+   DiffByte bytes[DIFF_MAX_BYTES];
+};
+
+//status codes returned by diffRun
+enum {
+   DIFF_OK,
+   DIFF_NO_MEMORY
+};
+
+void initDiffOptions(DiffOptions *opts);
+
+//run the current machine state twice in lockstep, accurately and in bug
+//mode, until the two differ, either stops or maxInsns have run
+int diffRun(const DiffOptions *opts, DiffStats *stats);
+
+#endif
@@ -22,12 +22,20 @@
 
 #include "cpu.h"
 #include "emu_script.h"
+#include "hooks.h"
 #include "sdk_versions.h"
 
 #if IDA_SDK_VERSION < 520
 typedef value_t idc_value_t;
 #endif
 
+//idc string type
+#if IDA_SDK_VERSION < 700
+#define IDC_STR VT_STR2
+#else
+#define IDC_STR VT_STR
+#endif
+
 #if IDA_SDK_VERSION >= 700
 
 bool set_idc_func_ex(const char *name, idc_func_t *fp, const char *args, int extfunc_flags) {
@@ -172,6 +180,131 @@ static error_t idaapi idc_emu_addbpt(idc_value_t *argv, idc_value_t *res) {
    return eOk;
 }
 
+/*
+ * native implementation of EmuQueueInput.  Queues a string for the
+ * getsn and getchar system calls, hex encoded when the second argument
+ * is non-zero.  Returns the number of queued inputs, or -1 if the input
+ * could not be queued.
+ */
+static error_t idaapi idc_emu_queue_input(idc_value_t *argv, idc_value_t *res) {
+   res->vtype = VT_LONG;
+   res->num = -1;
+   if (argv[0].vtype == IDC_STR && argv[1].vtype == VT_LONG) {
+      const char *data = argv[0].c_str();
+      bool ok = argv[1].num ? emu.queueHexInput(data) : emu.queueInput(data, strlen(data));
+      if (ok) {
+         res->num = emu.input.count;
+      }
+   }
+   return eOk;
+}
+
+/*
+ * native implementation of EmuClearInput.  Discards all queued input.
+ */
+static error_t idaapi idc_emu_clear_input(idc_value_t * /*argv*/, idc_value_t * /*res*/) {
+   emu.clearInput();
+   return eOk;
+}
+
+/*
+ * native implementation of EmuConsole.  Returns the console output still
+ * held by the emulator.
+ */
+static error_t idaapi idc_emu_console(idc_value_t * /*argv*/, idc_value_t *res) {
+   qstring text;
+   emu.flushConsole();
+   emu.consoleText(&text);
+   res->set_string(text.c_str());
+   return eOk;
+}
+
+/*
+ * native implementation of EmuConsoleChunks.  Returns the number of
+ * console chunks (lines, or output between stops) still held.
+ */
+static error_t idaapi idc_emu_console_chunks(idc_value_t * /*argv*/, idc_value_t *res) {
+   emu.flushConsole();
+   res->vtype = VT_LONG;
+   res->num = emu.consoleChunks();
+   return eOk;
+}
+
+/*
+ * native implementation of EmuConsoleChunk.  Returns the text of the
+ * specified chunk, 0 being the oldest, or "" for an invalid chunk.
+ */
+static error_t idaapi idc_emu_console_chunk(idc_value_t *argv, idc_value_t *res) {
+   qstring text;
+   uint64 insn;
+   if (argv[0].vtype != VT_LONG || !emu.consoleChunk((unsigned int)argv[0].num, &insn, &text)) {
+      text.clear();
+   }
+   res->set_string(text.c_str());
+   return eOk;
+}
+
+/*
+ * native implementation of EmuConsoleChunkInsn.  Returns the instruction
+ * count at which the specified chunk was written, or -1 for an invalid
+ * chunk.
+ */
+static error_t idaapi idc_emu_console_chunk_insn(idc_value_t *argv, idc_value_t *res) {
+   qstring text;
+   uint64 insn;
+   res->vtype = VT_LONG;
+   res->num = -1;
+   if (argv[0].vtype == VT_LONG && emu.consoleChunk((unsigned int)argv[0].num, &insn, &text)) {
+      res->num = insn;
+   }
+   return eOk;
+}
+
+/*
+ * native implementation of EmuAddHook.  Runs the named native function
+ * (strcpy, memcpy, memset, strlen, puts or INT) whenever pc reaches the
+ * specified address.  Flags are 1 to break after each call and 2 to log
+ * each call.  Returns 1 on success and 0 for an unknown function or when
+ * no more hooks can be added.
+ */
+static error_t idaapi idc_emu_add_hook(idc_value_t *argv, idc_value_t *res) {
+   res->vtype = VT_LONG;
+   res->num = 0;
+   if (argv[0].vtype == VT_LONG && argv[1].vtype == IDC_STR && argv[2].vtype == VT_LONG) {
+      unsigned int addr = (unsigned int)argv[0].num;
+      if (addr < MEM_SIZE) {
+         res->num = addNativeHook(&emu, addr, argv[1].c_str(), (unsigned int)argv[2].num & (HOOK_BREAK | HOOK_LOG));
+      }
+   }
+   return eOk;
+}
+
+/*
+ * native implementation of EmuRemoveHook.  Returns 1 if a hook was removed
+ * from the specified address, otherwise 0.
+ */
+static error_t idaapi idc_emu_remove_hook(idc_value_t *argv, idc_value_t *res) {
+   res->vtype = VT_LONG;
+   res->num = 0;
+   if (argv[0].vtype == VT_LONG && (unsigned int)argv[0].num < MEM_SIZE) {
+      res->num = emu.removeHook((unsigned short)argv[0].num);
+   }
+   return eOk;
+}
+
+/*
+ * native implementation of EmuSyscallCount.  Returns the number of times
+ * the specified system call has been made.
+ */
+static error_t idaapi idc_emu_syscall_count(idc_value_t *argv, idc_value_t *res) {
+   res->vtype = VT_LONG;
+   res->num = 0;
+   if (argv[0].vtype == VT_LONG && (unsigned int)argv[0].num < SYSCALL_NUMBERS) {
+      res->num = emu.syscallCount((unsigned int)argv[0].num);
+   }
+   return eOk;
+}
+
 /*
  * Register new IDC functions for use with the emulator
  */
@@ -180,6 +313,8 @@ void register_funcs() {
 //   static const char idc_str_args[] = { VT_STR, 0 };
    static const char idc_long[] = { VT_LONG, 0 };
    static const char idc_long_long[] = { VT_LONG, VT_LONG, 0 };
+   static const char idc_str_long[] = { IDC_STR, VT_LONG, 0 };
+   static const char idc_long_str_long[] = { VT_LONG, IDC_STR, VT_LONG, 0 };
 #if IDA_SDK_VERSION < 570
    set_idc_func("EmuRun", idc_emu_run, idc_void);
    set_idc_func("EmuTrace", idc_emu_trace, idc_void);
@@ -189,6 +324,15 @@ void register_funcs() {
    set_idc_func("EmuGetReg", idc_emu_getreg, idc_long);
    set_idc_func("EmuSetReg", idc_emu_setreg, idc_long_long);
    set_idc_func("EmuAddBpt", idc_emu_addbpt, idc_long);
+   set_idc_func("EmuQueueInput", idc_emu_queue_input, idc_str_long);
+   set_idc_func("EmuClearInput", idc_emu_clear_input, idc_void);
+   set_idc_func("EmuConsole", idc_emu_console, idc_void);
+   set_idc_func("EmuConsoleChunks", idc_emu_console_chunks, idc_void);
+   set_idc_func("EmuConsoleChunk", idc_emu_console_chunk, idc_long);
+   set_idc_func("EmuConsoleChunkInsn", idc_emu_console_chunk_insn, idc_long);
+   set_idc_func("EmuAddHook", idc_emu_add_hook, idc_long_str_long);
+   set_idc_func("EmuRemoveHook", idc_emu_remove_hook, idc_long);
+   set_idc_func("EmuSyscallCount", idc_emu_syscall_count, idc_long);
 #else
    set_idc_func_ex("EmuRun", idc_emu_run, idc_void, EXTFUN_BASE);
    set_idc_func_ex("EmuTrace", idc_emu_trace, idc_void, EXTFUN_BASE);
@@ -198,6 +342,15 @@ void register_funcs() {
    set_idc_func_ex("EmuGetReg", idc_emu_getreg, idc_long, EXTFUN_BASE);
    set_idc_func_ex("EmuSetReg", idc_emu_setreg, idc_long_long, EXTFUN_BASE);
    set_idc_func_ex("EmuAddBpt", idc_emu_addbpt, idc_long, EXTFUN_BASE);
+   set_idc_func_ex("EmuQueueInput", idc_emu_queue_input, idc_str_long, EXTFUN_BASE);
+   set_idc_func_ex("EmuClearInput", idc_emu_clear_input, idc_void, EXTFUN_BASE);
+   set_idc_func_ex("EmuConsole", idc_emu_console, idc_void, EXTFUN_BASE);
+   set_idc_func_ex("EmuConsoleChunks", idc_emu_console_chunks, idc_void, EXTFUN_BASE);
+   set_idc_func_ex("EmuConsoleChunk", idc_emu_console_chunk, idc_long, EXTFUN_BASE);
+   set_idc_func_ex("EmuConsoleChunkInsn", idc_emu_console_chunk_insn, idc_long, EXTFUN_BASE);
+   set_idc_func_ex("EmuAddHook", idc_emu_add_hook, idc_long_str_long, EXTFUN_BASE);
+   set_idc_func_ex("EmuRemoveHook", idc_emu_remove_hook, idc_long, EXTFUN_BASE);
+   set_idc_func_ex("EmuSyscallCount", idc_emu_syscall_count, idc_long, EXTFUN_BASE);
 #endif
 }
 
@@ -214,6 +367,15 @@ void unregister_funcs() {
    set_idc_func("EmuGetReg", NULL, NULL);
    set_idc_func("EmuSetReg", NULL, NULL);
    set_idc_func("EmuAddBpt", NULL, NULL);
+   set_idc_func("EmuQueueInput", NULL, NULL);
+   set_idc_func("EmuClearInput", NULL, NULL);
+   set_idc_func("EmuConsole", NULL, NULL);
+   set_idc_func("EmuConsoleChunks", NULL, NULL);
+   set_idc_func("EmuConsoleChunk", NULL, NULL);
+   set_idc_func("EmuConsoleChunkInsn", NULL, NULL);
+   set_idc_func("EmuAddHook", NULL, NULL);
+   set_idc_func("EmuRemoveHook", NULL, NULL);
+   set_idc_func("EmuSyscallCount", NULL, NULL);
 #else
    set_idc_func_ex("EmuRun", NULL, NULL, 0);
    set_idc_func_ex("EmuTrace", NULL, NULL, 0);
@@ -223,5 +385,14 @@ void unregister_funcs() {
    set_idc_func_ex("EmuGetReg", NULL, NULL, 0);
    set_idc_func_ex("EmuSetReg", NULL, NULL, 0);
    set_idc_func_ex("EmuAddBpt", NULL, NULL, 0);
+   set_idc_func_ex("EmuQueueInput", NULL, NULL, 0);
+   set_idc_func_ex("EmuClearInput", NULL, NULL, 0);
+   set_idc_func_ex("EmuConsole", NULL, NULL, 0);
+   set_idc_func_ex("EmuConsoleChunks", NULL, NULL, 0);
+   set_idc_func_ex("EmuConsoleChunk", NULL, NULL, 0);
+   set_idc_func_ex("EmuConsoleChunkInsn", NULL, NULL, 0);
+   set_idc_func_ex("EmuAddHook", NULL, NULL, 0);
+   set_idc_func_ex("EmuRemoveHook", NULL, NULL, 0);
+   set_idc_func_ex("EmuSyscallCount", NULL, NULL, 0);
 #endif
 }
@@ -0,0 +1,353 @@
+/*
+   Branch forking path exploration for MSP430 emulator
+   Copyright (c) 2014 Chris Eagle
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation; either version 2 of the License, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+   more details.
+
+   You should have received a copy of the GNU General Public License along with
+   this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+   Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/*
+ * Exploration runs the input with taint tracking on. At each conditional
+ * jump whose flags came from input the cpu calls back here and the machine
+ * is forked: a state taking the other direction is queued while the
+ * current one carries on. States are copy on write with respect to the
+ * input snapshot, holding only the pages (and their taint labels) written
+ * since it was taken. Each worker keeps its own deque, working depth first
+ * from the back, and idle workers steal the oldest states from the front
+ * of another worker's deque. Paths are bounded by the number of forced
+ * branches and states already seen are dropped.
+ *
+ * No solver is involved, so a path that reaches the goal says which
+ * branches (and the input bytes behind them) must change, not the input
+ * that changes them.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+
+#include "cpu.h"
+#include "snapshot.h"
+#include "runner.h"
+#include "explore.h"
+
+struct ExploreState {
+   Registers regs;
+   AuxState aux;
+   TaintMask regTaint[16];
+   bool deliver;              //the first state, input is still to be delivered
+   unsigned int depth;
+   ExploreBranch path[EXPLORE_MAX_DEPTH];
+   unsigned int numPages;
+   TaintMask *labels;         //numPages pages of taint labels
+   unsigned char *data;       //numPages pages of memory
+   unsigned short *pages;     //page numbers
+};
+
+struct ExploreWorker;
+
+struct ExploreShared {
+   const ExploreOptions *opts;
+   const Snapshot *base;
+   ExploreWorker *workers;
+   unsigned int numWorkers;
+   time_t start;
+   std::atomic<bool> stop;
+   std::atomic<int> pending;  //states queued or running
+   std::atomic<unsigned int> created;
+   std::atomic<unsigned int> states;
+   std::atomic<unsigned int> duplicates;
+   std::atomic<unsigned int> pruned;
+   std::atomic<unsigned int> steals;
+   std::mutex seenLock;
+   std::unordered_set<uint64> seen;
+   std::mutex foundLock;
+   ExploreStats *stats;
+};
+
+struct ExploreWorker {
+   ExploreShared *sh;
+   unsigned int id;
+   Runner runner;
+   ExploreState *current;
+   std::mutex lock;           //guards queue
+   std::deque<ExploreState*> queue;
+};
+
+void initExploreOptions(ExploreOptions *opts) {
+   opts->input = NULL;
+   opts->inputLen = 0;
+   opts->target = RUNNER_NO_TARGET;
+   opts->maxDepth = 8;
+   opts->maxStates = 20000;
+   opts->instBudget = 100000;
+   opts->seconds = 0;
+   opts->threads = 0;
+}
+
+static ExploreState *allocState(unsigned int numPages) {
+   size_t size = sizeof(ExploreState) +
+                 numPages * (MEM_PAGE_SIZE * sizeof(TaintMask) + MEM_PAGE_SIZE + sizeof(unsigned short));
+   ExploreState *s = (ExploreState*)malloc(size);
+   if (s) {
+      s->numPages = numPages;
+      s->labels = (TaintMask*)(s + 1);
+      s->data = (unsigned char*)(s->labels + numPages * MEM_PAGE_SIZE);
+      s->pages = (unsigned short*)(s->data + numPages * MEM_PAGE_SIZE);
+   }
+   return s;
+}
+
+static void pushState(ExploreWorker *w, ExploreState *s) {
+   w->sh->pending++;
+   std::lock_guard<std::mutex> guard(w->lock);
+   w->queue.push_back(s);
+}
+
+//the newest state of our own queue, or the oldest of someone else's
+static ExploreState *takeState(ExploreWorker *w) {
+   ExploreShared *sh = w->sh;
+   {
+      std::lock_guard<std::mutex> guard(w->lock);
+      if (!w->queue.empty()) {
+         ExploreState *s = w->queue.back();
+         w->queue.pop_back();
+         return s;
+      }
+   }
+   for (unsigned int i = 1; i < sh->numWorkers; i++) {
+      ExploreWorker *victim = &sh->workers[(w->id + i) % sh->numWorkers];
+      std::lock_guard<std::mutex> guard(victim->lock);
+      if (!victim->queue.empty()) {
+         ExploreState *s = victim->queue.front();
+         victim->queue.pop_front();
+         sh->steals++;
+         return s;
+      }
+   }
+   return NULL;
+}
+
+//ForkHook, queue a copy of the machine heading to otherPc
+static void exploreFork(Machine *m, unsigned short otherPc) {
+   ExploreWorker *w = (ExploreWorker*)((Runner*)m->user)->user;
+   ExploreShared *sh = w->sh;
+   ExploreState *cur = w->current;
+   if (cur->depth >= sh->opts->maxDepth) {
+      sh->pruned++;
+      return;
+   }
+   //the machine keeps its state hash up to date, so checking for a state
+   //seen before costs nothing more than pointing pc at the other side
+   unsigned short fallThrough = m->cpu.general[PC];
+   m->cpu.general[PC] = otherPc;
+   uint64 h = m->stateHash();
+   m->cpu.general[PC] = fallThrough;
+   {
+      std::lock_guard<std::mutex> guard(sh->seenLock);
+      if (!sh->seen.insert(h).second) {
+         sh->duplicates++;
+         return;
+      }
+   }
+   //only new states count against maxStates
+   if (sh->created.fetch_add(1) >= sh->opts->maxStates) {
+      sh->pruned++;
+      return;
+   }
+   unsigned int numPages;
+   const unsigned short *dirty = m->getDirtyPages(&numPages);
+   ExploreState *s = allocState(numPages);
+   if (s == NULL) {
+      sh->pruned++;
+      return;
+   }
+   const unsigned char *mem = m->getFlatMemory();
+   for (unsigned int i = 0; i < numPages; i++) {
+      unsigned int offset = dirty[i] << MEM_PAGE_SHIFT;
+      s->pages[i] = dirty[i];
+      memcpy(s->data + i * MEM_PAGE_SIZE, mem + offset, MEM_PAGE_SIZE);
+      memcpy(s->labels + i * MEM_PAGE_SIZE, m->taint->mem + offset, MEM_PAGE_SIZE * sizeof(TaintMask));
+   }
+   memcpy(&s->regs, &m->cpu, sizeof(Registers));
+   s->regs.general[PC] = otherPc;
+   memcpy(&s->aux, &m->aux, sizeof(AuxState));
+   memcpy(s->regTaint, m->taint->regs, sizeof(s->regTaint));
+   s->deliver = false;
+   s->depth = cur->depth + 1;
+   memcpy(s->path, cur->path, cur->depth * sizeof(ExploreBranch));
+   ExploreBranch *b = &s->path[cur->depth];
+   b->site = m->cpu.initial_pc;
+   b->dest = otherPc;
+   b->mask = m->taint->regs[SR];
+   pushState(w, s);
+}
+
+static void foundGoal(ExploreShared *sh, const ExploreState *s, unsigned int reason) {
+   std::lock_guard<std::mutex> guard(sh->foundLock);
+   ExploreStats *stats = sh->stats;
+   if (!stats->found) {
+      stats->found = true;
+      stats->reason = reason;
+      stats->depth = s->depth;
+      memcpy(stats->path, s->path, s->depth * sizeof(ExploreBranch));
+   }
+   sh->stop.store(true);
+}
+
+static void runState(ExploreWorker *w, ExploreState *s) {
+   ExploreShared *sh = w->sh;
+   const ExploreOptions *opts = sh->opts;
+   Runner *r = &w->runner;
+   Machine *m = r->m;
+   w->current = s;
+   if (s->deliver) {
+      restoreRunner(r, opts->input, opts->inputLen);
+   }
+   else {
+      m->clearTaint();
+      m->restoreDirtyPages(sh->base->mem);
+      for (unsigned int i = 0; i < s->numPages; i++) {
+         m->loadPage(s->pages[i], s->data + i * MEM_PAGE_SIZE);
+         memcpy(m->taint->mem + (s->pages[i] << MEM_PAGE_SHIFT), s->labels + i * MEM_PAGE_SIZE,
+                MEM_PAGE_SIZE * sizeof(TaintMask));
+      }
+      memcpy(&m->cpu, &s->regs, sizeof(Registers));
+      memcpy(&m->aux, &s->aux, sizeof(AuxState));
+      memcpy(m->taint->regs, s->regTaint, sizeof(s->regTaint));
+      m->stopReason = STOP_NONE;
+      //a second prompt ends the path
+      r->delivered = true;
+   }
+   sh->states++;
+   for (unsigned int n = 0; n < opts->instBudget && !sh->stop.load(std::memory_order_relaxed); n++) {
+      m->executeInstruction();
+      if (m->stopReason != STOP_NONE) {
+         if (m->stopReason == STOP_UNLOCK) {
+            foundGoal(sh, s, STOP_UNLOCK);
+         }
+         break;
+      }
+      if (m->cpu.general[PC] == opts->target) {
+         foundGoal(sh, s, STOP_TARGET);
+         break;
+      }
+   }
+}
+
+static void exploreWorker(void *arg, unsigned int slot) {
+   ExploreWorker *w = (ExploreWorker*)arg + slot;
+   ExploreShared *sh = w->sh;
+   while (!sh->stop.load()) {
+      ExploreState *s = takeState(w);
+      if (s == NULL) {
+         if (sh->pending.load() == 0) {
+            break;
+         }
+         std::this_thread::yield();
+         continue;
+      }
+      runState(w, s);
+      free(s);
+      sh->pending--;
+      if (sh->opts->seconds && (unsigned int)(time(NULL) - sh->start) >= sh->opts->seconds) {
+         sh->stop.store(true);
+      }
+   }
+}
+
+int explore(const ExploreOptions *opts, ExploreStats *stats) {
+   memset(stats, 0, sizeof(ExploreStats));
+   if (opts->inputLen > EXPLORE_MAX_INPUT || opts->maxDepth > EXPLORE_MAX_DEPTH) {
+      return EXPLORE_BAD_OPTIONS;
+   }
+   Snapshot *base = snapshotAtInput(RUNNER_BOOT_BUDGET);
+   if (base == NULL) {
+      return EXPLORE_NO_INPUT;
+   }
+
+   ExploreShared sh;
+   sh.opts = opts;
+   sh.base = base;
+   sh.stats = stats;
+   sh.numWorkers = opts->threads ? opts->threads : hardwareThreads();
+   sh.workers = new ExploreWorker[sh.numWorkers];
+   sh.stop.store(false);
+   sh.pending.store(0);
+   sh.created.store(0);
+   sh.states.store(0);
+   sh.duplicates.store(0);
+   sh.pruned.store(0);
+   sh.steals.store(0);
+   int result = EXPLORE_OK;
+   for (unsigned int i = 0; i < sh.numWorkers; i++) {
+      ExploreWorker *w = &sh.workers[i];
+      w->sh = &sh;
+      w->id = i;
+      w->current = NULL;
+      if (!initRunner(&w->runner, base)) {
+         result = EXPLORE_NO_MEMORY;
+         continue;
+      }
+      w->runner.user = w;
+      w->runner.m->taint = (Taint*)calloc(1, sizeof(Taint));
+      w->runner.m->forkHook = exploreFork;
+      w->runner.m->enableStateHash(true);
+      if (w->runner.m->taint == NULL) {
+         result = EXPLORE_NO_MEMORY;
+      }
+   }
+   ExploreState *root = allocState(0);
+   if (root == NULL) {
+      result = EXPLORE_NO_MEMORY;
+   }
+
+   if (result == EXPLORE_OK) {
+      memset(root, 0, sizeof(ExploreState));
+      root->deliver = true;
+      pushState(&sh.workers[0], root);
+      root = NULL;
+      sh.start = time(NULL);
+      runWorkers(exploreWorker, sh.workers, sh.numWorkers);
+      stats->states = sh.states.load();
+      stats->duplicates = sh.duplicates.load();
+      stats->pruned = sh.pruned.load();
+      stats->steals = sh.steals.load();
+      stats->seconds = (unsigned int)(time(NULL) - sh.start);
+      stats->threads = sh.numWorkers;
+   }
+
+   free(root);
+   for (unsigned int i = 0; i < sh.numWorkers; i++) {
+      ExploreWorker *w = &sh.workers[i];
+      //states left behind when the search stopped early
+      while (!w->queue.empty()) {
+         free(w->queue.back());
+         w->queue.pop_back();
+      }
+      if (w->runner.m) {
+         free(w->runner.m->taint);
+         w->runner.m->taint = NULL;
+      }
+      freeRunner(&w->runner);
+   }
+   delete [] sh.workers;
+   free(base);
+   return result;
+}
@@ -0,0 +1,78 @@
+/*
+   Headers for MSP430 emulator path exploration
+   Copyright (c) 2014 Chris Eagle
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation; either version 2 of the License, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+   more details.
+
+   You should have received a copy of the GNU General Public License along with
+   this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+   Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef __EXPLORE_H
+#define __EXPLORE_H
+
+#include "cpu.h"
+
+//most forced branches recorded along one path
+#define EXPLORE_MAX_DEPTH 32
+
+//longest input the exploration starts from
+#define EXPLORE_MAX_INPUT 256
+
+struct ExploreOptions {
+   const unsigned char *input;   //delivered to the pending getsn
+   unsigned int inputLen;
+   unsigned int target;          //address to reach, RUNNER_NO_TARGET to look for an unlock
+   unsigned int maxDepth;        //forced branches allowed along one path
+   unsigned int maxStates;       //states forked in all
+   unsigned int instBudget;      //instructions each state may run
+   unsigned int seconds;         //wall clock budget, 0 for none
+   unsigned int threads;         //worker count, 0 for one per hardware thread
+};
+
+//a conditional jump sent the way it did not go
+struct ExploreBranch {
+   unsigned short site;
+   unsigned short dest;          //where it was sent
+   TaintMask mask;               //input offsets its flags came from
+};
+
+struct ExploreStats {
+   bool found;
+   unsigned int reason;          //STOP_UNLOCK or STOP_TARGET when found
+   unsigned int depth;           //branches in path
+   ExploreBranch path[EXPLORE_MAX_DEPTH];
+   unsigned int states;          //states run, the first one included
+   unsigned int duplicates;      //forks dropped because the state was seen before
+   unsigned int pruned;          //forks dropped by maxDepth or maxStates
+   unsigned int steals;
+   unsigned int seconds;
+   unsigned int threads;
+};
+
+//status codes returned by explore
+enum {
+   EXPLORE_OK,
+   EXPLORE_NO_INPUT,    //never reached an input syscall
+   EXPLORE_NO_MEMORY,
+   EXPLORE_BAD_OPTIONS  //input too long or maxDepth too large
+};
+
+void initExploreOptions(ExploreOptions *opts);
+
+//run the input with taint tracking and, at each conditional jump whose
+//flags derive from input, fork a state that takes the other direction.
+//States are run by a work stealing pool until one opens the lock or
+//reaches the target, or none are left
+int explore(const ExploreOptions *opts, ExploreStats *stats);
+
+#endif
@@ -0,0 +1,342 @@
+/*
+   Fault injection campaigns for MSP430 emulator
+   Copyright (c) 2014 Chris Eagle
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation; either version 2 of the License, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+   more details.
+
+   You should have received a copy of the GNU General Public License along with
+   this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+   Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/*
+ * A campaign first runs the input without faults and records the address
+ * of every instruction it executes. Each fault is tied to a point in that
+ * run: instruction skips to the n'th execution of an address, bit flips to
+ * an instruction count. The fault space is the concatenation of the
+ * selected models and is numbered, so a campaign either walks every index
+ * or draws random ones, and workers decode indices on the fly rather than
+ * materializing millions of faults.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <atomic>
+#include <mutex>
+
+#include "cpu.h"
+#include "snapshot.h"
+#include "runner.h"
+#include "triage.h"
+#include "fault.h"
+
+//a faulted run gets this many times the unfaulted instruction count, plus
+//FAULT_HANG_SLACK, before it is called hung
+#define FAULT_HANG_FACTOR 2
+#define FAULT_HANG_SLACK 1000
+
+//registers worth flipping, r3 only generates constants
+static const unsigned char flipRegs[] = {0, 1, 2, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
+#define FLIP_REGS (sizeof(flipRegs) / sizeof(flipRegs[0]))
+
+struct FaultShared {
+   const FaultOptions *opts;
+   unsigned int goldenInsns;
+   unsigned int goldenReason;
+   unsigned int goldenPc;
+   unsigned short *pcs;    //address of each unfaulted instruction
+   unsigned int *nth;      //how many times that address had executed, 1 based
+   uint64 spaces[3];       //faults in each model, 0 when not selected
+   uint64 space;
+   uint64 runs;            //indices to walk or samples to draw
+   unsigned int budget;
+   time_t start;
+   std::atomic<uint64> next;
+   std::atomic<bool> stop;
+   std::mutex lock;        //guards the unlock report
+   uint64 unlockIdx[FAULT_MAX_REPORT];
+   FaultStats *stats;
+};
+
+struct FaultWorker {
+   FaultShared *sh;
+   Runner runner;
+   uint64 runs;
+   uint64 outcomes[FAULT_OUTCOMES];
+};
+
+const char *faultOutcomeName(unsigned int outcome) {
+   static const char *names[FAULT_OUTCOMES] = {
+      "unchanged", "unlocked", "crashed", "hung"
+   };
+   return outcome < FAULT_OUTCOMES ? names[outcome] : "unknown";
+}
+
+void initFaultOptions(FaultOptions *opts) {
+   opts->models = FAULT_MODEL(FAULT_SKIP) | FAULT_MODEL(FAULT_REG_FLIP);
+   opts->input = NULL;
+   opts->inputLen = 0;
+   opts->memLow = 0;
+   opts->memHigh = 0;
+   opts->samples = 0;
+   opts->seed = 1;
+   opts->maxInsns = 1000000;
+   opts->seconds = 0;
+   opts->threads = 0;
+}
+
+//decode fault number idx of the campaign
+static void faultAt(const FaultShared *sh, uint64 idx, Fault *f) {
+   unsigned int kind = FAULT_SKIP;
+   while (idx >= sh->spaces[kind]) {
+      idx -= sh->spaces[kind];
+      kind++;
+   }
+   f->kind = kind;
+   switch (kind) {
+      case FAULT_SKIP:
+         f->target = sh->pcs[idx];
+         f->when = sh->nth[idx];
+         f->bit = 0;
+         break;
+      case FAULT_REG_FLIP:
+         f->bit = idx % 16;
+         f->target = flipRegs[(idx / 16) % FLIP_REGS];
+         f->when = (unsigned int)(idx / (16 * FLIP_REGS)) + 1;
+         break;
+      case FAULT_MEM_FLIP: {
+         unsigned int range = sh->opts->memHigh - sh->opts->memLow + 1;
+         f->bit = idx % 8;
+         f->target = sh->opts->memLow + (unsigned int)((idx / 8) % range);
+         f->when = (unsigned int)(idx / (8 * (uint64)range)) + 1;
+         break;
+      }
+   }
+}
+
+//run the input from the snapshot under fault f, returns the stop reason
+static unsigned int runFaulted(Runner *r, const Fault *f, const FaultOptions *opts, unsigned int budget) {
+   Machine *m = r->m;
+   restoreRunner(r, opts->input, opts->inputLen);
+   unsigned int hits = 0;
+   bool fired = false;
+   LoopCheck loop;
+   memset(&loop, 0, sizeof(loop));
+   for (unsigned int n = 0; n < budget; ) {
+      unsigned short addr = m->cpu.general[PC];
+      if (f->kind == FAULT_SKIP && addr == f->target && ++hits == f->when) {
+         if (addr == SYSCALL_ADDR) {
+            //a skipped system call returns without doing anything
+            m->cpu.general[PC] = m->pop();
+         }
+         else {
+            m->cpu.general[PC] = addr + m->instructionLength(addr);
+         }
+         fired = true;
+         initLoopCheck(&loop, m);
+      }
+      else {
+         m->executeInstruction();
+         if (m->stopReason != STOP_NONE) {
+            return m->stopReason;
+         }
+         if (fired && loopCheck(&loop, m)) {
+            //nothing else can change once the fault is in, so it never ends
+            return STOP_LOOP;
+         }
+      }
+      n++;
+      if (n == f->when && f->kind != FAULT_SKIP) {
+         if (f->kind == FAULT_REG_FLIP) {
+            m->cpu.general[f->target] ^= 1 << f->bit;
+         }
+         else {
+            m->writeByte(f->target, m->readByte(f->target) ^ (1 << f->bit));
+         }
+         fired = true;
+         initLoopCheck(&loop, m);
+      }
+   }
+   return STOP_BUDGET;
+}
+
+static unsigned int classify(const FaultShared *sh, unsigned int reason, unsigned int stopPc) {
+   //an input that already unlocks can't be faulted into unlocking
+   if (reason == STOP_UNLOCK && sh->goldenReason != STOP_UNLOCK) {
+      return FAULT_UNLOCKED;
+   }
+   if (reason == STOP_BUDGET || reason == STOP_LOOP) {
+      return FAULT_HUNG;
+   }
+   if (isCrashReason(reason) && (reason != sh->goldenReason || stopPc != sh->goldenPc)) {
+      return FAULT_CRASHED;
+   }
+   return FAULT_UNCHANGED;
+}
+
+//keep the unlocking faults with the lowest run numbers so the report does
+//not depend on thread timing
+static void reportUnlock(FaultShared *sh, uint64 k, const Fault *f) {
+   std::lock_guard<std::mutex> guard(sh->lock);
+   FaultStats *stats = sh->stats;
+   unsigned int j = stats->numUnlocks;
+   if (j == FAULT_MAX_REPORT) {
+      if (sh->unlockIdx[j - 1] < k) {
+         return;
+      }
+      j--;
+   }
+   else {
+      stats->numUnlocks++;
+   }
+   while (j > 0 && sh->unlockIdx[j - 1] > k) {
+      sh->unlockIdx[j] = sh->unlockIdx[j - 1];
+      stats->unlocks[j] = stats->unlocks[j - 1];
+      j--;
+   }
+   sh->unlockIdx[j] = k;
+   stats->unlocks[j] = *f;
+}
+
+//splitmix64
+static uint64 sampleIndex(uint64 seed, uint64 k) {
+   uint64 z = seed + (k + 1) * 0x9E3779B97F4A7C15ULL;
+   z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+   z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+   return z ^ (z >> 31);
+}
+
+static void faultWorker(void *arg, unsigned int slot) {
+   FaultWorker *w = (FaultWorker*)arg + slot;
+   FaultShared *sh = w->sh;
+   const FaultOptions *opts = sh->opts;
+   while (!sh->stop.load(std::memory_order_relaxed)) {
+      uint64 k = sh->next.fetch_add(1, std::memory_order_relaxed);
+      if (k >= sh->runs) {
+         break;
+      }
+      Fault f;
+      faultAt(sh, opts->samples ? sampleIndex(opts->seed, k) % sh->space : k, &f);
+      unsigned int reason = runFaulted(&w->runner, &f, opts, sh->budget);
+      unsigned int outcome = classify(sh, reason, w->runner.m->cpu.initial_pc);
+      w->outcomes[outcome]++;
+      w->runs++;
+      if (outcome == FAULT_UNLOCKED) {
+         reportUnlock(sh, k, &f);
+      }
+      if (opts->seconds && (w->runs & 0xff) == 0 &&
+          (unsigned int)(time(NULL) - sh->start) >= opts->seconds) {
+         sh->stop.store(true);
+      }
+   }
+}
+
+//run the input unfaulted, recording the address of each instruction.
+//seen counts executions of each address. returns false if it does not
+//stop within maxInsns
+static bool goldenRun(FaultShared *sh, Runner *r, unsigned int *seen) {
+   const FaultOptions *opts = sh->opts;
+   Machine *m = r->m;
+   restoreRunner(r, opts->input, opts->inputLen);
+   unsigned int n;
+   for (n = 0; n < opts->maxInsns; ) {
+      unsigned short addr = m->cpu.general[PC];
+      sh->pcs[n] = addr;
+      sh->nth[n] = ++seen[addr];
+      m->executeInstruction();
+      n++;
+      if (m->stopReason != STOP_NONE) {
+         break;
+      }
+   }
+   sh->goldenInsns = n;
+   sh->goldenReason = m->stopReason;
+   sh->goldenPc = m->cpu.initial_pc;
+   return m->stopReason != STOP_NONE;
+}
+
+int faultCampaign(const FaultOptions *opts, FaultStats *stats) {
+   memset(stats, 0, sizeof(FaultStats));
+   if ((opts->models & (FAULT_MODEL(FAULT_SKIP) | FAULT_MODEL(FAULT_REG_FLIP) | FAULT_MODEL(FAULT_MEM_FLIP))) == 0 ||
+       ((opts->models & FAULT_MODEL(FAULT_MEM_FLIP)) && (opts->memLow > opts->memHigh || opts->memHigh >= MEM_SIZE)) ||
+       opts->inputLen > FAULT_MAX_INPUT || opts->maxInsns == 0) {
+      return FAULT_BAD_OPTIONS;
+   }
+   Snapshot *base = snapshotAtInput(RUNNER_BOOT_BUDGET);
+   if (base == NULL) {
+      return FAULT_NO_INPUT;
+   }
+
+   FaultShared sh;
+   sh.opts = opts;
+   sh.stats = stats;
+   sh.pcs = (unsigned short*)malloc(opts->maxInsns * sizeof(unsigned short));
+   sh.nth = (unsigned int*)malloc(opts->maxInsns * sizeof(unsigned int));
+   unsigned int *seen = (unsigned int*)calloc(MEM_SIZE, sizeof(unsigned int));
+   unsigned int numWorkers = opts->threads ? opts->threads : hardwareThreads();
+   FaultWorker *workers = new FaultWorker[numWorkers];
+   int result = FAULT_OK;
+   for (unsigned int i = 0; i < numWorkers; i++) {
+      memset(workers[i].outcomes, 0, sizeof(workers[i].outcomes));
+      workers[i].runs = 0;
+      workers[i].sh = &sh;
+      if (!initRunner(&workers[i].runner, base)) {
+         result = FAULT_NO_MEMORY;
+         continue;
+      }
+      workers[i].runner.m->enableStateHash(true);
+   }
+   if (sh.pcs == NULL || sh.nth == NULL || seen == NULL) {
+      result = FAULT_NO_MEMORY;
+   }
+   else if (result == FAULT_OK && !goldenRun(&sh, &workers[0].runner, seen)) {
+      result = FAULT_NO_END;
+   }
+
+   if (result == FAULT_OK) {
+      uint64 insns = sh.goldenInsns;
+      sh.spaces[FAULT_SKIP] = (opts->models & FAULT_MODEL(FAULT_SKIP)) ? insns : 0;
+      sh.spaces[FAULT_REG_FLIP] = (opts->models & FAULT_MODEL(FAULT_REG_FLIP)) ? insns * FLIP_REGS * 16 : 0;
+      sh.spaces[FAULT_MEM_FLIP] = (opts->models & FAULT_MODEL(FAULT_MEM_FLIP)) ?
+                                  insns * (opts->memHigh - opts->memLow + 1) * 8 : 0;
+      sh.space = sh.spaces[FAULT_SKIP] + sh.spaces[FAULT_REG_FLIP] + sh.spaces[FAULT_MEM_FLIP];
+      sh.runs = opts->samples ? opts->samples : sh.space;
+      sh.budget = sh.goldenInsns * FAULT_HANG_FACTOR + FAULT_HANG_SLACK;
+      sh.start = time(NULL);
+      sh.next.store(0);
+      sh.stop.store(false);
+
+      runWorkers(faultWorker, workers, numWorkers);
+
+      for (unsigned int i = 0; i < numWorkers; i++) {
+         stats->runs += workers[i].runs;
+         for (unsigned int j = 0; j < FAULT_OUTCOMES; j++) {
+            stats->outcomes[j] += workers[i].outcomes[j];
+         }
+      }
+      stats->goldenReason = sh.goldenReason;
+      stats->goldenInsns = sh.goldenInsns;
+      stats->space = sh.space;
+      stats->seconds = (unsigned int)(time(NULL) - sh.start);
+      stats->threads = numWorkers;
+   }
+
+   for (unsigned int i = 0; i < numWorkers; i++) {
+      freeRunner(&workers[i].runner);
+   }
+   delete [] workers;
+   free(sh.pcs);
+   free(sh.nth);
+   free(seen);
+   free(base);
+   return result;
+}
@@ -0,0 +1,99 @@
+/*
+   Headers for MSP430 emulator fault injection
+   Copyright (c) 2014 Chris Eagle
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation; either version 2 of the License, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+   more details.
+
+   You should have received a copy of the GNU General Public License along with
+   this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+   Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef __FAULT_H
+#define __FAULT_H
+
+#include "msp430defs.h"
+#include "snapshot.h"
+
+//unlocking faults reported by a campaign
+#define FAULT_MAX_REPORT 16
+
+//longest input a campaign runs under
+#define FAULT_MAX_INPUT 256
+
+//fault models
+enum {
+   FAULT_SKIP,       // skip the instruction at target on its when'th execution
+   FAULT_REG_FLIP,   // flip bit of register target after instruction when
+   FAULT_MEM_FLIP    // flip bit of the byte at target after instruction when
+};
+
+//fault model selection bits for FaultOptions.models
+#define FAULT_MODEL(k) (1 << (k))
+
+struct Fault {
+   unsigned short kind;
+   unsigned short bit;
+   unsigned int target;
+   unsigned int when;      //1 based
+};
+
+//outcome of one faulted run, compared with the unfaulted run
+enum {
+   FAULT_UNCHANGED,  // no unlock, no new crash and no hang
+   FAULT_UNLOCKED,   // unlocked where the unfaulted run did not
+   FAULT_CRASHED,    // a crash reason, or the cpu stopped somewhere new
+   FAULT_HUNG,       // looped forever or ran out of its instruction budget
+   FAULT_OUTCOMES
+};
+
+struct FaultOptions {
+   unsigned int models;          //FAULT_MODEL bits
+   const unsigned char *input;   //delivered to the pending getsn
+   unsigned int inputLen;
+   unsigned int memLow;          //bytes flipped by FAULT_MEM_FLIP
+   unsigned int memHigh;
+   uint64 samples;               //faults drawn at random, 0 for every fault
+   unsigned int seed;
+   unsigned int maxInsns;        //limit on the unfaulted run
+   unsigned int seconds;         //wall clock budget, 0 for none
+   unsigned int threads;         //worker count, 0 for one per hardware thread
+};
+
+struct FaultStats {
+   unsigned int goldenReason;    //how the unfaulted run stopped
+   unsigned int goldenInsns;
+   uint64 space;                 //faults in the selected models
+   uint64 runs;
+   uint64 outcomes[FAULT_OUTCOMES];
+   unsigned int numUnlocks;      //entries in unlocks
+   Fault unlocks[FAULT_MAX_REPORT];
+   unsigned int seconds;
+   unsigned int threads;
+};
+
+//status codes returned by faultCampaign
+enum {
+   FAULT_OK,
+   FAULT_NO_INPUT,      //never reached an input syscall
+   FAULT_NO_MEMORY,
+   FAULT_BAD_OPTIONS,   //no models, bad memory range or input too long
+   FAULT_NO_END         //the unfaulted run did not stop within maxInsns
+};
+
+const char *faultOutcomeName(unsigned int outcome);
+void initFaultOptions(FaultOptions *opts);
+
+//run the input once unfaulted, then under every fault of the selected
+//models (or samples of them) in parallel, tallying the outcomes
+int faultCampaign(const FaultOptions *opts, FaultStats *stats);
+
+#endif
@@ -0,0 +1,521 @@
+/*
+   Coverage guided input fuzzer for MSP430 emulator
+   Copyright (c) 2014 Chris Eagle
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation; either version 2 of the License, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+   more details.
+
+   You should have received a copy of the GNU General Public License along with
+   this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+   Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/*
+ * The fuzzer runs a flat copy of the machine up to the first input (getsn)
+ * system call and snapshots it there. One worker per thread then restores
+ * only the pages dirtied by its previous run, hands a mutated input to the
+ * getsn syscall and runs until the cpu asks to stop. Workers share a
+ * virgin coverage map updated with relaxed atomics. Inputs reaching new
+ * edges are appended to the finding worker's corpus, which the other
+ * workers steal parents from.
+ *
+ * Each new corpus entry is also run once with comparison logging on. For
+ * every logged cmp/sub the input is retried with each occurrence of one
+ * operand replaced by the other, which solves magic value and password
+ * checks a byte or word at a time.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <atomic>
+
+#include "cpu.h"
+#include "snapshot.h"
+#include "runner.h"
+#include "triage.h"
+#include "fuzz.h"
+
+struct FuzzInput {
+   unsigned char *data;
+   unsigned int len;
+};
+
+struct FuzzWorker;
+
+//state shared by all workers
+struct FuzzShared {
+   const FuzzOptions *opts;
+   const Snapshot *base;
+   unsigned int maxLen;
+   unsigned int execBudget;       //per worker share of maxExecs
+   time_t start;
+   std::atomic<unsigned char> *virgin;
+   std::atomic<unsigned int> edges;
+   std::atomic<bool> stop;
+   FuzzWorker *workers;
+   unsigned int numWorkers;
+   TriageIndex *triage;           //crash buckets in outDir, may be NULL
+};
+
+//crash buckets a worker has already filed, so that repeats of a known
+//crash don't go near the shared index
+#define FUZZ_KNOWN_CRASHES 64
+
+//per thread state. The corpus is append only, an entry is published by
+//bumping corpusCount so that other workers can read it without locks.
+//Statistics are only ever written by the owning worker.
+struct FuzzWorker {
+   unsigned int id;
+   FuzzShared *shared;
+   Runner runner;
+   unsigned char *cov;
+   unsigned int rng;
+   unsigned char testCase[FUZZ_MAX_INPUT];
+   unsigned int testLen;
+   FuzzInput *corpus;
+   std::atomic<unsigned int> corpusCount;
+   unsigned int cmpLogNext;       //next own corpus entry for the cmplog stage
+   CmpLog *cmps;
+   std::atomic<unsigned int> execs;
+   std::atomic<unsigned int> unlocks;
+   std::atomic<unsigned int> crashes;
+   std::atomic<unsigned int> hangs;
+   std::atomic<unsigned int> splices;
+   unsigned int knownCrashes[FUZZ_KNOWN_CRASHES];
+   unsigned int numKnown;
+};
+
+static unsigned char countClass[256];
+
+static const unsigned char interesting[] = {
+   0, 1, 0x7f, 0x80, 0xff, 0x10, 0x20, 0x40, '0', 'A', 'a', '\n'
+};
+
+//xorshift32
+static unsigned int rnd(FuzzWorker *w, unsigned int limit) {
+   w->rng ^= w->rng << 13;
+   w->rng ^= w->rng >> 17;
+   w->rng ^= w->rng << 5;
+   return limit ? w->rng % limit : 0;
+}
+
+//bucket hit counts so that loop iteration counts don't each look new
+static void initCountClass() {
+   countClass[0] = 0;
+   countClass[1] = 1;
+   countClass[2] = 2;
+   countClass[3] = 4;
+   for (unsigned int i = 4; i < 256; i++) {
+      if (i < 8) countClass[i] = 8;
+      else if (i < 16) countClass[i] = 16;
+      else if (i < 32) countClass[i] = 32;
+      else if (i < 128) countClass[i] = 64;
+      else countClass[i] = 128;
+   }
+}
+
+static void addToCorpus(FuzzWorker *w, const unsigned char *data, unsigned int len) {
+   unsigned int n = w->corpusCount.load(std::memory_order_relaxed);
+   if (n == FUZZ_MAX_CORPUS) {
+      return;
+   }
+   FuzzInput *fi = &w->corpus[n];
+   fi->data = (unsigned char*)malloc(len ? len : 1);
+   memcpy(fi->data, data, len);
+   fi->len = len;
+   w->corpusCount.store(n + 1, std::memory_order_release);
+}
+
+//pick a parent, mostly from our own corpus but sometimes stolen from
+//another worker
+static FuzzInput *pickInput(FuzzWorker *w) {
+   FuzzShared *sh = w->shared;
+   FuzzWorker *src = w;
+   if (sh->numWorkers > 1 && rnd(w, 8) == 0) {
+      src = &sh->workers[rnd(w, sh->numWorkers)];
+   }
+   unsigned int n = src->corpusCount.load(std::memory_order_acquire);
+   if (n == 0) {
+      src = w;
+      n = w->corpusCount.load(std::memory_order_relaxed);
+   }
+   return &src->corpus[rnd(w, n)];
+}
+
+//fold this run's coverage into the shared virgin map. returns 2 if a new
+//edge was seen, 1 for a new hit count bucket on a known edge, else 0
+static unsigned int newCoverage(FuzzWorker *w) {
+   unsigned int result = 0;
+   std::atomic<unsigned char> *virgin = w->shared->virgin;
+   uint64 *cur = (uint64*)w->cov;
+   for (unsigned int i = 0; i < COVERAGE_MAP_SIZE / sizeof(uint64); i++) {
+      if (cur[i] == 0) {
+         continue;
+      }
+      unsigned char *c = (unsigned char*)&cur[i];
+      for (unsigned int j = 0; j < sizeof(uint64); j++) {
+         unsigned char bucket = countClass[c[j]];
+         std::atomic<unsigned char> *v = &virgin[i * sizeof(uint64) + j];
+         if (bucket & v->load(std::memory_order_relaxed)) {
+            //only the worker that actually clears the bits counts them
+            unsigned char old = v->fetch_and(~bucket, std::memory_order_relaxed);
+            if (old & bucket) {
+               if (old == 0xff) {
+                  w->shared->edges.fetch_add(1, std::memory_order_relaxed);
+                  result = 2;
+               }
+               else if (result == 0) {
+                  result = 1;
+               }
+            }
+         }
+      }
+   }
+   return result;
+}
+
+static void havoc(FuzzWorker *w) {
+   unsigned int maxLen = w->shared->maxLen;
+   unsigned char *testCase = w->testCase;
+   unsigned int ops = 1 << (1 + rnd(w, 4));
+   for (unsigned int i = 0; i < ops; i++) {
+      unsigned int testLen = w->testLen;
+      switch (rnd(w, 9)) {
+         case 0:  //flip a bit
+            if (testLen) testCase[rnd(w, testLen)] ^= 1 << rnd(w, 8);
+            break;
+         case 1:  //random byte
+            if (testLen) testCase[rnd(w, testLen)] = rnd(w, 256);
+            break;
+         case 2:  //interesting byte
+            if (testLen) testCase[rnd(w, testLen)] = interesting[rnd(w, sizeof(interesting))];
+            break;
+         case 3:  //small arithmetic
+            if (testLen) testCase[rnd(w, testLen)] += rnd(w, 35) - 17;
+            break;
+         case 4:  //insert a byte
+            if (testLen < maxLen) {
+               unsigned int pos = rnd(w, testLen + 1);
+               memmove(testCase + pos + 1, testCase + pos, testLen - pos);
+               testCase[pos] = rnd(w, 256);
+               w->testLen++;
+            }
+            break;
+         case 5:  //delete a byte
+            if (testLen > 1) {
+               unsigned int pos = rnd(w, testLen);
+               memmove(testCase + pos, testCase + pos + 1, testLen - pos - 1);
+               w->testLen--;
+            }
+            break;
+         case 6:  //overwrite with a chunk from elsewhere in the input
+            if (testLen > 1) {
+               unsigned int len = 1 + rnd(w, testLen - 1);
+               unsigned int from = rnd(w, testLen - len + 1);
+               unsigned int to = rnd(w, testLen - len + 1);
+               memmove(testCase + to, testCase + from, len);
+            }
+            break;
+         case 7: {  //splice in the tail of another corpus entry
+            FuzzInput *other = pickInput(w);
+            if (other->len) {
+               unsigned int from = rnd(w, other->len);
+               unsigned int to = rnd(w, testLen + 1);
+               unsigned int len = other->len - from;
+               if (to + len > maxLen) {
+                  len = maxLen - to;
+               }
+               memcpy(testCase + to, other->data + from, len);
+               if (to + len > testLen) {
+                  w->testLen = to + len;
+               }
+            }
+            break;
+         }
+         case 8:  //printable character
+            if (testLen) testCase[rnd(w, testLen)] = 0x20 + rnd(w, 0x5f);
+            break;
+      }
+   }
+}
+
+static void saveInput(FuzzWorker *w, const char *kind, unsigned int addr) {
+   char path[1024];
+   const char *dir = w->shared->opts->outDir;
+   if (dir == NULL) {
+      return;
+   }
+   ::qsnprintf(path, sizeof(path), "%s" aDIR_SEP "%s_%02u_%06u_%04x", dir, kind, w->id,
+               w->execs.load(std::memory_order_relaxed), addr);
+   FILE *f = fopen(path, "wb");
+   if (f) {
+      fwrite(w->testCase, 1, w->testLen, f);
+      fclose(f);
+   }
+}
+
+//file a crash in the triage index when it reached new coverage or is the
+//first of its bucket this worker has seen
+static void fileCrash(FuzzWorker *w, unsigned int reason, unsigned int fresh) {
+   FuzzShared *sh = w->shared;
+   if (sh->triage == NULL) {
+      return;
+   }
+   Machine *m = w->runner.m;
+   unsigned int hash = crashHash(m);
+   unsigned int key = hash ^ (reason * 0x9E3779B9);
+   bool known = false;
+   for (unsigned int i = 0; i < w->numKnown; i++) {
+      if (w->knownCrashes[i] == key) {
+         known = true;
+         break;
+      }
+   }
+   if (known && !fresh) {
+      return;
+   }
+   if (!known && w->numKnown < FUZZ_KNOWN_CRASHES) {
+      w->knownCrashes[w->numKnown++] = key;
+   }
+   triageCrash(sh->triage, reason, hash, m->cpu.initial_pc, w->testCase, w->testLen);
+}
+
+//counters have a single writer so a relaxed load/store pair is enough
+static void bump(std::atomic<unsigned int> &counter) {
+   counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+//run the current test case and file it by result. returns nonzero when
+//it reached new coverage
+static unsigned int evaluate(FuzzWorker *w) {
+   FuzzShared *sh = w->shared;
+   const FuzzOptions *opts = sh->opts;
+   Runner *r = &w->runner;
+   unsigned int reason = runInput(r, w->testCase, w->testLen, opts->instBudget);
+   bump(w->execs);
+   unsigned int fresh = newCoverage(w);
+   if (fresh) {
+      addToCorpus(w, w->testCase, w->testLen);
+   }
+   switch (reason) {
+      case STOP_UNLOCK:
+         bump(w->unlocks);
+         if (fresh || w->unlocks.load(std::memory_order_relaxed) == 1) {
+            saveInput(w, "unlock", r->m->cpu.initial_pc);
+         }
+         if (opts->stopOnUnlock) {
+            sh->stop.store(true, std::memory_order_relaxed);
+         }
+         break;
+      case STOP_CPUOFF:
+         //main returned, an ordinary failed attempt
+         break;
+      case STOP_BUDGET: case STOP_LOOP:
+         bump(w->hangs);
+         if (fresh) {
+            saveInput(w, "hang", r->m->cpu.initial_pc);
+         }
+         break;
+      default:
+         if (isCrashReason(reason)) {
+            bump(w->crashes);
+            fileCrash(w, reason, fresh);
+         }
+         break;
+   }
+   return fresh;
+}
+
+//input to state replacement for one of our own corpus entries
+static void cmpLogStage(FuzzWorker *w, const FuzzInput *fi) {
+   FuzzShared *sh = w->shared;
+   Runner *r = &w->runner;
+   CmpLog *log = w->cmps;
+   log->count = 0;
+   r->m->cmpLog = log;
+   runInput(r, fi->data, fi->len, sh->opts->instBudget);
+   r->m->cmpLog = NULL;
+   bump(w->execs);
+
+   unsigned int n = log->count < CMPLOG_ENTRIES ? log->count : CMPLOG_ENTRIES;
+   unsigned int trials = 0;
+   for (unsigned int i = 0; i < n; i++) {
+      const CmpLogEntry *e = &log->entries[i];
+      if (e->kind == CMPLOG_HSM) {
+         //the expected password lives in the hsm, nothing to splice
+         continue;
+      }
+      unsigned int size = e->kind == CMPLOG_BYTE ? 1 : 2;
+      for (unsigned int dir = 0; dir < 2; dir++) {
+         unsigned short from = dir ? e->op2 : e->op1;
+         unsigned short to = dir ? e->op1 : e->op2;
+         for (unsigned int pos = 0; pos + size <= fi->len; pos++) {
+            if (fi->data[pos] != (from & 0xff) || (size == 2 && fi->data[pos + 1] != (from >> 8))) {
+               continue;
+            }
+            if (trials++ == FUZZ_CMPLOG_TRIALS || sh->stop.load(std::memory_order_relaxed)) {
+               return;
+            }
+            memcpy(w->testCase, fi->data, fi->len);
+            w->testLen = fi->len;
+            w->testCase[pos] = (unsigned char)to;
+            if (size == 2) {
+               w->testCase[pos + 1] = (unsigned char)(to >> 8);
+            }
+            if (evaluate(w)) {
+               bump(w->splices);
+            }
+         }
+      }
+   }
+}
+
+static void fuzzWorker(void *arg, unsigned int slot) {
+   FuzzWorker *w = (FuzzWorker*)arg + slot;
+   FuzzShared *sh = w->shared;
+   const FuzzOptions *opts = sh->opts;
+   Runner *r = &w->runner;
+   r->m->coverageMap = w->cov;
+
+   for (unsigned int n = 0; !sh->stop.load(std::memory_order_relaxed); n++) {
+      if (sh->execBudget && w->execs.load(std::memory_order_relaxed) >= sh->execBudget) {
+         break;
+      }
+      if ((n & 0x3ff) == 0 && opts->seconds &&
+          (unsigned int)(time(NULL) - sh->start) >= opts->seconds) {
+         break;
+      }
+      if (opts->cmpLog && w->cmpLogNext < w->corpusCount.load(std::memory_order_relaxed)) {
+         cmpLogStage(w, &w->corpus[w->cmpLogNext++]);
+         continue;
+      }
+      FuzzInput *parent = pickInput(w);
+      memcpy(w->testCase, parent->data, parent->len);
+      w->testLen = parent->len;
+      havoc(w);
+      evaluate(w);
+   }
+}
+
+void initFuzzOptions(FuzzOptions *opts) {
+   opts->seconds = 60;
+   opts->maxExecs = 0;
+   opts->instBudget = 100000;
+   opts->seed = 0;
+   opts->threads = 0;
+   opts->stopOnUnlock = true;
+   opts->cmpLog = true;
+   opts->cmpLogSites = NULL;
+   opts->outDir = NULL;
+}
+
+int fuzz(const FuzzOptions *opts, FuzzStats *stats) {
+   memset(stats, 0, sizeof(FuzzStats));
+
+   Snapshot *base = snapshotAtInput(RUNNER_BOOT_BUDGET);
+   if (base == NULL) {
+      return FUZZ_NO_INPUT;
+   }
+
+   FuzzShared sh;
+   sh.opts = opts;
+   sh.base = base;
+   sh.maxLen = inputLimit(base);
+   if (sh.maxLen > FUZZ_MAX_INPUT) {
+      sh.maxLen = FUZZ_MAX_INPUT;
+   }
+   sh.numWorkers = opts->threads ? opts->threads : hardwareThreads();
+   sh.execBudget = opts->maxExecs ? (opts->maxExecs + sh.numWorkers - 1) / sh.numWorkers : 0;
+   sh.start = time(NULL);
+   sh.edges.store(0);
+   sh.stop.store(false);
+   sh.virgin = new std::atomic<unsigned char>[COVERAGE_MAP_SIZE];
+   for (unsigned int i = 0; i < COVERAGE_MAP_SIZE; i++) {
+      sh.virgin[i].store(0xff, std::memory_order_relaxed);
+   }
+   sh.workers = new FuzzWorker[sh.numWorkers];
+   sh.triage = opts->outDir ? openTriageIndex(opts->outDir) : NULL;
+   initCountClass();
+
+   int result = FUZZ_OK;
+   unsigned int seed = opts->seed ? opts->seed : (unsigned int)sh.start;
+   for (unsigned int i = 0; i < sh.numWorkers; i++) {
+      FuzzWorker *w = &sh.workers[i];
+      w->id = i;
+      w->shared = &sh;
+      w->rng = (seed + i * 0x9E3779B9) | 1;
+      w->corpusCount.store(0);
+      w->execs.store(0);
+      w->unlocks.store(0);
+      w->crashes.store(0);
+      w->hangs.store(0);
+      w->splices.store(0);
+      w->numKnown = 0;
+      w->cmpLogNext = 0;
+      w->cmps = (CmpLog*)malloc(sizeof(CmpLog));
+      w->cov = (unsigned char*)malloc(COVERAGE_MAP_SIZE);
+      w->corpus = (FuzzInput*)malloc(FUZZ_MAX_CORPUS * sizeof(FuzzInput));
+      if (!initRunner(&w->runner, base) || w->cov == NULL || w->corpus == NULL || w->cmps == NULL) {
+         result = FUZZ_NO_MEMORY;
+         continue;
+      }
+      w->cmps->sites = opts->cmpLogSites;
+      //every worker starts from the same seed input
+      w->testLen = sh.maxLen < 8 ? sh.maxLen : 8;
+      memset(w->testCase, 'A', w->testLen);
+      w->runner.m->coverageMap = w->cov;
+      w->runner.detectLoops = true;
+      runInput(&w->runner, w->testCase, w->testLen, opts->instBudget);
+      newCoverage(w);
+      addToCorpus(w, w->testCase, w->testLen);
+   }
+
+   if (result == FUZZ_OK) {
+      //the calling thread doubles as worker 0
+      runWorkers(fuzzWorker, sh.workers, sh.numWorkers);
+
+      for (unsigned int i = 0; i < sh.numWorkers; i++) {
+         FuzzWorker *w = &sh.workers[i];
+         stats->execs += w->execs.load();
+         stats->unlocks += w->unlocks.load();
+         stats->crashes += w->crashes.load();
+         stats->hangs += w->hangs.load();
+         stats->splices += w->splices.load();
+         stats->corpus += w->corpusCount.load();
+      }
+      stats->edges = sh.edges.load();
+      stats->buckets = sh.triage ? triageBuckets(sh.triage) : 0;
+      stats->seconds = (unsigned int)(time(NULL) - sh.start);
+      stats->threads = sh.numWorkers;
+   }
+
+   for (unsigned int i = 0; i < sh.numWorkers; i++) {
+      FuzzWorker *w = &sh.workers[i];
+      if (w->corpus) {
+         unsigned int n = w->corpusCount.load();
+         for (unsigned int j = 0; j < n; j++) {
+            free(w->corpus[j].data);
+         }
+      }
+      free(w->corpus);
+      free(w->cmps);
+      free(w->cov);
+      freeRunner(&w->runner);
+   }
+   if (sh.triage) {
+      closeTriageIndex(sh.triage);
+   }
+   delete [] sh.workers;
+   delete [] sh.virgin;
+   free(base);
+   return result;
+}
@@ -0,0 +1,67 @@
+/*
+   Headers for MSP430 emulator input fuzzer
+   Copyright (c) 2014 Chris Eagle
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation; either version 2 of the License, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+   more details.
+
+   You should have received a copy of the GNU General Public License along with
+   this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+   Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef __FUZZ_H
+#define __FUZZ_H
+
+//largest input the fuzzer will generate regardless of the getsn limit
+#define FUZZ_MAX_INPUT 0x1000
+
+//corpus entries kept by each worker
+#define FUZZ_MAX_CORPUS 0x4000
+
+//replacement runs allowed per input in the comparison logging stage
+#define FUZZ_CMPLOG_TRIALS 1024
+
+struct FuzzOptions {
+   unsigned int seconds;      //wall clock budget, 0 for none
+   unsigned int maxExecs;     //execution budget, 0 for none
+   unsigned int instBudget;   //per execution instruction limit
+   unsigned int seed;         //mutator seed, 0 picks one
+   unsigned int threads;      //worker count, 0 for one per hardware thread
+   bool stopOnUnlock;
+   bool cmpLog;               //input to state stage driven by logged comparisons
+   const unsigned char *cmpLogSites;   //CMPLOG_SITE_BYTES bitmap, NULL for all
+   const char *outDir;        //where interesting inputs are saved, may be NULL
+};
+
+struct FuzzStats {
+   unsigned int execs;
+   unsigned int corpus;
+   unsigned int edges;
+   unsigned int unlocks;
+   unsigned int crashes;
+   unsigned int buckets;      //distinct crashes in the triage index
+   unsigned int hangs;
+   unsigned int splices;      //new paths found by the comparison logging stage
+   unsigned int seconds;
+   unsigned int threads;
+};
+
+//status codes returned by fuzz
+enum {
+   FUZZ_OK,
+   FUZZ_NO_INPUT,    //never reached an input syscall
+   FUZZ_NO_MEMORY
+};
+
+void initFuzzOptions(FuzzOptions *opts);
+int fuzz(const FuzzOptions *opts, FuzzStats *stats);
+
+#endif
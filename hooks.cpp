@@ -0,0 +1,182 @@
+/*
+   Native function hooks for MSP430 emulator
+   Copyright (c) 2014 Chris Eagle
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation; either version 2 of the License, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+   more details.
+
+   You should have received a copy of the GNU General Public License along with
+   this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+   Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/*
+ * Firmware spends much of its time in a few library loops. Hooking the
+ * entry of such a function runs it as one step: the handler does the work
+ * on machine memory, sets r15 and the call returns. Register and flag
+ * side effects inside the function are not reproduced, only its result,
+ * so hooks are opt-in per address.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "hooks.h"
+
+#define R(m, r) ((m)->cpu.general[r])
+
+static unsigned int hookStrcpy(Machine *m, unsigned short /*addr*/, void * /*arg*/) {
+   unsigned short dst = R(m, R15);
+   unsigned short src = R(m, R14);
+   for (unsigned int i = 0; i < MEM_SIZE; i++) {
+      unsigned char ch = m->readByte(src++);
+      m->writeByte(dst++, ch);
+      if (ch == 0) {
+         break;
+      }
+   }
+   return HOOK_RETURN;
+}
+
+static unsigned int hookMemcpy(Machine *m, unsigned short /*addr*/, void * /*arg*/) {
+   unsigned short dst = R(m, R15);
+   unsigned short src = R(m, R14);
+   for (unsigned int n = R(m, R13); n; n--) {
+      m->writeByte(dst++, m->readByte(src++));
+   }
+   return HOOK_RETURN;
+}
+
+static unsigned int hookMemset(Machine *m, unsigned short /*addr*/, void * /*arg*/) {
+   unsigned short dst = R(m, R15);
+   unsigned char val = (unsigned char)R(m, R14);
+   for (unsigned int n = R(m, R13); n; n--) {
+      m->writeByte(dst++, val);
+   }
+   return HOOK_RETURN;
+}
+
+static unsigned int hookStrlen(Machine *m, unsigned short /*addr*/, void * /*arg*/) {
+   unsigned short str = R(m, R15);
+   unsigned int len = 0;
+   while (len < MEM_SIZE && m->readByte((unsigned short)(str + len))) {
+      len++;
+   }
+   R(m, R15) = (unsigned short)len;
+   return HOOK_RETURN;
+}
+
+static unsigned int hookPuts(Machine *m, unsigned short /*addr*/, void * /*arg*/) {
+   unsigned short str = R(m, R15);
+   for (unsigned int i = 0; i < MEM_SIZE; i++) {
+      unsigned char ch = m->readByte(str++);
+      if (ch == 0) {
+         break;
+      }
+      m->consoleWrite(ch);
+   }
+   m->consoleWrite('\n');
+   R(m, R15) = 0;
+   return HOOK_RETURN;
+}
+
+//the microcorruption INT wrapper, the system call number at sp+2 and its
+//arguments after it. Does what INT does around its call to SYSCALL_ADDR
+static unsigned int hookInt(Machine *m, unsigned short addr, void * /*arg*/) {
+   unsigned short entrySp = R(m, SP);
+   unsigned short savedSr = R(m, SR);
+   unsigned short saved14 = R(m, R14);
+   unsigned short saved15 = R(m, R15);
+   unsigned short num = m->readWord(entrySp + 2);
+   R(m, R14) = num;
+   R(m, R15) = (unsigned short)((num << 8) | (num >> 8));
+   m->push(savedSr);
+   R(m, SR) = R(m, R15) | 0x8000;
+   //the system call returns here
+   m->push(addr);
+   m->syscall();
+   if (R(m, SP) != (unsigned short)(entrySp - 2)) {
+      //the call is to be retried, put everything back
+      R(m, SP) = entrySp;
+      R(m, SR) = savedSr;
+      R(m, R14) = saved14;
+      R(m, R15) = saved15;
+      R(m, PC) = addr;
+      return HOOK_JUMPED;
+   }
+   R(m, SR) = m->pop();
+   return HOOK_RETURN;
+}
+
+static const NativeFunction nativeFunctions[] = {
+   {"strcpy", hookStrcpy, "strcpy(r15 dst, r14 src)"},
+   {"memcpy", hookMemcpy, "memcpy(r15 dst, r14 src, r13 len)"},
+   {"memset", hookMemset, "memset(r15 dst, r14 val, r13 len)"},
+   {"strlen", hookStrlen, "strlen(r15 str)"},
+   {"puts", hookPuts, "puts(r15 str)"},
+   {"INT", hookInt, "microcorruption INT(num, args...) on the stack"}
+};
+
+#define NUM_NATIVE_FUNCTIONS (sizeof(nativeFunctions) / sizeof(nativeFunctions[0]))
+
+const NativeFunction *getNativeFunctions(unsigned int *count) {
+   *count = NUM_NATIVE_FUNCTIONS;
+   return nativeFunctions;
+}
+
+const NativeFunction *findNativeFunction(const char *name) {
+   while (*name == '_') {
+      name++;
+   }
+   for (unsigned int i = 0; i < NUM_NATIVE_FUNCTIONS; i++) {
+      if (strcmp(name, nativeFunctions[i].name) == 0) {
+         return &nativeFunctions[i];
+      }
+   }
+   return NULL;
+}
+
+bool addNativeHook(Machine *m, unsigned short addr, const char *name, unsigned int flags) {
+   const NativeFunction *f = findNativeFunction(name);
+   if (f == NULL || addr == SYSCALL_ADDR) {
+      return false;
+   }
+   return m->addHook(addr, f->fn, NULL, flags, f->name);
+}
+
+bool addNativeHooks(Machine *m, const char *spec) {
+   while (*spec) {
+      char name[32];
+      unsigned int len = 0;
+      while (*spec == ' ' || *spec == '\t' || *spec == ',') {
+         spec++;
+      }
+      if (*spec == 0) {
+         break;
+      }
+      while (*spec && *spec != '@' && len < sizeof(name) - 1) {
+         name[len++] = *spec++;
+      }
+      name[len] = 0;
+      if (*spec++ != '@') {
+         return false;
+      }
+      char *end;
+      unsigned long addr = strtoul(spec, &end, 0);
+      if (end == spec || addr >= MEM_SIZE || (*end && *end != ' ' && *end != '\t' && *end != ',')) {
+         return false;
+      }
+      if (!addNativeHook(m, (unsigned short)addr, name, 0)) {
+         return false;
+      }
+      spec = end;
+   }
+   return true;
+}
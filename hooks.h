@@ -0,0 +1,45 @@
+/*
+   Headers for MSP430 emulator native function hooks
+   Copyright (c) 2014 Chris Eagle
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation; either version 2 of the License, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+   more details.
+
+   You should have received a copy of the GNU General Public License along with
+   this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+   Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef __HOOKS_H
+#define __HOOKS_H
+
+#include "cpu.h"
+
+//a native replacement for a firmware function. The handlers follow the
+//microcorruption calling convention, arguments in r15, r14 and r13 and the
+//result in r15
+struct NativeFunction {
+   const char *name;
+   NativeHook fn;
+   const char *desc;
+};
+
+const NativeFunction *getNativeFunctions(unsigned int *count);
+//by name, ignoring leading underscores. NULL when there is none
+const NativeFunction *findNativeFunction(const char *name);
+
+//hook the native replacement for name at addr
+bool addNativeHook(Machine *m, unsigned short addr, const char *name, unsigned int flags);
+
+//parse a space separated list of name@addr pairs and hook each one.
+//Returns false, leaving the hooks added so far, at the first bad entry
+bool addNativeHooks(Machine *m, const char *spec);
+
+#endif
@@ -0,0 +1,628 @@
+/*
+   Firmware loaders for MSP430 emulator
+   Copyright (c) 2014 Chris Eagle
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation; either version 2 of the License, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+   more details.
+
+   You should have received a copy of the GNU General Public License along with
+   this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+   Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/*
+ * Files are mapped rather than read and parsed straight into a flat 64K
+ * image. Parsed images are cached by a hash of the file contents, so a
+ * batch that loads the same firmware for every run pays for the parse
+ * once and for hashing the mapped file after that.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <mutex>
+#ifdef _WIN32
+#include <stdio.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "cpu.h"
+#include "snapshot.h"
+#include "loader.h"
+
+#define EM_MSP430 105
+#define PT_LOAD 1
+#define SHT_SYMTAB 2
+#define SHN_LORESERVE 0xff00
+
+struct ImageCacheEntry {
+   Image *img;
+   unsigned int format;
+   unsigned int base;
+   unsigned int len;
+   uint64 stamp;        //last use, the smallest goes first
+};
+
+static ImageCacheEntry imageCache[LOADER_CACHE_SIZE];
+static uint64 imageClock = 0;
+static std::mutex imageLock;
+
+static const char *formatNames[IMAGE_FORMATS] = {
+   "detect", "raw", "ihex", "titxt", "elf", "mcdump"
+};
+
+const char *imageFormatName(unsigned int format) {
+   return format < IMAGE_FORMATS ? formatNames[format] : "unknown";
+}
+
+//IMAGE_FORMATS for an unknown name
+unsigned int imageFormatByName(const char *name) {
+   for (unsigned int i = 0; i < IMAGE_FORMATS; i++) {
+      if (strcmp(name, formatNames[i]) == 0) {
+         return i;
+      }
+   }
+   if (strcmp(name, "hex") == 0) {
+      return IMAGE_IHEX;
+   }
+   if (strcmp(name, "txt") == 0) {
+      return IMAGE_TITXT;
+   }
+   return IMAGE_FORMATS;
+}
+
+static int hexDigit(unsigned char c) {
+   if (c >= '0' && c <= '9') {
+      return c - '0';
+   }
+   c |= 0x20;
+   if (c >= 'a' && c <= 'f') {
+      return c - 'a' + 10;
+   }
+   return -1;
+}
+
+static bool isSpace(unsigned char c) {
+   return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+unsigned int detectImageFormat(const unsigned char *data, unsigned int len) {
+   if (len >= 4 && memcmp(data, "\x7f" "ELF", 4) == 0) {
+      return IMAGE_ELF;
+   }
+   unsigned int i = 0;
+   while (i < len && isSpace(data[i])) {
+      i++;
+   }
+   if (i < len && (data[i] == ':' || data[i] == '@')) {
+      //text formats are entirely printable
+      for (unsigned int j = i; j < len; j++) {
+         if (!isSpace(data[j]) && (data[j] < 0x20 || data[j] > 0x7e)) {
+            return IMAGE_RAW;
+         }
+      }
+      return data[i] == ':' ? IMAGE_IHEX : IMAGE_TITXT;
+   }
+   if (i + 5 <= len && data[i + 4] == ':' && hexDigit(data[i]) >= 0 && hexDigit(data[i + 1]) >= 0 &&
+       hexDigit(data[i + 2]) >= 0 && hexDigit(data[i + 3]) >= 0) {
+      return IMAGE_MCDUMP;
+   }
+   return IMAGE_RAW;
+}
+
+static void putImageByte(Image *img, unsigned int addr, unsigned char val) {
+   img->mem[addr] = val;
+   img->present[addr >> 3] |= 1 << (addr & 7);
+   img->pages[addr >> MEM_PAGE_SHIFT] = 1;
+}
+
+static int parseRaw(const unsigned char *data, unsigned int len, unsigned int base, Image *img) {
+   if (base >= MEM_SIZE) {
+      return LOAD_BAD_FORMAT;
+   }
+   if (len > MEM_SIZE - base) {
+      len = MEM_SIZE - base;
+   }
+   memcpy(img->mem + base, data, len);
+   for (unsigned int addr = base; addr < base + len; addr++) {
+      img->present[addr >> 3] |= 1 << (addr & 7);
+      img->pages[addr >> MEM_PAGE_SHIFT] = 1;
+   }
+   return LOAD_OK;
+}
+
+//Intel HEX, records beyond 64K (MSP430X) are dropped
+static int parseIhex(const unsigned char *data, unsigned int len, Image *img) {
+   unsigned char rec[5 + 255];
+   unsigned int upper = 0;
+   unsigned int i = 0;
+   while (i < len) {
+      if (isSpace(data[i])) {
+         i++;
+         continue;
+      }
+      if (data[i++] != ':') {
+         return LOAD_BAD_FORMAT;
+      }
+      unsigned int n = 0;
+      unsigned char sum = 0;
+      while (i + 1 < len && hexDigit(data[i]) >= 0 && hexDigit(data[i + 1]) >= 0) {
+         if (n == sizeof(rec)) {
+            return LOAD_BAD_FORMAT;
+         }
+         rec[n] = (hexDigit(data[i]) << 4) | hexDigit(data[i + 1]);
+         sum += rec[n++];
+         i += 2;
+      }
+      if (n < 5 || n != rec[0] + 5u || sum != 0) {
+         return LOAD_BAD_FORMAT;
+      }
+      unsigned int count = rec[0];
+      unsigned int offset = (rec[1] << 8) | rec[2];
+      const unsigned char *payload = rec + 4;
+      switch (rec[3]) {
+         case 0:
+            for (unsigned int j = 0; j < count; j++) {
+               unsigned int addr = upper + ((offset + j) & 0xffff);
+               if (addr < MEM_SIZE) {
+                  putImageByte(img, addr, payload[j]);
+               }
+            }
+            break;
+         case 1:
+            return LOAD_OK;
+         case 2:
+            if (count != 2) {
+               return LOAD_BAD_FORMAT;
+            }
+            upper = ((payload[0] << 8) | payload[1]) << 4;
+            break;
+         case 3:
+            if (count != 4) {
+               return LOAD_BAD_FORMAT;
+            }
+            img->entry = (((payload[0] << 8) | payload[1]) << 4) + ((payload[2] << 8) | payload[3]);
+            break;
+         case 4:
+            if (count != 2) {
+               return LOAD_BAD_FORMAT;
+            }
+            upper = ((payload[0] << 8) | payload[1]) << 16;
+            break;
+         case 5:
+            if (count != 4) {
+               return LOAD_BAD_FORMAT;
+            }
+            img->entry = (payload[0] << 24) | (payload[1] << 16) | (payload[2] << 8) | payload[3];
+            break;
+         default:
+            return LOAD_BAD_FORMAT;
+      }
+   }
+   //tolerate a missing end of file record
+   return LOAD_OK;
+}
+
+//TI-TXT, "@addr" lines followed by lines of hex bytes, ended by "q"
+static int parseTitxt(const unsigned char *data, unsigned int len, Image *img) {
+   unsigned int addr = 0;
+   bool haveAddr = false;
+   unsigned int i = 0;
+   while (i < len) {
+      unsigned char c = data[i];
+      if (isSpace(c)) {
+         i++;
+      }
+      else if (c == 'q' || c == 'Q') {
+         return LOAD_OK;
+      }
+      else if (c == '@') {
+         addr = 0;
+         unsigned int digits = 0;
+         for (i++; i < len && hexDigit(data[i]) >= 0; i++, digits++) {
+            addr = (addr << 4) | hexDigit(data[i]);
+         }
+         if (digits == 0 || digits > 8) {
+            return LOAD_BAD_FORMAT;
+         }
+         haveAddr = true;
+      }
+      else {
+         if (!haveAddr || i + 1 >= len || hexDigit(c) < 0 || hexDigit(data[i + 1]) < 0 ||
+             (i + 2 < len && !isSpace(data[i + 2]))) {
+            return LOAD_BAD_FORMAT;
+         }
+         if (addr < MEM_SIZE) {
+            putImageByte(img, addr, (hexDigit(c) << 4) | hexDigit(data[i + 1]));
+         }
+         addr++;
+         i += 2;
+      }
+   }
+   return LOAD_OK;
+}
+
+//the number of hex digits starting at data[i], at most max
+static unsigned int hexRun(const unsigned char *data, unsigned int len, unsigned int i, unsigned int max) {
+   unsigned int n = 0;
+   while (n < max && i + n < len && hexDigit(data[i + n]) >= 0) {
+      n++;
+   }
+   return n;
+}
+
+//microcorruption memory dump, lines of "addr:" followed by eight groups of
+//four hex digits and the ascii rendering. A line holding only "*" stands
+//for the zero lines up to the next address and costs nothing to load
+static int parseMcdump(const unsigned char *data, unsigned int len, Image *img) {
+   unsigned int i = 0;
+   while (i < len) {
+      if (isSpace(data[i])) {
+         i++;
+         continue;
+      }
+      if (hexRun(data, len, i, 5) != 4 || i + 4 >= len || data[i + 4] != ':') {
+         return LOAD_BAD_FORMAT;
+      }
+      unsigned int addr = 0;
+      for (unsigned int j = 0; j < 4; j++) {
+         addr = (addr << 4) | hexDigit(data[i + j]);
+      }
+      i += 5;
+      //eight groups at most, the ascii column may look like hex too
+      for (unsigned int group = 0; group < 8; group++) {
+         while (i < len && (data[i] == ' ' || data[i] == '\t')) {
+            i++;
+         }
+         if (i < len && data[i] == '*') {
+            i++;
+            break;
+         }
+         if (hexRun(data, len, i, 5) != 4 || (i + 4 < len && !isSpace(data[i + 4]))) {
+            break;
+         }
+         for (unsigned int j = 0; j < 4; j += 2) {
+            putImageByte(img, addr, (hexDigit(data[i + j]) << 4) | hexDigit(data[i + j + 1]));
+            addr = (addr + 1) & 0xffff;
+         }
+         i += 4;
+      }
+      //skip the ascii column
+      while (i < len && data[i] != '\n') {
+         i++;
+      }
+   }
+   return LOAD_OK;
+}
+
+static unsigned int rd16(const unsigned char *p) {
+   return p[0] | (p[1] << 8);
+}
+
+static unsigned int rd32(const unsigned char *p) {
+   return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+//true when [offset, offset + size) lies within the file
+static bool inFile(unsigned int len, unsigned int offset, unsigned int size) {
+   return offset <= len && size <= len - offset;
+}
+
+static int elfSymbols(const unsigned char *data, unsigned int len, Image *img) {
+   unsigned int shoff = rd32(data + 32);
+   unsigned int shentsize = rd16(data + 46);
+   unsigned int shnum = rd16(data + 48);
+   if (shnum == 0) {
+      return LOAD_OK;
+   }
+   if (shentsize < 40 || !inFile(len, shoff, shnum * shentsize)) {
+      return LOAD_BAD_FORMAT;
+   }
+   for (unsigned int s = 0; s < shnum; s++) {
+      const unsigned char *sh = data + shoff + s * shentsize;
+      if (rd32(sh + 4) != SHT_SYMTAB) {
+         continue;
+      }
+      unsigned int symoff = rd32(sh + 16);
+      unsigned int symsize = rd32(sh + 20);
+      unsigned int link = rd32(sh + 24);
+      if (!inFile(len, symoff, symsize) || link >= shnum) {
+         return LOAD_BAD_FORMAT;
+      }
+      const unsigned char *str = data + shoff + link * shentsize;
+      unsigned int stroff = rd32(str + 16);
+      unsigned int strsize = rd32(str + 20);
+      if (!inFile(len, stroff, strsize)) {
+         return LOAD_BAD_FORMAT;
+      }
+      unsigned int count = symsize / 16;
+      ImageSymbol *syms = (ImageSymbol*)realloc(img->symbols, (img->numSymbols + count) * sizeof(ImageSymbol));
+      if (syms == NULL && count) {
+         return LOAD_NO_MEMORY;
+      }
+      img->symbols = syms;
+      for (unsigned int i = 0; i < count; i++) {
+         const unsigned char *sym = data + symoff + i * 16;
+         unsigned int name = rd32(sym);
+         unsigned int type = sym[12] & 0xf;
+         unsigned int shndx = rd16(sym + 14);
+         //functions, objects and labels defined in some section
+         if (type > 2 || shndx == 0 || shndx >= SHN_LORESERVE || name == 0 || name >= strsize) {
+            continue;
+         }
+         const char *s = (const char*)data + stroff + name;
+         unsigned int slen = strnlen(s, strsize - name);
+         if (slen == 0 || slen == strsize - name || s[0] == '$' || s[0] == '.') {
+            continue;
+         }
+         ImageSymbol *is = &img->symbols[img->numSymbols];
+         is->name = (char*)malloc(slen + 1);
+         if (is->name == NULL) {
+            return LOAD_NO_MEMORY;
+         }
+         memcpy(is->name, s, slen + 1);
+         is->addr = rd32(sym + 4) & 0xffff;
+         img->numSymbols++;
+      }
+   }
+   return LOAD_OK;
+}
+
+//MSP430 ELF, PT_LOAD segments go to their load (physical) address
+static int parseElf(const unsigned char *data, unsigned int len, Image *img) {
+   if (len < 52 || data[4] != 1 || data[5] != 1 || rd16(data + 18) != EM_MSP430) {
+      return LOAD_BAD_FORMAT;
+   }
+   img->entry = rd32(data + 24) & 0xffff;
+   unsigned int phoff = rd32(data + 28);
+   unsigned int phentsize = rd16(data + 42);
+   unsigned int phnum = rd16(data + 44);
+   if (phnum && (phentsize < 32 || !inFile(len, phoff, phnum * phentsize))) {
+      return LOAD_BAD_FORMAT;
+   }
+   for (unsigned int p = 0; p < phnum; p++) {
+      const unsigned char *ph = data + phoff + p * phentsize;
+      if (rd32(ph) != PT_LOAD) {
+         continue;
+      }
+      unsigned int offset = rd32(ph + 4);
+      unsigned int paddr = rd32(ph + 12);
+      unsigned int filesz = rd32(ph + 16);
+      unsigned int memsz = rd32(ph + 20);
+      if (!inFile(len, offset, filesz) || filesz > memsz) {
+         return LOAD_BAD_FORMAT;
+      }
+      //the tail past filesz is zero filled (.bss)
+      for (unsigned int i = 0; i < memsz && paddr + i < MEM_SIZE; i++) {
+         putImageByte(img, paddr + i, i < filesz ? data[offset + i] : 0);
+      }
+   }
+   return elfSymbols(data, len, img);
+}
+
+void freeImageSymbols(Image *img) {
+   for (unsigned int i = 0; i < img->numSymbols; i++) {
+      free(img->symbols[i].name);
+   }
+   free(img->symbols);
+   img->symbols = NULL;
+   img->numSymbols = 0;
+}
+
+static int parseHashed(const unsigned char *data, unsigned int len, unsigned int format,
+                       unsigned int base, uint64 hash, Image *img) {
+   memset(img, 0, sizeof(Image));
+   img->entry = IMAGE_NO_ENTRY;
+   if (format == IMAGE_DETECT) {
+      format = detectImageFormat(data, len);
+   }
+   img->format = format;
+   img->hash = hash;
+   int res;
+   switch (format) {
+      case IMAGE_RAW:
+         res = parseRaw(data, len, base, img);
+         break;
+      case IMAGE_IHEX:
+         res = parseIhex(data, len, img);
+         break;
+      case IMAGE_TITXT:
+         res = parseTitxt(data, len, img);
+         break;
+      case IMAGE_ELF:
+         res = parseElf(data, len, img);
+         break;
+      case IMAGE_MCDUMP:
+         res = parseMcdump(data, len, img);
+         break;
+      default:
+         res = LOAD_BAD_FORMAT;
+         break;
+   }
+   if (res != LOAD_OK) {
+      freeImageSymbols(img);
+   }
+   return res;
+}
+
+int parseImage(const unsigned char *data, unsigned int len, unsigned int format,
+               unsigned int base, Image *img) {
+   return parseHashed(data, len, format, base, hashMemory(data, len), img);
+}
+
+//map path read only, NULL on failure or for an empty file
+static const unsigned char *mapFile(const char *path, unsigned int *len) {
+#ifdef _WIN32
+   FILE *f = fopen(path, "rb");
+   if (f == NULL) {
+      return NULL;
+   }
+   fseek(f, 0, SEEK_END);
+   long size = ftell(f);
+   fseek(f, 0, SEEK_SET);
+   unsigned char *data = size > 0 ? (unsigned char*)malloc(size) : NULL;
+   if (data && fread(data, 1, size, f) != (size_t)size) {
+      free(data);
+      data = NULL;
+   }
+   fclose(f);
+   *len = (unsigned int)size;
+   return data;
+#else
+   int fd = open(path, O_RDONLY);
+   if (fd < 0) {
+      return NULL;
+   }
+   struct stat st;
+   void *map = MAP_FAILED;
+   if (fstat(fd, &st) == 0 && st.st_size > 0) {
+      map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   }
+   close(fd);
+   if (map == MAP_FAILED) {
+      return NULL;
+   }
+   *len = (unsigned int)st.st_size;
+   return (const unsigned char*)map;
+#endif
+}
+
+static void unmapFile(const unsigned char *data, unsigned int len) {
+#ifdef _WIN32
+   free((void*)data);
+#else
+   munmap((void*)data, len);
+#endif
+}
+
+static void freeImage(Image *img) {
+   freeImageSymbols(img);
+   free(img);
+}
+
+//caller holds imageLock
+static Image *findCachedImage(uint64 hash, unsigned int len, unsigned int format, unsigned int base) {
+   for (unsigned int i = 0; i < LOADER_CACHE_SIZE; i++) {
+      ImageCacheEntry *e = &imageCache[i];
+      if (e->img && e->img->hash == hash && e->len == len && e->format == format &&
+          (format != IMAGE_RAW || e->base == base)) {
+         e->stamp = ++imageClock;
+         e->img->refs++;
+         return e->img;
+      }
+   }
+   return NULL;
+}
+
+//caller holds imageLock, the oldest entry makes way. The cache holds its
+//own reference so images still in use outlive their eviction
+static void cacheImage(Image *img, unsigned int len, unsigned int base) {
+   ImageCacheEntry *victim = &imageCache[0];
+   for (unsigned int i = 0; i < LOADER_CACHE_SIZE; i++) {
+      if (imageCache[i].img == NULL) {
+         victim = &imageCache[i];
+         break;
+      }
+      if (imageCache[i].stamp < victim->stamp) {
+         victim = &imageCache[i];
+      }
+   }
+   if (victim->img && --victim->img->refs == 0) {
+      freeImage(victim->img);
+   }
+   victim->img = img;
+   victim->format = img->format;
+   victim->base = base;
+   victim->len = len;
+   victim->stamp = ++imageClock;
+   img->refs++;
+}
+
+int loadImage(const char *path, unsigned int format, unsigned int base, const Image **img) {
+   *img = NULL;
+   unsigned int len;
+   const unsigned char *data = mapFile(path, &len);
+   if (data == NULL) {
+      return LOAD_NO_FILE;
+   }
+   if (format == IMAGE_DETECT) {
+      format = detectImageFormat(data, len);
+   }
+   uint64 hash = hashMemory(data, len);
+   {
+      std::lock_guard<std::mutex> guard(imageLock);
+      *img = findCachedImage(hash, len, format, base);
+   }
+   if (*img) {
+      unmapFile(data, len);
+      return LOAD_OK;
+   }
+   Image *parsed = (Image*)malloc(sizeof(Image));
+   if (parsed == NULL) {
+      unmapFile(data, len);
+      return LOAD_NO_MEMORY;
+   }
+   int res = parseHashed(data, len, format, base, hash, parsed);
+   unmapFile(data, len);
+   if (res != LOAD_OK) {
+      free(parsed);
+      return res;
+   }
+   parsed->refs = 1;
+   {
+      std::lock_guard<std::mutex> guard(imageLock);
+      cacheImage(parsed, len, base);
+   }
+   *img = parsed;
+   return LOAD_OK;
+}
+
+void releaseImage(const Image *img) {
+   if (img == NULL) {
+      return;
+   }
+   std::lock_guard<std::mutex> guard(imageLock);
+   Image *i = (Image*)img;
+   if (--i->refs == 0) {
+      freeImage(i);
+   }
+}
+
+void flushImageCache() {
+   std::lock_guard<std::mutex> guard(imageLock);
+   for (unsigned int i = 0; i < LOADER_CACHE_SIZE; i++) {
+      Image *img = imageCache[i].img;
+      if (img && --img->refs == 0) {
+         freeImage(img);
+      }
+      imageCache[i].img = NULL;
+   }
+}
+
+unsigned int nextImageRange(const Image *img, unsigned int *addr) {
+   unsigned int start = *addr;
+   while (start < MEM_SIZE && !IMAGE_PRESENT(img, start)) {
+      if (!img->pages[start >> MEM_PAGE_SHIFT]) {
+         //nothing in this page, skip the rest of it
+         start = (start | (MEM_PAGE_SIZE - 1)) + 1;
+         continue;
+      }
+      start++;
+   }
+   unsigned int end = start;
+   while (end < MEM_SIZE && IMAGE_PRESENT(img, end)) {
+      end++;
+   }
+   *addr = start;
+   return end - start;
+}
@@ -0,0 +1,90 @@
+/*
+   Headers for MSP430 emulator firmware loaders
+   Copyright (c) 2014 Chris Eagle
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation; either version 2 of the License, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+   more details.
+
+   You should have received a copy of the GNU General Public License along with
+   this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+   Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef __LOADER_H
+#define __LOADER_H
+
+#include "cpu.h"
+
+//parsed images kept for repeated loads of the same file
+#define LOADER_CACHE_SIZE 8
+
+//Image.entry when the file does not name one
+#define IMAGE_NO_ENTRY 0xFFFFFFFF
+
+enum {
+   IMAGE_DETECT,     //pick the format from the file contents
+   IMAGE_RAW,        //bytes loaded at the base address
+   IMAGE_IHEX,       //Intel HEX
+   IMAGE_TITXT,      //TI-TXT
+   IMAGE_ELF,        //MSP430 ELF, PT_LOAD segments and symbols
+   IMAGE_MCDUMP,     //microcorruption memory dump, "*" lines elide zeros
+   IMAGE_FORMATS
+};
+
+struct ImageSymbol {
+   char *name;
+   unsigned short addr;
+};
+
+//a firmware file parsed into the whole address space. Bytes the file did
+//not supply are zero and clear in present
+struct Image {
+   unsigned char mem[MEM_SIZE];
+   unsigned char present[MEM_SIZE / 8];   //bit per byte supplied by the file
+   unsigned char pages[MEM_PAGES];        //non zero when any byte of the page was
+   unsigned int format;
+   unsigned int entry;                    //IMAGE_NO_ENTRY for none
+   unsigned int numSymbols;
+   ImageSymbol *symbols;
+   uint64 hash;                           //of the file contents
+   unsigned int refs;                     //owned by the cache
+};
+
+//status codes returned by the loaders
+enum {
+   LOAD_OK,
+   LOAD_NO_FILE,        //could not open or map the file
+   LOAD_BAD_FORMAT,     //malformed, or a checksum or machine mismatch
+   LOAD_NO_MEMORY
+};
+
+#define IMAGE_PRESENT(img, addr) (((img)->present[(addr) >> 3] >> ((addr) & 7)) & 1)
+
+const char *imageFormatName(unsigned int format);
+unsigned int imageFormatByName(const char *name);
+unsigned int detectImageFormat(const unsigned char *data, unsigned int len);
+
+//parse a file already in memory into img, base only applies to raw images
+int parseImage(const unsigned char *data, unsigned int len, unsigned int format,
+               unsigned int base, Image *img);
+void freeImageSymbols(Image *img);
+
+//load and parse path, or find it in the cache when the same contents were
+//loaded before. The image is shared and read only, hand it back with
+//releaseImage. Safe to call from any thread
+int loadImage(const char *path, unsigned int format, unsigned int base, const Image **img);
+void releaseImage(const Image *img);
+void flushImageCache();
+
+//the contiguous run of present bytes starting at or after *addr, returns
+//its length and moves *addr to its start, 0 once there are no more
+unsigned int nextImageRange(const Image *img, unsigned int *addr);
+
+#endif
@@ -0,0 +1,196 @@
+/*
+   Parallel input minimizer for MSP430 emulator
+   Copyright (c) 2014 Chris Eagle
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation; either version 2 of the License, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+   more details.
+
+   You should have received a copy of the GNU General Public License along with
+   this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+   Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/*
+ * Delta debugging over snapshot restored runs. Each round builds a list of
+ * candidate reductions of the current input, first removing chunks of
+ * halving size and then replacing single bytes with '0'. Workers claim
+ * candidates from a shared counter and run them from the same snapshot;
+ * the lowest numbered candidate that keeps the stop reason and pc wins
+ * the round so the result does not depend on thread scheduling.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+
+#include "cpu.h"
+#include "snapshot.h"
+#include "runner.h"
+#include "minimize.h"
+
+enum {
+   MIN_REMOVE,    //candidate i drops chunk i
+   MIN_ZERO       //candidate i sets byte i to '0'
+};
+
+struct MinShared {
+   unsigned char *cur;           //best input so far
+   unsigned int curLen;
+   unsigned int reason;
+   unsigned int stopPc;
+   unsigned int budget;
+   unsigned int mode;
+   unsigned int chunk;
+   unsigned int first;           //candidates below first are not retried
+   unsigned int numCands;
+   std::atomic<unsigned int> next;
+   std::atomic<unsigned int> found;    //lowest passing candidate, numCands if none
+   std::atomic<unsigned int> execs;
+};
+
+struct MinWorker {
+   MinShared *shared;
+   Runner runner;
+   unsigned char *buf;
+};
+
+//build candidate idx in buf, returns its length or -1 if it would not
+//change the input
+static int makeCandidate(MinShared *sh, unsigned int idx, unsigned char *buf) {
+   if (sh->mode == MIN_ZERO) {
+      if (sh->cur[idx] == '0') {
+         return -1;
+      }
+      memcpy(buf, sh->cur, sh->curLen);
+      buf[idx] = '0';
+      return sh->curLen;
+   }
+   unsigned int start = idx * sh->chunk;
+   unsigned int end = start + sh->chunk < sh->curLen ? start + sh->chunk : sh->curLen;
+   memcpy(buf, sh->cur, start);
+   memcpy(buf + start, sh->cur + end, sh->curLen - end);
+   return sh->curLen - (end - start);
+}
+
+static void minWorker(void *arg, unsigned int slot) {
+   MinWorker *w = (MinWorker*)arg + slot;
+   MinShared *sh = w->shared;
+   while (true) {
+      unsigned int idx = sh->next.fetch_add(1, std::memory_order_relaxed);
+      if (idx >= sh->numCands) {
+         break;
+      }
+      if (idx > sh->found.load(std::memory_order_relaxed)) {
+         //a lower candidate already passed
+         continue;
+      }
+      int len = makeCandidate(sh, idx, w->buf);
+      if (len < 0) {
+         continue;
+      }
+      unsigned int reason = runInput(&w->runner, w->buf, len, sh->budget);
+      sh->execs.fetch_add(1, std::memory_order_relaxed);
+      if (reason != sh->reason || w->runner.m->cpu.initial_pc != sh->stopPc) {
+         continue;
+      }
+      unsigned int best = sh->found.load(std::memory_order_relaxed);
+      while (idx < best && !sh->found.compare_exchange_weak(best, idx, std::memory_order_relaxed)) {
+      }
+   }
+}
+
+//run every candidate from first up on all workers. returns the winning
+//candidate or numCands
+static unsigned int runRound(MinShared *sh, MinWorker *workers, unsigned int numWorkers) {
+   sh->next.store(sh->first);
+   sh->found.store(sh->numCands);
+   runWorkers(minWorker, workers, numWorkers);
+   return sh->found.load();
+}
+
+int minimizeInput(const Snapshot *base, const unsigned char *input, unsigned int len,
+                  unsigned char *out, unsigned int budget, unsigned int threads,
+                  MinimizeStats *stats) {
+   memset(stats, 0, sizeof(MinimizeStats));
+   unsigned int limit = inputLimit(base);
+   if (len > limit) {
+      //the firmware never sees the excess
+      len = limit;
+   }
+   memcpy(out, input, len);
+   stats->origLen = len;
+
+   unsigned int numWorkers = threads ? threads : hardwareThreads();
+   MinWorker *workers = new MinWorker[numWorkers];
+   MinShared sh;
+   sh.cur = out;
+   sh.curLen = len;
+   sh.budget = budget;
+   sh.execs.store(0);
+
+   int result = MIN_OK;
+   for (unsigned int i = 0; i < numWorkers; i++) {
+      workers[i].shared = &sh;
+      workers[i].buf = (unsigned char*)malloc(len ? len : 1);
+      if (!initRunner(&workers[i].runner, base) || workers[i].buf == NULL) {
+         result = MIN_NO_MEMORY;
+      }
+   }
+
+   if (result == MIN_OK) {
+      //the behavior to preserve
+      sh.reason = runInput(&workers[0].runner, out, len, budget);
+      sh.stopPc = workers[0].runner.m->cpu.initial_pc;
+      sh.execs.fetch_add(1);
+
+      sh.mode = MIN_REMOVE;
+      sh.chunk = len / 2 ? len / 2 : 1;
+      sh.first = 0;
+      while (sh.curLen) {
+         if (sh.mode == MIN_REMOVE) {
+            sh.numCands = (sh.curLen + sh.chunk - 1) / sh.chunk;
+         }
+         else {
+            sh.numCands = sh.curLen;
+         }
+         unsigned int win = sh.first < sh.numCands ? runRound(&sh, workers, numWorkers) : sh.numCands;
+         if (win < sh.numCands) {
+            int n = makeCandidate(&sh, win, workers[0].buf);
+            memcpy(out, workers[0].buf, n);
+            sh.curLen = n;
+            //everything below win failed, the chunk now at win is new
+            sh.first = sh.mode == MIN_REMOVE ? win : win + 1;
+         }
+         else if (sh.mode == MIN_REMOVE && sh.chunk > 1) {
+            sh.chunk /= 2;
+            sh.first = 0;
+         }
+         else if (sh.mode == MIN_REMOVE) {
+            sh.mode = MIN_ZERO;
+            sh.first = 0;
+         }
+         else {
+            break;
+         }
+      }
+      stats->reason = sh.reason;
+      stats->stopPc = sh.stopPc;
+      stats->len = sh.curLen;
+      stats->execs = sh.execs.load();
+      stats->threads = numWorkers;
+   }
+
+   for (unsigned int i = 0; i < numWorkers; i++) {
+      free(workers[i].buf);
+      freeRunner(&workers[i].runner);
+   }
+   delete [] workers;
+   return result;
+}
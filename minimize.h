@@ -0,0 +1,47 @@
+/*
+   Headers for MSP430 emulator input minimizer
+   Copyright (c) 2014 Chris Eagle
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation; either version 2 of the License, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+   more details.
+
+   You should have received a copy of the GNU General Public License along with
+   this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+   Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef __MINIMIZE_H
+#define __MINIMIZE_H
+
+#include "snapshot.h"
+
+struct MinimizeStats {
+   unsigned int reason;       //stop reason being preserved
+   unsigned int stopPc;       //and where the cpu stopped
+   unsigned int origLen;
+   unsigned int len;
+   unsigned int execs;
+   unsigned int threads;
+};
+
+//status codes returned by minimizeInput
+enum {
+   MIN_OK,
+   MIN_NO_MEMORY
+};
+
+//shrink len bytes of input delivered to the getsn syscall pending in base
+//while keeping the stop reason and stopping pc. The result is written to
+//out, which must hold len bytes. threads of 0 uses one per hardware thread
+int minimizeInput(const Snapshot *base, const unsigned char *input, unsigned int len,
+                  unsigned char *out, unsigned int budget, unsigned int threads,
+                  MinimizeStats *stats);
+
+#endif
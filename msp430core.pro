@@ -0,0 +1,52 @@
+
+#headless emulator core as a static library, needs neither the Ida SDK
+#nor Qt. Front ends supply the global bugMode setting
+
+OBJECTS_DIR = core
+
+TEMPLATE = lib
+
+CONFIG += staticlib c++11
+CONFIG -= qt
+
+#DEFINES += DEBUG
+linux-g++:DEFINES += __LINUX__
+macx:DEFINES += __MAC__
+
+SOURCES = cpu.cpp \
+	snapshot.cpp \
+	runner.cpp \
+	minimize.cpp \
+	triage.cpp \
+	fuzz.cpp \
+	brute.cpp \
+	timing.cpp \
+	power.cpp \
+	fault.cpp \
+	explore.cpp \
+	diff.cpp \
+	loader.cpp \
+	hooks.cpp \
+	replay.cpp \
+	batch.cpp
+
+HEADERS = cpu.h \
+   snapshot.h \
+   runner.h \
+   minimize.h \
+   triage.h \
+   fuzz.h \
+   brute.h \
+   timing.h \
+   power.h \
+   fault.h \
+   explore.h \
+   diff.h \
+   loader.h \
+   hooks.h \
+   replay.h \
+   batch.h \
+   buffer.h \
+   msp430defs.h
+
+TARGET = msp430core
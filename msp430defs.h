@@ -43,9 +43,14 @@ typedef int int32_t;
 typedef unsigned int   uint;
 typedef unsigned short ushort;
 typedef unsigned char  uchar;
+typedef uquad uint64;
 
 // Use printf instead of msg when not using Ida
 #define msg printf
+#define qsnprintf snprintf
+
+#include <string>
+typedef std::string qstring;
 
 #else   //#ifdef __IDP__
 
@@ -347,9 +352,27 @@ void setTracing(bool trace);
 bool getTracing();
 void setBreakpoint();
 void clearBreakpoint();
+void setWarmBootAddr();
+void fuzzInput();
+void minimizeCurrentInput();
+void bruteForceInput();
+void timingAttackInput();
+void powerAnalysisInput();
+void faultCampaignInput();
+void explorePathsInput();
+void bugModeDiffInput();
+void importDumpInput();
+void queueInputDialog();
+void clearQueuedInput();
+void nativeHooksInput();
+bool isRecording();
+void recordSession();
+void replaySessionInput();
 void generateMemoryException();
 void formatStack(unsigned int begin, unsigned int end);
+#ifdef __IDP__
 bool do_getsn(bytevec_t &bv, unsigned int max, const char *console);
+#endif
 
 #ifdef __NT__
 #define DIR_SEP '\\'
@@ -0,0 +1,37 @@
+
+#headless AFL++ forkserver build of the emulator core, needs neither
+#the Ida SDK nor Qt
+
+OBJECTS_DIR = afl
+
+TEMPLATE = app
+
+CONFIG += console c++11 thread
+CONFIG -= qt app_bundle
+
+#DEFINES += DEBUG
+linux-g++:DEFINES += __LINUX__
+macx:DEFINES += __MAC__
+
+SOURCES = msp430emu_afl.cpp \
+	cpu.cpp \
+	snapshot.cpp \
+	runner.cpp \
+	minimize.cpp \
+	triage.cpp \
+	loader.cpp \
+	hooks.cpp \
+	replay.cpp
+
+HEADERS = cpu.h \
+   snapshot.h \
+   runner.h \
+   minimize.h \
+   triage.h \
+   loader.h \
+   hooks.h \
+   replay.h \
+   buffer.h \
+   msp430defs.h
+
+TARGET = msp430emu-afl
@@ -0,0 +1,25 @@
+
+#headless batch runner for JSONL scenario manifests, needs neither the
+#Ida SDK nor Qt. Build msp430core.pro into the same directory first
+
+OBJECTS_DIR = batch
+
+TEMPLATE = app
+
+CONFIG += console c++11 thread
+CONFIG -= qt app_bundle
+
+#DEFINES += DEBUG
+linux-g++:DEFINES += __LINUX__
+macx:DEFINES += __MAC__
+
+SOURCES = msp430emu_batch.cpp
+
+HEADERS = cpu.h \
+   batch.h \
+   msp430defs.h
+
+LIBS += -L$$OUT_PWD -lmsp430core
+PRE_TARGETDEPS += $$OUT_PWD/libmsp430core.a
+
+TARGET = msp430emu-batch
@@ -0,0 +1,24 @@
+
+#headless command line build of the emulator, needs neither the Ida SDK
+#nor Qt. Build msp430core.pro into the same directory first
+
+OBJECTS_DIR = cli
+
+TEMPLATE = app
+
+CONFIG += console c++11 thread
+CONFIG -= qt app_bundle
+
+#DEFINES += DEBUG
+linux-g++:DEFINES += __LINUX__
+macx:DEFINES += __MAC__
+
+SOURCES = msp430emu_cli.cpp
+
+HEADERS = cpu.h \
+   msp430defs.h
+
+LIBS += -L$$OUT_PWD -lmsp430core
+PRE_TARGETDEPS += $$OUT_PWD/libmsp430core.a
+
+TARGET = msp430emu-cli
@@ -70,10 +70,24 @@
 #include <typeinf.hpp>
 #include <struct.hpp>
 #include <entry.hpp>
+#include <name.hpp>
 
 #include "break.h"
 #include "emu_script.h"
 #include "buffer.h"
+#include "snapshot.h"
+#include "fuzz.h"
+#include "runner.h"
+#include "minimize.h"
+#include "brute.h"
+#include "timing.h"
+#include "power.h"
+#include "fault.h"
+#include "explore.h"
+#include "diff.h"
+#include "loader.h"
+#include "hooks.h"
+#include "replay.h"
 
 #ifndef DEBUG
 //#define DEBUG 1
@@ -169,6 +183,7 @@ void traceLog(char *entry) {
 
 void setBugMode(bool newMode) {
    bugMode = newMode;
+   emu.bugMode = newMode;
 }
 
 bool getBugMode() {
@@ -259,6 +274,8 @@ void syncDisplay() {
    for (int i = MIN_REG; i <= MAX_REG; i++) {
       updateRegisterDisplay(i);
    }
+   emu.flushConsole();
+   updateConsoleDisplay();
    if (find_tform("IDA View-Stack")) {
       idaplace_t p(sp, 0);
       jumpto(stackCC, &p, 0, 0);
@@ -411,9 +428,6 @@ void dumpRange() {
 //at the specified address
 void memLoadFile(unsigned short start) {
    char szFile[260];       // buffer for file name
-   unsigned char buf[512];
-   int readBytes;
-   unsigned int addr = start;
 #ifndef __QT__
    const char *filter = "All (*.*)\0*.*\0";
 #else
@@ -422,22 +436,348 @@ void memLoadFile(unsigned short start) {
    szFile[0] = 0;
    char *fileName = getOpenFileName("Load memory from file", szFile, sizeof(szFile), filter);
    if (fileName) {
-      FILE *f = qfopen(szFile, "rb");
-      if (f) {
-         while ((readBytes = qfread(f, buf, sizeof(buf))) > 0) {
-            patch_many_bytes(addr, buf, readBytes);
-            addr += readBytes;
-   /*
-            ptr = buf;
-            for (; readBytes > 0; readBytes--) {
-               writeMem(addr++, *ptr++, SIZE_BYTE);
+      //raw files load at start, the other formats say where they go
+      const Image *img;
+      int res = loadImage(szFile, IMAGE_DETECT, start, &img);
+      if (res != LOAD_OK) {
+         showErrorMessage(res == LOAD_BAD_FORMAT ? "Malformed or unsupported firmware file" : "Unable to read firmware file");
+         return;
+      }
+      unsigned int total = 0;
+      unsigned int addr = 0;
+      unsigned int len;
+      while ((len = nextImageRange(img, &addr)) != 0) {
+         patch_many_bytes(addr, img->mem + addr, len);
+         addr += len;
+         total += len;
+      }
+      for (unsigned int i = 0; i < img->numSymbols; i++) {
+         set_name(img->symbols[i].addr, img->symbols[i].name, SN_NOCHECK | SN_NOWARN);
+      }
+      invalidateBootImage();
+      if (img->format == IMAGE_RAW) {
+         msg("msp430emu: Loaded 0x%X bytes from file %s to address 0x%X\n", total, szFile, start);
+      }
+      else {
+         msg("msp430emu: Loaded 0x%X bytes and %u symbols from %s file %s\n", total, img->numSymbols,
+             imageFormatName(img->format), szFile);
+      }
+      releaseImage(img);
+   }
+}
+
+//make len bytes of the database at start match want, or zeros when want is
+//NULL, reading a page at a time and patching only the bytes that differ.
+//returns the number of bytes patched
+static unsigned int syncBytes(unsigned int start, unsigned int len, const unsigned char *want) {
+   static const unsigned char zeros[MEM_PAGE_SIZE] = {0};
+   unsigned char cur[MEM_PAGE_SIZE];
+   unsigned int patched = 0;
+   while (len) {
+      unsigned int n = len < MEM_PAGE_SIZE ? len : MEM_PAGE_SIZE;
+      const unsigned char *w = want ? want : zeros;
+      get_many_bytes(start, cur, n);
+      if (memcmp(cur, w, n) != 0) {
+         for (unsigned int i = 0; i < n; i++) {
+            if (cur[i] != w[i]) {
+               patch_byte(start + i, w[i]);
+               patched++;
             }
-   */
          }
-         qfclose(f);
       }
-      msg("msp430emu: Loaded 0x%X bytes from file %s to address 0x%X\n", addr - start, szFile, start);
+      start += n;
+      len -= n;
+      if (want) {
+         want += n;
+      }
    }
+   return patched;
+}
+
+//replace all of memory with a microcorruption dump, pasted or from a file,
+//and reset the cpu through the dump's reset vector
+void importDumpInput() {
+   char szFile[260];
+   char msg_buf[256];
+#ifndef __QT__
+   const char *filter = "All (*.*)\0*.*\0";
+#else
+   const char *filter = "All (*.*)";
+#endif
+   Image *parsed = NULL;
+   const Image *img = NULL;
+   int res;
+   char *text = textBox("Import Microcorruption Dump", "Paste a memory dump, or leave this empty to choose a file");
+   if (text == NULL) {
+      return;
+   }
+   if (text[0]) {
+      parsed = (Image*)qalloc(sizeof(Image));
+      if (parsed == NULL) {
+         qfree(text);
+         showErrorMessage("Out of memory, import cancelled");
+         return;
+      }
+      res = parseImage((const unsigned char*)text, strlen(text), IMAGE_MCDUMP, 0, parsed);
+      img = parsed;
+      ::qstrncpy(szFile, "pasted dump", sizeof(szFile));
+   }
+   else {
+      szFile[0] = 0;
+      if (getOpenFileName("Microcorruption dump", szFile, sizeof(szFile), filter) == NULL) {
+         qfree(text);
+         return;
+      }
+      res = loadImage(szFile, IMAGE_MCDUMP, 0, &img);
+   }
+   qfree(text);
+   if (res != LOAD_OK) {
+      showErrorMessage(res == LOAD_BAD_FORMAT ? "That is not a Microcorruption memory dump" : "Unable to read the dump");
+      qfree(parsed);
+      return;
+   }
+   //walk the dump's ranges, clearing whatever lies between them, elided
+   //zero lines and missing pages mostly match already
+   unsigned int patched = 0;
+   unsigned int addr = 0;
+   unsigned int end = 0;
+   unsigned int len;
+   while ((len = nextImageRange(img, &addr)) != 0) {
+      patched += syncBytes(end, addr - end, NULL);
+      patched += syncBytes(addr, len, img->mem + addr);
+      addr += len;
+      end = addr;
+   }
+   patched += syncBytes(end, MEM_SIZE - end, NULL);
+   if (parsed) {
+      freeImageSymbols(parsed);
+      qfree(parsed);
+   }
+   else {
+      releaseImage(img);
+   }
+   invalidateBootImage();
+   resetCpu();
+   ::qsnprintf(msg_buf, sizeof(msg_buf), "Imported %s, %u bytes changed, pc 0x%04x", szFile, patched, pc);
+   msg("msp430emu: %s\n", msg_buf);
+   jumpto(pc);
+}
+
+//queue input for the getsn and getchar system calls, one entry per pasted
+//line or the whole of a file
+void queueInputDialog() {
+   char szFile[260];
+#ifndef __QT__
+   const char *filter = "All (*.*)\0*.*\0";
+#else
+   const char *filter = "All (*.*)";
+#endif
+   char *text = textBox("Queue Input", "One input per line, start a line with hex: for hex encoded bytes.\n"
+                                       "Leave this empty to queue the contents of a file");
+   if (text == NULL) {
+      return;
+   }
+   unsigned int before = emu.input.count;
+   if (text[0]) {
+      char *line = text;
+      while (*line) {
+         char *end = strchr(line, '\n');
+         if (end) {
+            *end = 0;
+         }
+         size_t len = strlen(line);
+         if (len && line[len - 1] == '\r') {
+            line[--len] = 0;
+         }
+         bool ok;
+         if (strncmp(line, "hex:", 4) == 0) {
+            ok = emu.queueHexInput(line + 4);
+         }
+         else {
+            ok = emu.queueInput(line, len);
+         }
+         if (!ok) {
+            msg("msp430emu: queue input: could not queue \"%s\"\n", line);
+         }
+         if (end == NULL) {
+            break;
+         }
+         line = end + 1;
+      }
+   }
+   else {
+      szFile[0] = 0;
+      if (getOpenFileName("Input to queue", szFile, sizeof(szFile), filter) == NULL) {
+         qfree(text);
+         return;
+      }
+      FILE *f = qfopen(szFile, "rb");
+      if (f == NULL) {
+         qfree(text);
+         showErrorMessage("Unable to open input file");
+         return;
+      }
+      bytevec_t input;
+      unsigned char buf[512];
+      int readBytes;
+      while ((readBytes = qfread(f, buf, sizeof(buf))) > 0) {
+         input.append(buf, readBytes);
+      }
+      qfclose(f);
+      if (!emu.queueInput(input.size() ? &input[0] : buf, input.size())) {
+         showErrorMessage("That file is too large to queue");
+      }
+   }
+   qfree(text);
+   msg("msp430emu: queue input: %u queued, %u waiting\n", emu.input.count - before, emu.input.count);
+}
+
+void clearQueuedInput() {
+   emu.clearInput();
+   msg("msp430emu: input queue cleared\n");
+}
+
+//run library functions natively, the current hooks or else those the
+//database's names suggest offered for editing
+void nativeHooksInput() {
+   char spec[512];
+   size_t len = 0;
+   spec[0] = 0;
+   unsigned int count;
+   const HookEntry *hooks = emu.getHooks(&count);
+   for (unsigned int i = 0; i < count; i++) {
+      if (hooks[i].addr != SYSCALL_ADDR && hooks[i].name && len < sizeof(spec)) {
+         len += ::qsnprintf(spec + len, sizeof(spec) - len, "%s@0x%04X ", hooks[i].name, hooks[i].addr);
+      }
+   }
+   if (len == 0) {
+      for (size_t i = 0; i < get_nlist_size() && len < sizeof(spec); i++) {
+         const NativeFunction *f = findNativeFunction(get_nlist_name(i));
+         unsigned int addr = (unsigned int)get_nlist_ea(i);
+         if (f && addr < MEM_SIZE && addr != SYSCALL_ADDR) {
+            len += ::qsnprintf(spec + len, sizeof(spec) - len, "%s@0x%04X ", f->name, addr);
+         }
+      }
+   }
+   char *reply = inputBox("Native Hooks", "Functions to run natively, name@addr (blank for none)", spec);
+   if (reply == NULL) {
+      return;
+   }
+   emu.clearHooks();
+   if (!addNativeHooks(&emu, reply)) {
+      showErrorMessage("Unknown function or bad address in the hook list");
+   }
+   hooks = emu.getHooks(&count);
+   unsigned int installed = 0;
+   for (unsigned int i = 0; i < count; i++) {
+      installed += hooks[i].addr != SYSCALL_ADDR;
+   }
+   msg("msp430emu: native hooks: %u installed\n", installed);
+}
+
+//where the session being recorded goes when recording stops
+static char recordPath[260];
+
+bool isRecording() {
+   return emu.replay != NULL;
+}
+
+static void finishRecording() {
+   if (emu.replay) {
+      if (stopRecording(&emu, recordPath) == REPLAY_OK) {
+         msg("msp430emu: session recorded to %s\n", recordPath);
+      }
+      else {
+         msg("msp430emu: unable to write the session to %s\n", recordPath);
+      }
+   }
+}
+
+//start logging everything that reaches the emulator from outside, or stop
+//and write the log
+void recordSession() {
+#ifndef __QT__
+   const char *filter = "All (*.*)\0*.*\0Replay files (*.rpl)\0*.rpl\0";
+#else
+   const char *filter = "All (*.*);;Replay files (*.rpl)";
+#endif
+   if (emu.replay) {
+      finishRecording();
+      return;
+   }
+   recordPath[0] = 0;
+   if (getSaveFileName("Record session to", recordPath, sizeof(recordPath), filter) == NULL) {
+      return;
+   }
+   showWaitCursor();
+   ReplayLog *log = startRecording(&emu);
+   restoreCursor();
+   if (log == NULL) {
+      showErrorMessage("Out of memory, recording cancelled");
+      return;
+   }
+   log->randVal = randVal;
+   msg("msp430emu: recording session\n");
+}
+
+//replay a recorded session on a private machine and check that it ends
+//exactly as the recording did
+void replaySessionInput() {
+   char msg_buf[256];
+   char szFile[260];
+#ifndef __QT__
+   const char *filter = "Replay files (*.rpl)\0*.rpl\0All (*.*)\0*.*\0";
+#else
+   const char *filter = "Replay files (*.rpl);;All (*.*)";
+#endif
+   szFile[0] = 0;
+   if (getOpenFileName("Session to replay", szFile, sizeof(szFile), filter) == NULL) {
+      return;
+   }
+   ReplayLog *log;
+   switch (loadReplay(szFile, &log)) {
+      case REPLAY_OK:
+         break;
+      case REPLAY_NO_FILE:
+         showErrorMessage("Unable to open the replay file");
+         return;
+      case REPLAY_BAD_FORMAT:
+         showErrorMessage("Malformed or unfinished replay file");
+         return;
+      default:
+         showErrorMessage("Out of memory, replay cancelled");
+         return;
+   }
+   unsigned char *mem = (unsigned char*)malloc(MEM_SIZE);
+   if (mem == NULL) {
+      freeReplay(log);
+      showErrorMessage("Out of memory, replay cancelled");
+      return;
+   }
+   Machine *m = new Machine();
+   ReplayResult res;
+   showWaitCursor();
+   replayRun(log, m, mem, &res);
+   restoreCursor();
+   if (res.match) {
+      ::qsnprintf(msg_buf, sizeof(msg_buf), "Replayed %llu instructions, the final state matches the recording\n"
+                  "stop reason %s at 0x%04x",
+                  (unsigned long long)res.insns, stopReasonName(res.reason), m->cpu.general[PC]);
+   }
+   else if (res.diverged) {
+      ::qsnprintf(msg_buf, sizeof(msg_buf), "Replayed %llu instructions, the replay diverged from the recording\n"
+                  "at instruction %llu",
+                  (unsigned long long)res.insns, (unsigned long long)res.divergedAt);
+   }
+   else {
+      ::qsnprintf(msg_buf, sizeof(msg_buf), "Replayed %llu instructions, the final state differs from the recording",
+                  (unsigned long long)res.insns);
+   }
+   msg("msp430emu: replay: %s\n", msg_buf);
+   showInformationMessage("Replay complete", msg_buf);
+   delete m;
+   free(mem);
+   freeReplay(log);
 }
 
 //skip the instruction at eip
@@ -473,7 +813,9 @@ void grabStackBlock() {
 
 void stepOne() {
    codeCheck();
+   recordResume(&emu);
    executeInstruction();
+   recordPause(&emu);
    codeCheck();
    syncDisplay();
 }
@@ -487,7 +829,9 @@ void emuSyncDisplay() {
 //step the emulator one instruction without
 //updating any emulator displays
 void traceOne() {
+   recordResume(&emu);
    executeInstruction();
+   recordPause(&emu);
 }
 
 //let the emulator run
@@ -497,13 +841,15 @@ void run() {
    codeCheck();
    showWaitCursor();
    //tell the cpu that we want to run free
-   shouldBreak = 0;
+   emu.shouldBreak = 0;
+   recordResume(&emu);
    //always execute at least one instruction this helps when
    //we are running from an existing breakpoint
    executeInstruction();
-   while (!isBreakpoint(pc) && !shouldBreak) {
+   while (!isBreakpoint(pc) && !emu.shouldBreak) {
       executeInstruction();
    }
+   recordPause(&emu);
    syncDisplay();
    restoreCursor();
 }
@@ -512,13 +858,16 @@ void trace() {
    codeCheck();
    showWaitCursor();
    //tell the cpu that we want to run free
-   shouldBreak = 0;
+   emu.shouldBreak = 0;
+   recordResume(&emu);
    //always execute at least one instruction this helps when
    //we are running from an existing breakpoint
    executeInstruction();
-   while (!isBreakpoint(pc) && !shouldBreak) {
+   while (!isBreakpoint(pc) && !emu.shouldBreak) {
       executeInstruction();
    }
+   recordPause(&emu);
+   emu.flushConsole();
    restoreCursor();
 }
 
@@ -590,6 +939,7 @@ static int idaapi idpCallback(void * /*cookie*/, int code, va_list /*va*/) {
 #ifdef DEBUG
       msg(PLUGIN_NAME": closebase notification\n");
 #endif
+      invalidateBootImage();
       break;
    }
 #if IDA_SDK_VERSION >= 700
@@ -636,8 +986,26 @@ static int idaapi idpCallback(void * /*cookie*/, int code, va_list /*va*/) {
    return 0;
 }
 
+//
+// Database patches made while the emulator is stopped come from the user,
+// a session being recorded compares the pages they touch when it resumes
+//
+#if IDA_SDK_VERSION >= 700
+static ssize_t idaapi idbCallback(void * /*cookie*/, int code, va_list va) {
+#else
+static int idaapi idbCallback(void * /*cookie*/, int code, va_list va) {
+#endif
+   if (code == idb_event::byte_patched) {
+      ea_t ea = va_arg(va, ea_t);
+      if (ea < MEM_SIZE) {
+         recordEdit(&emu, (unsigned short)ea, 1);
+      }
+   }
+   return 0;
+}
+
 void doReset() {
-   resetCpu();
+   warmReset();
 //   pc = (unsigned int)get_screen_ea();
    syncDisplay();
 }
@@ -652,10 +1020,12 @@ void runToCursor() {
    showWaitCursor();
    unsigned int endAddr = (unsigned int)get_screen_ea();
    //tell the cpu that we want to run free
-   shouldBreak = 0;
-   while (pc != endAddr && !shouldBreak) {
+   emu.shouldBreak = 0;
+   recordResume(&emu);
+   while (pc != endAddr && !emu.shouldBreak) {
       executeInstruction();
    }
+   recordPause(&emu);
    syncDisplay();
    restoreCursor();
    codeCheck();
@@ -672,6 +1042,497 @@ void setBreakpoint() {
    }
 }
 
+//ask the user where warm boot state should be captured. an empty
+//response selects the first input system call
+void setWarmBootAddr() {
+   char loc[16];
+   unsigned int addr = getWarmBootAddress();
+   if (addr == WARM_BOOT_INPUT) {
+      loc[0] = 0;
+   }
+   else {
+      ::qsnprintf(loc, sizeof(loc), "0x%04X", addr);
+   }
+   char *wb = inputBox("Warm Boot Address", "Capture state at (blank for first input syscall)", loc);
+   if (wb) {
+      setWarmBootAddress(strtoul(wb, NULL, 0) & 0xffff);
+   }
+   else {
+      setWarmBootAddress(WARM_BOOT_INPUT);
+   }
+   invalidateBootImage();
+}
+
+//fuzz the getsn system call starting from the current machine state
+void fuzzInput() {
+   char msg_buf[256];
+   char *secs = inputBox("Fuzz Input", "How many seconds should the fuzzer run?", "60");
+   if (secs == NULL) {
+      return;
+   }
+   FuzzOptions opts;
+   FuzzStats stats;
+   char dir[260];
+   initFuzzOptions(&opts);
+   opts.seconds = strtoul(secs, NULL, 0);
+   //an empty reply logs comparisons everywhere
+   char *sites = inputBox("Fuzz Input", "Log comparisons at (space separated addresses, blank for all)", "");
+   static unsigned char siteMap[CMPLOG_SITE_BYTES];
+   memset(siteMap, 0, sizeof(siteMap));
+   for (char *tok = sites ? strtok(sites, " ,") : NULL; tok; tok = strtok(NULL, " ,")) {
+      unsigned int addr = parseNumber(tok) & 0xffff;
+      CMPLOG_SET_SITE(siteMap, addr);
+      opts.cmpLogSites = siteMap;
+   }
+   opts.outDir = getDirectoryName("Save interesting inputs to", dir, sizeof(dir));
+   showWaitCursor();
+   int res = fuzz(&opts, &stats);
+   restoreCursor();
+   switch (res) {
+      case FUZZ_NO_INPUT:
+         showErrorMessage("The firmware never requested input, fuzzing cancelled");
+         break;
+      case FUZZ_NO_MEMORY:
+         showErrorMessage("Out of memory, fuzzing cancelled");
+         break;
+      default:
+         ::qsnprintf(msg_buf, sizeof(msg_buf),
+                     "%u execs in %u seconds on %u threads, %u edges, %u corpus inputs\n"
+                     "%u unlocks, %u crashes in %u buckets, %u hangs, %u paths from logged comparisons",
+                     stats.execs, stats.seconds, stats.threads, stats.edges, stats.corpus,
+                     stats.unlocks, stats.crashes, stats.buckets, stats.hangs, stats.splices);
+         msg("msp430emu: fuzz: %s\n", msg_buf);
+         showInformationMessage("Fuzzing complete", msg_buf);
+         break;
+   }
+}
+
+//shrink a crashing or unlocking input, either one chosen from disk or
+//the last one typed into the getsn dialog, keeping the stop reason and pc
+void minimizeCurrentInput() {
+   char msg_buf[256];
+   char szFile[260];
+#ifndef __QT__
+   const char *filter = "All (*.*)\0*.*\0";
+#else
+   const char *filter = "All (*.*)";
+#endif
+   bytevec_t input;
+   szFile[0] = 0;
+   if (getOpenFileName("Input to minimize (cancel for the last getsn input)", szFile, sizeof(szFile), filter)) {
+      FILE *f = qfopen(szFile, "rb");
+      if (f == NULL) {
+         showErrorMessage("Unable to open input file");
+         return;
+      }
+      unsigned char buf[512];
+      int readBytes;
+      while ((readBytes = qfread(f, buf, sizeof(buf))) > 0) {
+         input.append(buf, readBytes);
+      }
+      qfclose(f);
+   }
+   else {
+      input = lastInput;
+   }
+   if (input.size() == 0) {
+      return;
+   }
+
+   showWaitCursor();
+   Snapshot *base = snapshotAtInput(RUNNER_BOOT_BUDGET);
+   if (base == NULL) {
+      restoreCursor();
+      showErrorMessage("The firmware never requested input, minimizing cancelled");
+      return;
+   }
+   FuzzOptions opts;
+   MinimizeStats stats;
+   initFuzzOptions(&opts);
+   bytevec_t result;
+   result.resize(input.size());
+   int res = minimizeInput(base, &input[0], input.size(), &result[0], opts.instBudget, 0, &stats);
+   free(base);
+   restoreCursor();
+   if (res != MIN_OK) {
+      showErrorMessage("Out of memory, minimizing cancelled");
+      return;
+   }
+   result.resize(stats.len);
+   ::qsnprintf(msg_buf, sizeof(msg_buf),
+               "Reduced %u bytes to %u bytes in %u execs on %u threads,\n"
+               "stop reason %s at 0x%04x preserved",
+               stats.origLen, stats.len, stats.execs, stats.threads, stopReasonName(stats.reason), stats.stopPc);
+   msg("msp430emu: minimize: %s\n", msg_buf);
+   showInformationMessage("Minimizing complete", msg_buf);
+
+   char *fname = getSaveFileName("Save minimized input", szFile, sizeof(szFile), filter);
+   if (fname) {
+      FILE *f = qfopen(fname, "wb");
+      if (f) {
+         qfwrite(f, &result[0], result.size());
+         qfclose(f);
+      }
+   }
+}
+
+//enumerate candidate inputs on every core until one opens the lock
+void bruteForceInput() {
+   char msg_buf[512];
+   char charset[80];
+   char prefix[80];
+   char suffix[80];
+   //inputBox hands back a shared buffer so each reply is copied out
+   char *reply = inputBox("Brute Force Input", "Characters to try (a-z style ranges allowed)", "0-9");
+   if (reply == NULL) {
+      return;
+   }
+   ::qstrncpy(charset, reply, sizeof(charset));
+   reply = inputBox("Brute Force Input", "Length range of the enumerated part", "1-4");
+   if (reply == NULL) {
+      return;
+   }
+   BruteOptions opts;
+   BruteStats stats;
+   initBruteOptions(&opts);
+   char *end;
+   opts.minLen = strtoul(reply, &end, 0);
+   opts.maxLen = *end ? strtoul(end + 1, NULL, 0) : opts.minLen;
+   reply = inputBox("Brute Force Input", "Fixed prefix (blank for none)", "");
+   ::qstrncpy(prefix, reply ? reply : "", sizeof(prefix));
+   reply = inputBox("Brute Force Input", "Fixed suffix (blank for none)", "");
+   ::qstrncpy(suffix, reply ? reply : "", sizeof(suffix));
+   opts.charset = charset;
+   opts.prefix = prefix;
+   opts.suffix = suffix;
+
+   showWaitCursor();
+   int res = bruteForce(&opts, &stats);
+   restoreCursor();
+   switch (res) {
+      case BRUTE_NO_INPUT:
+         showErrorMessage("The firmware never requested input, brute force cancelled");
+         break;
+      case BRUTE_NO_MEMORY:
+         showErrorMessage("Out of memory, brute force cancelled");
+         break;
+      case BRUTE_BAD_OPTIONS:
+         showErrorMessage("Empty character set, bad length range or candidates longer than the input buffer");
+         break;
+      default:
+         if (stats.found) {
+            ::qsnprintf(msg_buf, sizeof(msg_buf), "Unlocked by \"%.*s\" after %" FMT_64 "u of %" FMT_64 "u candidates in %u seconds on %u threads",
+                        (int)stats.len, stats.input, stats.tried, stats.space, stats.seconds, stats.threads);
+         }
+         else {
+            ::qsnprintf(msg_buf, sizeof(msg_buf), "No unlock in %" FMT_64 "u of %" FMT_64 "u candidates, %u seconds on %u threads",
+                        stats.tried, stats.space, stats.seconds, stats.threads);
+         }
+         msg("msp430emu: brute force: %s\n", msg_buf);
+         showInformationMessage("Brute force complete", msg_buf);
+         break;
+   }
+}
+
+void timingAttackInput() {
+   char msg_buf[512];
+   char charset[80];
+   char *reply = inputBox("Timing Attack Input", "Characters to try (a-z style ranges allowed)", "0-9a-zA-Z");
+   if (reply == NULL) {
+      return;
+   }
+   ::qstrncpy(charset, reply, sizeof(charset));
+   TimingOptions opts;
+   TimingStats stats;
+   initTimingOptions(&opts);
+   opts.charset = charset;
+   reply = inputBox("Timing Attack Input", "Longest input to recover", "16");
+   if (reply == NULL) {
+      return;
+   }
+   opts.maxLen = strtoul(reply, NULL, 0);
+   reply = inputBox("Timing Attack Input", "Address to time to (blank for the whole run)", "");
+   if (reply) {
+      opts.target = strtoul(reply, NULL, 0) & 0xffff;
+   }
+
+   showWaitCursor();
+   int res = timingSearch(&opts, &stats);
+   restoreCursor();
+   switch (res) {
+      case TIMING_NO_INPUT:
+         showErrorMessage("The firmware never requested input, timing attack cancelled");
+         break;
+      case TIMING_NO_MEMORY:
+         showErrorMessage("Out of memory, timing attack cancelled");
+         break;
+      case TIMING_BAD_OPTIONS:
+         showErrorMessage("Empty character set or bad length");
+         break;
+      default:
+         for (unsigned int i = 0; i < stats.len; i++) {
+            msg("msp430emu: timing: byte %u '%c' %u instructions, lead %u\n", i,
+                stats.input[i], stats.insns[i], stats.margin[i]);
+         }
+         ::qsnprintf(msg_buf, sizeof(msg_buf), "%s \"%.*s\" after %u runs on %u threads",
+                     stats.unlocked ? "Unlocked by" : "Lock still closed, best guess",
+                     (int)stats.len, stats.input, stats.execs, stats.threads);
+         msg("msp430emu: timing: %s\n", msg_buf);
+         showInformationMessage("Timing attack complete", msg_buf);
+         break;
+   }
+}
+
+void powerAnalysisInput() {
+   char msg_buf[512];
+   PowerOptions opts;
+   PowerStats stats;
+   initPowerOptions(&opts);
+   char *reply = inputBox("Power Analysis", "Number of random inputs to trace", "500");
+   if (reply == NULL) {
+      return;
+   }
+   opts.traces = strtoul(reply, NULL, 0);
+   reply = inputBox("Power Analysis", "Input length", "16");
+   if (reply == NULL) {
+      return;
+   }
+   opts.inputLen = strtoul(reply, NULL, 0);
+   reply = inputBox("Power Analysis", "Input byte mixed with the key byte", "0");
+   if (reply == NULL) {
+      return;
+   }
+   opts.offset = strtoul(reply, NULL, 0);
+   reply = inputBox("Power Analysis", "Intermediate to attack (xor or aes)", "aes");
+   if (reply == NULL) {
+      return;
+   }
+   opts.sbox = strcmp(reply, "xor") == 0 ? NULL : aesSbox;
+   reply = inputBox("Power Analysis", "Instructions to record per trace", "4096");
+   if (reply == NULL) {
+      return;
+   }
+   opts.samples = strtoul(reply, NULL, 0);
+   opts.instBudget = opts.samples;
+
+   showWaitCursor();
+   int res = powerAnalysis(&opts, &stats);
+   restoreCursor();
+   switch (res) {
+      case POWER_NO_INPUT:
+         showErrorMessage("The firmware never requested input, power analysis cancelled");
+         break;
+      case POWER_NO_MEMORY:
+         showErrorMessage("Out of memory, power analysis cancelled");
+         break;
+      case POWER_BAD_OPTIONS:
+         showErrorMessage("Too few traces, no samples, a bad byte offset or inputs longer than the input buffer");
+         break;
+      default:
+         for (unsigned int i = 0; i < 8; i++) {
+            msg("msp430emu: power: key 0x%02x correlation %.3f at instruction %u\n",
+                stats.peaks[i].guess, stats.peaks[i].corr, stats.peaks[i].sample);
+         }
+         ::qsnprintf(msg_buf, sizeof(msg_buf), "Best key byte 0x%02x, correlation %.3f at instruction %u (next best %.3f), %u traces on %u threads",
+                     stats.peaks[0].guess, stats.peaks[0].corr, stats.peaks[0].sample,
+                     stats.peaks[1].corr, stats.execs, stats.threads);
+         msg("msp430emu: power: %s\n", msg_buf);
+         showInformationMessage("Power analysis complete", msg_buf);
+         break;
+   }
+}
+
+void faultCampaignInput() {
+   char msg_buf[512];
+   char input[FAULT_MAX_INPUT + 1];
+   FaultOptions opts;
+   FaultStats stats;
+   initFaultOptions(&opts);
+   char *reply = inputBox("Fault Injection", "Input to run under each fault", "");
+   ::qstrncpy(input, reply ? reply : "", sizeof(input));
+   opts.input = (const unsigned char*)input;
+   opts.inputLen = strlen(input);
+   reply = inputBox("Fault Injection", "Fault models (any of skip, reg, mem)", "skip reg");
+   if (reply == NULL) {
+      return;
+   }
+   opts.models = 0;
+   if (strstr(reply, "skip")) {
+      opts.models |= FAULT_MODEL(FAULT_SKIP);
+   }
+   if (strstr(reply, "reg")) {
+      opts.models |= FAULT_MODEL(FAULT_REG_FLIP);
+   }
+   if (strstr(reply, "mem")) {
+      opts.models |= FAULT_MODEL(FAULT_MEM_FLIP);
+      reply = inputBox("Fault Injection", "Memory range to flip", "0x2400-0x240f");
+      if (reply == NULL) {
+         return;
+      }
+      char *end;
+      opts.memLow = strtoul(reply, &end, 0);
+      opts.memHigh = *end ? strtoul(end + 1, NULL, 0) : opts.memLow;
+   }
+   reply = inputBox("Fault Injection", "Faults to sample (0 for every fault)", "0");
+   if (reply == NULL) {
+      return;
+   }
+   opts.samples = strtoul(reply, NULL, 0);
+
+   showWaitCursor();
+   int res = faultCampaign(&opts, &stats);
+   restoreCursor();
+   switch (res) {
+      case FAULT_NO_INPUT:
+         showErrorMessage("The firmware never requested input, fault campaign cancelled");
+         break;
+      case FAULT_NO_MEMORY:
+         showErrorMessage("Out of memory, fault campaign cancelled");
+         break;
+      case FAULT_BAD_OPTIONS:
+         showErrorMessage("No fault models selected or a bad memory range");
+         break;
+      case FAULT_NO_END:
+         showErrorMessage("The run without faults never stopped, fault campaign cancelled");
+         break;
+      default:
+         for (unsigned int i = 0; i < stats.numUnlocks; i++) {
+            Fault *f = &stats.unlocks[i];
+            switch (f->kind) {
+               case FAULT_SKIP:
+                  msg("msp430emu: fault: unlocked by skipping 0x%04x on execution %u\n", f->target, f->when);
+                  break;
+               case FAULT_REG_FLIP:
+                  msg("msp430emu: fault: unlocked by flipping bit %u of r%u after instruction %u\n",
+                      f->bit, f->target, f->when);
+                  break;
+               case FAULT_MEM_FLIP:
+                  msg("msp430emu: fault: unlocked by flipping bit %u of 0x%04x after instruction %u\n",
+                      f->bit, f->target, f->when);
+                  break;
+            }
+         }
+         ::qsnprintf(msg_buf, sizeof(msg_buf), "%" FMT_64 "u of %" FMT_64 "u faults run in %u seconds on %u threads "
+                     "(unfaulted run: %s after %u instructions): %" FMT_64 "u unlocked, %" FMT_64 "u crashed, "
+                     "%" FMT_64 "u hung, %" FMT_64 "u unchanged",
+                     stats.runs, stats.space, stats.seconds, stats.threads,
+                     stopReasonName(stats.goldenReason), stats.goldenInsns,
+                     stats.outcomes[FAULT_UNLOCKED], stats.outcomes[FAULT_CRASHED],
+                     stats.outcomes[FAULT_HUNG], stats.outcomes[FAULT_UNCHANGED]);
+         msg("msp430emu: fault: %s\n", msg_buf);
+         showInformationMessage("Fault campaign complete", msg_buf);
+         break;
+   }
+}
+
+void explorePathsInput() {
+   char msg_buf[512];
+   char input[EXPLORE_MAX_INPUT + 1];
+   ExploreOptions opts;
+   ExploreStats stats;
+   initExploreOptions(&opts);
+   char *reply = inputBox("Explore Paths", "Input to start from", "");
+   ::qstrncpy(input, reply ? reply : "", sizeof(input));
+   opts.input = (const unsigned char*)input;
+   opts.inputLen = strlen(input);
+   reply = inputBox("Explore Paths", "Most branches to force along one path", "8");
+   if (reply == NULL) {
+      return;
+   }
+   opts.maxDepth = strtoul(reply, NULL, 0);
+   reply = inputBox("Explore Paths", "Address to reach (blank to look for an unlock)", "");
+   if (reply) {
+      opts.target = strtoul(reply, NULL, 0) & 0xffff;
+   }
+
+   showWaitCursor();
+   int res = explore(&opts, &stats);
+   restoreCursor();
+   switch (res) {
+      case EXPLORE_NO_INPUT:
+         showErrorMessage("The firmware never requested input, exploration cancelled");
+         break;
+      case EXPLORE_NO_MEMORY:
+         showErrorMessage("Out of memory, exploration cancelled");
+         break;
+      case EXPLORE_BAD_OPTIONS:
+         ::qsnprintf(msg_buf, sizeof(msg_buf), "At most %u branches may be forced", EXPLORE_MAX_DEPTH);
+         showErrorMessage(msg_buf);
+         break;
+      default:
+         for (unsigned int i = 0; i < stats.depth; i++) {
+            char offsets[128];
+            formatTaint(stats.path[i].mask, offsets, sizeof(offsets));
+            msg("msp430emu: explore: force the jump at 0x%04x to 0x%04x (input bytes %s)\n",
+                stats.path[i].site, stats.path[i].dest, offsets);
+         }
+         if (stats.found) {
+            ::qsnprintf(msg_buf, sizeof(msg_buf), "%s after forcing %u branches, %u states run (%u duplicates, %u pruned) in %u seconds on %u threads",
+                        stats.reason == STOP_UNLOCK ? "Unlocked" : "Target reached", stats.depth,
+                        stats.states, stats.duplicates, stats.pruned, stats.seconds, stats.threads);
+         }
+         else {
+            ::qsnprintf(msg_buf, sizeof(msg_buf), "Nothing found, %u states run (%u duplicates, %u pruned) in %u seconds on %u threads",
+                        stats.states, stats.duplicates, stats.pruned, stats.seconds, stats.threads);
+         }
+         msg("msp430emu: explore: %s\n", msg_buf);
+         showInformationMessage("Exploration complete", msg_buf);
+         break;
+   }
+}
+
+void bugModeDiffInput() {
+   char msg_buf[512];
+   char input[256];
+   DiffOptions opts;
+   DiffStats stats;
+   initDiffOptions(&opts);
+   char *reply = inputBox("Bug Mode Differences", "Input for the next getsn", "");
+   ::qstrncpy(input, reply ? reply : "", sizeof(input));
+   opts.input = (const unsigned char*)input;
+   opts.inputLen = strlen(input);
+
+   showWaitCursor();
+   int res = diffRun(&opts, &stats);
+   restoreCursor();
+   if (res != DIFF_OK) {
+      showErrorMessage("Out of memory, bug mode comparison cancelled");
+      return;
+   }
+   if (!stats.diverged) {
+      if (stats.reason == STOP_NONE) {
+         ::qsnprintf(msg_buf, sizeof(msg_buf), "No differences in %u instructions", stats.insns);
+      }
+      else {
+         ::qsnprintf(msg_buf, sizeof(msg_buf), "No differences in %u instructions, both stopped (%s)",
+                     stats.insns, stopReasonName(stats.reason));
+      }
+      msg("msp430emu: diff: %s\n", msg_buf);
+      showInformationMessage("Bug mode comparison complete", msg_buf);
+      return;
+   }
+   unsigned int regs = 0;
+   for (unsigned int i = 0; i < 16; i++) {
+      if (stats.regMask & (1 << i)) {
+         regs++;
+         msg("msp430emu: diff: r%u accurate 0x%04x, bug mode 0x%04x\n", i, stats.accurate[i], stats.quirk[i]);
+      }
+   }
+   for (unsigned int i = 0; i < stats.numBytes; i++) {
+      DiffByte *d = &stats.bytes[i];
+      msg("msp430emu: diff: 0x%04x accurate 0x%02x, bug mode 0x%02x\n", d->addr, d->accurate, d->quirk);
+   }
+   if (stats.reason != stats.quirkReason) {
+      msg("msp430emu: diff: accurate run %s, bug mode run %s\n",
+          stopReasonName(stats.reason), stopReasonName(stats.quirkReason));
+   }
+   ::qsnprintf(msg_buf, sizeof(msg_buf), "Instruction %u at 0x%04x (opcode 0x%04x) differs in bug mode: %u registers, %u memory bytes",
+               stats.insns, stats.site, stats.opcode, regs, stats.totalBytes);
+   msg("msp430emu: diff: %s\n", msg_buf);
+   showInformationMessage("Bug mode comparison complete", msg_buf);
+   jumpto(stats.site);
+}
+
 void clearBreakpoint() {
    char loc[16];
    ::qsnprintf(loc, sizeof(loc), "0x%04X", (unsigned int)get_screen_ea());
@@ -707,6 +1568,8 @@ int idaapi init(void) {
 //   msg(PLUGIN_NAME": hooking idp\n");
    hook_to_notification_point(HT_IDP, idpCallback, NULL);
    idpHooked = true;
+   hook_to_notification_point(HT_IDB, idbCallback, NULL);
+   idbHooked = true;
 
    resetCpu();
 
@@ -739,8 +1602,13 @@ void idaapi term(void) {
       idpHooked = false;
       unhook_from_notification_point(HT_IDP, idpCallback, NULL);
    }
+   if (idbHooked) {
+      idbHooked = false;
+      unhook_from_notification_point(HT_IDB, idbCallback, NULL);
+   }
    destroyEmulatorWindow();
    closeTrace();
+   finishRecording();
    doTrace = false;
    doTrack = false;
 #ifdef DEBUG
@@ -31,7 +31,7 @@ TEMPLATE = lib
 
 #QT +=
 
-CONFIG += qt dll
+CONFIG += qt dll c++11
 
 INCLUDEPATH += $${SDK}/include
 
@@ -81,10 +81,38 @@ SOURCES = msp430emu.cpp \
 	cpu.cpp \
 	break.cpp \
 	buffer.cpp \
+	snapshot.cpp \
+	fuzz.cpp \
+	runner.cpp \
+	minimize.cpp \
+	triage.cpp \
+	brute.cpp \
+	timing.cpp \
+	power.cpp \
+	fault.cpp \
+	explore.cpp \
+	diff.cpp \
+	loader.cpp \
+	hooks.cpp \
+	replay.cpp \
 	emu_script.cpp
 
 HEADERS = break.h \
    buffer.h \
+   snapshot.h \
+   fuzz.h \
+   runner.h \
+   minimize.h \
+   triage.h \
+   brute.h \
+   timing.h \
+   power.h \
+   fault.h \
+   explore.h \
+   diff.h \
+   loader.h \
+   hooks.h \
+   replay.h \
    cpu.h \
    emu_script.h \
    sdk_versions.h \
@@ -0,0 +1,357 @@
+/*
+   Headless AFL++ forkserver front end for MSP430 emulator
+   Copyright (c) 2014 Chris Eagle
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation; either version 2 of the License, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+   more details.
+
+   You should have received a copy of the GNU General Public License along with
+   this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+   Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/*
+ * Usage: msp430emu-afl [-m] [-u] [-t] [-b budget] [-l addr] [-z out] image [testcase]
+ *        msp430emu-afl [-m] [-b budget] [-l addr] -T dir image crash...
+ *
+ * The image (raw memory loaded at addr, default 0, or an Intel HEX, TI-TXT
+ * or ELF file) is loaded, the cpu is reset through the reset vector and
+ * run to the first getsn system call where the machine is snapshotted.
+ * The testcase (a file, or stdin when absent) is then delivered to that
+ * getsn call. Under afl-fuzz the process acts as a persistent mode
+ * forkserver: a child is forked once and restores the snapshot for each
+ * testcase, stopping itself between runs. Edge coverage is written
+ * straight into the __AFL_SHM_ID map. With -z the testcase is minimized
+ * instead, keeping its stop reason and pc, and written to out.
+ * With -T each crash input is replayed and filed in the triage index in dir.
+ *
+ * Stop reasons are reported to afl-fuzz as follows
+ *    lock opened            SIGABRT (a normal exit with -u)
+ *    invalid instruction    SIGILL
+ *    misaligned pc, read    SIGBUS
+ *    or write
+ *    pc in a NX page        SIGSEGV
+ *    budget exhausted or    normal exit (SIGXCPU with -t)
+ *    state repeated
+ *    cpu off, input needed  normal exit
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/shm.h>
+#include <sys/wait.h>
+
+#include "cpu.h"
+#include "snapshot.h"
+#include "runner.h"
+#include "minimize.h"
+#include "triage.h"
+#include "loader.h"
+
+//descriptors afl-fuzz uses to talk to the forkserver, status is one higher
+#define FORKSRV_FD 198
+
+//default per testcase instruction limit
+#define AFL_INST_BUDGET 1000000
+
+//testcases run by one child before it exits and is replaced
+#define AFL_LOOP_COUNT 10000
+
+#define AFL_MAX_INPUT 0x10000
+
+bool bugMode = false;
+
+//afl-fuzz looks for this to learn that children stop between testcases,
+//external linkage keeps it in the binary
+extern volatile const char persistentSig[];
+volatile const char persistentSig[] = "##SIG_AFL_PERSISTENT##";
+
+static unsigned char image[MEM_SIZE];
+static unsigned char testCase[AFL_MAX_INPUT];
+static const char *testPath = NULL;    //NULL for stdin
+
+static bool unlockIsCrash = true;
+static bool hangIsCrash = false;
+
+static void usage(const char *prog) {
+   fprintf(stderr, "usage: %s [-m] [-u] [-t] [-b budget] [-l addr] [-z out] image [testcase]\n", prog);
+   fprintf(stderr, "       %s [-m] [-b budget] [-l addr] -T dir image crash...\n", prog);
+   fprintf(stderr, "   -m         emulate the microcorruption bugs\n");
+   fprintf(stderr, "   -u         report opening the lock as a normal exit\n");
+   fprintf(stderr, "   -t         report budget exhaustion as a crash\n");
+   fprintf(stderr, "   -b budget  instructions per testcase (default %u)\n", AFL_INST_BUDGET);
+   fprintf(stderr, "   -l addr    load address of the raw image (default 0)\n");
+   fprintf(stderr, "   -z out     minimize the testcase into out\n");
+   fprintf(stderr, "   -T dir     file crash inputs in the triage index in dir\n");
+   exit(1);
+}
+
+static bool loadFirmware(const char *path, unsigned int addr) {
+   const Image *img;
+   int res = loadImage(path, IMAGE_DETECT, addr, &img);
+   if (res != LOAD_OK) {
+      fprintf(stderr, "%s: %s\n", path, res == LOAD_BAD_FORMAT ? "malformed or unsupported image" : "can't read image");
+      return false;
+   }
+   memcpy(image, img->mem, MEM_SIZE);
+   releaseImage(img);
+   return true;
+}
+
+//afl-fuzz rewrites the same file (or stdin) for each testcase so it is
+//read again from the start every time
+static unsigned int readTestCase() {
+   int fd = 0;
+   if (testPath) {
+      fd = open(testPath, O_RDONLY);
+      if (fd < 0) {
+         return 0;
+      }
+   }
+   else {
+      lseek(0, 0, SEEK_SET);
+   }
+   unsigned int len = 0;
+   ssize_t n;
+   while (len < sizeof(testCase) && (n = read(fd, testCase + len, sizeof(testCase) - len)) > 0) {
+      len += n;
+   }
+   if (testPath) {
+      close(fd);
+   }
+   return len;
+}
+
+//the signal that reports reason to afl-fuzz, 0 for a normal exit
+static int stopSignal(unsigned int reason) {
+   switch (reason) {
+      case STOP_UNLOCK:
+         return unlockIsCrash ? SIGABRT : 0;
+      case STOP_INVALID:
+         return SIGILL;
+      case STOP_MISALIGNED_PC: case STOP_MISALIGNED_READ: case STOP_MISALIGNED_WRITE:
+         return SIGBUS;
+      case STOP_EXEC_NX:
+         return SIGSEGV;
+      case STOP_BUDGET: case STOP_LOOP:
+         return hangIsCrash ? SIGXCPU : 0;
+   }
+   return 0;
+}
+
+static void die(int sig) {
+   signal(sig, SIG_DFL);
+   raise(sig);
+   _exit(128 + sig);
+}
+
+//run testcases in a forked child. In persistent mode the child stops
+//itself after each clean run and afl-fuzz's SIGCONT starts the next one
+static void runChild(Runner *r, unsigned int budget) {
+   for (unsigned int i = 0; i < AFL_LOOP_COUNT; i++) {
+      unsigned int len = readTestCase();
+      int sig = stopSignal(runInput(r, testCase, len, budget));
+      if (sig) {
+         die(sig);
+      }
+      if (i + 1 < AFL_LOOP_COUNT) {
+         raise(SIGSTOP);
+      }
+   }
+   _exit(0);
+}
+
+static void forkServer(Runner *r, unsigned int budget) {
+   pid_t child = -1;
+   bool stopped = false;
+   int status;
+   while (true) {
+      unsigned int wasKilled;
+      if (read(FORKSRV_FD, &wasKilled, 4) != 4) {
+         _exit(0);
+      }
+      if (stopped && wasKilled) {
+         //afl-fuzz killed our stopped child on a timeout, reap it
+         stopped = false;
+         waitpid(child, &status, 0);
+      }
+      if (stopped) {
+         stopped = false;
+         kill(child, SIGCONT);
+      }
+      else {
+         child = fork();
+         if (child < 0) {
+            _exit(1);
+         }
+         if (child == 0) {
+            close(FORKSRV_FD);
+            close(FORKSRV_FD + 1);
+            runChild(r, budget);
+         }
+      }
+      if (write(FORKSRV_FD + 1, &child, 4) != 4) {
+         _exit(1);
+      }
+      if (waitpid(child, &status, WUNTRACED) < 0) {
+         _exit(1);
+      }
+      if (WIFSTOPPED(status)) {
+         stopped = true;
+      }
+      if (write(FORKSRV_FD + 1, &status, 4) != 4) {
+         _exit(1);
+      }
+   }
+}
+
+static int minimize(const Snapshot *base, const char *outPath, unsigned int budget) {
+   static unsigned char result[AFL_MAX_INPUT];
+   MinimizeStats stats;
+   unsigned int len = readTestCase();
+   if (minimizeInput(base, testCase, len, result, budget, 0, &stats) != MIN_OK) {
+      fprintf(stderr, "out of memory\n");
+      return 1;
+   }
+   fprintf(stderr, "%u bytes reduced to %u in %u execs on %u threads, %s at 0x%04x\n",
+           stats.origLen, stats.len, stats.execs, stats.threads, stopReasonName(stats.reason), stats.stopPc);
+   FILE *f = fopen(outPath, "wb");
+   if (f == NULL) {
+      perror(outPath);
+      return 1;
+   }
+   fwrite(result, 1, stats.len, f);
+   fclose(f);
+   return 0;
+}
+
+static int triage(Runner *r, const char *dir, char **paths, int count, unsigned int budget) {
+   TriageIndex *ti = openTriageIndex(dir);
+   unsigned int crashes = 0;
+   for (int i = 0; i < count; i++) {
+      testPath = paths[i];
+      unsigned int len = readTestCase();
+      unsigned int reason = runInput(r, testCase, len, budget);
+      if (!isCrashReason(reason)) {
+         fprintf(stderr, "%s: %s, not a crash\n", paths[i], stopReasonName(reason));
+         continue;
+      }
+      crashes++;
+      unsigned int hash = crashHash(r->m);
+      if (triageCrash(ti, reason, hash, r->m->cpu.initial_pc, testCase, len)) {
+         fprintf(stderr, "%s: new bucket %s_%08x at 0x%04x\n", paths[i], stopReasonName(reason),
+                 hash, r->m->cpu.initial_pc);
+      }
+   }
+   fprintf(stderr, "%u crashes, %u buckets in index\n", crashes, triageBuckets(ti));
+   closeTriageIndex(ti);
+   return 0;
+}
+
+static unsigned char *attachCoverage() {
+   const char *id = getenv("__AFL_SHM_ID");
+   if (id == NULL) {
+      return NULL;
+   }
+   void *map = shmat(atoi(id), NULL, 0);
+   if (map == (void*)-1) {
+      perror("shmat");
+      exit(1);
+   }
+   return (unsigned char*)map;
+}
+
+int main(int argc, char **argv) {
+   unsigned int budget = AFL_INST_BUDGET;
+   unsigned int loadAddr = 0;
+   const char *minPath = NULL;
+   const char *triageDir = NULL;
+   int opt;
+   while ((opt = getopt(argc, argv, "mutb:l:z:T:")) != -1) {
+      switch (opt) {
+         case 'm':
+            bugMode = true;
+            emu.bugMode = true;
+            break;
+         case 'u':
+            unlockIsCrash = false;
+            break;
+         case 't':
+            hangIsCrash = true;
+            break;
+         case 'b':
+            budget = strtoul(optarg, NULL, 0);
+            break;
+         case 'l':
+            loadAddr = strtoul(optarg, NULL, 0);
+            break;
+         case 'z':
+            minPath = optarg;
+            break;
+         case 'T':
+            triageDir = optarg;
+            break;
+         default:
+            usage(argv[0]);
+      }
+   }
+   if (optind >= argc || loadAddr >= MEM_SIZE) {
+      usage(argv[0]);
+   }
+   if (triageDir == NULL && optind + 1 < argc && strcmp(argv[optind + 1], "-") != 0) {
+      testPath = argv[optind + 1];
+   }
+   if (!loadFirmware(argv[optind], loadAddr)) {
+      return 1;
+   }
+
+   emu.quietMode = true;
+   emu.setFlatMemory(image);
+   resetCpu();
+   Snapshot *base = snapshotAtInput(RUNNER_BOOT_BUDGET);
+   if (base == NULL) {
+      fprintf(stderr, "firmware never asked for input\n");
+      return 1;
+   }
+   if (minPath) {
+      return minimize(base, minPath, budget);
+   }
+   Runner r;
+   if (!initRunner(&r, base)) {
+      fprintf(stderr, "out of memory\n");
+      return 1;
+   }
+   if (triageDir) {
+      return triage(&r, triageDir, argv + optind + 1, argc - optind - 1, budget);
+   }
+   r.m->coverageMap = attachCoverage();
+   r.detectLoops = true;
+
+   unsigned int hello = 0;
+   if (write(FORKSRV_FD + 1, &hello, 4) == 4) {
+      forkServer(&r, budget);
+   }
+
+   //not running under a forkserver aware afl-fuzz, run the testcase once
+   unsigned int len = readTestCase();
+   unsigned int reason = runInput(&r, testCase, len, budget);
+   fprintf(stderr, "%s at 0x%04x after %u instructions\n", stopReasonName(reason),
+           r.m->cpu.initial_pc, r.insns);
+   int sig = stopSignal(reason);
+   if (sig) {
+      die(sig);
+   }
+   return 0;
+}
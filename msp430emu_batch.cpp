@@ -0,0 +1,717 @@
+/*
+   Headless batch front end for MSP430 emulator
+   Copyright (c) 2014 Chris Eagle
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation; either version 2 of the License, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+   more details.
+
+   You should have received a copy of the GNU General Public License along with
+   this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+   Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/*
+ * Usage: msp430emu-batch [-m] [-t threads] [-b budget] [-o results] manifest
+ *
+ * The manifest holds one JSON object per line, each an independent
+ * scenario:
+ *
+ *   {"id": "guess", "image": "fw.bin", "input": ["password"], "stop": [17472]}
+ *
+ *   id       name echoed in the result (default the line number)
+ *   image    firmware as the command line front end loads it, relative
+ *            paths are taken from the manifest's directory
+ *   format   raw, ihex, titxt, elf or mcdump (default from the contents)
+ *   base     load address of a raw image
+ *   session  session log whose starting state, bug mode and hooks are
+ *            used instead of an image
+ *   regs     {"pc": "0x4400", "r15": 2, ...} replacing starting registers
+ *   bugmode  true to emulate the microcorruption bugs
+ *   input    strings queued in order for getsn and getchar, a "hex:"
+ *            prefix gives hex encoded bytes
+ *   budget   instructions to run (default from -b)
+ *   stop     addresses that end the run when pc reaches one
+ *   hooks    "name@addr ..." native replacements, as -H
+ *
+ * Numbers may be JSON integers or strings such as "0x4400". The scenarios
+ * run across threads workers (default one per hardware thread), each on a
+ * machine of its own. One result line is written per scenario, in manifest
+ * order, to stdout or the -o file:
+ *
+ *   {"id": "guess", "status": "ok", "stop": "...", "pc": 17472, "insns": 1234,
+ *    "inputs_used": 1, "regs": [...], "console": "..."}
+ *
+ * A scenario that can't be run has a status other than "ok" and an error.
+ * Console bytes outside printable ASCII are written as \u00XX escapes, as
+ * are input bytes read that way. Exit status is 0 when every scenario ran,
+ * 1 for a usage error or unreadable manifest, 2 when any scenario failed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cpu.h"
+#include "loader.h"
+#include "batch.h"
+
+//default instruction limit
+#define BATCH_INST_BUDGET 100000000
+
+bool bugMode = false;
+
+static void usage(const char *prog) {
+   fprintf(stderr, "usage: %s [-m] [-t threads] [-b budget] [-o results] manifest\n", prog);
+   fprintf(stderr, "   -m          emulate the microcorruption bugs unless a scenario says otherwise\n");
+   fprintf(stderr, "   -t threads  workers to run (default one per hardware thread)\n");
+   fprintf(stderr, "   -b budget   instructions per scenario (default %u)\n", BATCH_INST_BUDGET);
+   fprintf(stderr, "   -o results  write results here instead of stdout\n");
+   exit(1);
+}
+
+static void skipSpace(const char **p) {
+   while (**p == ' ' || **p == '\t' || **p == '\r' || **p == '\n') {
+      (*p)++;
+   }
+}
+
+static int hexDigit(int c) {
+   if (c >= '0' && c <= '9') {
+      return c - '0';
+   }
+   if (c >= 'a' && c <= 'f') {
+      return c - 'a' + 10;
+   }
+   if (c >= 'A' && c <= 'F') {
+      return c - 'A' + 10;
+   }
+   return -1;
+}
+
+//a JSON string. \u0000 through \u00ff become single bytes so that binary
+//input can be written, anything above is UTF-8 encoded
+static bool parseString(const char **p, qstring *out) {
+   const char *s = *p;
+   out->clear();
+   if (*s++ != '"') {
+      return false;
+   }
+   while (*s != '"') {
+      unsigned char c = *s++;
+      if (c == 0) {
+         return false;
+      }
+      if (c != '\\') {
+         *out += (char)c;
+         continue;
+      }
+      c = *s++;
+      switch (c) {
+         case '"': case '\\': case '/':
+            *out += (char)c;
+            break;
+         case 'b':
+            *out += '\b';
+            break;
+         case 'f':
+            *out += '\f';
+            break;
+         case 'n':
+            *out += '\n';
+            break;
+         case 'r':
+            *out += '\r';
+            break;
+         case 't':
+            *out += '\t';
+            break;
+         case 'u': {
+            unsigned int v = 0;
+            for (int i = 0; i < 4; i++) {
+               int d = hexDigit(*s++);
+               if (d < 0) {
+                  return false;
+               }
+               v = (v << 4) | d;
+            }
+            if (v < 0x100) {
+               *out += (char)v;
+            }
+            else if (v < 0x800) {
+               *out += (char)(0xc0 | (v >> 6));
+               *out += (char)(0x80 | (v & 0x3f));
+            }
+            else {
+               *out += (char)(0xe0 | (v >> 12));
+               *out += (char)(0x80 | ((v >> 6) & 0x3f));
+               *out += (char)(0x80 | (v & 0x3f));
+            }
+            break;
+         }
+         default:
+            return false;
+      }
+   }
+   *p = s + 1;
+   return true;
+}
+
+//a non negative JSON integer or a string holding a C style number
+static bool parseNumber(const char **p, uint64 *v) {
+   char *end;
+   if (**p == '"') {
+      qstring s;
+      if (!parseString(p, &s) || s.length() == 0) {
+         return false;
+      }
+      *v = strtoull(s.c_str(), &end, 0);
+      return *end == 0;
+   }
+   if (**p < '0' || **p > '9') {
+      return false;
+   }
+   *v = strtoull(*p, &end, 10);
+   *p = end;
+   return true;
+}
+
+static bool parseBool(const char **p, bool *v) {
+   uint64 n;
+   if (strncmp(*p, "true", 4) == 0) {
+      *p += 4;
+      *v = true;
+      return true;
+   }
+   if (strncmp(*p, "false", 5) == 0) {
+      *p += 5;
+      *v = false;
+      return true;
+   }
+   if (!parseNumber(p, &n)) {
+      return false;
+   }
+   *v = n != 0;
+   return true;
+}
+
+//step over a value this front end doesn't use
+static bool skipValue(const char **p, unsigned int depth = 0) {
+   qstring s;
+   skipSpace(p);
+   if (depth > 64) {
+      return false;
+   }
+   if (**p == '"') {
+      return parseString(p, &s);
+   }
+   if (**p == '[' || **p == '{') {
+      char close = **p == '[' ? ']' : '}';
+      (*p)++;
+      skipSpace(p);
+      if (**p == close) {
+         (*p)++;
+         return true;
+      }
+      while (true) {
+         if (close == '}') {
+            if (!parseString(p, &s)) {
+               return false;
+            }
+            skipSpace(p);
+            if (*(*p)++ != ':') {
+               return false;
+            }
+         }
+         if (!skipValue(p, depth + 1)) {
+            return false;
+         }
+         skipSpace(p);
+         if (**p == close) {
+            (*p)++;
+            return true;
+         }
+         if (*(*p)++ != ',') {
+            return false;
+         }
+         skipSpace(p);
+      }
+   }
+   const char *s0 = *p;
+   while (**p == '-' || **p == '+' || **p == '.' || (**p >= '0' && **p <= '9') ||
+          (**p >= 'a' && **p <= 'z') || (**p >= 'A' && **p <= 'Z')) {
+      (*p)++;
+   }
+   return *p != s0;
+}
+
+//parse one element of a list into s, leaving *p after it
+typedef bool (*ListElem)(const char **p, BatchScenario *s);
+
+//the elements of a JSON array, or a single value treated as a one element
+//array
+static bool parseList(const char **p, BatchScenario *s, ListElem elem) {
+   skipSpace(p);
+   if (**p != '[') {
+      return elem(p, s);
+   }
+   (*p)++;
+   skipSpace(p);
+   if (**p == ']') {
+      (*p)++;
+      return true;
+   }
+   while (true) {
+      skipSpace(p);
+      if (!elem(p, s)) {
+         return false;
+      }
+      skipSpace(p);
+      if (**p == ']') {
+         (*p)++;
+         return true;
+      }
+      if (*(*p)++ != ',') {
+         return false;
+      }
+   }
+}
+
+static int regByName(const char *name) {
+   static const char *aliases[] = {"pc", "sp", "sr", "cg"};
+   for (int i = 0; i < 4; i++) {
+      if (strcmp(name, aliases[i]) == 0) {
+         return i;
+      }
+   }
+   if (name[0] == 'r' && name[1] >= '0' && name[1] <= '9') {
+      char *end;
+      unsigned long n = strtoul(name + 1, &end, 10);
+      if (*end == 0 && n < 16) {
+         return (int)n;
+      }
+   }
+   return -1;
+}
+
+static char *dupString(const qstring &s) {
+   char *d = (char*)malloc(s.length() + 1);
+   if (d) {
+      memcpy(d, s.c_str(), s.length() + 1);
+   }
+   return d;
+}
+
+//relative paths are taken from the manifest's directory
+static char *resolvePath(const qstring &path, const qstring &dir) {
+   if (path.length() && path[0] != '/' && dir.length()) {
+      return dupString(dir + path);
+   }
+   return dupString(path);
+}
+
+static bool hexBytes(const char *hex, qstring *out) {
+   int hi = -1;
+   out->clear();
+   for (; *hex; hex++) {
+      if (*hex == ' ' || *hex == '\t') {
+         continue;
+      }
+      int v = hexDigit(*hex);
+      if (v < 0) {
+         return false;
+      }
+      if (hi < 0) {
+         hi = v;
+      }
+      else {
+         *out += (char)((hi << 4) | v);
+         hi = -1;
+      }
+   }
+   return hi < 0;
+}
+
+static bool inputElem(const char **p, BatchScenario *s) {
+   qstring in;
+   if (!parseString(p, &in)) {
+      return false;
+   }
+   if (in.compare(0, 4, "hex:") == 0) {
+      qstring bytes;
+      return hexBytes(in.c_str() + 4, &bytes) && addBatchInput(s, bytes.data(), (unsigned int)bytes.length());
+   }
+   return addBatchInput(s, in.data(), (unsigned int)in.length());
+}
+
+static bool stopElem(const char **p, BatchScenario *s) {
+   uint64 addr;
+   if (!parseNumber(p, &addr) || addr >= MEM_SIZE || s->numStops == BATCH_MAX_STOPS) {
+      return false;
+   }
+   s->stops[s->numStops++] = (unsigned short)addr;
+   return true;
+}
+
+//hooks arrays are joined into one comma separated spec
+static bool hookElem(const char **p, BatchScenario *s) {
+   qstring h;
+   if (!parseString(p, &h)) {
+      return false;
+   }
+   size_t len = s->hooks ? strlen(s->hooks) : 0;
+   char *spec = (char*)realloc(s->hooks, len + h.length() + 2);
+   if (spec == NULL) {
+      return false;
+   }
+   if (len) {
+      spec[len++] = ',';
+   }
+   memcpy(spec + len, h.c_str(), h.length() + 1);
+   s->hooks = spec;
+   return true;
+}
+
+//fill s from one manifest line. returns NULL or what was wrong with it
+static const char *parseScenario(const char *line, const qstring &dir, BatchScenario *s) {
+   const char *p = line;
+   qstring key;
+   qstring str;
+   uint64 v;
+   bool b;
+   skipSpace(&p);
+   if (*p++ != '{') {
+      return "not a JSON object";
+   }
+   skipSpace(&p);
+   if (*p == '}') {
+      p++;
+   }
+   else while (true) {
+      skipSpace(&p);
+      if (!parseString(&p, &key)) {
+         return "malformed key";
+      }
+      skipSpace(&p);
+      if (*p++ != ':') {
+         return "missing ':'";
+      }
+      skipSpace(&p);
+      if (key == "id") {
+         const char *start = p;
+         if (*p == '"') {
+            if (!parseString(&p, &str)) {
+               return "malformed id";
+            }
+         }
+         else if (skipValue(&p)) {
+            str.assign(start, p - start);
+         }
+         else {
+            return "malformed id";
+         }
+         free(s->id);
+         s->id = dupString(str);
+      }
+      else if (key == "image" || key == "session") {
+         if (!parseString(&p, &str)) {
+            return "malformed path";
+         }
+         char **field = key == "image" ? &s->image : &s->session;
+         free(*field);
+         *field = resolvePath(str, dir);
+      }
+      else if (key == "format") {
+         if (!parseString(&p, &str) || (s->format = imageFormatByName(str.c_str())) == IMAGE_FORMATS) {
+            return "unknown format";
+         }
+      }
+      else if (key == "base") {
+         if (!parseNumber(&p, &v) || v >= MEM_SIZE) {
+            return "bad base address";
+         }
+         s->base = (unsigned int)v;
+      }
+      else if (key == "budget") {
+         if (!parseNumber(&p, &v)) {
+            return "bad budget";
+         }
+         s->budget = v;
+      }
+      else if (key == "bugmode") {
+         if (!parseBool(&p, &b)) {
+            return "bad bugmode";
+         }
+         s->bugMode = b ? 1 : 0;
+      }
+      else if (key == "regs") {
+         if (*p++ != '{') {
+            return "regs is not an object";
+         }
+         skipSpace(&p);
+         if (*p == '}') {
+            p++;
+         }
+         else while (true) {
+            skipSpace(&p);
+            int reg;
+            if (!parseString(&p, &key) || (reg = regByName(key.c_str())) < 0) {
+               return "unknown register";
+            }
+            skipSpace(&p);
+            if (*p++ != ':') {
+               return "missing ':'";
+            }
+            skipSpace(&p);
+            if (!parseNumber(&p, &v) || v > 0xffff) {
+               return "bad register value";
+            }
+            s->regs[reg] = (unsigned short)v;
+            s->regMask |= 1 << reg;
+            skipSpace(&p);
+            if (*p == '}') {
+               p++;
+               break;
+            }
+            if (*p++ != ',') {
+               return "missing ','";
+            }
+         }
+      }
+      else if (key == "input") {
+         if (!parseList(&p, s, inputElem)) {
+            return "bad input";
+         }
+      }
+      else if (key == "stop") {
+         if (!parseList(&p, s, stopElem)) {
+            return "bad stop address, or too many";
+         }
+      }
+      else if (key == "hooks") {
+         free(s->hooks);
+         s->hooks = NULL;
+         if (!parseList(&p, s, hookElem)) {
+            return "bad hooks";
+         }
+      }
+      else if (!skipValue(&p)) {
+         return "malformed value";
+      }
+      skipSpace(&p);
+      if (*p == '}') {
+         p++;
+         break;
+      }
+      if (*p++ != ',') {
+         return "missing ','";
+      }
+   }
+   skipSpace(&p);
+   if (*p) {
+      return "text after the object";
+   }
+   if (s->image == NULL && s->session == NULL) {
+      return "neither image nor session given";
+   }
+   return NULL;
+}
+
+static void writeString(FILE *f, const char *s, unsigned int len) {
+   fputc('"', f);
+   for (unsigned int i = 0; i < len; i++) {
+      unsigned char c = s[i];
+      if (c == '"' || c == '\\') {
+         fprintf(f, "\\%c", c);
+      }
+      else if (c == '\n') {
+         fprintf(f, "\\n");
+      }
+      else if (c < 0x20 || c >= 0x7f) {
+         fprintf(f, "\\u%04x", c);
+      }
+      else {
+         fputc(c, f);
+      }
+   }
+   fputc('"', f);
+}
+
+static void writeResult(FILE *f, const char *id, const BatchResult *r, const char *error) {
+   fprintf(f, "{\"id\": ");
+   writeString(f, id, strlen(id));
+   if (error) {
+      fprintf(f, ", \"status\": \"error\", \"error\": ");
+      writeString(f, error, strlen(error));
+      fprintf(f, "}\n");
+      return;
+   }
+   if (r->status != BATCH_OK) {
+      fprintf(f, ", \"status\": \"error\", \"error\": \"%s\"}\n", batchStatusName(r->status));
+      return;
+   }
+   fprintf(f, ", \"status\": \"ok\", \"stop\": \"%s\", \"pc\": %u, \"insns\": %llu, \"inputs_used\": %u, \"regs\": [",
+           stopReasonName(r->reason), r->addr, (unsigned long long)r->insns, r->inputsUsed);
+   for (unsigned int i = 0; i < 16; i++) {
+      fprintf(f, i ? ", %u" : "%u", r->regs[i]);
+   }
+   fprintf(f, "], \"console\": ");
+   writeString(f, r->console ? r->console : "", r->consoleLen);
+   fprintf(f, "}\n");
+}
+
+//one line of f of any length, without its newline. false at end of file
+static bool readLine(FILE *f, qstring *line) {
+   char buf[4096];
+   line->clear();
+   while (fgets(buf, sizeof(buf), f)) {
+      size_t n = strlen(buf);
+      if (n && buf[n - 1] == '\n') {
+         line->append(buf, n - 1);
+         return true;
+      }
+      line->append(buf, n);
+   }
+   return line->length() != 0;
+}
+
+int main(int argc, char **argv) {
+   unsigned int threads = 0;
+   uint64 budget = BATCH_INST_BUDGET;
+   const char *outPath = NULL;
+   int opt;
+   while ((opt = getopt(argc, argv, "mt:b:o:")) != -1) {
+      switch (opt) {
+         case 'm':
+            bugMode = true;
+            break;
+         case 't':
+            threads = strtoul(optarg, NULL, 0);
+            break;
+         case 'b':
+            budget = strtoull(optarg, NULL, 0);
+            break;
+         case 'o':
+            outPath = optarg;
+            break;
+         default:
+            usage(argv[0]);
+      }
+   }
+   if (optind + 1 != argc) {
+      usage(argv[0]);
+   }
+   const char *manifest = argv[optind];
+   FILE *in = strcmp(manifest, "-") == 0 ? stdin : fopen(manifest, "r");
+   if (in == NULL) {
+      perror(manifest);
+      return 1;
+   }
+   qstring dir;
+   const char *slash = strrchr(manifest, '/');
+   if (in != stdin && slash) {
+      dir.assign(manifest, slash - manifest + 1);
+   }
+
+   //every line gets a result, those that don't parse are never run
+   unsigned int count = 0;
+   unsigned int cap = 0;
+   BatchScenario *scenarios = NULL;
+   char **errors = NULL;
+   qstring line;
+   unsigned int lineNum = 0;
+   while (readLine(in, &line)) {
+      lineNum++;
+      const char *p = line.c_str();
+      skipSpace(&p);
+      if (*p == 0) {
+         continue;
+      }
+      if (count == cap) {
+         cap = cap ? cap * 2 : 64;
+         scenarios = (BatchScenario*)realloc(scenarios, cap * sizeof(BatchScenario));
+         errors = (char**)realloc(errors, cap * sizeof(char*));
+         if (scenarios == NULL || errors == NULL) {
+            fprintf(stderr, "out of memory\n");
+            return 1;
+         }
+      }
+      BatchScenario *s = &scenarios[count];
+      initBatchScenario(s);
+      s->budget = budget;
+      const char *err = parseScenario(line.c_str(), dir, s);
+      errors[count] = NULL;
+      if (s->id == NULL) {
+         char id[16];
+         qsnprintf(id, sizeof(id), "%u", lineNum);
+         s->id = dupString(id);
+      }
+      if (err) {
+         char text[128];
+         qsnprintf(text, sizeof(text), "line %u: %s", lineNum, err);
+         errors[count] = dupString(text);
+         fprintf(stderr, "%s: %s\n", manifest, text);
+      }
+      count++;
+   }
+   if (in != stdin) {
+      fclose(in);
+   }
+
+   FILE *out = outPath ? fopen(outPath, "w") : stdout;
+   if (out == NULL) {
+      perror(outPath);
+      return 1;
+   }
+
+   //only the scenarios that parsed go to the workers
+   BatchScenario *runnable = (BatchScenario*)malloc((count ? count : 1) * sizeof(BatchScenario));
+   BatchResult *results = (BatchResult*)calloc(count ? count : 1, sizeof(BatchResult));
+   if (runnable == NULL || results == NULL) {
+      fprintf(stderr, "out of memory\n");
+      return 1;
+   }
+   unsigned int numRunnable = 0;
+   for (unsigned int i = 0; i < count; i++) {
+      if (errors[i] == NULL) {
+         runnable[numRunnable++] = scenarios[i];
+      }
+   }
+   time_t start = time(NULL);
+   unsigned int workers = numRunnable ? runBatch(runnable, results, numRunnable, threads) : 0;
+
+   int status = 0;
+   for (unsigned int i = 0, j = 0; i < count; i++) {
+      const BatchResult *r = errors[i] ? NULL : &results[j++];
+      writeResult(out, scenarios[i].id, r, errors[i]);
+      if (errors[i] || r->status != BATCH_OK) {
+         status = 2;
+      }
+   }
+   if (out != stdout) {
+      fclose(out);
+   }
+   fprintf(stderr, "%u scenarios on %u threads in %u seconds\n", count, workers,
+           (unsigned int)(time(NULL) - start));
+
+   for (unsigned int i = 0; i < numRunnable; i++) {
+      freeBatchResult(&results[i]);
+   }
+   for (unsigned int i = 0; i < count; i++) {
+      freeBatchScenario(&scenarios[i]);
+      free(errors[i]);
+   }
+   free(results);
+   free(runnable);
+   free(scenarios);
+   free(errors);
+   return status;
+}
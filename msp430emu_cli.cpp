@@ -0,0 +1,386 @@
+/*
+   Headless command line front end for MSP430 emulator
+   Copyright (c) 2014 Chris Eagle
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation; either version 2 of the License, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+   more details.
+
+   You should have received a copy of the GNU General Public License along with
+   this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+   Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/*
+ * Usage: msp430emu-cli [-m] [-q] [-c] [-n] [-b budget] [-f format] [-l addr] [-B addr]... [-H name@addr]...
+ *                      [-i file | -s text | -x hex]... [-r log] image
+ *        msp430emu-cli [-c] -R log
+ *
+ * The image may be raw memory, loaded at addr (default 0), Intel HEX, TI-TXT
+ * or ELF, the format is taken from the contents unless given with -f. The
+ * cpu is reset through the reset vector, or started at the entry point of
+ * an ELF or HEX file that names one. It then runs until the cpu asks to
+ * stop, pc reaches a breakpoint or budget instructions have executed.
+ * -H runs a native replacement (strcpy, memcpy, memset, strlen, puts or
+ * INT) as a single step whenever pc reaches addr.
+ * The -i, -s and -x inputs are queued in order, each getsn system call
+ * takes the next one and getchar takes them a byte at a time. Running out
+ * of input ends the run. Firmware console output goes to stdout unless -q
+ * is given, -c prints it again at the end with the instruction count at
+ * which each line was written. The stop reason, instruction count, speed,
+ * system calls made and final registers are printed when the run ends.
+ * Copy, fill, strlen and compare loops are run in bulk unless -n is given
+ * or a breakpoint is set, the instruction count is exact either way.
+ * -r records the run to a session log, -R replays a log recorded here or
+ * in the plugin and reports whether it ended exactly as the recording did.
+ *
+ * Exit status is 0 when the run ends, 1 for a usage or loading error.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cpu.h"
+#include "loader.h"
+#include "hooks.h"
+#include "replay.h"
+
+//default instruction limit
+#define CLI_INST_BUDGET 100000000
+
+#define CLI_MAX_BREAKS 64
+
+bool bugMode = false;
+
+static unsigned char image[MEM_SIZE];
+
+static unsigned short breaks[CLI_MAX_BREAKS];
+static unsigned int numBreaks = 0;
+
+static void usage(const char *prog) {
+   fprintf(stderr, "usage: %s [-m] [-q] [-c] [-n] [-b budget] [-f format] [-l addr] [-B addr]... [-H name@addr]...\n", prog);
+   fprintf(stderr, "          [-i file | -s text | -x hex]... [-r log] image\n");
+   fprintf(stderr, "       %s [-c] -R log\n", prog);
+   fprintf(stderr, "   -m         emulate the microcorruption bugs\n");
+   fprintf(stderr, "   -q         do not echo the firmware console\n");
+   fprintf(stderr, "   -c         print the console with instruction counts at the end\n");
+   fprintf(stderr, "   -n         interpret every loop an instruction at a time\n");
+   fprintf(stderr, "   -b budget  instructions to run (default %u)\n", CLI_INST_BUDGET);
+   fprintf(stderr, "   -f format  raw, ihex, titxt or elf (default from the contents)\n");
+   fprintf(stderr, "   -l addr    load address of a raw image (default 0)\n");
+   fprintf(stderr, "   -B addr    stop when pc reaches addr\n");
+   fprintf(stderr, "   -H name@addr  run the native name function at addr\n");
+   fprintf(stderr, "   -i file    queue the contents of file as input\n");
+   fprintf(stderr, "   -s text    queue text as input\n");
+   fprintf(stderr, "   -x hex     queue hex encoded bytes as input\n");
+   fprintf(stderr, "   -r log     record the run to a session log\n");
+   fprintf(stderr, "   -R log     replay a session log\n");
+   exit(1);
+}
+
+//load path into image, resetting through the file's entry point when it
+//names one. returns false after reporting a failure
+static bool loadFirmware(const char *path, unsigned int format, unsigned int addr, unsigned int *entry) {
+   const Image *img;
+   switch (loadImage(path, format, addr, &img)) {
+      case LOAD_OK:
+         break;
+      case LOAD_NO_FILE:
+         fprintf(stderr, "%s: can't read image\n", path);
+         return false;
+      case LOAD_BAD_FORMAT:
+         fprintf(stderr, "%s: malformed or unsupported image\n", path);
+         return false;
+      default:
+         fprintf(stderr, "out of memory\n");
+         return false;
+   }
+   memcpy(image, img->mem, MEM_SIZE);
+   *entry = img->entry;
+   releaseImage(img);
+   return true;
+}
+
+//queue the whole of path as one input. returns false after reporting a failure
+static bool queueFile(Machine *m, const char *path) {
+   FILE *f = fopen(path, "rb");
+   if (f == NULL) {
+      perror(path);
+      return false;
+   }
+   //one more than an entry may hold so that oversize files are caught
+   unsigned char *buf = (unsigned char*)malloc(0x10000);
+   size_t n = buf ? fread(buf, 1, 0x10000, f) : 0;
+   fclose(f);
+   bool ok = buf != NULL && n < 0x10000 && m->queueInput(buf, n);
+   free(buf);
+   if (!ok) {
+      fprintf(stderr, "%s: too large to queue\n", path);
+   }
+   return ok;
+}
+
+static bool isBreak(unsigned short addr) {
+   for (unsigned int i = 0; i < numBreaks; i++) {
+      if (breaks[i] == addr) {
+         return true;
+      }
+   }
+   return false;
+}
+
+static void printSyscalls(Machine *m) {
+   const char *sep = "syscalls:";
+   for (unsigned int i = 0; i < SYSCALL_NUMBERS; i++) {
+      unsigned int calls = m->syscallCount(i);
+      if (calls) {
+         const char *name = m->syscallName(i);
+         if (name) {
+            printf("%s %s %u", sep, name, calls);
+         }
+         else {
+            printf("%s 0x%02x %u", sep, i, calls);
+         }
+         sep = ",";
+      }
+   }
+   if (sep[0] == ',') {
+      printf("\n");
+   }
+}
+
+//console chunks that begin a line are tagged with their instruction count
+static void printConsole(Machine *m) {
+   qstring chunk;
+   bool lineStart = true;
+   unsigned int count = m->consoleChunks();
+   for (unsigned int i = 0; i < count; i++) {
+      uint64 insn;
+      m->consoleChunk(i, &insn, &chunk);
+      if (lineStart) {
+         printf("%10llu  ", (unsigned long long)insn);
+      }
+      fwrite(chunk.c_str(), 1, chunk.length(), stdout);
+      lineStart = chunk.length() != 0 && chunk[chunk.length() - 1] == '\n';
+   }
+   if (!lineStart) {
+      printf("\n");
+   }
+}
+
+static double now() {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void printRegisters(Machine *m) {
+   for (unsigned int i = 0; i < 16; i++) {
+      printf("r%-2u %04x%s", i, m->cpu.general[i], (i & 3) == 3 ? "\n" : "   ");
+   }
+}
+
+//replay path and report how it compares with the recording
+static int replaySession(Machine *m, const char *path, bool showConsole) {
+   ReplayLog *log;
+   switch (loadReplay(path, &log)) {
+      case REPLAY_OK:
+         break;
+      case REPLAY_NO_FILE:
+         fprintf(stderr, "%s: can't read session log\n", path);
+         return 1;
+      case REPLAY_BAD_FORMAT:
+         fprintf(stderr, "%s: malformed or unfinished session log\n", path);
+         return 1;
+      default:
+         fprintf(stderr, "out of memory\n");
+         return 1;
+   }
+   ReplayResult res;
+   replayRun(log, m, image, &res);
+   printf("stop: %s at 0x%04x\n", stopReasonName(res.reason), m->cpu.general[PC]);
+   printf("instructions: %llu of %llu recorded\n", (unsigned long long)res.insns, (unsigned long long)log->endInsn);
+   if (res.match) {
+      printf("replay: matches the recording\n");
+   }
+   else if (res.diverged) {
+      printf("replay: diverged at instruction %llu\n", (unsigned long long)res.divergedAt);
+   }
+   else {
+      printf("replay: final state %016llx, recorded %016llx\n",
+             (unsigned long long)res.hash, (unsigned long long)log->endHash);
+   }
+   printRegisters(m);
+   if (showConsole) {
+      printConsole(m);
+   }
+   freeReplay(log);
+   return 0;
+}
+
+int main(int argc, char **argv) {
+   unsigned int budget = CLI_INST_BUDGET;
+   unsigned int loadAddr = 0;
+   unsigned int format = IMAGE_DETECT;
+   unsigned int entry;
+   bool quiet = false;
+   bool showConsole = false;
+   bool idioms = true;
+   const char *recordLog = NULL;
+   const char *replayLog = NULL;
+   int opt;
+   Machine *m = new Machine();
+   while ((opt = getopt(argc, argv, "mqcnb:f:l:B:H:i:s:x:r:R:")) != -1) {
+      switch (opt) {
+         case 'm':
+            bugMode = true;
+            break;
+         case 'q':
+            quiet = true;
+            break;
+         case 'c':
+            showConsole = true;
+            break;
+         case 'n':
+            idioms = false;
+            break;
+         case 'b':
+            budget = strtoul(optarg, NULL, 0);
+            break;
+         case 'f':
+            format = imageFormatByName(optarg);
+            if (format == IMAGE_FORMATS) {
+               usage(argv[0]);
+            }
+            break;
+         case 'l':
+            loadAddr = strtoul(optarg, NULL, 0);
+            break;
+         case 'B':
+            if (numBreaks == CLI_MAX_BREAKS) {
+               fprintf(stderr, "at most %u breakpoints\n", CLI_MAX_BREAKS);
+               return 1;
+            }
+            breaks[numBreaks++] = strtoul(optarg, NULL, 0);
+            break;
+         case 'H':
+            if (!addNativeHooks(m, optarg)) {
+               fprintf(stderr, "%s: unknown function or bad address\n", optarg);
+               return 1;
+            }
+            break;
+         case 'i':
+            if (!queueFile(m, optarg)) {
+               return 1;
+            }
+            break;
+         case 's':
+            if (!m->queueInput(optarg, strlen(optarg))) {
+               fprintf(stderr, "-s input too large\n");
+               return 1;
+            }
+            break;
+         case 'x':
+            if (!m->queueHexInput(optarg)) {
+               fprintf(stderr, "%s: malformed hex input\n", optarg);
+               return 1;
+            }
+            break;
+         case 'r':
+            recordLog = optarg;
+            break;
+         case 'R':
+            replayLog = optarg;
+            break;
+         default:
+            usage(argv[0]);
+      }
+   }
+   if (replayLog) {
+      if (optind != argc) {
+         usage(argv[0]);
+      }
+      int res = replaySession(m, replayLog, showConsole);
+      delete m;
+      return res;
+   }
+   if (optind + 1 != argc || loadAddr >= MEM_SIZE) {
+      usage(argv[0]);
+   }
+   if (!loadFirmware(argv[optind], format, loadAddr, &entry)) {
+      return 1;
+   }
+
+   unsigned int numInputs = m->input.count;
+   m->bugMode = bugMode;
+   m->quietMode = quiet;
+   m->setFlatMemory(image);
+   m->resetCpu();
+   if (entry != IMAGE_NO_ENTRY) {
+      m->initProgram(entry & 0xffff);
+   }
+   m->stopReason = STOP_NONE;
+   if (recordLog && startRecording(m) == NULL) {
+      fprintf(stderr, "out of memory\n");
+      return 1;
+   }
+   recordResume(m);
+
+   //a loop run in bulk could step over a breakpoint
+   m->loopIdioms = idioms && numBreaks == 0;
+   m->insnLimit = budget;
+   bool hitBreak = false;
+   double start = now();
+   while (m->insnCount < budget) {
+      m->executeInstruction();
+      if (m->stopReason != STOP_NONE) {
+         break;
+      }
+      if (numBreaks && isBreak(m->cpu.general[PC])) {
+         hitBreak = true;
+         break;
+      }
+   }
+   double elapsed = now() - start;
+   unsigned int insns = (unsigned int)m->insnCount;
+   recordPause(m);
+   if (recordLog && stopRecording(m, recordLog) != REPLAY_OK) {
+      fprintf(stderr, "%s: can't write session log\n", recordLog);
+   }
+   m->flushConsole();
+   if (!quiet) {
+      fflush(stdout);
+      printf("\n");
+   }
+
+   const char *reason;
+   if (hitBreak) {
+      reason = "breakpoint";
+   }
+   else if (m->stopReason == STOP_NONE) {
+      reason = stopReasonName(STOP_BUDGET);
+   }
+   else {
+      reason = stopReasonName(m->stopReason);
+   }
+   printf("stop: %s at 0x%04x\n", reason, hitBreak ? m->cpu.general[PC] : m->cpu.initial_pc);
+   printf("instructions: %u in %.3f seconds (%.1f million per second)\n", insns, elapsed,
+          elapsed > 0 ? insns / elapsed / 1e6 : 0.0);
+   printf("inputs: %u of %u used\n", numInputs - m->input.count, numInputs);
+   printSyscalls(m);
+   printRegisters(m);
+   if (showConsole) {
+      printConsole(m);
+   }
+   delete m;
+   return 0;
+}
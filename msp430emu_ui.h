@@ -22,10 +22,12 @@
 
 void setEmulatorTitle(const char *title);
 void updateRegisterDisplay(int r);
+void updateConsoleDisplay();
 bool createEmulatorWindow();
 void destroyEmulatorWindow();
 void displayEmulatorWindow();
 char *inputBox(const char *boxTitle, const char *msg, const char *init);
+char *textBox(const char *boxTitle, const char *msg);
 char *getOpenFileName(const char *title, char *fileName, int nameLen, const char *filter, char *initDir = 0);
 char *getSaveFileName(const char *title, char *fileName, int nameSize, const char *filter);
 char *getDirectoryName(const char *title, char *dirName, int nameSize);
@@ -73,6 +73,7 @@
 #include <ctype.h>
 
 #include "cpu.h"
+#include "snapshot.h"
 
 QWidget *mainWindow;
 MSP430Dialog *msp430Dlg;
@@ -176,6 +177,31 @@ void updateRegisterDisplay(int r) {
    }
 }
 
+//refresh the console pane from the cpu's console output. Chunks that
+//begin a line are tagged with the instruction count they were written at
+void updateConsoleDisplay() {
+   if (msp430Dlg == NULL || !msp430Dlg->consoleDock->isVisible()) {
+      return;
+   }
+   qstring text;
+   qstring chunk;
+   bool lineStart = true;
+   unsigned int count = emu.consoleChunks();
+   for (unsigned int i = 0; i < count; i++) {
+      uint64 insn;
+      emu.consoleChunk(i, &insn, &chunk);
+      if (lineStart) {
+         char tag[32];
+         ::qsnprintf(tag, sizeof(tag), "%10" FMT_64 "u  ", insn);
+         text.append(tag, strlen(tag));
+      }
+      text.append(chunk.c_str(), chunk.length());
+      lineStart = chunk.length() != 0 && chunk[chunk.length() - 1] == '\n';
+   }
+   msp430Dlg->consoleText->setPlainText(text.c_str());
+   msp430Dlg->consoleText->moveCursor(QTextCursor::End);
+}
+
 //get an int value from Edit box string
 //assumes value is a valid hex string
 unsigned int getEditBoxInt(QLineEdit *l) {
@@ -197,6 +223,47 @@ char *inputBox(const char *boxTitle, const char *msg, const char *init) {
    return NULL;
 }
 
+//display a multi line text box with the given title and prompt. returns
+//the text entered, to be released with qfree, or NULL on cancel
+char *textBox(const char *boxTitle, const char *msg) {
+   QDialog dlg(getWidgetParent());
+   dlg.setWindowTitle(boxTitle);
+   dlg.setModal(true);
+
+   QLabel *label = new QLabel(msg);
+   QPlainTextEdit *text = new QPlainTextEdit(&dlg);
+
+   QPushButton *btn_ok = new QPushButton("&OK");
+   btn_ok->setAutoDefault(true);
+   btn_ok->setDefault(true);
+
+   QPushButton *btn_cancel = new QPushButton("&Cancel");
+   btn_cancel->setAutoDefault(true);
+
+   QHBoxLayout *buttonLayout = new QHBoxLayout();
+   buttonLayout->setSpacing(2);
+   buttonLayout->setContentsMargins(4, 4, 4, 4);
+   buttonLayout->addStretch(1);
+   buttonLayout->addWidget(btn_ok);
+   buttonLayout->addWidget(btn_cancel);
+   buttonLayout->addStretch(1);
+
+   QVBoxLayout *mainLayout = new QVBoxLayout();
+   mainLayout->addWidget(label);
+   mainLayout->addWidget(text);
+   mainLayout->addLayout(buttonLayout);
+   dlg.setLayout(mainLayout);
+   dlg.resize(640, 400);
+
+   QObject::connect(btn_ok, SIGNAL(clicked()), &dlg, SLOT(accept()));
+   QObject::connect(btn_cancel, SIGNAL(clicked()), &dlg, SLOT(reject()));
+
+   if (dlg.exec() != QDialog::Accepted) {
+      return NULL;
+   }
+   return ::qstrdup(text->toPlainText().toAscii().data());
+}
+
 //display a single line input box with the given title, prompt
 //and initial data value.  If the user does not cancel, their
 //data is placed into the global variable "value"
@@ -293,6 +360,7 @@ void SetMemoryDialog::do_ok() {
       while (*v) writeMem(addr++, *v++, SIZE_BYTE);
       if (type_asciiz->isChecked()) writeMem(addr, 0, SIZE_BYTE);
    }
+   invalidateBootImage();
    accept();
 }
 
@@ -516,6 +584,14 @@ void MSP430Dialog::trackExec() {
    setTracking(!getTracking());
 }
 
+void MSP430Dialog::taintInput() {
+   bool on = !getTaintTracking();
+   if (setTaintTracking(on) != on) {
+      showErrorMessage("Out of memory, input taint is not being tracked");
+   }
+   emulateTrack_input_taintAction->setChecked(getTaintTracking());
+}
+
 void MSP430Dialog::traceExec() {
    if (getTracing()) {
       emulateTrace_executionAction->setChecked(false);
@@ -528,6 +604,97 @@ void MSP430Dialog::traceExec() {
    setTracing(!getTracing()); 
 }
 
+void MSP430Dialog::warmBootMode() {
+   if (getWarmBoot()) {
+      emulateWarmBootAction->setChecked(false);
+   }
+   else {
+      emulateWarmBootAction->setChecked(true);
+   }
+   setWarmBoot(!getWarmBoot());
+}
+
+void MSP430Dialog::warmBootAddr() {
+   setWarmBootAddr();
+}
+
+void MSP430Dialog::warmBootFlush() {
+   flushWarmBoot();
+}
+
+void MSP430Dialog::fuzz() {
+   fuzzInput();
+   syncDisplay();
+}
+
+void MSP430Dialog::minimize() {
+   minimizeCurrentInput();
+   syncDisplay();
+}
+
+void MSP430Dialog::bruteForce() {
+   bruteForceInput();
+   syncDisplay();
+}
+
+void MSP430Dialog::timingAttack() {
+   timingAttackInput();
+   syncDisplay();
+}
+
+void MSP430Dialog::powerAnalysis() {
+   powerAnalysisInput();
+   syncDisplay();
+}
+
+void MSP430Dialog::faultCampaign() {
+   faultCampaignInput();
+   syncDisplay();
+}
+
+void MSP430Dialog::explorePaths() {
+   explorePathsInput();
+   syncDisplay();
+}
+
+void MSP430Dialog::bugModeDiff() {
+   bugModeDiffInput();
+   syncDisplay();
+}
+
+void MSP430Dialog::importDump() {
+   importDumpInput();
+   syncDisplay();
+}
+
+void MSP430Dialog::queueInput() {
+   queueInputDialog();
+}
+
+void MSP430Dialog::clearInput() {
+   clearQueuedInput();
+}
+
+void MSP430Dialog::nativeHooks() {
+   nativeHooksInput();
+}
+
+void MSP430Dialog::recordSession() {
+   ::recordSession();
+   //the file dialog may have been cancelled
+   emulateRecordSessionAction->setChecked(isRecording());
+}
+
+void MSP430Dialog::replaySession() {
+   replaySessionInput();
+}
+
+void MSP430Dialog::showConsole(bool visible) {
+   if (visible) {
+      updateConsoleDisplay();
+   }
+}
+
 void MSP430Dialog::setBreak() {
    setBreakpoint();
 }
@@ -555,7 +722,7 @@ void MSP430Dialog::run() {
 }
 
 void MSP430Dialog::doBreak() {
-   shouldBreak = 1;
+   emu.shouldBreak = 1;
 }
 
 void MSP430Dialog::runCursor() {
@@ -586,6 +753,7 @@ void MSP430Dialog::setMemory() {
                          Qt::Tool
 MSP430Dialog::MSP430Dialog(QWidget *parent) : QMainWindow(parent, MSP430_WINDOW_FLAGS) {   
    QAction *fileDumpAction = new QAction("Dump", this);
+   QAction *fileImportDumpAction = new QAction("Import Microcorruption dump...", this);
    QAction *fileCloseAction = new QAction("Close", this);   
    QAction *viewResetAction = new QAction("Reset", this);
    QAction *emulateSet_breakpointAction = new QAction("Set breakpoint...", this);
@@ -597,12 +765,34 @@ MSP430Dialog::MSP430Dialog(QWidget *parent) : QMainWindow(parent, MSP430_WINDOW_
    emulateMicrocorruptionBugModeAction = new QAction("Emulate microcorruption bugs", this);
    emulateMicrocorruptionBugModeAction->setCheckable(true);
 
+   emulateWarmBootAction = new QAction("Warm boot from cached state", this);
+   emulateWarmBootAction->setCheckable(true);
+   QAction *emulateQueueInputAction = new QAction("Queue input...", this);
+   QAction *emulateClearInputAction = new QAction("Clear input queue", this);
+   QAction *emulateNativeHooksAction = new QAction("Native hooks...", this);
+   emulateRecordSessionAction = new QAction("Record session...", this);
+   emulateRecordSessionAction->setCheckable(true);
+   QAction *emulateReplaySessionAction = new QAction("Replay session...", this);
+   QAction *emulateWarmBootAddrAction = new QAction("Set warm boot address...", this);
+   QAction *emulateWarmBootFlushAction = new QAction("Flush warm boot cache", this);
+   QAction *emulateFuzzAction = new QAction("Fuzz input...", this);
+   QAction *emulateMinimizeAction = new QAction("Minimize input...", this);
+   QAction *emulateBruteForceAction = new QAction("Brute force input...", this);
+   QAction *emulateTimingAttackAction = new QAction("Timing attack input...", this);
+   QAction *emulatePowerAnalysisAction = new QAction("Power analysis...", this);
+   QAction *emulateFaultCampaignAction = new QAction("Fault injection campaign...", this);
+   QAction *emulateExplorePathsAction = new QAction("Explore paths...", this);
+   QAction *emulateBugModeDiffAction = new QAction("Compare with bug mode...", this);
+
    emulateTrack_fetched_bytesAction = new QAction("Track fetched bytes", this);
    emulateTrack_fetched_bytesAction->setCheckable(true);
 
    emulateTrace_executionAction = new QAction("Trace execution", this);
    emulateTrace_executionAction->setCheckable(true);
 
+   emulateTrack_input_taintAction = new QAction("Track input taint", this);
+   emulateTrack_input_taintAction->setCheckable(true);
+
    QPC = new QLineEdit();
    QPC->setValidator(&aiv);
    QFont font1;
@@ -779,6 +969,14 @@ MSP430Dialog::MSP430Dialog(QWidget *parent) : QMainWindow(parent, MSP430_WINDOW_
    
    setCentralWidget(central);
 
+   consoleText = new QPlainTextEdit(this);
+   consoleText->setReadOnly(true);
+   consoleText->setFont(font1);
+   consoleDock = new QDockWidget("Console", this);
+   consoleDock->setWidget(consoleText);
+   addDockWidget(Qt::BottomDockWidgetArea, consoleDock);
+   consoleDock->hide();
+
    QToolBar *toolBar = new QToolBar();
    toolBar->setMovable(false);
 
@@ -818,18 +1016,41 @@ MSP430Dialog::MSP430Dialog(QWidget *parent) : QMainWindow(parent, MSP430_WINDOW_
    toolBar->addAction(Emulate->menuAction());
 
    File->addAction(fileDumpAction);
+   File->addAction(fileImportDumpAction);
    File->addSeparator();
    File->addAction(fileCloseAction);
 
    View->addAction(viewResetAction);
+   View->addAction(consoleDock->toggleViewAction());
    Emulate->addAction(emulateSet_breakpointAction);
    Emulate->addAction(emulateRemove_breakpointAction);
    Emulate->addSeparator();
    Emulate->addAction(emulateBreakOnSyscallsAction);
    Emulate->addAction(emulateMicrocorruptionBugModeAction);
    Emulate->addSeparator();
+   Emulate->addAction(emulateQueueInputAction);
+   Emulate->addAction(emulateClearInputAction);
+   Emulate->addAction(emulateNativeHooksAction);
+   Emulate->addSeparator();
+   Emulate->addAction(emulateRecordSessionAction);
+   Emulate->addAction(emulateReplaySessionAction);
+   Emulate->addSeparator();
+   Emulate->addAction(emulateWarmBootAction);
+   Emulate->addAction(emulateWarmBootAddrAction);
+   Emulate->addAction(emulateWarmBootFlushAction);
+   Emulate->addSeparator();
+   Emulate->addAction(emulateFuzzAction);
+   Emulate->addAction(emulateMinimizeAction);
+   Emulate->addAction(emulateBruteForceAction);
+   Emulate->addAction(emulateTimingAttackAction);
+   Emulate->addAction(emulatePowerAnalysisAction);
+   Emulate->addAction(emulateFaultCampaignAction);
+   Emulate->addAction(emulateExplorePathsAction);
+   Emulate->addAction(emulateBugModeDiffAction);
+   Emulate->addSeparator();
    Emulate->addAction(emulateTrack_fetched_bytesAction);
    Emulate->addAction(emulateTrace_executionAction);
+   Emulate->addAction(emulateTrack_input_taintAction);
    
    connect(STEP, SIGNAL(clicked()), this, SLOT(step()));
    connect(SKIP, SIGNAL(clicked()), this, SLOT(skip()));
@@ -857,15 +1078,34 @@ MSP430Dialog::MSP430Dialog(QWidget *parent) : QMainWindow(parent, MSP430_WINDOW_
    connect(QR15, SIGNAL(editingFinished()), this, SLOT(changeR15()));
 
    connect(fileDumpAction, SIGNAL(triggered()), this, SLOT(dumpRange()));
+   connect(fileImportDumpAction, SIGNAL(triggered()), this, SLOT(importDump()));
    connect(fileCloseAction, SIGNAL(triggered()), this, SLOT(hideEmu()));
    connect(emulateSet_breakpointAction, SIGNAL(triggered()), this, SLOT(setBreak()));
    connect(emulateRemove_breakpointAction, SIGNAL(triggered()), this, SLOT(clearBreak()));
    connect(viewResetAction, SIGNAL(triggered()), this, SLOT(reset()));
+   connect(consoleDock, SIGNAL(visibilityChanged(bool)), this, SLOT(showConsole(bool)));
 
    connect(emulateBreakOnSyscallsAction, SIGNAL(triggered()), this, SLOT(breakOnSyscalls()));
    connect(emulateMicrocorruptionBugModeAction, SIGNAL(triggered()), this, SLOT(microCorruptionBugs()));
+   connect(emulateWarmBootAction, SIGNAL(triggered()), this, SLOT(warmBootMode()));
+   connect(emulateWarmBootAddrAction, SIGNAL(triggered()), this, SLOT(warmBootAddr()));
+   connect(emulateWarmBootFlushAction, SIGNAL(triggered()), this, SLOT(warmBootFlush()));
+   connect(emulateFuzzAction, SIGNAL(triggered()), this, SLOT(fuzz()));
+   connect(emulateMinimizeAction, SIGNAL(triggered()), this, SLOT(minimize()));
+   connect(emulateBruteForceAction, SIGNAL(triggered()), this, SLOT(bruteForce()));
+   connect(emulateTimingAttackAction, SIGNAL(triggered()), this, SLOT(timingAttack()));
+   connect(emulatePowerAnalysisAction, SIGNAL(triggered()), this, SLOT(powerAnalysis()));
+   connect(emulateFaultCampaignAction, SIGNAL(triggered()), this, SLOT(faultCampaign()));
+   connect(emulateExplorePathsAction, SIGNAL(triggered()), this, SLOT(explorePaths()));
+   connect(emulateBugModeDiffAction, SIGNAL(triggered()), this, SLOT(bugModeDiff()));
+   connect(emulateQueueInputAction, SIGNAL(triggered()), this, SLOT(queueInput()));
+   connect(emulateClearInputAction, SIGNAL(triggered()), this, SLOT(clearInput()));
+   connect(emulateNativeHooksAction, SIGNAL(triggered()), this, SLOT(nativeHooks()));
+   connect(emulateRecordSessionAction, SIGNAL(triggered()), this, SLOT(recordSession()));
+   connect(emulateReplaySessionAction, SIGNAL(triggered()), this, SLOT(replaySession()));
    connect(emulateTrack_fetched_bytesAction, SIGNAL(triggered()), this, SLOT(trackExec()));
    connect(emulateTrace_executionAction, SIGNAL(triggered()), this, SLOT(traceExec()));
+   connect(emulateTrack_input_taintAction, SIGNAL(triggered()), this, SLOT(taintInput()));
 
    setWindowTitle("msp430 Emulator");
 
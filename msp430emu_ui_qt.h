@@ -38,6 +38,8 @@
 #include <QPushButton>
 #include <QCheckBox>
 #include <QAction>
+#include <QDockWidget>
+#include <QPlainTextEdit>
 
 #include "msp430defs.h"
 #include "msp430emu_ui.h"
@@ -78,6 +80,25 @@ public slots:
    void microCorruptionBugs();
    void trackExec();
    void traceExec();
+   void taintInput();
+   void warmBootMode();
+   void warmBootAddr();
+   void warmBootFlush();
+   void fuzz();
+   void minimize();
+   void bruteForce();
+   void timingAttack();
+   void powerAnalysis();
+   void faultCampaign();
+   void explorePaths();
+   void bugModeDiff();
+   void importDump();
+   void queueInput();
+   void clearInput();
+   void nativeHooks();
+   void recordSession();
+   void replaySession();
+   void showConsole(bool visible);
    void setBreak();
    void clearBreak();
    void hideEmu();
@@ -107,11 +128,16 @@ public:
    QLineEdit *QR13;
    QLineEdit *QR14;
    QLineEdit *QR15;
+   QDockWidget *consoleDock;
+   QPlainTextEdit *consoleText;
 private:
    QAction *emulateTrack_fetched_bytesAction;
    QAction *emulateTrace_executionAction;
+   QAction *emulateTrack_input_taintAction;
    QAction *emulateMicrocorruptionBugModeAction;
    QAction *emulateBreakOnSyscallsAction;
+   QAction *emulateWarmBootAction;
+   QAction *emulateRecordSessionAction;
    QPushButton *BREAK;
 };
 
@@ -0,0 +1,353 @@
+/*
+   Power trace simulation and correlation power analysis for MSP430 emulator
+   Copyright (c) 2014 Chris Eagle
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation; either version 2 of the License, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+   more details.
+
+   You should have received a copy of the GNU General Public License along with
+   this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+   Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/*
+ * Traces come from the PowerTrace hook in the cpu: one sample per
+ * instruction, the hamming weight or distance of the values it moves. There
+ * is no noise so a few hundred traces are usually enough. The correlation
+ * engine centres the traces and hypotheses once, then each worker takes a
+ * block of guesses and sweeps the traces a row at a time. The inner loops
+ * run over contiguous floats so the compiler can vectorize them.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <atomic>
+
+#include "cpu.h"
+#include "snapshot.h"
+#include "runner.h"
+#include "power.h"
+
+//guesses correlated together by one worker, each trace row is reused this
+//many times while it is in cache
+#define CPA_BLOCK 8
+
+const unsigned char aesSbox[256] = {
+   0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+   0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+   0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+   0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+   0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+   0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+   0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+   0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+   0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+   0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+   0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+   0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+   0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+   0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+   0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+   0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16
+};
+
+struct TraceShared {
+   const unsigned char *inputs;
+   unsigned int inputLen;
+   unsigned int count;
+   unsigned int model;
+   unsigned int samples;
+   unsigned int budget;
+   unsigned char *traces;
+   std::atomic<unsigned int> next;
+};
+
+struct TraceWorker {
+   TraceShared *sh;
+   Runner runner;
+   PowerTrace trace;
+};
+
+static void traceWorker(void *arg, unsigned int slot) {
+   TraceWorker *w = (TraceWorker*)arg + slot;
+   TraceShared *sh = w->sh;
+   w->runner.m->power = &w->trace;
+   w->trace.model = sh->model;
+   w->trace.capacity = sh->samples;
+   while (true) {
+      unsigned int i = sh->next.fetch_add(1, std::memory_order_relaxed);
+      if (i >= sh->count) {
+         break;
+      }
+      w->trace.samples = sh->traces + (size_t)i * sh->samples;
+      w->trace.count = 0;
+      memset(w->trace.bus, 0, sizeof(w->trace.bus));
+      runInput(&w->runner, sh->inputs + (size_t)i * sh->inputLen, sh->inputLen, sh->budget);
+   }
+}
+
+bool collectTraces(const Snapshot *base, const unsigned char *inputs, unsigned int inputLen,
+                   unsigned int count, unsigned int model, unsigned int samples,
+                   unsigned int budget, unsigned int threads, unsigned char *traces) {
+   TraceShared sh;
+   sh.inputs = inputs;
+   sh.inputLen = inputLen;
+   sh.count = count;
+   sh.model = model;
+   sh.samples = samples;
+   sh.budget = budget;
+   sh.traces = traces;
+   sh.next.store(0);
+   memset(traces, 0, (size_t)count * samples);
+
+   unsigned int numWorkers = threads ? threads : hardwareThreads();
+   TraceWorker *workers = new TraceWorker[numWorkers];
+   bool ok = true;
+   for (unsigned int i = 0; i < numWorkers; i++) {
+      workers[i].sh = &sh;
+      if (!initRunner(&workers[i].runner, base)) {
+         ok = false;
+      }
+   }
+   if (ok) {
+      runWorkers(traceWorker, workers, numWorkers);
+   }
+   for (unsigned int i = 0; i < numWorkers; i++) {
+      freeRunner(&workers[i].runner);
+   }
+   delete [] workers;
+   return ok;
+}
+
+static unsigned int byteWeight(unsigned int v) {
+   unsigned int n = 0;
+   for (; v; v &= v - 1) {
+      n++;
+   }
+   return n;
+}
+
+void byteHypotheses(const unsigned char *inputs, unsigned int inputLen, unsigned int numTraces,
+                    unsigned int offset, const unsigned char *sbox, float *hyp) {
+   for (unsigned int t = 0; t < numTraces; t++) {
+      unsigned char in = inputs[(size_t)t * inputLen + offset];
+      float *row = hyp + (size_t)t * POWER_GUESSES;
+      for (unsigned int g = 0; g < POWER_GUESSES; g++) {
+         unsigned int v = in ^ g;
+         row[g] = (float)byteWeight(sbox ? sbox[v] : v);
+      }
+   }
+}
+
+struct CpaShared {
+   const float *xc;        //centred traces, numTraces x numSamples
+   const float *hc;        //centred hypotheses, numTraces x numGuesses
+   const float *sdX;       //root of the sum of squares of each column
+   const float *sdH;
+   unsigned int numTraces;
+   unsigned int numSamples;
+   unsigned int numGuesses;
+   float *corr;
+   float *acc;             //CPA_BLOCK x numSamples of scratch per worker
+   std::atomic<unsigned int> next;
+};
+
+static void cpaWorker(void *arg, unsigned int slot) {
+   CpaShared *sh = (CpaShared*)arg;
+   unsigned int ns = sh->numSamples;
+   float *acc = sh->acc + (size_t)slot * CPA_BLOCK * ns;
+   while (true) {
+      unsigned int g0 = sh->next.fetch_add(CPA_BLOCK, std::memory_order_relaxed);
+      if (g0 >= sh->numGuesses) {
+         break;
+      }
+      unsigned int nb = sh->numGuesses - g0 < CPA_BLOCK ? sh->numGuesses - g0 : CPA_BLOCK;
+      memset(acc, 0, (size_t)nb * ns * sizeof(float));
+      for (unsigned int t = 0; t < sh->numTraces; t++) {
+         const float *x = sh->xc + (size_t)t * ns;
+         const float *h = sh->hc + (size_t)t * sh->numGuesses + g0;
+         for (unsigned int b = 0; b < nb; b++) {
+            float hb = h[b];
+            float *a = acc + (size_t)b * ns;
+            for (unsigned int s = 0; s < ns; s++) {
+               a[s] += hb * x[s];
+            }
+         }
+      }
+      for (unsigned int b = 0; b < nb; b++) {
+         float *out = sh->corr + (size_t)(g0 + b) * ns;
+         const float *a = acc + (size_t)b * ns;
+         float sdH = sh->sdH[g0 + b];
+         for (unsigned int s = 0; s < ns; s++) {
+            float d = sdH * sh->sdX[s];
+            out[s] = d > 0 ? a[s] / d : 0;
+         }
+      }
+   }
+}
+
+//subtract its mean from each column of the rows x cols matrix m and
+//store the root of the centred sum of squares of each column in sd
+static void centre(float *m, unsigned int rows, unsigned int cols, float *sd) {
+   double *sum = (double*)calloc(cols, sizeof(double));
+   double *sq = (double*)calloc(cols, sizeof(double));
+   for (unsigned int r = 0; r < rows; r++) {
+      for (unsigned int c = 0; c < cols; c++) {
+         sum[c] += m[(size_t)r * cols + c];
+      }
+   }
+   for (unsigned int c = 0; c < cols; c++) {
+      sum[c] /= rows;
+   }
+   for (unsigned int r = 0; r < rows; r++) {
+      for (unsigned int c = 0; c < cols; c++) {
+         float v = (float)(m[(size_t)r * cols + c] - sum[c]);
+         m[(size_t)r * cols + c] = v;
+         sq[c] += (double)v * v;
+      }
+   }
+   for (unsigned int c = 0; c < cols; c++) {
+      sd[c] = (float)sqrt(sq[c]);
+   }
+   free(sum);
+   free(sq);
+}
+
+bool cpaCorrelate(const unsigned char *traces, unsigned int numTraces, unsigned int numSamples,
+                  const float *hyp, unsigned int numGuesses, unsigned int threads, float *corr) {
+   CpaShared sh;
+   float *xc = (float*)malloc((size_t)numTraces * numSamples * sizeof(float));
+   float *hc = (float*)malloc((size_t)numTraces * numGuesses * sizeof(float));
+   float *sdX = (float*)malloc(numSamples * sizeof(float));
+   float *sdH = (float*)malloc(numGuesses * sizeof(float));
+   unsigned int numWorkers = threads ? threads : hardwareThreads();
+   if (numWorkers > (numGuesses + CPA_BLOCK - 1) / CPA_BLOCK) {
+      numWorkers = (numGuesses + CPA_BLOCK - 1) / CPA_BLOCK;
+   }
+   float *acc = (float*)malloc((size_t)numWorkers * CPA_BLOCK * numSamples * sizeof(float));
+   bool ok = xc && hc && sdX && sdH && acc;
+   if (ok) {
+      for (size_t i = 0; i < (size_t)numTraces * numSamples; i++) {
+         xc[i] = traces[i];
+      }
+      memcpy(hc, hyp, (size_t)numTraces * numGuesses * sizeof(float));
+      centre(xc, numTraces, numSamples, sdX);
+      centre(hc, numTraces, numGuesses, sdH);
+      sh.xc = xc;
+      sh.hc = hc;
+      sh.sdX = sdX;
+      sh.sdH = sdH;
+      sh.numTraces = numTraces;
+      sh.numSamples = numSamples;
+      sh.numGuesses = numGuesses;
+      sh.corr = corr;
+      sh.acc = acc;
+      sh.next.store(0);
+      runWorkers(cpaWorker, &sh, numWorkers);
+   }
+   free(xc);
+   free(hc);
+   free(sdX);
+   free(sdH);
+   free(acc);
+   return ok;
+}
+
+void cpaRank(const float *corr, unsigned int numGuesses, unsigned int numSamples, CpaPeak *peaks) {
+   for (unsigned int g = 0; g < numGuesses; g++) {
+      CpaPeak p;
+      p.guess = g;
+      p.sample = 0;
+      p.corr = corr[(size_t)g * numSamples];
+      for (unsigned int s = 1; s < numSamples; s++) {
+         if (corr[(size_t)g * numSamples + s] > p.corr) {
+            p.corr = corr[(size_t)g * numSamples + s];
+            p.sample = s;
+         }
+      }
+      //insertion keeps peaks sorted, strongest first
+      unsigned int j = g;
+      while (j > 0 && peaks[j - 1].corr < p.corr) {
+         peaks[j] = peaks[j - 1];
+         j--;
+      }
+      peaks[j] = p;
+   }
+}
+
+void initPowerOptions(PowerOptions *opts) {
+   opts->traces = 500;
+   opts->inputLen = 16;
+   opts->offset = 0;
+   opts->sbox = NULL;
+   opts->model = POWER_HW;
+   opts->samples = 4096;
+   opts->instBudget = 4096;
+   opts->seed = 1;
+   opts->threads = 0;
+}
+
+int powerAnalysis(const PowerOptions *opts, PowerStats *stats) {
+   memset(stats, 0, sizeof(PowerStats));
+   if (opts->traces < 2 || opts->samples == 0 || opts->inputLen == 0 ||
+       opts->inputLen > POWER_MAX_INPUT || opts->offset >= opts->inputLen) {
+      return POWER_BAD_OPTIONS;
+   }
+   Snapshot *base = snapshotAtInput(RUNNER_BOOT_BUDGET);
+   if (base == NULL) {
+      return POWER_NO_INPUT;
+   }
+   if (opts->inputLen > inputLimit(base)) {
+      free(base);
+      return POWER_BAD_OPTIONS;
+   }
+
+   int result = POWER_OK;
+   unsigned int n = opts->traces;
+   unsigned char *inputs = (unsigned char*)malloc((size_t)n * opts->inputLen);
+   unsigned char *traces = (unsigned char*)malloc((size_t)n * opts->samples);
+   float *hyp = (float*)malloc((size_t)n * POWER_GUESSES * sizeof(float));
+   float *corr = (float*)malloc((size_t)POWER_GUESSES * opts->samples * sizeof(float));
+   if (inputs == NULL || traces == NULL || hyp == NULL || corr == NULL) {
+      result = POWER_NO_MEMORY;
+   }
+   else {
+      //xorshift32
+      unsigned int rng = opts->seed | 1;
+      for (size_t i = 0; i < (size_t)n * opts->inputLen; i++) {
+         rng ^= rng << 13;
+         rng ^= rng >> 17;
+         rng ^= rng << 5;
+         inputs[i] = (unsigned char)rng;
+      }
+      if (!collectTraces(base, inputs, opts->inputLen, n, opts->model, opts->samples,
+                         opts->instBudget, opts->threads, traces)) {
+         result = POWER_NO_MEMORY;
+      }
+      else {
+         byteHypotheses(inputs, opts->inputLen, n, opts->offset, opts->sbox, hyp);
+         if (!cpaCorrelate(traces, n, opts->samples, hyp, POWER_GUESSES, opts->threads, corr)) {
+            result = POWER_NO_MEMORY;
+         }
+         else {
+            cpaRank(corr, POWER_GUESSES, opts->samples, stats->peaks);
+         }
+      }
+      stats->execs = n;
+      stats->threads = opts->threads ? opts->threads : hardwareThreads();
+   }
+   free(inputs);
+   free(traces);
+   free(hyp);
+   free(corr);
+   free(base);
+   return result;
+}
@@ -0,0 +1,96 @@
+/*
+   Headers for MSP430 emulator power analysis
+   Copyright (c) 2014 Chris Eagle
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation; either version 2 of the License, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+   more details.
+
+   You should have received a copy of the GNU General Public License along with
+   this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+   Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef __POWER_H
+#define __POWER_H
+
+#include "cpu.h"
+#include "snapshot.h"
+
+//longest random input handed to the firmware
+#define POWER_MAX_INPUT 256
+
+//key byte guesses tried by the byte attacks
+#define POWER_GUESSES 256
+
+//the aes forward s-box, for attacks on the first round
+extern const unsigned char aesSbox[256];
+
+//run count inputs (packed inputLen bytes apiece) from base in parallel and
+//record a PowerTrace of the first samples instructions of each into the
+//count x samples matrix traces. Short runs are padded with zeros. threads
+//of 0 uses one per hardware thread. returns false if out of memory
+bool collectTraces(const Snapshot *base, const unsigned char *inputs, unsigned int inputLen,
+                   unsigned int count, unsigned int model, unsigned int samples,
+                   unsigned int budget, unsigned int threads, unsigned char *traces);
+
+//fill the numTraces x POWER_GUESSES matrix hyp with the hamming weight of
+//sbox[input[offset] ^ guess] for each trace, sbox NULL for plain xor
+void byteHypotheses(const unsigned char *inputs, unsigned int inputLen, unsigned int numTraces,
+                    unsigned int offset, const unsigned char *sbox, float *hyp);
+
+//pearson correlation between every sample of traces (numTraces x
+//numSamples) and every column of hyp (numTraces x numGuesses), written to
+//the numGuesses x numSamples matrix corr. returns false if out of memory
+bool cpaCorrelate(const unsigned char *traces, unsigned int numTraces, unsigned int numSamples,
+                  const float *hyp, unsigned int numGuesses, unsigned int threads, float *corr);
+
+struct CpaPeak {
+   unsigned int guess;
+   unsigned int sample;    //instruction with the strongest correlation
+   float corr;
+};
+
+//the best sample of each guess in peaks, strongest positive correlation
+//first
+void cpaRank(const float *corr, unsigned int numGuesses, unsigned int numSamples, CpaPeak *peaks);
+
+struct PowerOptions {
+   unsigned int traces;       //random inputs to run
+   unsigned int inputLen;
+   unsigned int offset;       //input byte combined with the key byte
+   const unsigned char *sbox; //applied after the xor, NULL for none
+   unsigned int model;        //POWER_HW or POWER_HD
+   unsigned int samples;      //instructions recorded per trace
+   unsigned int instBudget;
+   unsigned int seed;
+   unsigned int threads;      //worker count, 0 for one per hardware thread
+};
+
+struct PowerStats {
+   CpaPeak peaks[POWER_GUESSES];   //best first
+   unsigned int execs;
+   unsigned int threads;
+};
+
+//status codes returned by powerAnalysis
+enum {
+   POWER_OK,
+   POWER_NO_INPUT,      //never reached an input syscall
+   POWER_NO_MEMORY,
+   POWER_BAD_OPTIONS    //no traces or samples, offset past the input or input too long
+};
+
+void initPowerOptions(PowerOptions *opts);
+
+//run random inputs, trace them and rank guesses for the key byte mixed
+//with input byte offset
+int powerAnalysis(const PowerOptions *opts, PowerStats *stats);
+
+#endif
@@ -0,0 +1,854 @@
+/*
+   Session record and replay for MSP430 emulator
+   Copyright (c) 2014 Chris Eagle
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation; either version 2 of the License, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+   more details.
+
+   You should have received a copy of the GNU General Public License along with
+   this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+   Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/*
+ * The emulator itself is deterministic, so a session is its starting state
+ * plus everything that reached the machine from outside: what the getsn,
+ * getchar and rand system calls handed it and whatever the user changed
+ * between runs. Each event is stamped with the instruction count at which
+ * it happened and a replay delivers it at the same count, so the replay
+ * executes exactly the instructions the session did.
+ *
+ * User changes are found by comparing the machine against a copy taken
+ * when it last stopped rather than by catching each way of making them.
+ * Registers, DEP state, bug mode and hooks are small enough to compare
+ * every time. Memory is only compared on pages reported with recordEdit;
+ * the plugin reports every database patch it is notified of, so the
+ * register and memory dialogs, pushData, file loads, dump imports and
+ * patches made through Ida itself are all caught. The copy is kept current
+ * from the pages the machine itself wrote, so single steps stay cheap.
+ *
+ * The log is text, one line each. Version 2 added the aux, bugmode and
+ * hooks events; version 1 logs, which never have them, still load.
+ *    msp430emu replay 2
+ *    bugmode 0|1
+ *    randval <hex>
+ *    regs <r0> ... <r15> <initial pc>
+ *    dep 0|1
+ *    nx <page>...                  pages DEP marked writable
+ *    calls <depth> <slot>:<ret>... the shadow call stack
+ *    hook <addr> <flags> <name>    native hooks in place
+ *    page <page> <hex>             non zero pages of memory
+ *    @<insn> input <addr> <hex>
+ *    @<insn> char <value>
+ *    @<insn> rand <value>
+ *    @<insn> mem <addr> <hex>
+ *    @<insn> reg <n> <value>
+ *    @<insn> aux <hex>             DEP state and shadow call stack, see packAux
+ *    @<insn> bugmode 0|1
+ *    @<insn> hooks <hex>           the whole hook table, see packHooks
+ *    @<insn> end <hash>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "snapshot.h"
+#include "hooks.h"
+#include "replay.h"
+
+static const char *kindNames[REPLAY_KINDS] = {"input", "char", "rand", "mem", "reg", "aux", "bugmode", "hooks"};
+
+//changed bytes closer together than this are logged as one change
+#define REPLAY_GAP 8
+
+static ReplayEvent *addEvent(ReplayLog *log, unsigned int kind, uint64 insn) {
+   if (log->numEvents == log->cap) {
+      unsigned int cap = log->cap ? log->cap * 2 : 256;
+      ReplayEvent *e = (ReplayEvent*)realloc(log->events, cap * sizeof(ReplayEvent));
+      if (e == NULL) {
+         return NULL;
+      }
+      log->events = e;
+      log->cap = cap;
+   }
+   ReplayEvent *e = &log->events[log->numEvents++];
+   memset(e, 0, sizeof(ReplayEvent));
+   e->kind = kind;
+   e->insn = insn;
+   return e;
+}
+
+static bool addData(ReplayLog *log, ReplayEvent *e, const unsigned char *data, unsigned int len) {
+   if (log->dataSize + len > log->dataCap) {
+      unsigned int cap = log->dataCap ? log->dataCap : 0x1000;
+      while (cap < log->dataSize + len) {
+         cap *= 2;
+      }
+      unsigned char *d = (unsigned char*)realloc(log->data, cap);
+      if (d == NULL) {
+         return false;
+      }
+      log->data = d;
+      log->dataCap = cap;
+   }
+   memcpy(log->data + log->dataSize, data, len);
+   e->data = log->dataSize;
+   e->len = len;
+   log->dataSize += len;
+   return true;
+}
+
+//events made by the user while the machine was stopped, as opposed to
+//those the machine's own system calls asked for
+static bool userEvent(unsigned int kind) {
+   return kind == REPLAY_MEM || kind == REPLAY_REG || kind == REPLAY_AUX ||
+          kind == REPLAY_BUGMODE || kind == REPLAY_HOOKS;
+}
+
+static void putLong(unsigned char *p, unsigned int v) {
+   p[0] = v & 0xff;
+   p[1] = (v >> 8) & 0xff;
+   p[2] = (v >> 16) & 0xff;
+   p[3] = v >> 24;
+}
+
+//aux state as dep, the noExec pages, the call depth as a 4 byte little
+//endian count and a slot and return word for each entry kept
+static unsigned int packAux(const AuxState *aux, unsigned char *out) {
+   unsigned int n = 0;
+   out[n++] = aux->depEnabled ? 1 : 0;
+   memcpy(out + n, aux->noExec, MEM_PAGES);
+   n += MEM_PAGES;
+   putLong(out + n, aux->callDepth);
+   n += 4;
+   for (unsigned int i = 0; i < aux->callDepth && i < CALL_STACK_DEPTH; i++) {
+      out[n++] = aux->callSlots[i] & 0xff;
+      out[n++] = aux->callSlots[i] >> 8;
+      out[n++] = aux->callStack[i] & 0xff;
+      out[n++] = aux->callStack[i] >> 8;
+   }
+   return n;
+}
+
+static bool unpackAux(const unsigned char *in, unsigned int len, AuxState *aux) {
+   if (len < 1 + MEM_PAGES + 4) {
+      return false;
+   }
+   unsigned int depth = in[1 + MEM_PAGES] | (in[2 + MEM_PAGES] << 8) |
+                        (in[3 + MEM_PAGES] << 16) | ((unsigned int)in[4 + MEM_PAGES] << 24);
+   unsigned int kept = depth < CALL_STACK_DEPTH ? depth : CALL_STACK_DEPTH;
+   if (len != 1 + MEM_PAGES + 4 + 4 * kept) {
+      return false;
+   }
+   memset(aux, 0, sizeof(AuxState));
+   aux->depEnabled = in[0];
+   memcpy(aux->noExec, in + 1, MEM_PAGES);
+   aux->callDepth = depth;
+   in += 1 + MEM_PAGES + 4;
+   for (unsigned int i = 0; i < kept; i++, in += 4) {
+      aux->callSlots[i] = in[0] | (in[1] << 8);
+      aux->callStack[i] = in[2] | (in[3] << 8);
+   }
+   return true;
+}
+
+//the hooks a replay can put back by name, each as a little endian address
+//and flags word followed by the nul terminated name
+static unsigned int packHooks(Machine *m, unsigned char *out) {
+   unsigned int count;
+   unsigned int n = 0;
+   const HookEntry *hooks = m->getHooks(&count);
+   for (unsigned int i = 0; i < count; i++) {
+      if (hooks[i].name && findNativeFunction(hooks[i].name)) {
+         size_t len = strlen(hooks[i].name);
+         if (len >= REPLAY_HOOK_NAME) {
+            len = REPLAY_HOOK_NAME - 1;
+         }
+         out[n++] = hooks[i].addr & 0xff;
+         out[n++] = hooks[i].addr >> 8;
+         out[n++] = hooks[i].flags & 0xff;
+         out[n++] = hooks[i].flags >> 8;
+         memcpy(out + n, hooks[i].name, len);
+         n += (unsigned int)len;
+         out[n++] = 0;
+      }
+   }
+   return n;
+}
+
+static void unpackHooks(Machine *m, const unsigned char *in, unsigned int len) {
+   m->clearHooks();
+   unsigned int i = 0;
+   while (i + 5 <= len) {
+      const char *name = (const char*)in + i + 4;
+      size_t n = strnlen(name, len - i - 4);
+      if (i + 4 + n == len) {
+         //unterminated
+         break;
+      }
+      addNativeHook(m, in[i] | (in[i + 1] << 8), name, in[i + 2] | (in[i + 3] << 8));
+      i += 4 + (unsigned int)n + 1;
+   }
+}
+
+static bool recording(Machine *m) {
+   return m->replay != NULL && !m->replay->replaying;
+}
+
+static ReplayLog *newLog() {
+   ReplayLog *log = (ReplayLog*)calloc(1, sizeof(ReplayLog));
+   return log;
+}
+
+void freeReplay(ReplayLog *log) {
+   if (log) {
+      free(log->events);
+      free(log->data);
+      free(log->shadow);
+      free(log);
+   }
+}
+
+const unsigned char *replayData(const ReplayLog *log, const ReplayEvent *e) {
+   return log->data + e->data;
+}
+
+uint64 replayHash(Machine *m) {
+   unsigned char *mem = (unsigned char*)malloc(MEM_SIZE);
+   if (mem == NULL) {
+      return 0;
+   }
+   m->readBuffer(0, mem, MEM_SIZE);
+   uint64 h = hashMemory(mem, MEM_SIZE);
+   free(mem);
+   for (unsigned int i = 0; i < 16; i++) {
+      h = (h ^ m->cpu.general[i]) * 0x100000001b3ULL;
+   }
+   return h;
+}
+
+ReplayLog *startRecording(Machine *m) {
+   ReplayLog *log = newLog();
+   if (log == NULL) {
+      return NULL;
+   }
+   log->shadow = (Snapshot*)malloc(sizeof(Snapshot));
+   if (log->shadow == NULL) {
+      free(log);
+      return NULL;
+   }
+   takeSnapshot(&log->initial, m);
+   memcpy(log->shadow, &log->initial, sizeof(Snapshot));
+   log->bugMode = m->bugMode;
+   unsigned int count;
+   const HookEntry *hooks = m->getHooks(&count);
+   for (unsigned int i = 0; i < count; i++) {
+      //only hooks a replay can put back by name
+      if (hooks[i].name && findNativeFunction(hooks[i].name)) {
+         ReplayHook *h = &log->hooks[log->numHooks++];
+         h->addr = hooks[i].addr;
+         h->flags = hooks[i].flags;
+         ::qsnprintf(h->name, sizeof(h->name), "%s", hooks[i].name);
+      }
+   }
+   log->shadowBugMode = m->bugMode;
+   log->shadowHooksLen = packHooks(m, log->shadowHooks);
+   m->clearDirtyPages();
+   log->base = m->insnCount;
+   m->replay = log;
+   return log;
+}
+
+//log the bytes in [start, end) that differ from the shadow as mem events
+//and bring the shadow up to date
+static void diffRange(ReplayLog *log, Machine *m, uint64 insn, unsigned int start, unsigned int end) {
+   Snapshot *s = log->shadow;
+   unsigned char *mem = (unsigned char*)malloc(end - start);
+   if (mem == NULL) {
+      return;
+   }
+   m->readBuffer(start, mem, end - start);
+   unsigned int addr = start;
+   while (addr < end) {
+      if (mem[addr - start] == s->mem[addr]) {
+         addr++;
+         continue;
+      }
+      //extend the change over short runs of equal bytes
+      unsigned int next = addr + 1;
+      unsigned int last = addr;
+      while (next < end && next - last <= REPLAY_GAP) {
+         if (mem[next - start] != s->mem[next]) {
+            last = next;
+         }
+         next++;
+      }
+      ReplayEvent *e = addEvent(log, REPLAY_MEM, insn);
+      if (e) {
+         e->addr = addr;
+         if (!addData(log, e, mem + addr - start, last + 1 - addr)) {
+            log->numEvents--;
+         }
+      }
+      addr = last + 1;
+   }
+   memcpy(s->mem + start, mem, end - start);
+   free(mem);
+}
+
+void recordResume(Machine *m) {
+   if (!recording(m)) {
+      return;
+   }
+   ReplayLog *log = m->replay;
+   Snapshot *s = log->shadow;
+   uint64 insn = m->insnCount - log->base;
+   for (unsigned int i = 0; i < 16; i++) {
+      if (m->cpu.general[i] != s->regs.general[i]) {
+         ReplayEvent *e = addEvent(log, REPLAY_REG, insn);
+         if (e) {
+            e->addr = i;
+            e->value = m->cpu.general[i];
+         }
+         s->regs.general[i] = m->cpu.general[i];
+      }
+   }
+   //View/Reset clears DEP and the call stack without touching memory
+   unsigned char cur[REPLAY_HOOKS_SIZE > REPLAY_AUX_SIZE ? REPLAY_HOOKS_SIZE : REPLAY_AUX_SIZE];
+   unsigned char old[REPLAY_AUX_SIZE];
+   unsigned int len = packAux(&m->aux, cur);
+   if (len != packAux(&s->aux, old) || memcmp(cur, old, len) != 0) {
+      ReplayEvent *e = addEvent(log, REPLAY_AUX, insn);
+      if (e && !addData(log, e, cur, len)) {
+         log->numEvents--;
+      }
+      memcpy(&s->aux, &m->aux, sizeof(AuxState));
+   }
+   if (m->bugMode != log->shadowBugMode) {
+      ReplayEvent *e = addEvent(log, REPLAY_BUGMODE, insn);
+      if (e) {
+         e->value = m->bugMode ? 1 : 0;
+      }
+      log->shadowBugMode = m->bugMode;
+   }
+   len = packHooks(m, cur);
+   if (len != log->shadowHooksLen || memcmp(cur, log->shadowHooks, len) != 0) {
+      ReplayEvent *e = addEvent(log, REPLAY_HOOKS, insn);
+      if (e && !addData(log, e, cur, len)) {
+         log->numEvents--;
+      }
+      memcpy(log->shadowHooks, cur, len);
+      log->shadowHooksLen = len;
+   }
+   //memory only where it was written while the machine was stopped, either
+   //through the machine or as reported by recordEdit
+   unsigned int count;
+   const unsigned short *dirty = m->getDirtyPages(&count);
+   for (unsigned int i = 0; i < count; i++) {
+      log->edited[dirty[i]] = 1;
+   }
+   unsigned int page = 0;
+   while (page < MEM_PAGES) {
+      if (!log->edited[page]) {
+         page++;
+         continue;
+      }
+      unsigned int first = page;
+      while (page < MEM_PAGES && log->edited[page]) {
+         log->edited[page++] = 0;
+      }
+      diffRange(log, m, insn, first << MEM_PAGE_SHIFT, page << MEM_PAGE_SHIFT);
+   }
+   //what runs next is picked up by recordPause from the dirty pages
+   m->clearDirtyPages();
+   log->running = true;
+}
+
+void recordPause(Machine *m) {
+   if (!recording(m)) {
+      return;
+   }
+   Snapshot *s = m->replay->shadow;
+   memcpy(&s->regs, &m->cpu, sizeof(Registers));
+   memcpy(&s->aux, &m->aux, sizeof(AuxState));
+   unsigned int count;
+   const unsigned short *dirty = m->getDirtyPages(&count);
+   for (unsigned int i = 0; i < count; i++) {
+      unsigned int offset = dirty[i] << MEM_PAGE_SHIFT;
+      m->readBuffer(offset, s->mem + offset, MEM_PAGE_SIZE);
+   }
+   m->clearDirtyPages();
+   m->replay->running = false;
+}
+
+void recordEdit(Machine *m, unsigned short addr, unsigned int len) {
+   if (!recording(m) || m->replay->running || len == 0) {
+      //the machine's own writes are picked up by recordPause
+      return;
+   }
+   unsigned int last = addr + len - 1 < MEM_SIZE ? addr + len - 1 : MEM_SIZE - 1;
+   for (unsigned int page = addr >> MEM_PAGE_SHIFT; page <= last >> MEM_PAGE_SHIFT; page++) {
+      m->replay->edited[page] = 1;
+   }
+}
+
+void recordValue(Machine *m, unsigned int kind, unsigned int value) {
+   if (recording(m)) {
+      ReplayEvent *e = addEvent(m->replay, kind, m->insnCount - m->replay->base);
+      if (e) {
+         e->value = value;
+      }
+   }
+}
+
+void recordBytes(Machine *m, unsigned int kind, unsigned short addr, const unsigned char *data, unsigned int len) {
+   if (recording(m)) {
+      ReplayEvent *e = addEvent(m->replay, kind, m->insnCount - m->replay->base);
+      if (e) {
+         e->addr = addr;
+         if (!addData(m->replay, e, data, len)) {
+            m->replay->numEvents--;
+         }
+      }
+   }
+}
+
+const ReplayEvent *replayTake(Machine *m, unsigned int kind) {
+   ReplayLog *log = m->replay;
+   if (log == NULL || !log->replaying || log->next == log->numEvents) {
+      return NULL;
+   }
+   //a call the session answered and the replay doesn't make is caught by
+   //replayRun when the event goes unused
+   const ReplayEvent *e = &log->events[log->next];
+   if (e->insn != m->insnCount || e->kind != kind) {
+      return NULL;
+   }
+   log->next++;
+   return e;
+}
+
+int stopRecording(Machine *m, const char *path) {
+   ReplayLog *log = m->replay;
+   if (log == NULL || log->replaying) {
+      return REPLAY_BAD_FORMAT;
+   }
+   if (!log->running) {
+      //changes made since the machine last stopped
+      recordResume(m);
+   }
+   m->replay = NULL;
+   log->ended = true;
+   log->endInsn = m->insnCount - log->base;
+   log->endHash = replayHash(m);
+   int res = writeReplay(log, path);
+   freeReplay(log);
+   return res;
+}
+
+static void writeHex(FILE *f, const unsigned char *data, unsigned int len) {
+   for (unsigned int i = 0; i < len; i++) {
+      fprintf(f, "%02x", data[i]);
+   }
+}
+
+int writeReplay(const ReplayLog *log, const char *path) {
+   FILE *f = fopen(path, "w");
+   if (f == NULL) {
+      return REPLAY_NO_FILE;
+   }
+   const Snapshot *s = &log->initial;
+   fprintf(f, "msp430emu replay %u\n", REPLAY_VERSION);
+   fprintf(f, "bugmode %u\n", log->bugMode ? 1 : 0);
+   fprintf(f, "randval %08x\n", log->randVal);
+   fprintf(f, "regs");
+   for (unsigned int i = 0; i < 16; i++) {
+      fprintf(f, " %04x", s->regs.general[i]);
+   }
+   fprintf(f, " %04x\n", s->regs.initial_pc);
+   fprintf(f, "dep %u\n", s->aux.depEnabled ? 1 : 0);
+   fprintf(f, "nx");
+   for (unsigned int i = 0; i < MEM_PAGES; i++) {
+      if (s->aux.noExec[i]) {
+         fprintf(f, " %02x", i);
+      }
+   }
+   fprintf(f, "\ncalls %u", s->aux.callDepth);
+   for (unsigned int i = 0; i < s->aux.callDepth && i < CALL_STACK_DEPTH; i++) {
+      fprintf(f, " %04x:%04x", s->aux.callSlots[i], s->aux.callStack[i]);
+   }
+   fprintf(f, "\n");
+   for (unsigned int i = 0; i < log->numHooks; i++) {
+      fprintf(f, "hook %04x %u %s\n", log->hooks[i].addr, log->hooks[i].flags, log->hooks[i].name);
+   }
+   for (unsigned int page = 0; page < MEM_PAGES; page++) {
+      const unsigned char *p = s->mem + (page << MEM_PAGE_SHIFT);
+      unsigned int i;
+      for (i = 0; i < MEM_PAGE_SIZE && p[i] == 0; i++) {
+      }
+      if (i < MEM_PAGE_SIZE) {
+         fprintf(f, "page %02x ", page);
+         writeHex(f, p, MEM_PAGE_SIZE);
+         fprintf(f, "\n");
+      }
+   }
+   for (unsigned int i = 0; i < log->numEvents; i++) {
+      const ReplayEvent *e = &log->events[i];
+      fprintf(f, "@%llu %s ", (unsigned long long)e->insn, kindNames[e->kind]);
+      switch (e->kind) {
+         case REPLAY_INPUT: case REPLAY_MEM:
+            fprintf(f, "%04x ", e->addr);
+            writeHex(f, replayData(log, e), e->len);
+            break;
+         case REPLAY_AUX: case REPLAY_HOOKS:
+            writeHex(f, replayData(log, e), e->len);
+            break;
+         case REPLAY_REG:
+            fprintf(f, "%u %04x", e->addr, e->value);
+            break;
+         default:
+            fprintf(f, "%04x", e->value);
+            break;
+      }
+      fprintf(f, "\n");
+   }
+   if (log->ended) {
+      fprintf(f, "@%llu end %016llx\n", (unsigned long long)log->endInsn, (unsigned long long)log->endHash);
+   }
+   bool ok = ferror(f) == 0;
+   return fclose(f) == 0 && ok ? REPLAY_OK : REPLAY_NO_FILE;
+}
+
+static int hexDigit(char c) {
+   if (c >= '0' && c <= '9') {
+      return c - '0';
+   }
+   if (c >= 'a' && c <= 'f') {
+      return c - 'a' + 10;
+   }
+   if (c >= 'A' && c <= 'F') {
+      return c - 'A' + 10;
+   }
+   return -1;
+}
+
+//decode the hex at *p up to white space into out (at most max bytes),
+//returns the byte count or -1 when malformed
+static int parseHex(char **p, unsigned char *out, unsigned int max) {
+   char *s = *p;
+   unsigned int n = 0;
+   while (*s && *s != ' ' && *s != '\t') {
+      int hi = hexDigit(s[0]);
+      int lo = hi < 0 ? -1 : hexDigit(s[1]);
+      if (lo < 0 || n == max) {
+         return -1;
+      }
+      out[n++] = (unsigned char)((hi << 4) | lo);
+      s += 2;
+   }
+   *p = s;
+   return n;
+}
+
+static bool nextNumber(char **p, unsigned long long *val, int base) {
+   char *end;
+   while (**p == ' ' || **p == '\t') {
+      (*p)++;
+   }
+   *val = strtoull(*p, &end, base);
+   if (end == *p) {
+      return false;
+   }
+   *p = end;
+   return true;
+}
+
+static void skipSpace(char **p) {
+   while (**p == ' ' || **p == '\t') {
+      (*p)++;
+   }
+}
+
+static bool startsWord(char **p, const char *word) {
+   size_t n = strlen(word);
+   if (strncmp(*p, word, n) == 0 && ((*p)[n] == ' ' || (*p)[n] == 0)) {
+      *p += n;
+      return true;
+   }
+   return false;
+}
+
+static bool parseEvent(ReplayLog *log, char *p, unsigned char *buf) {
+   unsigned long long insn;
+   unsigned long long a;
+   unsigned long long v;
+   if (!nextNumber(&p, &insn, 10)) {
+      return false;
+   }
+   skipSpace(&p);
+   if (startsWord(&p, "end")) {
+      if (!nextNumber(&p, &v, 16)) {
+         return false;
+      }
+      log->ended = true;
+      log->endInsn = insn;
+      log->endHash = v;
+      return true;
+   }
+   unsigned int kind;
+   for (kind = 0; kind < REPLAY_KINDS; kind++) {
+      if (startsWord(&p, kindNames[kind])) {
+         break;
+      }
+   }
+   if (kind == REPLAY_AUX || kind == REPLAY_HOOKS) {
+      ReplayEvent *e = addEvent(log, kind, insn);
+      skipSpace(&p);
+      int n = parseHex(&p, buf, kind == REPLAY_AUX ? REPLAY_AUX_SIZE : REPLAY_HOOKS_SIZE);
+      if (e == NULL || n < 0) {
+         return false;
+      }
+      AuxState aux;
+      if (kind == REPLAY_AUX && !unpackAux(buf, n, &aux)) {
+         return false;
+      }
+      return addData(log, e, buf, n);
+   }
+   if (kind == REPLAY_KINDS || !nextNumber(&p, &a, 16)) {
+      return false;
+   }
+   ReplayEvent *e = addEvent(log, kind, insn);
+   if (e == NULL) {
+      return false;
+   }
+   switch (kind) {
+      case REPLAY_INPUT: case REPLAY_MEM: {
+         skipSpace(&p);
+         int n = parseHex(&p, buf, MEM_SIZE - (unsigned int)(a & 0xffff));
+         if (n < 0 || a >= MEM_SIZE) {
+            return false;
+         }
+         e->addr = (unsigned short)a;
+         return addData(log, e, buf, n);
+      }
+      case REPLAY_REG:
+         if (a > 15 || !nextNumber(&p, &v, 16)) {
+            return false;
+         }
+         e->addr = (unsigned short)a;
+         e->value = (unsigned int)v;
+         return true;
+      default:
+         e->value = (unsigned int)a;
+         return true;
+   }
+}
+
+static bool parseLine(ReplayLog *log, char *p, unsigned char *buf) {
+   unsigned long long v;
+   Snapshot *s = &log->initial;
+   if (*p == '@') {
+      return parseEvent(log, p + 1, buf);
+   }
+   if (startsWord(&p, "bugmode")) {
+      log->bugMode = nextNumber(&p, &v, 10) && v != 0;
+      return true;
+   }
+   if (startsWord(&p, "randval")) {
+      if (nextNumber(&p, &v, 16)) {
+         log->randVal = (unsigned int)v;
+      }
+      return true;
+   }
+   if (startsWord(&p, "regs")) {
+      for (unsigned int i = 0; i < 16; i++) {
+         if (!nextNumber(&p, &v, 16)) {
+            return false;
+         }
+         s->regs.general[i] = (unsigned int)v & 0xffff;
+      }
+      s->regs.initial_pc = nextNumber(&p, &v, 16) ? (unsigned int)v : s->regs.general[0];
+      return true;
+   }
+   if (startsWord(&p, "dep")) {
+      s->aux.depEnabled = nextNumber(&p, &v, 10) && v != 0;
+      return true;
+   }
+   if (startsWord(&p, "nx")) {
+      while (nextNumber(&p, &v, 16)) {
+         if (v >= MEM_PAGES) {
+            return false;
+         }
+         s->aux.noExec[v] = 1;
+      }
+      return true;
+   }
+   if (startsWord(&p, "calls")) {
+      if (!nextNumber(&p, &v, 10)) {
+         return false;
+      }
+      s->aux.callDepth = (unsigned int)v;
+      for (unsigned int i = 0; i < s->aux.callDepth && i < CALL_STACK_DEPTH; i++) {
+         unsigned long long ret;
+         if (!nextNumber(&p, &v, 16) || *p++ != ':' || !nextNumber(&p, &ret, 16)) {
+            return false;
+         }
+         s->aux.callSlots[i] = (unsigned short)v;
+         s->aux.callStack[i] = (unsigned short)ret;
+      }
+      return true;
+   }
+   if (startsWord(&p, "hook")) {
+      unsigned long long flags;
+      if (log->numHooks == MAX_HOOKS || !nextNumber(&p, &v, 16) || !nextNumber(&p, &flags, 10)) {
+         return false;
+      }
+      skipSpace(&p);
+      ReplayHook *h = &log->hooks[log->numHooks++];
+      h->addr = (unsigned short)v;
+      h->flags = (unsigned short)flags;
+      ::qsnprintf(h->name, sizeof(h->name), "%s", p);
+      return true;
+   }
+   if (startsWord(&p, "page")) {
+      if (!nextNumber(&p, &v, 16) || v >= MEM_PAGES) {
+         return false;
+      }
+      skipSpace(&p);
+      return parseHex(&p, s->mem + (v << MEM_PAGE_SHIFT), MEM_PAGE_SIZE) == MEM_PAGE_SIZE;
+   }
+   //blank lines and anything newer versions add
+   return true;
+}
+
+int loadReplay(const char *path, ReplayLog **result) {
+   *result = NULL;
+   FILE *f = fopen(path, "rb");
+   if (f == NULL) {
+      return REPLAY_NO_FILE;
+   }
+   fseek(f, 0, SEEK_END);
+   long size = ftell(f);
+   fseek(f, 0, SEEK_SET);
+   char *text = size >= 0 ? (char*)malloc(size + 1) : NULL;
+   unsigned char *buf = (unsigned char*)malloc(MEM_SIZE);
+   ReplayLog *log = newLog();
+   if (text == NULL || buf == NULL || log == NULL) {
+      fclose(f);
+      free(text);
+      free(buf);
+      free(log);
+      return REPLAY_NO_MEMORY;
+   }
+   size_t n = fread(text, 1, size, f);
+   fclose(f);
+   text[n] = 0;
+
+   unsigned int version = 0;
+   bool ok = sscanf(text, "msp430emu replay %u", &version) == 1 && version <= REPLAY_VERSION;
+   char *line = strchr(text, '\n');
+   while (ok && line) {
+      line++;
+      char *eol = strchr(line, '\n');
+      if (eol) {
+         *eol = 0;
+         if (eol > line && eol[-1] == '\r') {
+            eol[-1] = 0;
+         }
+      }
+      ok = parseLine(log, line, buf);
+      line = eol;
+   }
+   free(text);
+   free(buf);
+   if (!ok || !log->ended) {
+      freeReplay(log);
+      return REPLAY_BAD_FORMAT;
+   }
+   *result = log;
+   return REPLAY_OK;
+}
+
+static void applyEvent(Machine *m, const ReplayLog *log, const ReplayEvent *e) {
+   switch (e->kind) {
+      case REPLAY_REG:
+         m->cpu.general[e->addr] = e->value;
+         break;
+      case REPLAY_AUX:
+         unpackAux(replayData(log, e), e->len, &m->aux);
+         break;
+      case REPLAY_BUGMODE:
+         m->bugMode = e->value != 0;
+         break;
+      case REPLAY_HOOKS:
+         unpackHooks(m, replayData(log, e), e->len);
+         break;
+      default:
+         m->writeBuffer(e->addr, (void*)replayData(log, e), e->len);
+         break;
+   }
+}
+
+void replayRun(ReplayLog *log, Machine *m, unsigned char *mem, ReplayResult *res) {
+   memset(res, 0, sizeof(ReplayResult));
+   memcpy(mem, log->initial.mem, MEM_SIZE);
+   m->setFlatMemory(mem);
+   memcpy(&m->cpu, &log->initial.regs, sizeof(Registers));
+   memcpy(&m->aux, &log->initial.aux, sizeof(AuxState));
+   m->bugMode = log->bugMode;
+   m->quietMode = true;
+   m->clearHooks();
+   for (unsigned int i = 0; i < log->numHooks; i++) {
+      addNativeHook(m, log->hooks[i].addr, log->hooks[i].name, log->hooks[i].flags);
+   }
+   m->stopReason = STOP_NONE;
+   m->shouldBreak = 0;
+   m->insnCount = 0;
+   log->replaying = true;
+   log->next = 0;
+   log->diverged = false;
+   log->divergedAt = 0;
+   m->replay = log;
+
+   while (true) {
+      //user changes made while the machine was stopped at this count
+      while (log->next < log->numEvents) {
+         const ReplayEvent *e = &log->events[log->next];
+         if (e->insn > m->insnCount) {
+            break;
+         }
+         if (e->insn == m->insnCount && userEvent(e->kind)) {
+            applyEvent(m, log, e);
+         }
+         else if (!log->diverged) {
+            //an input call the replay never made
+            log->diverged = true;
+            log->divergedAt = e->insn;
+         }
+         log->next++;
+      }
+      if (m->insnCount >= log->endInsn) {
+         break;
+      }
+      m->executeInstruction();
+   }
+
+   m->replay = NULL;
+   log->replaying = false;
+   m->flushConsole();
+   res->insns = m->insnCount;
+   res->reason = m->stopReason;
+   res->hash = replayHash(m);
+   res->diverged = log->diverged || log->next != log->numEvents;
+   res->divergedAt = log->diverged ? log->divergedAt : m->insnCount;
+   res->match = res->hash == log->endHash && !res->diverged;
+}
@@ -0,0 +1,152 @@
+/*
+   Headers for MSP430 emulator session record and replay
+   Copyright (c) 2014 Chris Eagle
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation; either version 2 of the License, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+   more details.
+
+   You should have received a copy of the GNU General Public License along with
+   this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+   Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef __REPLAY_H
+#define __REPLAY_H
+
+#include "cpu.h"
+#include "snapshot.h"
+
+#define REPLAY_VERSION 2
+
+//hook names kept in a log
+#define REPLAY_HOOK_NAME 32
+
+//packed sizes of the REPLAY_AUX and REPLAY_HOOKS event data
+#define REPLAY_AUX_SIZE (1 + MEM_PAGES + 4 + 4 * CALL_STACK_DEPTH)
+#define REPLAY_HOOKS_SIZE (MAX_HOOKS * (4 + REPLAY_HOOK_NAME))
+
+//things that happen to a machine that its code can't predict
+enum {
+   REPLAY_INPUT,     //getsn wrote len bytes at addr
+   REPLAY_CHAR,      //getchar returned value
+   REPLAY_RAND,      //rand returned value
+   REPLAY_MEM,       //the user changed len bytes at addr
+   REPLAY_REG,       //the user set register addr to value
+   REPLAY_AUX,       //the user changed DEP or the shadow call stack, len bytes packed
+   REPLAY_BUGMODE,   //the user set bug mode to value
+   REPLAY_HOOKS,     //the user changed native hooks, len bytes of the new table packed
+   REPLAY_KINDS
+};
+
+struct ReplayEvent {
+   uint64 insn;            //instructions run since recording started
+   unsigned int kind;
+   unsigned int value;
+   unsigned short addr;
+   unsigned int len;
+   unsigned int data;      //offset of the bytes in ReplayLog.data
+};
+
+struct ReplayHook {
+   unsigned short addr;
+   unsigned short flags;
+   char name[REPLAY_HOOK_NAME];
+};
+
+//a recorded session, the machine state it started from and every event in
+//the order it happened. While a machine has a log in Machine::replay its
+//input system calls either add to it or, replaying, take from it
+struct ReplayLog {
+   Snapshot initial;
+   bool bugMode;
+   unsigned int randVal;   //the database's random value, set by the recorder's owner
+   unsigned int numHooks;
+   ReplayHook hooks[MAX_HOOKS];
+
+   ReplayEvent *events;
+   unsigned int numEvents;
+   unsigned int cap;
+   unsigned char *data;
+   unsigned int dataSize;
+   unsigned int dataCap;
+
+   //how the session ended
+   bool ended;
+   uint64 endInsn;
+   uint64 endHash;
+
+   //recording, the machine as it was when it last stopped
+   Snapshot *shadow;
+   bool shadowBugMode;
+   unsigned char shadowHooks[REPLAY_HOOKS_SIZE];
+   unsigned int shadowHooksLen;
+   unsigned char edited[MEM_PAGES];  //pages the user wrote while the machine was stopped
+   bool running;                     //between recordResume and recordPause
+   uint64 base;            //the machine's insnCount when recording started
+
+   //replaying, the next event to deliver
+   bool replaying;
+   unsigned int next;
+   bool diverged;          //an event went unused
+   uint64 divergedAt;
+};
+
+struct ReplayResult {
+   uint64 insns;
+   unsigned int reason;    //the machine's stopReason at the end
+   uint64 hash;            //of the final state, compare with ReplayLog.endHash
+   bool match;             //same instruction count and state as the recording
+   bool diverged;
+   uint64 divergedAt;
+};
+
+//status codes returned when reading and writing logs
+enum {
+   REPLAY_OK,
+   REPLAY_NO_FILE,
+   REPLAY_BAD_FORMAT,
+   REPLAY_NO_MEMORY
+};
+
+//start logging m, capturing its whole state. NULL when out of memory
+ReplayLog *startRecording(Machine *m);
+//the machine is about to run again, log whatever the user changed since it
+//last stopped. Cheap to call when m isn't recording, and cheap for single
+//steps when nothing was edited
+void recordResume(Machine *m);
+//the machine has stopped. Only the pages it wrote are copied to the shadow
+void recordPause(Machine *m);
+//the user changed len bytes at addr while the machine was stopped without
+//going through m. Only memory reported here or written through m is
+//compared at the next recordResume
+void recordEdit(Machine *m, unsigned short addr, unsigned int len);
+//end the log with the final state, write it to path and free it
+int stopRecording(Machine *m, const char *path);
+
+//called by the input system calls. While recording these log what the
+//call delivered, while replaying replayTake hands back the event the call
+//made at this instruction or NULL when it made none
+void recordValue(Machine *m, unsigned int kind, unsigned int value);
+void recordBytes(Machine *m, unsigned int kind, unsigned short addr, const unsigned char *data, unsigned int len);
+const ReplayEvent *replayTake(Machine *m, unsigned int kind);
+const unsigned char *replayData(const ReplayLog *log, const ReplayEvent *e);
+
+int writeReplay(const ReplayLog *log, const char *path);
+int loadReplay(const char *path, ReplayLog **log);
+void freeReplay(ReplayLog *log);
+
+//run a loaded log to its end on m, which is given mem (MEM_SIZE bytes) as
+//flat memory and left in the final state
+void replayRun(ReplayLog *log, Machine *m, unsigned char *mem, ReplayResult *res);
+
+//hash of a machine's registers and memory, as recorded at the end of a log
+uint64 replayHash(Machine *m);
+
+#endif
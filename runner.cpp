@@ -0,0 +1,208 @@
+/*
+   Snapshot runners for MSP430 emulator
+   Copyright (c) 2014 Chris Eagle
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation; either version 2 of the License, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+   more details.
+
+   You should have received a copy of the GNU General Public License along with
+   this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+   Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+
+#include "cpu.h"
+#include "snapshot.h"
+#include "runner.h"
+
+//give m the interactive machine's system call profile and native hooks
+static void copyHooks(Machine *m) {
+   m->setSyscallProfile(emu.getSyscallProfile());
+   unsigned int count;
+   const HookEntry *h = emu.getHooks(&count);
+   for (unsigned int i = 0; i < count; i++) {
+      m->addHook(h[i].addr, h[i].fn, h[i].arg, h[i].flags, h[i].name);
+   }
+}
+
+//run a flat copy of the interactive machine forward to its first input
+//system call and snapshot it there. returns NULL if the firmware does not
+//ask for input within budget instructions
+Snapshot *snapshotAtInput(unsigned int budget) {
+   Snapshot *s = (Snapshot*)malloc(sizeof(Snapshot));
+   Machine *m = new Machine();
+   if (s == NULL) {
+      delete m;
+      return NULL;
+   }
+   readBuffer(0, s->mem, MEM_SIZE);
+   memcpy(&m->cpu, &cpu, sizeof(Registers));
+   memcpy(&m->aux, &emu.aux, sizeof(AuxState));
+   copyHooks(m);
+   m->quietMode = true;
+   m->setFlatMemory(s->mem);
+   m->stopReason = STOP_NONE;
+   unsigned int n;
+   for (n = 0; !m->atSyscall(SYS_GETSN); n++) {
+      if (n == budget || m->stopReason != STOP_NONE) {
+         break;
+      }
+      m->executeInstruction();
+   }
+   bool found = m->atSyscall(SYS_GETSN);
+   memcpy(&s->regs, &m->cpu, sizeof(Registers));
+   memcpy(&s->aux, &m->aux, sizeof(AuxState));
+   delete m;
+   if (!found) {
+      free(s);
+      return NULL;
+   }
+   return s;
+}
+
+//the getsn length argument of the pending input syscall
+unsigned int inputLimit(const Snapshot *base) {
+   unsigned int addr = (base->regs.general[SP] + 10) & 0xffff;
+   return base->mem[addr] | (base->mem[(addr + 1) & 0xffff] << 8);
+}
+
+static bool runnerGetsn(Machine *m, unsigned short addr, unsigned short len) {
+   Runner *r = (Runner*)m->user;
+   if (r->delivered) {
+      //a second prompt ends the run
+      return false;
+   }
+   r->delivered = true;
+   m->writeBuffer(addr, (void*)r->input, r->inputLen < len ? r->inputLen : len);
+   return true;
+}
+
+bool initRunner(Runner *r, const Snapshot *base) {
+   memset(r, 0, sizeof(Runner));
+   r->image = (unsigned char*)malloc(MEM_SIZE);
+   if (r->image == NULL) {
+      return false;
+   }
+   memcpy(r->image, base->mem, MEM_SIZE);
+   r->base = base;
+   r->stopAddr = RUNNER_NO_TARGET;
+   r->loopIdioms = true;
+   r->m = new Machine();
+   r->m->quietMode = true;
+   r->m->user = r;
+   r->m->getsnHook = runnerGetsn;
+   copyHooks(r->m);
+   r->m->setFlatMemory(r->image);
+   return true;
+}
+
+void freeRunner(Runner *r) {
+   delete r->m;
+   free(r->image);
+   r->m = NULL;
+   r->image = NULL;
+}
+
+//restore the snapshot and arm input for delivery to the pending getsn
+void restoreRunner(Runner *r, const unsigned char *input, unsigned int len) {
+   Machine *m = r->m;
+   if (m->taint) {
+      m->clearTaint();
+   }
+   m->restoreDirtyPages(r->base->mem);
+   memcpy(&m->cpu, &r->base->regs, sizeof(Registers));
+   memcpy(&m->aux, &r->base->aux, sizeof(AuxState));
+   m->resetCoverage();
+   m->stopReason = STOP_NONE;
+   m->insnCount = 0;
+   m->loopIdioms = false;
+   m->clearConsole();
+   r->input = input;
+   r->inputLen = len;
+   r->delivered = false;
+}
+
+//restore the snapshot and run input until the cpu asks to stop, pc
+//reaches stopAddr or budget instructions have executed. returns the stop
+//reason
+unsigned int runInput(Runner *r, const unsigned char *input, unsigned int len, unsigned int budget) {
+   Machine *m = r->m;
+   if (r->detectLoops && !m->stateHashEnabled()) {
+      m->enableStateHash(true);
+   }
+   restoreRunner(r, input, len);
+   LoopCheck loop;
+   memset(&loop, 0, sizeof(loop));
+   if (r->detectLoops) {
+      initLoopCheck(&loop, m);
+   }
+   //a loop run in bulk could step over stopAddr
+   m->loopIdioms = r->loopIdioms && r->stopAddr == RUNNER_NO_TARGET;
+   m->insnLimit = budget;
+   for (r->insns = 0; r->insns < budget; ) {
+      m->executeInstruction();
+      r->insns = (unsigned int)m->insnCount;
+      if (m->stopReason != STOP_NONE) {
+         return m->stopReason;
+      }
+      if (m->cpu.general[PC] == r->stopAddr) {
+         return STOP_TARGET;
+      }
+      if (r->detectLoops && loopCheck(&loop, m)) {
+         return STOP_LOOP;
+      }
+   }
+   return STOP_BUDGET;
+}
+
+void initLoopCheck(LoopCheck *c, Machine *m) {
+   c->saved = m->stateHash();
+   c->lap = 0;
+   c->power = 1;
+   c->lastPc = m->cpu.general[PC];
+}
+
+bool loopCheck(LoopCheck *c, Machine *m) {
+   unsigned short last = c->lastPc;
+   c->lastPc = m->cpu.general[PC];
+   if (c->lastPc > last) {
+      return false;
+   }
+   uint64 h = m->stateHash();
+   if (h == c->saved) {
+      return true;
+   }
+   if (++c->lap == c->power) {
+      c->saved = h;
+      c->power <<= 1;
+      c->lap = 0;
+   }
+   return false;
+}
+
+unsigned int hardwareThreads() {
+   unsigned int n = std::thread::hardware_concurrency();
+   return n ? n : 1;
+}
+
+void runWorkers(void (*fn)(void *arg, unsigned int i), void *arg, unsigned int n) {
+   std::thread *threads = new std::thread[n];
+   for (unsigned int i = 1; i < n; i++) {
+      threads[i] = std::thread(fn, arg, i);
+   }
+   fn(arg, 0);
+   for (unsigned int i = 1; i < n; i++) {
+      threads[i].join();
+   }
+   delete [] threads;
+}
@@ -0,0 +1,76 @@
+/*
+   Headers for MSP430 emulator snapshot runners
+   Copyright (c) 2014 Chris Eagle
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation; either version 2 of the License, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+   more details.
+
+   You should have received a copy of the GNU General Public License along with
+   this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+   Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef __RUNNER_H
+#define __RUNNER_H
+
+#include "cpu.h"
+#include "snapshot.h"
+
+//a private flat memory machine that repeatedly runs inputs starting from
+//a snapshot taken at the getsn system call. Each runner belongs to one
+//thread, any number of them may share the same snapshot.
+struct Runner {
+   Machine *m;
+   unsigned char *image;
+   const Snapshot *base;
+   const unsigned char *input;
+   unsigned int inputLen;
+   bool delivered;
+   unsigned int insns;     //instructions executed by the last run
+   unsigned int stopAddr;  //runs end with STOP_TARGET here, RUNNER_NO_TARGET for none
+   bool detectLoops;       //end runs whose machine state repeats with STOP_LOOP
+   bool loopIdioms;        //let runInput run recognized loops in bulk, on by default
+   void *user;             //owner supplied context
+};
+
+#define RUNNER_NO_TARGET 0xFFFFFFFF
+
+//instructions allowed from reset to the first getsn call
+#define RUNNER_BOOT_BUDGET 50000000
+
+Snapshot *snapshotAtInput(unsigned int budget);
+unsigned int inputLimit(const Snapshot *base);
+
+bool initRunner(Runner *r, const Snapshot *base);
+void freeRunner(Runner *r);
+void restoreRunner(Runner *r, const unsigned char *input, unsigned int len);
+unsigned int runInput(Runner *r, const unsigned char *input, unsigned int len, unsigned int budget);
+
+//Brent's cycle detection over machine state hashes: the state is saved at
+//doubling intervals and each later state compared with it. Any cycle must
+//move pc backwards somewhere, so only states following such an instruction
+//are looked at. The machine must have its state hash enabled
+struct LoopCheck {
+   uint64 saved;
+   unsigned int lap;
+   unsigned int power;
+   unsigned short lastPc;
+};
+
+void initLoopCheck(LoopCheck *c, Machine *m);
+//call after each instruction, true once an earlier state comes around again
+bool loopCheck(LoopCheck *c, Machine *m);
+
+unsigned int hardwareThreads();
+//call fn(arg, i) for each i below n, each on its own thread with 0 on the
+//calling one, and return once they have all finished
+void runWorkers(void (*fn)(void *arg, unsigned int i), void *arg, unsigned int n);
+
+#endif
@@ -0,0 +1,171 @@
+/*
+   Machine snapshots and warm boot support for MSP430 emulator
+   Copyright (c) 2014 Chris Eagle
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation; either version 2 of the License, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+   more details.
+
+   You should have received a copy of the GNU General Public License along with
+   this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+   Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "snapshot.h"
+
+//one cached post boot machine state
+struct WarmBootEntry {
+   uint64 hash;         //hash of the image at cold reset
+   unsigned int addr;   //where the state was captured
+   Snapshot *state;
+};
+
+static WarmBootEntry warmCache[WARM_CACHE_SIZE];
+static unsigned int warmNext = 0;
+
+static bool warmBoot = false;
+static unsigned int warmBootAddr = WARM_BOOT_INPUT;
+
+//hash of the image present at the most recent cold reset, valid until
+//the user loads or edits the image
+static uint64 bootHash;
+static bool haveBootImage = false;
+
+//true while waiting to capture state following a cold reset
+bool warmBootArmed = false;
+
+Snapshot *takeSnapshot(Snapshot *s, Machine *m) {
+   if (s == NULL) {
+      s = (Snapshot*)malloc(sizeof(Snapshot));
+   }
+   memcpy(&s->regs, &m->cpu, sizeof(Registers));
+   memcpy(&s->aux, &m->aux, sizeof(AuxState));
+   m->readBuffer(0, s->mem, MEM_SIZE);
+   return s;
+}
+
+void restoreSnapshot(const Snapshot *s, Machine *m) {
+   //only touch bytes that differ to keep database patching to a minimum
+   for (unsigned int addr = 0; addr < MEM_SIZE; addr++) {
+      if (m->readByte(addr) != s->mem[addr]) {
+         m->writeByte(addr, s->mem[addr]);
+      }
+   }
+   memcpy(&m->cpu, &s->regs, sizeof(Registers));
+   memcpy(&m->aux, &s->aux, sizeof(AuxState));
+}
+
+//64 bit FNV-1a
+uint64 hashMemory(const unsigned char *mem, unsigned int len) {
+   uint64 h = 0xcbf29ce484222325ULL;
+   for (unsigned int i = 0; i < len; i++) {
+      h ^= mem[i];
+      h *= 0x100000001b3ULL;
+   }
+   return h;
+}
+
+uint64 hashImage() {
+   unsigned char *mem = (unsigned char*)malloc(MEM_SIZE);
+   readBuffer(0, mem, MEM_SIZE);
+   uint64 h = hashMemory(mem, MEM_SIZE);
+   free(mem);
+   return h;
+}
+
+static WarmBootEntry *findWarmEntry(uint64 hash) {
+   for (unsigned int i = 0; i < WARM_CACHE_SIZE; i++) {
+      WarmBootEntry *e = &warmCache[i];
+      if (e->state && e->hash == hash && e->addr == warmBootAddr) {
+         return e;
+      }
+   }
+   return NULL;
+}
+
+void setWarmBoot(bool mode) {
+   warmBoot = mode;
+   if (!warmBoot) {
+      warmBootArmed = false;
+   }
+}
+
+bool getWarmBoot() {
+   return warmBoot;
+}
+
+void setWarmBootAddress(unsigned int addr) {
+   warmBootAddr = addr;
+}
+
+unsigned int getWarmBootAddress() {
+   return warmBootAddr;
+}
+
+void flushWarmBoot() {
+   for (unsigned int i = 0; i < WARM_CACHE_SIZE; i++) {
+      free(warmCache[i].state);
+      warmCache[i].state = NULL;
+   }
+   warmNext = 0;
+   warmBootArmed = false;
+   haveBootImage = false;
+}
+
+//call whenever the image is replaced or edited outside of emulation so
+//that the next reset rehashes memory
+void invalidateBootImage() {
+   haveBootImage = false;
+   warmBootArmed = false;
+}
+
+//reset the cpu, jumping straight to cached post boot state when we
+//have some for the current image. returns true for a warm reset
+bool warmReset() {
+   resetCpu();
+   if (!warmBoot) {
+      return false;
+   }
+   if (!haveBootImage) {
+      bootHash = hashImage();
+      haveBootImage = true;
+   }
+   WarmBootEntry *e = findWarmEntry(bootHash);
+   if (e) {
+      restoreSnapshot(e->state);
+      warmBootArmed = false;
+      msg("msp430emu: Warm boot to 0x%04x\n", pc);
+      return true;
+   }
+   warmBootArmed = true;
+   return false;
+}
+
+//called by the cpu before each instruction while armed
+void warmBootCheck() {
+   if (warmBootAddr == WARM_BOOT_INPUT) {
+      if (!emu.atSyscall(SYS_GETSN)) {
+         return;
+      }
+   }
+   else if (pc != warmBootAddr) {
+      return;
+   }
+   warmBootArmed = false;
+   WarmBootEntry *e = &warmCache[warmNext];
+   warmNext = (warmNext + 1) % WARM_CACHE_SIZE;
+   e->hash = bootHash;
+   e->addr = warmBootAddr;
+   e->state = takeSnapshot(e->state);
+   msg("msp430emu: Captured warm boot state at 0x%04x\n", pc);
+}
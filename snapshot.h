@@ -0,0 +1,56 @@
+/*
+   Headers for MSP430 emulator machine snapshots
+   Copyright (c) 2014 Chris Eagle
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation; either version 2 of the License, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+   more details.
+
+   You should have received a copy of the GNU General Public License along with
+   this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+   Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef __SNAPSHOT_H
+#define __SNAPSHOT_H
+
+#include "cpu.h"
+
+//complete machine state, registers plus the entire address space
+struct Snapshot {
+   Registers regs;
+   AuxState aux;
+   unsigned char mem[MEM_SIZE];
+};
+
+//capture warm boot state at the first input system call rather than
+//at a user specified address
+#define WARM_BOOT_INPUT 0xFFFFFFFF
+
+//number of distinct images for which warm boot state is remembered
+#define WARM_CACHE_SIZE 8
+
+Snapshot *takeSnapshot(Snapshot *s = NULL, Machine *m = &emu);
+void restoreSnapshot(const Snapshot *s, Machine *m = &emu);
+
+uint64 hashMemory(const unsigned char *mem, unsigned int len);
+uint64 hashImage();
+
+extern bool warmBootArmed;
+
+void setWarmBoot(bool mode);
+bool getWarmBoot();
+void setWarmBootAddress(unsigned int addr);
+unsigned int getWarmBootAddress();
+void flushWarmBoot();
+void invalidateBootImage();
+bool warmReset();
+void warmBootCheck();
+
+#endif
@@ -0,0 +1,283 @@
+#!/usr/bin/env python3
+#
+# Regenerates the regression images in tests/images and tests/bad. The
+# outputs are checked in so run.sh needs nothing but a shell and the
+# command line front end; rerun this only when changing a test.
+#
+
+import os
+import struct
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+def path(*parts):
+   return os.path.join(HERE, *parts)
+
+def write(name, data):
+   with open(path(*name.split('/')), 'wb') as f:
+      f.write(data)
+
+class Asm:
+   def __init__(self, base=0x4400):
+      self.base = base
+      self.code = []
+      self.labels = {}
+      self.fixes = []
+
+   def here(self):
+      return self.base + 2 * len(self.code)
+
+   def w(self, *words):
+      self.code.extend(words)
+
+   def label(self, name):
+      self.labels[name] = self.here()
+
+   #jcc with its target resolved later
+   def jump(self, op, name):
+      self.fixes.append((len(self.code), name, 'jump'))
+      self.w(op)
+
+   #a word holding a label's address
+   def ref(self, name):
+      self.fixes.append((len(self.code), name, 'abs'))
+      self.w(0)
+
+   def jnz_back(self, head):
+      off = (head - (self.here() + 2)) // 2
+      self.w(0x2000 | (off & 0x3ff))
+
+   def image(self, mem):
+      for idx, name, kind in self.fixes:
+         target = self.labels[name]
+         if kind == 'jump':
+            self.code[idx] |= ((target - (self.base + 2 * idx + 2)) // 2) & 0x3ff
+         else:
+            self.code[idx] = target
+      for i, c in enumerate(self.code):
+         struct.pack_into('<H', mem, self.base + 2 * i, c)
+      struct.pack_into('<H', mem, 0xfffe, self.base)
+      return mem
+
+#a lock asking for a password with getsn and opening on "pw!"
+def lock():
+   a = Asm()
+   mem = bytearray(0x10000)
+   a.w(0x4031, 0x4400)              # mov #0x4400, sp
+   a.w(0x1230, 0x0010)              # push #0x10
+   a.w(0x1230, 0x2400)              # push #0x2400
+   a.w(0x1223)                      # push #2
+   a.w(0x12b0); a.ref('INT')        # call #INT
+   a.w(0x5031, 0x0006)              # add #6, sp
+   for i, ch in enumerate(b"pw!"):
+      a.w(0x90f2, ch, 0x2400 + i)   # cmp.b #ch, &addr
+      a.jump(0x2000, 'fail')        # jnz fail
+   a.w(0x1230, 0x007f)              # push #0x7f
+   a.w(0x12b0); a.ref('INT')        # call #INT
+   a.label('fail')
+   a.w(0xd032, 0x00f0)              # bis #0xf0, sr
+   a.label('INT')
+   a.w(0x411e, 0x0002, 0x1202, 0x4e0f, 0x108f, 0x4f02, 0xd032, 0x8000, 0x12b0, 0x0010, 0x4132, 0x4130)
+   return a.image(mem), a
+
+#echoes getchar to putchar until input runs out
+def echo():
+   a = Asm()
+   mem = bytearray(0x10000)
+   a.w(0x4031, 0x4400)              # mov #0x4400, sp
+   a.label('loop')
+   a.w(0x1213)                      # push #1
+   a.w(0x12b0); a.ref('INT')        # call #INT
+   a.w(0x5321)                      # incd sp
+   a.w(0x120f)                      # push r15
+   a.w(0x1203)                      # push #0
+   a.w(0x12b0); a.ref('INT')        # call #INT
+   a.w(0x5221)                      # add #4, sp
+   a.jump(0x3c00, 'loop')           # jmp loop
+   a.label('INT')
+   a.w(0x411e, 0x0002, 0x1202, 0x4e0f, 0x108f, 0x4f02, 0xd032, 0x8000, 0x12b0, 0x0010, 0x4132, 0x4130)
+   return a.image(mem), a
+
+#every loop shape run in bulk, then a checksum of the memory they wrote
+def idioms():
+   a = Asm()
+   mem = bytearray(0x10000)
+   movi = lambda v, r: a.w(0x4030 | r, v & 0xffff)
+   s1 = b"hello world this is a test of the loop idioms\0"
+   mem[0x2000:0x2000 + len(s1)] = s1
+   s2 = b"hello world this is a test of the loop idiomX\0"
+   mem[0x2100:0x2100 + len(s2)] = s2
+   # strcpy via a temporary
+   movi(0x2000, 14); movi(0x3000, 15)
+   h = a.here(); a.w(0x4E7C, 0x4CCF, 0x0000, 0x531F, 0x934C); a.jnz_back(h)
+   # strcpy testing the stored byte
+   movi(0x2000, 14); movi(0x3100, 15)
+   h = a.here(); a.w(0x4EFF, 0x0000, 0x531F, 0x93CF, 0xFFFF); a.jnz_back(h)
+   # strlen by index
+   movi(0x1fff, 15)
+   h = a.here(); a.w(0x531F, 0x93CF, 0x0000); a.jnz_back(h)
+   a.w(0x4F0A)                      # mov r15, r10
+   # strlen by pointer
+   movi(0x2000, 15)
+   h = a.here(); a.w(0x4F7C, 0x934C); a.jnz_back(h)
+   a.w(0x4F09)                      # mov r15, r9
+   # compare with a forward exit
+   movi(0x2000, 15); movi(0x2100, 14)
+   h = a.here(); a.w(0x4F7C, 0x9E7C, 0x2002, 0x934C); a.jnz_back(h)
+   a.w(0x4F08)                      # mov r15, r8
+   # counted fill from a register
+   movi(0x3200, 15); movi(40, 14); movi(0x1255, 13)
+   h = a.here(); a.w(0x4DCF, 0x0000, 0x531F, 0x831E); a.jnz_back(h)
+   # fill with an immediate, add #-1 and tst
+   movi(0x3300, 15); movi(33, 14)
+   h = a.here(); a.w(0x40FF, 0x0041, 0x0000, 0x531F, 0x533E, 0x930E); a.jnz_back(h)
+   # zero fill up to an end pointer
+   movi(0x3000, 15); movi(0x3020, 13)
+   h = a.here(); a.w(0x43CF, 0x0000, 0x531F, 0x9D0F); a.jnz_back(h)
+   # counted copy
+   movi(0x2000, 14); movi(0x3400, 15); movi(30, 13)
+   h = a.here(); a.w(0x4EFF, 0x0000, 0x531F, 0x831D); a.jnz_back(h)
+   # overlapping copy with dst above src, interpreted
+   movi(0x2000, 14); movi(0x2001, 15); movi(20, 13)
+   h = a.here(); a.w(0x4EFF, 0x0000, 0x531F, 0x831D); a.jnz_back(h)
+   # overlapping copy with dst below src
+   movi(0x2101, 14); movi(0x2100, 15); movi(20, 13)
+   h = a.here(); a.w(0x4EFF, 0x0000, 0x531F, 0x831D); a.jnz_back(h)
+   # fill comparing the end against the pointer
+   movi(0x3500, 15); movi(0x3530, 12); movi(0x77, 13)
+   h = a.here(); a.w(0x4DCF, 0x0001, 0x531F, 0x9F0C); a.jnz_back(h)
+   # r11 = rotating xor of 0x2000-0x35ff, no idiom matches this loop
+   movi(0x2000, 15); a.w(0x430B)    # clr r11
+   h = a.here()
+   a.w(0x4F76)                      # mov.b @r15+, r6
+   a.w(0xE60B)                      # xor r6, r11
+   a.w(0x5B0B)                      # rla r11
+   a.w(0x630B)                      # adc r11
+   a.w(0x903F, 0x3600)              # cmp #0x3600, r15
+   a.jnz_back(h)
+   a.w(0xD032, 0x0010)              # bis #0x10, sr
+   return a.image(mem), a
+
+def ranges(mem):
+   out = []
+   addr = 0
+   while addr < len(mem):
+      if mem[addr] == 0:
+         addr += 1
+         continue
+      end = addr
+      while end < len(mem) and any(mem[end:end + 16]):
+         end += 16
+      end = min(end, len(mem))
+      out.append((addr, mem[addr:end]))
+      addr = end
+   return out
+
+def ihex(mem, entry=None):
+   lines = []
+   def rec(kind, addr, data):
+      body = bytes([len(data), addr >> 8, addr & 0xff, kind]) + data
+      lines.append(':' + body.hex().upper() + '%02X' % (-sum(body) & 0xff))
+   for start, data in ranges(mem):
+      for i in range(0, len(data), 16):
+         rec(0, start + i, data[i:i + 16])
+   if entry is not None:
+      rec(5, 0, struct.pack('>I', entry))
+   rec(1, 0, b'')
+   return ('\n'.join(lines) + '\n').encode()
+
+def titxt(mem):
+   lines = []
+   for start, data in ranges(mem):
+      lines.append('@%04X' % start)
+      for i in range(0, len(data), 16):
+         lines.append(' '.join('%02X' % b for b in data[i:i + 16]))
+   lines.append('q')
+   return ('\n'.join(lines) + '\n').encode()
+
+#the microcorruption memory window, "*" standing for zero lines
+def mcdump(mem):
+   lines = []
+   skipping = False
+   for addr in range(0, len(mem), 16):
+      line = mem[addr:addr + 16]
+      if not any(line):
+         if not skipping:
+            lines.append('%04x:   *' % addr)
+         skipping = True
+         continue
+      skipping = False
+      groups = ' '.join(line[i:i + 2].hex() for i in range(0, 16, 2))
+      text = ''.join(chr(b) if 0x20 <= b < 0x7f else '.' for b in line)
+      lines.append('%04x:   %s   %s' % (addr, groups, text))
+   return ('\n'.join(lines) + '\n').encode()
+
+#an MSP430 ELF with the code in one PT_LOAD segment, the vector in another
+#and the labels in a symbol table
+def elf(mem, asm):
+   code = bytes(mem[asm.base:asm.here()])
+   vec = bytes(mem[0xfffe:0x10000])
+   names = [n for n in sorted(asm.labels)]
+   strtab = b'\0' + b''.join(n.encode() + b'\0' for n in names)
+   syms = b'\0' * 16
+   off = 1
+   for n in names:
+      syms += struct.pack('<IIIBBH', off, asm.labels[n], 0, 0x12, 0, 1)
+      off += len(n) + 1
+   shstrtab = b'\0.text\0.vectors\0.symtab\0.strtab\0.shstrtab\0'
+   ehsize, phsize, shsize = 52, 32, 40
+   phoff = ehsize
+   text_off = phoff + 2 * phsize
+   vec_off = text_off + len(code)
+   sym_off = vec_off + len(vec)
+   str_off = sym_off + len(syms)
+   shstr_off = str_off + len(strtab)
+   shoff = (shstr_off + len(shstrtab) + 3) & ~3
+   hdr = b'\x7fELF' + bytes([1, 1, 1, 0xff]) + b'\0' * 8
+   hdr += struct.pack('<HHIIIIIHHHHHH', 2, 105, 1, asm.base, phoff, shoff, 0, ehsize, phsize, 2, shsize, 6, 5)
+   ph = struct.pack('<IIIIIIII', 1, text_off, asm.base, asm.base, len(code), len(code), 5, 2)
+   ph += struct.pack('<IIIIIIII', 1, vec_off, 0xfffe, 0xfffe, len(vec), len(vec), 4, 2)
+   body = hdr + ph + code + vec + syms + strtab + shstrtab
+   body += b'\0' * (shoff - len(body))
+   sh = b'\0' * shsize
+   sh += struct.pack('<IIIIIIIIII', 1, 1, 6, asm.base, text_off, len(code), 0, 0, 2, 0)
+   sh += struct.pack('<IIIIIIIIII', 7, 1, 2, 0xfffe, vec_off, len(vec), 0, 0, 2, 0)
+   sh += struct.pack('<IIIIIIIIII', 16, 2, 0, 0, sym_off, len(syms), 4, 1, 4, 16)
+   sh += struct.pack('<IIIIIIIIII', 24, 3, 0, 0, str_off, len(strtab), 0, 0, 1, 0)
+   sh += struct.pack('<IIIIIIIIII', 32, 3, 0, 0, shstr_off, len(shstrtab), 0, 0, 1, 0)
+   return body + sh
+
+def main():
+   mem, asm = lock()
+   write('images/lock.hex', ihex(mem))
+   write('images/lock.txt', titxt(mem))
+   write('images/lock.dump', mcdump(mem))
+   lock_elf = elf(mem, asm)
+   write('images/lock.elf', lock_elf)
+   mem, asm = echo()
+   write('images/echo.hex', ihex(mem))
+   mem, asm = idioms()
+   write('images/idioms.txt', titxt(mem))
+
+   hexed = ihex(mem)
+   write('bad/truncated.hex', hexed[:len(hexed) // 2 - 7])
+   lines = hexed.split(b'\n')
+   lines[3] = lines[3][:-2] + (b'00' if lines[3][-2:] != b'00' else b'01')
+   write('bad/checksum.hex', b'\n'.join(lines))
+   write('bad/long.hex', b':FF0000' + b'00' * 300 + b'\n')
+   write('bad/nobase.txt', b'01 02 03\n@4400\n04\nq\n')
+   write('bad/oddhex.txt', b'@4400\n0102 03\nq\n')
+   write('bad/truncated.dump', b'4400:   3140 0044\n44')
+   write('bad/header.elf', lock_elf[:40])
+   seg = bytearray(lock_elf)
+   struct.pack_into('<I', seg, 52 + 4, len(lock_elf) + 0x100)
+   write('bad/segment.elf', bytes(seg))
+   sym = bytearray(lock_elf)
+   shoff = struct.unpack_from('<I', sym, 32)[0]
+   struct.pack_into('<I', sym, shoff + 3 * 40 + 20, 0x7fffffff)
+   write('bad/symtab.elf', bytes(sym))
+   arch = bytearray(lock_elf)
+   struct.pack_into('<H', arch, 18, 40)
+   write('bad/machine.elf', bytes(arch))
+
+main()
@@ -0,0 +1,69 @@
+#!/bin/sh
+#
+# Regression tests for the command line front end
+#
+# Usage: tests/run.sh [msp430emu-cli]
+#
+# Runs each case below and compares its output, less the timing figures,
+# with tests/expected/<case>.out. Images and malformed inputs are made by
+# mkimages.py. Set UPDATE=1 to rewrite the expected output after a change
+# that is meant to alter it. Exit status is the number of failed cases.
+#
+
+cli=${1:-./msp430emu-cli}
+case $cli in
+   /*) ;;
+   *) cli=$(pwd)/$cli ;;
+esac
+cd "$(dirname "$0")" || exit 1
+tmp=$(mktemp -d) || exit 1
+trap 'rm -rf "$tmp"' EXIT
+failed=0
+
+#check name args... runs the front end with args
+check() {
+   name=$1
+   shift
+   "$cli" "$@" > "$tmp/$name.out" 2>&1
+   echo "exit $?" >> "$tmp/$name.out"
+   sed -e 's/ in [0-9.]* seconds (.*)$//' -e "s|$tmp/||g" "$tmp/$name.out" > "$tmp/$name.txt"
+   if [ -n "$UPDATE" ]; then
+      cp "$tmp/$name.txt" "expected/$name.out"
+   elif ! cmp -s "$tmp/$name.txt" "expected/$name.out"; then
+      echo "FAIL $name"
+      diff -u "expected/$name.out" "$tmp/$name.txt"
+      failed=$((failed + 1))
+      return
+   fi
+   echo "ok   $name"
+}
+
+#every image format loads the same lock
+for f in hex txt dump elf; do
+   check lock-$f -q -s 'pw!' images/lock.$f
+done
+check lock-wrong -q -c -s wrong images/lock.hex
+check lock-empty -q images/lock.hex
+
+#getchar stops the run once input runs out, just as getsn does
+check echo -c -b 1000 -s ab images/echo.hex
+
+#loops run in bulk must leave exactly what interpreting them does
+check idioms -q images/idioms.txt
+check idioms-n -q -n images/idioms.txt
+check idioms-break -q -B 0x4504 images/idioms.txt
+
+#a recorded session replays to the same end
+check record-lock -q -s wrong -r "$tmp/lock.rpl" images/lock.hex
+check replay-lock -R "$tmp/lock.rpl"
+check record-idioms -q -r "$tmp/idioms.rpl" images/idioms.txt
+check replay-idioms -R "$tmp/idioms.rpl"
+
+#malformed and truncated images are refused, not loaded
+for f in truncated.hex checksum.hex long.hex oddhex.txt truncated.dump \
+         header.elf segment.elf symtab.elf machine.elf; do
+   check bad-$f -q bad/$f
+done
+check bad-nobase.txt -q -f titxt bad/nobase.txt
+
+exit $failed
@@ -0,0 +1,218 @@
+/*
+   Instruction count timing oracle for MSP430 emulator
+   Copyright (c) 2014 Chris Eagle
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation; either version 2 of the License, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+   more details.
+
+   You should have received a copy of the GNU General Public License along with
+   this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+   Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/*
+ * Timing here is the exact number of instructions the emulator executes
+ * from the pending input syscall until pc reaches a target address (or the
+ * run stops), so it is immune to host noise. A comparison loop that bails
+ * at the first wrong byte runs longer for every correct leading byte,
+ * which the byte by byte search exploits.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+
+#include "cpu.h"
+#include "snapshot.h"
+#include "runner.h"
+#include "brute.h"
+#include "timing.h"
+
+struct TimingPool;
+
+struct TimingWorker {
+   TimingPool *pool;
+   Runner runner;
+};
+
+//a set of runners reused for each batch of candidates
+struct TimingPool {
+   TimingWorker *workers;
+   unsigned int numWorkers;
+   const unsigned char *const *inputs;
+   const unsigned int *lens;
+   unsigned int count;
+   unsigned int budget;
+   TimingResult *results;
+   std::atomic<unsigned int> next;
+};
+
+static void timingWorker(void *arg, unsigned int slot) {
+   TimingWorker *w = (TimingWorker*)arg + slot;
+   TimingPool *p = w->pool;
+   while (true) {
+      unsigned int i = p->next.fetch_add(1, std::memory_order_relaxed);
+      if (i >= p->count) {
+         break;
+      }
+      p->results[i].reason = runInput(&w->runner, p->inputs[i], p->lens[i], p->budget);
+      p->results[i].insns = w->runner.insns;
+   }
+}
+
+static bool initPool(TimingPool *p, const Snapshot *base, unsigned int target,
+                     unsigned int budget, unsigned int threads) {
+   p->numWorkers = threads ? threads : hardwareThreads();
+   p->workers = new TimingWorker[p->numWorkers];
+   p->budget = budget;
+   bool ok = true;
+   for (unsigned int i = 0; i < p->numWorkers; i++) {
+      p->workers[i].pool = p;
+      if (!initRunner(&p->workers[i].runner, base)) {
+         ok = false;
+      }
+      p->workers[i].runner.stopAddr = target;
+   }
+   return ok;
+}
+
+static void freePool(TimingPool *p) {
+   for (unsigned int i = 0; i < p->numWorkers; i++) {
+      freeRunner(&p->workers[i].runner);
+   }
+   delete [] p->workers;
+}
+
+static void runPool(TimingPool *p, const unsigned char *const *inputs, const unsigned int *lens,
+                    unsigned int count, TimingResult *results) {
+   p->inputs = inputs;
+   p->lens = lens;
+   p->count = count;
+   p->results = results;
+   p->next.store(0);
+   runWorkers(timingWorker, p->workers, p->numWorkers);
+}
+
+bool timeInputs(const Snapshot *base, const unsigned char *const *inputs, const unsigned int *lens,
+                unsigned int count, unsigned int target, unsigned int budget,
+                unsigned int threads, TimingResult *results) {
+   TimingPool pool;
+   bool ok = initPool(&pool, base, target, budget, threads);
+   if (ok) {
+      runPool(&pool, inputs, lens, count, results);
+   }
+   freePool(&pool);
+   return ok;
+}
+
+void rankTimings(const TimingResult *results, unsigned int count, unsigned int *order) {
+   //insertion sort, batches are a charset wide
+   for (unsigned int i = 0; i < count; i++) {
+      unsigned int j = i;
+      while (j > 0 && results[order[j - 1]].insns < results[i].insns) {
+         order[j] = order[j - 1];
+         j--;
+      }
+      order[j] = i;
+   }
+}
+
+void initTimingOptions(TimingOptions *opts) {
+   opts->charset = "0-9a-zA-Z";
+   opts->maxLen = 16;
+   opts->padLen = 0;
+   opts->pad = 0;
+   opts->target = RUNNER_NO_TARGET;
+   opts->instBudget = 100000;
+   opts->threads = 0;
+}
+
+int timingSearch(const TimingOptions *opts, TimingStats *stats) {
+   memset(stats, 0, sizeof(TimingStats));
+   unsigned char charset[256];
+   unsigned int numChars = expandCharset(opts->charset ? opts->charset : "", charset);
+   if (numChars == 0 || opts->maxLen == 0 || opts->maxLen > TIMING_MAX_INPUT ||
+       opts->padLen > TIMING_MAX_INPUT) {
+      return TIMING_BAD_OPTIONS;
+   }
+   Snapshot *base = snapshotAtInput(RUNNER_BOOT_BUDGET);
+   if (base == NULL) {
+      return TIMING_NO_INPUT;
+   }
+
+   TimingPool pool;
+   Runner check;     //runs untargeted to see whether a prefix opens the lock
+   int result = TIMING_OK;
+   unsigned char *cands = (unsigned char*)malloc(numChars * TIMING_MAX_INPUT);
+   const unsigned char **inputs = (const unsigned char**)malloc(numChars * sizeof(unsigned char*));
+   unsigned int *lens = (unsigned int*)malloc(numChars * sizeof(unsigned int));
+   unsigned int *order = (unsigned int*)malloc(numChars * sizeof(unsigned int));
+   TimingResult *results = (TimingResult*)malloc(numChars * sizeof(TimingResult));
+   bool poolOk = initPool(&pool, base, opts->target, opts->instBudget, opts->threads);
+   bool checkOk = initRunner(&check, base);
+   if (!poolOk || !checkOk || cands == NULL || inputs == NULL || lens == NULL || order == NULL || results == NULL) {
+      result = TIMING_NO_MEMORY;
+   }
+
+   for (unsigned int pos = 0; result == TIMING_OK && pos < opts->maxLen; pos++) {
+      for (unsigned int c = 0; c < numChars; c++) {
+         unsigned char *cand = cands + c * TIMING_MAX_INPUT;
+         memcpy(cand, stats->input, pos);
+         cand[pos] = charset[c];
+         unsigned int len = pos + 1;
+         if (len < opts->padLen) {
+            memset(cand + len, opts->pad, opts->padLen - len);
+            len = opts->padLen;
+         }
+         inputs[c] = cand;
+         lens[c] = len;
+      }
+      runPool(&pool, inputs, lens, numChars, results);
+      stats->execs += numChars;
+      rankTimings(results, numChars, order);
+
+      unsigned int best = order[0];
+      for (unsigned int c = 0; c < numChars; c++) {
+         if (results[c].reason == STOP_UNLOCK) {
+            best = c;
+            break;
+         }
+      }
+      unsigned int margin = numChars > 1 ? results[order[0]].insns - results[order[1]].insns : 0;
+      if (results[best].reason != STOP_UNLOCK && numChars > 1 && margin == 0) {
+         //nothing stands out, the oracle has nothing more to say
+         break;
+      }
+      stats->input[pos] = charset[best];
+      stats->insns[pos] = results[best].insns;
+      stats->margin[pos] = margin;
+      stats->len = pos + 1;
+      if (results[best].reason == STOP_UNLOCK) {
+         stats->unlocked = true;
+         break;
+      }
+      stats->execs++;
+      if (runInput(&check, inputs[best], lens[best], opts->instBudget) == STOP_UNLOCK) {
+         stats->unlocked = true;
+         break;
+      }
+   }
+   stats->threads = pool.numWorkers;
+
+   freeRunner(&check);
+   freePool(&pool);
+   free(cands);
+   free(inputs);
+   free(lens);
+   free(order);
+   free(results);
+   free(base);
+   return result;
+}
@@ -0,0 +1,78 @@
+/*
+   Headers for MSP430 emulator instruction count timing oracle
+   Copyright (c) 2014 Chris Eagle
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation; either version 2 of the License, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+   more details.
+
+   You should have received a copy of the GNU General Public License along with
+   this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+   Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef __TIMING_H
+#define __TIMING_H
+
+#include "snapshot.h"
+
+//longest input the byte by byte search will build
+#define TIMING_MAX_INPUT 256
+
+struct TimingResult {
+   unsigned int insns;     //instructions from the input syscall to the target or stop
+   unsigned int reason;    //STOP_TARGET when the target was reached
+};
+
+//run count inputs from base in parallel and record how long each took to
+//reach target (RUNNER_NO_TARGET to time the whole run). threads of 0 uses
+//one per hardware thread. returns false if out of memory
+bool timeInputs(const Snapshot *base, const unsigned char *const *inputs, const unsigned int *lens,
+                unsigned int count, unsigned int target, unsigned int budget,
+                unsigned int threads, TimingResult *results);
+
+//fill order with result indices, slowest first
+void rankTimings(const TimingResult *results, unsigned int count, unsigned int *order);
+
+struct TimingOptions {
+   const char *charset;       //characters tried at each position, a-z ranges allowed
+   unsigned int maxLen;
+   unsigned int padLen;       //pad candidates to this length with pad, 0 for none
+   unsigned char pad;
+   unsigned int target;       //address timed to, RUNNER_NO_TARGET for the whole run
+   unsigned int instBudget;
+   unsigned int threads;
+};
+
+struct TimingStats {
+   bool unlocked;
+   unsigned int len;                      //bytes recovered
+   unsigned char input[TIMING_MAX_INPUT];
+   unsigned int insns[TIMING_MAX_INPUT];  //count of the winner at each position
+   unsigned int margin[TIMING_MAX_INPUT]; //its lead over the runner up
+   unsigned int execs;
+   unsigned int threads;
+};
+
+//status codes returned by timingSearch
+enum {
+   TIMING_OK,
+   TIMING_NO_INPUT,        //never reached an input syscall
+   TIMING_NO_MEMORY,
+   TIMING_BAD_OPTIONS
+};
+
+void initTimingOptions(TimingOptions *opts);
+
+//recover an input one byte at a time, keeping the candidate that runs
+//longest at each position until the lock opens, no candidate stands out
+//or maxLen is reached
+int timingSearch(const TimingOptions *opts, TimingStats *stats);
+
+#endif
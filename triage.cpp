@@ -0,0 +1,173 @@
+/*
+   Crash triage for MSP430 emulator
+   Copyright (c) 2014 Chris Eagle
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation; either version 2 of the License, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+   more details.
+
+   You should have received a copy of the GNU General Public License along with
+   this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+   Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/*
+ * Crashes are bucketed by stop reason and a hash of the innermost frames
+ * of the shadow call stack at the fault. A ret to an address that is not
+ * on the shadow stack does not pop it, so inputs that smash a return
+ * address all land in the bucket of the function whose ret went astray
+ * however much the garbage pc differs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mutex>
+
+#include "cpu.h"
+#include "triage.h"
+
+struct TriageIndex {
+   char dir[1024];
+   TriageBucket *buckets;
+   unsigned int numBuckets;
+   unsigned int maxBuckets;
+   std::mutex lock;
+};
+
+bool isCrashReason(unsigned int reason) {
+   switch (reason) {
+      case STOP_INVALID: case STOP_MISALIGNED_PC:
+      case STOP_MISALIGNED_READ: case STOP_MISALIGNED_WRITE: case STOP_EXEC_NX:
+         return true;
+   }
+   return false;
+}
+
+unsigned int crashHash(Machine *m) {
+   return m->callStackHash(TRIAGE_FRAMES);
+}
+
+static TriageBucket *findBucket(TriageIndex *ti, unsigned int reason, unsigned int hash) {
+   for (unsigned int i = 0; i < ti->numBuckets; i++) {
+      if (ti->buckets[i].reason == reason && ti->buckets[i].hash == hash) {
+         return &ti->buckets[i];
+      }
+   }
+   return NULL;
+}
+
+static TriageBucket *addBucket(TriageIndex *ti) {
+   if (ti->numBuckets == ti->maxBuckets) {
+      unsigned int n = ti->maxBuckets ? ti->maxBuckets * 2 : 64;
+      TriageBucket *b = (TriageBucket*)realloc(ti->buckets, n * sizeof(TriageBucket));
+      if (b == NULL) {
+         return NULL;
+      }
+      ti->buckets = b;
+      ti->maxBuckets = n;
+   }
+   return &ti->buckets[ti->numBuckets++];
+}
+
+static unsigned int reasonByName(const char *name) {
+   for (unsigned int i = 0; i < STOP_REASONS; i++) {
+      if (strcmp(name, stopReasonName(i)) == 0) {
+         return i;
+      }
+   }
+   return STOP_NONE;
+}
+
+TriageIndex *openTriageIndex(const char *dir) {
+   TriageIndex *ti = new TriageIndex();
+   ::qsnprintf(ti->dir, sizeof(ti->dir), "%s", dir);
+   ti->buckets = NULL;
+   ti->numBuckets = 0;
+   ti->maxBuckets = 0;
+
+   char path[1100];
+   ::qsnprintf(path, sizeof(path), "%s" aDIR_SEP TRIAGE_INDEX_FILE, dir);
+   FILE *f = fopen(path, "r");
+   if (f) {
+      char line[256];
+      while (fgets(line, sizeof(line), f)) {
+         char name[64];
+         TriageBucket b;
+         if (sscanf(line, "%63s %x %x %u", name, &b.hash, &b.stopPc, &b.count) != 4) {
+            continue;
+         }
+         b.reason = reasonByName(name);
+         TriageBucket *nb = addBucket(ti);
+         if (nb == NULL) {
+            break;
+         }
+         *nb = b;
+      }
+      fclose(f);
+   }
+   return ti;
+}
+
+bool triageCrash(TriageIndex *ti, unsigned int reason, unsigned int hash, unsigned int stopPc,
+                 const unsigned char *input, unsigned int len) {
+   std::lock_guard<std::mutex> guard(ti->lock);
+   TriageBucket *b = findBucket(ti, reason, hash);
+   if (b) {
+      b->count++;
+      return false;
+   }
+   b = addBucket(ti);
+   if (b == NULL) {
+      return false;
+   }
+   b->reason = reason;
+   b->hash = hash;
+   b->stopPc = stopPc;
+   b->count = 1;
+
+   char path[1100];
+   ::qsnprintf(path, sizeof(path), "%s" aDIR_SEP "%s_%08x", ti->dir, stopReasonName(reason), hash);
+   FILE *f = fopen(path, "wb");
+   if (f) {
+      fwrite(input, 1, len, f);
+      fclose(f);
+   }
+   return true;
+}
+
+unsigned int triageBuckets(TriageIndex *ti) {
+   return ti->numBuckets;
+}
+
+const TriageBucket *triageBucket(TriageIndex *ti, unsigned int n) {
+   return n < ti->numBuckets ? &ti->buckets[n] : NULL;
+}
+
+bool saveTriageIndex(TriageIndex *ti) {
+   std::lock_guard<std::mutex> guard(ti->lock);
+   char path[1100];
+   ::qsnprintf(path, sizeof(path), "%s" aDIR_SEP TRIAGE_INDEX_FILE, ti->dir);
+   FILE *f = fopen(path, "w");
+   if (f == NULL) {
+      return false;
+   }
+   for (unsigned int i = 0; i < ti->numBuckets; i++) {
+      TriageBucket *b = &ti->buckets[i];
+      fprintf(f, "%s %08x %04x %u\n", stopReasonName(b->reason), b->hash, b->stopPc, b->count);
+   }
+   fclose(f);
+   return true;
+}
+
+void closeTriageIndex(TriageIndex *ti) {
+   saveTriageIndex(ti);
+   free(ti->buckets);
+   delete ti;
+}
@@ -0,0 +1,66 @@
+/*
+   Headers for MSP430 emulator crash triage
+   Copyright (c) 2014 Chris Eagle
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation; either version 2 of the License, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+   more details.
+
+   You should have received a copy of the GNU General Public License along with
+   this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+   Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef __TRIAGE_H
+#define __TRIAGE_H
+
+#include "cpu.h"
+
+//innermost shadow call stack frames that identify a crash
+#define TRIAGE_FRAMES 5
+
+//name of the index file kept in a triage directory
+#define TRIAGE_INDEX_FILE "triage.idx"
+
+struct TriageBucket {
+   unsigned int reason;
+   unsigned int hash;      //call stack hash at the fault
+   unsigned int stopPc;    //where the first crash in the bucket stopped
+   unsigned int count;     //crashing inputs filed here
+};
+
+struct TriageIndex;
+
+//stop reasons that count as crashes. CPUOFF is how firmware normally ends
+//when main returns, so it isn't one
+bool isCrashReason(unsigned int reason);
+
+//bucket key of the crash m just stopped with
+unsigned int crashHash(Machine *m);
+
+//open a triage directory, loading any existing index. returns NULL if
+//out of memory
+TriageIndex *openTriageIndex(const char *dir);
+
+//file a crashing input. The first input of each bucket is saved to the
+//triage directory as <reason>_<hash>. returns true for a new bucket.
+//safe to call from several threads
+bool triageCrash(TriageIndex *ti, unsigned int reason, unsigned int hash, unsigned int stopPc,
+                 const unsigned char *input, unsigned int len);
+
+unsigned int triageBuckets(TriageIndex *ti);
+const TriageBucket *triageBucket(TriageIndex *ti, unsigned int n);
+
+//write the index, one bucket per line: reason hash pc count
+bool saveTriageIndex(TriageIndex *ti);
+
+//save and free
+void closeTriageIndex(TriageIndex *ti);
+
+#endif